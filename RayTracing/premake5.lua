@@ -43,7 +43,7 @@ project "RayTracing"
 
    filter "configurations:Dist"
       kind "WindowedApp"
-      defines { "WL_DIST" }
+      defines { "WL_DIST", "RT_NO_PROFILING" }
       runtime "Release"
       optimize "On"
       symbols "Off"
\ No newline at end of file
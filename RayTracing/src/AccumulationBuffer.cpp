@@ -0,0 +1,297 @@
+#include "AccumulationBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+	#include <emmintrin.h>
+	#define RT_RESOLVE_SSE
+#endif
+
+namespace Utils
+{
+	static float Luminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Round to nearest even; values past the half range become infinity
+	static uint16_t FloatToHalf(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+		uint32_t magnitude = bits & 0x7fffffff;
+
+		if (magnitude >= 0x47800000) // 65536 and up, infinity and NaN
+			return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+
+		if (magnitude < 0x38800000) // Below 2^-14, half subnormals in steps of 2^-24
+		{
+			float absolute;
+			std::memcpy(&absolute, &magnitude, sizeof(absolute));
+			return sign | (uint16_t)std::nearbyint(absolute * 16777216.0f);
+		}
+
+		// Rebias the exponent from 127 to 15 and round away the low 13 mantissa bits
+		uint32_t rounded = magnitude + 0x0fff + ((magnitude >> 13) & 1) - (112u << 23);
+		return sign | (uint16_t)(rounded >> 13);
+	}
+
+	static float HalfToFloat(uint16_t half)
+	{
+		uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1f;
+		uint32_t mantissa = half & 0x3ff;
+
+		uint32_t bits;
+		if (exponent == 0)
+		{
+			float value = (float)mantissa * (1.0f / 16777216.0f);
+			std::memcpy(&bits, &value, sizeof(bits));
+			bits |= sign;
+		}
+		else if (exponent == 31)
+		{
+			bits = sign | 0x7f800000 | (mantissa << 13);
+		}
+		else
+		{
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	// image[i] = RGBA8(clamp(plane[i] / divisors[i], 0, 1)) for count pixels, dividing by 1
+	// without divisors and by at least 1 with them
+	static void ResolveRow(const float* red, const float* green, const float* blue, uint32_t count, const uint32_t* divisors, uint32_t* image)
+	{
+		uint32_t i = 0;
+
+#ifdef RT_RESOLVE_SSE
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps(255.0f);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+		__m128 divisorVector = one;
+		auto toByte = [&](const float* plane)
+		{
+			__m128 value = _mm_div_ps(_mm_loadu_ps(plane + i), divisorVector);
+			value = _mm_min_ps(_mm_max_ps(value, zero), one);
+			return _mm_cvttps_epi32(_mm_mul_ps(value, scale));
+		};
+
+		for (; i + 4 <= count; i += 4)
+		{
+			if (divisors)
+				divisorVector = _mm_max_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(divisors + i))), one);
+			__m128i r = toByte(red);
+			__m128i g = _mm_slli_epi32(toByte(green), 8);
+			__m128i b = _mm_slli_epi32(toByte(blue), 16);
+
+			__m128i pixels = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, alpha));
+			_mm_storeu_si128((__m128i*)(image + i), pixels);
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			float divisor = divisors ? (float)std::max(divisors[i], 1u) : 1.0f;
+			float r = std::min(std::max(red[i] / divisor, 0.0f), 1.0f);
+			float g = std::min(std::max(green[i] / divisor, 0.0f), 1.0f);
+			float b = std::min(std::max(blue[i] / divisor, 0.0f), 1.0f);
+			image[i] = AccumulationBuffer::ConvertToRGBA(r, g, b);
+		}
+	}
+}
+
+void AccumulationBuffer::Resize(uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+	Allocate();
+}
+
+void AccumulationBuffer::SetFormat(Format format)
+{
+	if (format == m_Format)
+		return;
+
+	m_Format = format;
+	Allocate();
+}
+
+void AccumulationBuffer::Allocate()
+{
+	size_t pixelCount = (size_t)m_Width * m_Height;
+	size_t floatCount = m_Format == Format::Float32 ? pixelCount : 0;
+	size_t halfCount = m_Format == Format::Float16 ? pixelCount : 0;
+
+	for (std::vector<float>* plane : { &m_Red, &m_Green, &m_Blue, &m_LuminanceSquared })
+	{
+		plane->resize(floatCount);
+		plane->shrink_to_fit();
+	}
+	for (std::vector<uint16_t>* plane : { &m_HalfRed, &m_HalfGreen, &m_HalfBlue, &m_HalfLuminanceSquared })
+	{
+		plane->resize(halfCount);
+		plane->shrink_to_fit();
+	}
+
+	Clear();
+}
+
+void AccumulationBuffer::Clear()
+{
+	for (std::vector<float>* plane : { &m_Red, &m_Green, &m_Blue, &m_LuminanceSquared })
+		std::fill(plane->begin(), plane->end(), 0.0f);
+	for (std::vector<uint16_t>* plane : { &m_HalfRed, &m_HalfGreen, &m_HalfBlue, &m_HalfLuminanceSquared })
+		std::fill(plane->begin(), plane->end(), (uint16_t)0);
+}
+
+size_t AccumulationBuffer::GetMemoryUsage() const
+{
+	return 4 * (m_Red.size() * sizeof(float) + m_HalfRed.size() * sizeof(uint16_t));
+}
+
+void AccumulationBuffer::Add(uint32_t pixelIndex, const glm::vec3& color, uint32_t sampleCount)
+{
+	float luminance = Utils::Luminance(color);
+
+	if (m_Format == Format::Float32)
+	{
+		m_Red[pixelIndex] += color.r;
+		m_Green[pixelIndex] += color.g;
+		m_Blue[pixelIndex] += color.b;
+		m_LuminanceSquared[pixelIndex] += luminance * luminance;
+		return;
+	}
+
+	float weight = 1.0f / (float)sampleCount;
+	auto blend = [&](uint16_t& mean, float value)
+	{
+		float previous = Utils::HalfToFloat(mean);
+		mean = Utils::FloatToHalf(previous + (value - previous) * weight);
+	};
+	blend(m_HalfRed[pixelIndex], color.r);
+	blend(m_HalfGreen[pixelIndex], color.g);
+	blend(m_HalfBlue[pixelIndex], color.b);
+	blend(m_HalfLuminanceSquared[pixelIndex], luminance * luminance);
+}
+
+float AccumulationBuffer::GetStandardError(uint32_t pixelIndex, uint32_t sampleCount) const
+{
+	if (sampleCount < 2)
+		return std::numeric_limits<float>::infinity();
+
+	glm::vec3 mean;
+	float meanSquare;
+	GetMoments(pixelIndex, sampleCount, mean, meanSquare);
+
+	// Unbiased sample variance, divided by n once more for the variance of the mean
+	float luminance = Utils::Luminance(mean);
+	float variance = std::max(meanSquare - luminance * luminance, 0.0f) / (float)(sampleCount - 1);
+	return std::sqrt(variance);
+}
+
+void AccumulationBuffer::GetMoments(uint32_t pixelIndex, uint32_t sampleCount, glm::vec3& mean, float& meanLuminanceSquared) const
+{
+	if (sampleCount == 0)
+	{
+		mean = glm::vec3(0.0f);
+		meanLuminanceSquared = 0.0f;
+	}
+	else if (m_Format == Format::Float32)
+	{
+		float weight = 1.0f / (float)sampleCount;
+		mean = glm::vec3(m_Red[pixelIndex], m_Green[pixelIndex], m_Blue[pixelIndex]) * weight;
+		meanLuminanceSquared = m_LuminanceSquared[pixelIndex] * weight;
+	}
+	else
+	{
+		mean = glm::vec3(Utils::HalfToFloat(m_HalfRed[pixelIndex]), Utils::HalfToFloat(m_HalfGreen[pixelIndex]),
+			Utils::HalfToFloat(m_HalfBlue[pixelIndex]));
+		meanLuminanceSquared = Utils::HalfToFloat(m_HalfLuminanceSquared[pixelIndex]);
+	}
+}
+
+void AccumulationBuffer::SetMoments(uint32_t pixelIndex, const glm::vec3& mean, float meanLuminanceSquared, uint32_t sampleCount)
+{
+	if (m_Format == Format::Float32)
+	{
+		m_Red[pixelIndex] = mean.r * (float)sampleCount;
+		m_Green[pixelIndex] = mean.g * (float)sampleCount;
+		m_Blue[pixelIndex] = mean.b * (float)sampleCount;
+		m_LuminanceSquared[pixelIndex] = meanLuminanceSquared * (float)sampleCount;
+		return;
+	}
+
+	m_HalfRed[pixelIndex] = Utils::FloatToHalf(mean.r);
+	m_HalfGreen[pixelIndex] = Utils::FloatToHalf(mean.g);
+	m_HalfBlue[pixelIndex] = Utils::FloatToHalf(mean.b);
+	m_HalfLuminanceSquared[pixelIndex] = Utils::FloatToHalf(meanLuminanceSquared);
+}
+
+void AccumulationBuffer::Resolve(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* sampleCounts, uint32_t* image) const
+{
+	for (uint32_t row = y; row < y + height; row++)
+	{
+		size_t offset = (size_t)row * m_Width + x;
+
+		if (m_Format == Format::Float32)
+		{
+			Utils::ResolveRow(&m_Red[offset], &m_Green[offset], &m_Blue[offset], width, sampleCounts + offset, image + offset);
+			continue;
+		}
+
+		// Widen the stored means in chunks, they are already divided
+		constexpr uint32_t ChunkSize = 64;
+		float red[ChunkSize], green[ChunkSize], blue[ChunkSize];
+		for (uint32_t first = 0; first < width; first += ChunkSize)
+		{
+			uint32_t count = std::min(ChunkSize, width - first);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				red[i] = Utils::HalfToFloat(m_HalfRed[offset + first + i]);
+				green[i] = Utils::HalfToFloat(m_HalfGreen[offset + first + i]);
+				blue[i] = Utils::HalfToFloat(m_HalfBlue[offset + first + i]);
+			}
+			Utils::ResolveRow(red, green, blue, count, nullptr, image + offset + first);
+		}
+	}
+}
+
+void AccumulationBuffer::GetMeans(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* sampleCounts, float* red, float* green, float* blue) const
+{
+	for (uint32_t row = y; row < y + height; row++)
+	{
+		for (size_t i = (size_t)row * m_Width + x; i < (size_t)row * m_Width + x + width; i++)
+		{
+			uint32_t sampleCount = sampleCounts[i];
+			if (sampleCount == 0)
+			{
+				red[i] = green[i] = blue[i] = 0.0f;
+			}
+			else if (m_Format == Format::Float32)
+			{
+				// Divided as Resolve() does
+				red[i] = m_Red[i] / (float)sampleCount;
+				green[i] = m_Green[i] / (float)sampleCount;
+				blue[i] = m_Blue[i] / (float)sampleCount;
+			}
+			else
+			{
+				red[i] = Utils::HalfToFloat(m_HalfRed[i]);
+				green[i] = Utils::HalfToFloat(m_HalfGreen[i]);
+				blue[i] = Utils::HalfToFloat(m_HalfBlue[i]);
+			}
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Running per-pixel radiance, stored as three separate colour planes plus a plane of squared
+// luminance for variance estimates. Float32 keeps the sums of all samples (16 bytes per pixel);
+// Float16 keeps running means instead, since a half-float sum stops absorbing new samples after
+// a few hundred frames (8 bytes per pixel).
+class AccumulationBuffer
+{
+public:
+	enum class Format
+	{
+		Float32 = 0, Float16
+	};
+
+public:
+	void Resize(uint32_t width, uint32_t height);
+	void SetFormat(Format format);
+	void Clear();
+
+	Format GetFormat() const { return m_Format; }
+	size_t GetMemoryUsage() const;
+
+	// Adds a sample to the pixel; sampleCount is the number of samples including this one
+	void Add(uint32_t pixelIndex, const glm::vec3& color, uint32_t sampleCount);
+
+	// Standard error of the pixel's mean luminance after sampleCount samples, infinite below two
+	float GetStandardError(uint32_t pixelIndex, uint32_t sampleCount) const;
+
+	// Mean colour and mean squared luminance of the pixel's sampleCount samples, and setting
+	// them, for moving samples between pixels and buffers
+	void GetMoments(uint32_t pixelIndex, uint32_t sampleCount, glm::vec3& mean, float& meanLuminanceSquared) const;
+	void SetMoments(uint32_t pixelIndex, const glm::vec3& mean, float meanLuminanceSquared, uint32_t sampleCount);
+
+	// Converts the mean colour of each pixel inside the rectangle to clamped RGBA8, writing into
+	// image. sampleCounts holds each pixel's count; it and image have a row pitch of the buffer
+	// width. Uses SSE where the build targets it.
+	void Resolve(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* sampleCounts, uint32_t* image) const;
+	// Writes the mean colour of each pixel inside the rectangle into the planes, laid out as
+	// sampleCounts; zero for pixels without samples
+	void GetMeans(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* sampleCounts, float* red, float* green, float* blue) const;
+
+	// Packs a colour already clamped to [0, 1] as the image's RGBA8, with opaque alpha
+	static uint32_t ConvertToRGBA(float r, float g, float b)
+	{
+		uint8_t red = (uint8_t)(r * 255.0f);
+		uint8_t green = (uint8_t)(g * 255.0f);
+		uint8_t blue = (uint8_t)(b * 255.0f);
+
+		return 0xff000000 | (blue << 16) | (green << 8) | red;
+	}
+private:
+	void Allocate();
+private:
+	Format m_Format = Format::Float32;
+	uint32_t m_Width = 0, m_Height = 0;
+
+	std::vector<float> m_Red, m_Green, m_Blue, m_LuminanceSquared;
+	std::vector<uint16_t> m_HalfRed, m_HalfGreen, m_HalfBlue, m_HalfLuminanceSquared;
+};
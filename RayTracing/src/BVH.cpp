@@ -0,0 +1,335 @@
+#include "BVH.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+void BVH::Build(const std::vector<AABB>& primitiveBounds, uint32_t maxLeafSize, float traversalCost, ThreadPool* threadPool)
+{
+	Clear();
+	m_MaxLeafSize = maxLeafSize;
+	m_TraversalCost = traversalCost;
+
+	uint32_t primitiveCount = (uint32_t)primitiveBounds.size();
+	if (primitiveCount == 0)
+		return;
+
+	m_PrimitiveIndices.resize(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++)
+		m_PrimitiveIndices[i] = i;
+
+	std::vector<glm::vec3> centroids(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++)
+		centroids[i] = primitiveBounds[i].GetCenter();
+
+	// A binary tree with N leaves has 2N - 1 nodes
+	m_Nodes.reserve(2 * primitiveCount - 1);
+
+	BVHNode& root = m_Nodes.emplace_back();
+	root.LeftFirst = 0;
+	root.Count = primitiveCount;
+	UpdateNodeBounds(root, primitiveBounds);
+
+	if (threadPool && threadPool->GetWorkerCount() > 1 && primitiveCount >= ParallelBuildThreshold)
+		SubdivideParallel(*threadPool, primitiveBounds, centroids);
+	else
+		Subdivide(m_Nodes, 0, 1, primitiveBounds, centroids);
+
+	m_Nodes.shrink_to_fit();
+}
+
+void BVH::Refit(const std::vector<AABB>& primitiveBounds)
+{
+	// Children are always stored after their parent, so a reverse sweep sees them first
+	for (size_t i = m_Nodes.size(); i-- > 0;)
+	{
+		BVHNode& node = m_Nodes[i];
+		if (node.IsLeaf())
+		{
+			UpdateNodeBounds(node, primitiveBounds);
+			continue;
+		}
+
+		const BVHNode& left = m_Nodes[node.LeftFirst];
+		const BVHNode& right = m_Nodes[node.LeftFirst + 1];
+		node.BoundsMin = glm::min(left.BoundsMin, right.BoundsMin);
+		node.BoundsMax = glm::max(left.BoundsMax, right.BoundsMax);
+	}
+}
+
+void BVH::LinkParents()
+{
+	m_ParentIndices.assign(m_Nodes.size(), 0);
+	m_PrimitiveSlots.resize(m_PrimitiveIndices.size());
+	m_SlotLeaves.resize(m_PrimitiveIndices.size());
+
+	for (uint32_t nodeIndex = 0; nodeIndex < (uint32_t)m_Nodes.size(); nodeIndex++)
+	{
+		const BVHNode& node = m_Nodes[nodeIndex];
+		if (!node.IsLeaf())
+		{
+			m_ParentIndices[node.LeftFirst] = nodeIndex;
+			m_ParentIndices[node.LeftFirst + 1] = nodeIndex;
+			continue;
+		}
+
+		for (uint32_t slot = node.LeftFirst; slot < node.LeftFirst + node.Count; slot++)
+		{
+			m_PrimitiveSlots[m_PrimitiveIndices[slot]] = slot;
+			m_SlotLeaves[slot] = nodeIndex;
+		}
+	}
+}
+
+void BVH::PropagateBounds(uint32_t nodeIndex)
+{
+	while (nodeIndex != 0)
+	{
+		nodeIndex = m_ParentIndices[nodeIndex];
+		BVHNode& node = m_Nodes[nodeIndex];
+		const BVHNode& left = m_Nodes[node.LeftFirst];
+		const BVHNode& right = m_Nodes[node.LeftFirst + 1];
+		glm::vec3 boundsMin = glm::min(left.BoundsMin, right.BoundsMin);
+		glm::vec3 boundsMax = glm::max(left.BoundsMax, right.BoundsMax);
+
+		// Everything above is the union of unchanged bounds
+		if (boundsMin == node.BoundsMin && boundsMax == node.BoundsMax)
+			return;
+
+		node.BoundsMin = boundsMin;
+		node.BoundsMax = boundsMax;
+	}
+}
+
+void BVH::Clear()
+{
+	m_Nodes.clear();
+	m_PrimitiveIndices.clear();
+	m_ParentIndices.clear();
+	m_PrimitiveSlots.clear();
+	m_SlotLeaves.clear();
+}
+
+void BVH::Assign(std::vector<BVHNode> nodes, std::vector<uint32_t> primitiveIndices, uint32_t maxLeafSize)
+{
+	m_Nodes = std::move(nodes);
+	m_PrimitiveIndices = std::move(primitiveIndices);
+	m_MaxLeafSize = maxLeafSize;
+	m_ParentIndices.clear();
+	m_PrimitiveSlots.clear();
+	m_SlotLeaves.clear();
+}
+
+bool BVH::IsValid(const std::vector<BVHNode>& nodes, size_t leafRangeEnd)
+{
+	// Children after their parent rule out cycles, so depths follow in one pass in node order
+	std::vector<uint32_t> depths(nodes.size(), 0);
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const BVHNode& node = nodes[i];
+		if (node.IsLeaf())
+		{
+			if ((uint64_t)node.LeftFirst + node.Count > leafRangeEnd)
+				return false;
+			continue;
+		}
+
+		if (node.LeftFirst <= i || (uint64_t)node.LeftFirst + 1 >= nodes.size() || depths[i] + 1 >= StackSize)
+			return false;
+		depths[node.LeftFirst] = std::max(depths[node.LeftFirst], depths[i] + 1);
+		depths[node.LeftFirst + 1] = std::max(depths[node.LeftFirst + 1], depths[i] + 1);
+	}
+	return true;
+}
+
+void BVH::UpdateNodeBounds(BVHNode& node, const std::vector<AABB>& primitiveBounds) const
+{
+	AABB bounds;
+	for (uint32_t i = 0; i < node.Count; i++)
+		bounds.Grow(primitiveBounds[m_PrimitiveIndices[node.LeftFirst + i]]);
+
+	node.BoundsMin = bounds.Min;
+	node.BoundsMax = bounds.Max;
+}
+
+float BVH::FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids,
+	int& axis, float& splitPosition) const
+{
+	AABB centroidBounds;
+	for (uint32_t i = 0; i < node.Count; i++)
+		centroidBounds.Grow(centroids[m_PrimitiveIndices[node.LeftFirst + i]]);
+
+	float bestCost = std::numeric_limits<float>::max();
+	for (int a = 0; a < 3; a++)
+	{
+		float boundsMin = centroidBounds.Min[a];
+		float boundsMax = centroidBounds.Max[a];
+		if (boundsMin == boundsMax)
+			continue;
+
+		struct Bin
+		{
+			AABB Bounds;
+			uint32_t Count = 0;
+		};
+		Bin bins[BinCount];
+
+		float scale = (float)BinCount / (boundsMax - boundsMin);
+		for (uint32_t i = 0; i < node.Count; i++)
+		{
+			uint32_t primitiveIndex = m_PrimitiveIndices[node.LeftFirst + i];
+			uint32_t binIndex = std::min(BinCount - 1, (uint32_t)((centroids[primitiveIndex][a] - boundsMin) * scale));
+			bins[binIndex].Count++;
+			bins[binIndex].Bounds.Grow(primitiveBounds[primitiveIndex]);
+		}
+
+		// Sweep from both sides to get the area and count on each side of every bin boundary
+		float leftArea[BinCount - 1], rightArea[BinCount - 1];
+		uint32_t leftCount[BinCount - 1], rightCount[BinCount - 1];
+		AABB leftBox, rightBox;
+		uint32_t leftSum = 0, rightSum = 0;
+		for (uint32_t i = 0; i < BinCount - 1; i++)
+		{
+			leftSum += bins[i].Count;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].Bounds);
+			leftArea[i] = leftBox.GetSurfaceArea();
+
+			rightSum += bins[BinCount - 1 - i].Count;
+			rightCount[BinCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[BinCount - 1 - i].Bounds);
+			rightArea[BinCount - 2 - i] = rightBox.GetSurfaceArea();
+		}
+
+		float binWidth = (boundsMax - boundsMin) / (float)BinCount;
+		for (uint32_t i = 0; i < BinCount - 1; i++)
+		{
+			float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				axis = a;
+				splitPosition = boundsMin + binWidth * (i + 1);
+			}
+		}
+	}
+
+	return bestCost;
+}
+
+bool BVH::Split(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds,
+	const std::vector<glm::vec3>& centroids)
+{
+	BVHNode& node = nodes[nodeIndex];
+	if (node.Count <= 1)
+		return false;
+
+	int axis = -1;
+	float splitPosition = 0.0f;
+	float splitCost = FindBestSplit(node, primitiveBounds, centroids, axis, splitPosition);
+
+	// Splitting only pays off if it is cheaper than intersecting every primitive in the node
+	AABB nodeBounds;
+	nodeBounds.Min = node.BoundsMin;
+	nodeBounds.Max = node.BoundsMax;
+	float leafCost = node.Count * nodeBounds.GetSurfaceArea();
+	splitCost += m_TraversalCost * nodeBounds.GetSurfaceArea();
+	if (axis < 0 || depth >= StackSize || (node.Count <= m_MaxLeafSize && splitCost >= leafCost))
+		return false;
+
+	uint32_t* first = m_PrimitiveIndices.data() + node.LeftFirst;
+	uint32_t* last = first + node.Count;
+	uint32_t* middle = std::partition(first, last,
+		[&](uint32_t primitiveIndex) { return centroids[primitiveIndex][axis] < splitPosition; });
+
+	uint32_t leftCount = (uint32_t)(middle - first);
+	if (leftCount == 0 || leftCount == node.Count)
+		return false;
+
+	uint32_t leftChild = (uint32_t)nodes.size();
+	nodes.emplace_back();
+	nodes.emplace_back();
+
+	BVHNode& parent = nodes[nodeIndex];
+	nodes[leftChild].LeftFirst = parent.LeftFirst;
+	nodes[leftChild].Count = leftCount;
+	nodes[leftChild + 1].LeftFirst = parent.LeftFirst + leftCount;
+	nodes[leftChild + 1].Count = parent.Count - leftCount;
+	parent.LeftFirst = leftChild;
+	parent.Count = 0;
+
+	UpdateNodeBounds(nodes[leftChild], primitiveBounds);
+	UpdateNodeBounds(nodes[leftChild + 1], primitiveBounds);
+	return true;
+}
+
+void BVH::Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds,
+	const std::vector<glm::vec3>& centroids)
+{
+	if (!Split(nodes, nodeIndex, depth, primitiveBounds, centroids))
+		return;
+
+	uint32_t leftChild = nodes[nodeIndex].LeftFirst;
+	Subdivide(nodes, leftChild, depth + 1, primitiveBounds, centroids);
+	Subdivide(nodes, leftChild + 1, depth + 1, primitiveBounds, centroids);
+}
+
+void BVH::SubdivideParallel(ThreadPool& threadPool, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids)
+{
+	struct Subtree
+	{
+		uint32_t NodeIndex;
+		uint32_t Depth;
+		std::vector<BVHNode> Nodes;
+	};
+
+	// Split the largest open node until there are a few subtrees per worker. Subtrees cover
+	// disjoint ranges of m_PrimitiveIndices, so they can be partitioned concurrently.
+	std::vector<Subtree> subtrees;
+	std::vector<Subtree> open;
+	open.push_back({ 0, 1, {} });
+	uint32_t targetCount = threadPool.GetWorkerCount() * 4;
+	while (!open.empty() && open.size() + subtrees.size() < targetCount)
+	{
+		auto largest = std::max_element(open.begin(), open.end(),
+			[&](const Subtree& a, const Subtree& b) { return m_Nodes[a.NodeIndex].Count < m_Nodes[b.NodeIndex].Count; });
+		Subtree subtree = std::move(*largest);
+		open.erase(largest);
+
+		if (!Split(m_Nodes, subtree.NodeIndex, subtree.Depth, primitiveBounds, centroids))
+		{
+			subtrees.push_back(std::move(subtree));
+			continue;
+		}
+
+		uint32_t leftChild = m_Nodes[subtree.NodeIndex].LeftFirst;
+		open.push_back({ leftChild, subtree.Depth + 1, {} });
+		open.push_back({ leftChild + 1, subtree.Depth + 1, {} });
+	}
+	for (Subtree& subtree : open)
+		subtrees.push_back(std::move(subtree));
+
+	threadPool.ParallelFor((uint32_t)subtrees.size(),
+		[&](uint32_t i, uint32_t)
+		{
+			Subtree& subtree = subtrees[i];
+			subtree.Nodes.push_back(m_Nodes[subtree.NodeIndex]);
+			Subdivide(subtree.Nodes, 0, subtree.Depth, primitiveBounds, centroids);
+		});
+
+	// Each subtree's root replaces its node; the rest is appended with child indices shifted
+	for (const Subtree& subtree : subtrees)
+	{
+		uint32_t offset = (uint32_t)m_Nodes.size() - 1;
+		auto relocate = [offset](const BVHNode& source)
+		{
+			BVHNode node = source;
+			if (!node.IsLeaf())
+				node.LeftFirst += offset;
+			return node;
+		};
+
+		m_Nodes[subtree.NodeIndex] = relocate(subtree.Nodes[0]);
+		for (size_t j = 1; j < subtree.Nodes.size(); j++)
+			m_Nodes.push_back(relocate(subtree.Nodes[j]));
+	}
+}
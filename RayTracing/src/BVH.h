@@ -0,0 +1,247 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+struct AABB
+{
+	glm::vec3 Min{ std::numeric_limits<float>::max() };
+	glm::vec3 Max{ -std::numeric_limits<float>::max() };
+
+	void Grow(const glm::vec3& point) { Min = glm::min(Min, point); Max = glm::max(Max, point); }
+	void Grow(const AABB& other) { Min = glm::min(Min, other.Min); Max = glm::max(Max, other.Max); }
+
+	glm::vec3 GetCenter() const { return (Min + Max) * 0.5f; }
+
+	float GetSurfaceArea() const
+	{
+		glm::vec3 extent = Max - Min;
+		return extent.x < 0.0f ? 0.0f : 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+};
+
+// 32 bytes, two per cache line. Interior nodes point at their two children, which are
+// always stored next to each other; leaves point at a range of BVH::GetPrimitiveIndices().
+struct alignas(32) BVHNode
+{
+	glm::vec3 BoundsMin;
+	uint32_t LeftFirst; // Left child for interior nodes, first primitive for leaves
+	glm::vec3 BoundsMax;
+	uint32_t Count;     // Primitive count, 0 for interior nodes
+
+	bool IsLeaf() const { return Count > 0; }
+};
+
+// Bounding volume hierarchy over an arbitrary list of primitive bounds, built with binned SAH.
+// The BVH only stores primitive indices; the caller intersects the primitives themselves.
+class BVH
+{
+public:
+	static constexpr uint32_t DefaultMaxLeafSize = 4;
+	static constexpr uint32_t BinCount = 16;
+	static constexpr uint32_t StackSize = 64; // Also the maximum tree depth
+	static constexpr uint32_t ParallelBuildThreshold = 1 << 16; // Primitives below which threads do not pay off
+
+public:
+	// Rebuilds the hierarchy from scratch. Leaves stop splitting at maxLeafSize primitives
+	// unless the SAH says splitting further is cheaper. traversalCost is the cost of visiting a
+	// node relative to intersecting one primitive; above 0 it keeps small leaves from being
+	// split all the way down to single primitives.
+	// With a thread pool, the top of the tree is split on the calling thread and the subtrees
+	// below are built in parallel. The hierarchy is the same, only the node order differs.
+	void Build(const std::vector<AABB>& primitiveBounds, uint32_t maxLeafSize = DefaultMaxLeafSize, float traversalCost = 0.0f,
+		ThreadPool* threadPool = nullptr);
+
+	// Recomputes node bounds for primitives that moved, keeping the topology.
+	// primitiveBounds must hold the same primitives, in the same order, as the last Build().
+	void Refit(const std::vector<AABB>& primitiveBounds);
+
+	// Refit after only a few primitives changed: recomputes their leaves and walks up towards
+	// the root, stopping where a node's bounds come out unchanged. The result is the same as
+	// Refit(). boundsOf(primitiveIndex) returns a primitive's current AABB. The first call after
+	// a build links every node to its parent (4 bytes per node and 8 per primitive).
+	template<typename BoundsFn>
+	void RefitPrimitives(const std::vector<uint32_t>& primitives, BoundsFn&& boundsOf);
+
+	// Where a primitive sits in GetPrimitiveIndices(); valid once RefitPrimitives() has run
+	uint32_t GetPrimitiveSlot(uint32_t primitive) const { return m_PrimitiveSlots[primitive]; }
+
+	void Clear();
+
+	// Takes over a hierarchy built earlier (a scene cache), as returned by GetNodes() and
+	// GetPrimitiveIndices()
+	void Assign(std::vector<BVHNode> nodes, std::vector<uint32_t> primitiveIndices, uint32_t maxLeafSize);
+	// Whether nodes read from disk are safe to traverse: every child is stored after its parent
+	// and inside the array, no path is deeper than the traversal stack, and leaf ranges end at
+	// or before leafRangeEnd (the primitive index count, or the triangle count of a mesh)
+	static bool IsValid(const std::vector<BVHNode>& nodes, size_t leafRangeEnd);
+
+	bool IsEmpty() const { return m_Nodes.empty(); }
+
+	const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+	const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+	uint32_t GetMaxLeafSize() const { return m_MaxLeafSize; }
+
+	// Visits leaves front to back along the ray, calling intersect(primitiveIndex, tMax) for
+	// every primitive whose leaf bounds are hit before tMax. The callback shortens tMax when
+	// it finds a closer hit, which prunes the rest of the traversal; setting it below zero ends
+	// the traversal, which any-hit (occlusion) queries do at their first hit.
+	template<typename IntersectFn>
+	void Traverse(const Ray& ray, float& tMax, IntersectFn&& intersect) const;
+
+	// Same traversal, but hands over whole leaves as intersect(first, count, tMax), where
+	// [first, first + count) is a range of GetPrimitiveIndices()
+	template<typename IntersectLeafFn>
+	void TraverseLeaves(const Ray& ray, float& tMax, IntersectLeafFn&& intersectLeaf) const;
+
+	static float IntersectAABB(const Ray& ray, const glm::vec3& invDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float tMax);
+private:
+	void UpdateNodeBounds(BVHNode& node, const std::vector<AABB>& primitiveBounds) const;
+	void LinkParents();
+	// Recomputes the ancestors of a node from their children
+	void PropagateBounds(uint32_t nodeIndex);
+
+	// Splits nodes[nodeIndex] in two if the SAH says so, appending the children to nodes
+	bool Split(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds,
+		const std::vector<glm::vec3>& centroids);
+	void Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds,
+		const std::vector<glm::vec3>& centroids);
+	void SubdivideParallel(ThreadPool& threadPool, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids);
+	float FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids,
+		int& axis, float& splitPosition) const;
+private:
+	std::vector<BVHNode> m_Nodes;
+	std::vector<uint32_t> m_PrimitiveIndices;
+	uint32_t m_MaxLeafSize = DefaultMaxLeafSize;
+	float m_TraversalCost = 0.0f;
+
+	// Built by LinkParents() for RefitPrimitives(), cleared when the hierarchy is replaced
+	std::vector<uint32_t> m_ParentIndices;
+	std::vector<uint32_t> m_PrimitiveSlots;
+	std::vector<uint32_t> m_SlotLeaves;
+};
+
+inline float BVH::IntersectAABB(const Ray& ray, const glm::vec3& invDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float tMax)
+{
+	glm::vec3 t0 = (boundsMin - ray.Origin) * invDirection;
+	glm::vec3 t1 = (boundsMax - ray.Origin) * invDirection;
+
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float entry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+	// Rounding in the slab distances can drop a ray that grazes a corner or edge of the box;
+	// growing the far distance by 2 * gamma(3) keeps the test conservative (Ize, "Robust BVH Ray Traversal")
+	float exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z) * 1.0000004f;
+	exit = glm::min(exit, tMax);
+
+	return entry <= exit ? entry : std::numeric_limits<float>::max();
+}
+
+template<typename BoundsFn>
+void BVH::RefitPrimitives(const std::vector<uint32_t>& primitives, BoundsFn&& boundsOf)
+{
+	if (m_Nodes.empty())
+		return;
+	if (m_ParentIndices.size() != m_Nodes.size())
+		LinkParents();
+
+	for (uint32_t primitive : primitives)
+	{
+		uint32_t leafIndex = m_SlotLeaves[m_PrimitiveSlots[primitive]];
+		BVHNode& leaf = m_Nodes[leafIndex];
+
+		AABB bounds;
+		for (uint32_t i = 0; i < leaf.Count; i++)
+			bounds.Grow(boundsOf(m_PrimitiveIndices[leaf.LeftFirst + i]));
+
+		if (bounds.Min == leaf.BoundsMin && bounds.Max == leaf.BoundsMax)
+			continue;
+
+		leaf.BoundsMin = bounds.Min;
+		leaf.BoundsMax = bounds.Max;
+		PropagateBounds(leafIndex);
+	}
+}
+
+template<typename IntersectFn>
+void BVH::Traverse(const Ray& ray, float& tMax, IntersectFn&& intersect) const
+{
+	TraverseLeaves(ray, tMax,
+		[&](uint32_t first, uint32_t count, float& leafTMax)
+		{
+			for (uint32_t i = 0; i < count && leafTMax >= 0.0f; i++)
+				intersect(m_PrimitiveIndices[first + i], leafTMax);
+		});
+}
+
+template<typename IntersectLeafFn>
+void BVH::TraverseLeaves(const Ray& ray, float& tMax, IntersectLeafFn&& intersectLeaf) const
+{
+	if (m_Nodes.empty())
+		return;
+
+	const glm::vec3 invDirection = 1.0f / ray.Direction;
+	constexpr float miss = std::numeric_limits<float>::max();
+
+	if (IntersectAABB(ray, invDirection, m_Nodes[0].BoundsMin, m_Nodes[0].BoundsMax, tMax) == miss)
+		return;
+
+	struct StackEntry
+	{
+		uint32_t NodeIndex;
+		float Distance;
+	};
+	StackEntry stack[StackSize];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+
+	while (true)
+	{
+		const BVHNode& node = m_Nodes[nodeIndex];
+
+		if (node.IsLeaf())
+		{
+			intersectLeaf(node.LeftFirst, node.Count, tMax);
+		}
+		else
+		{
+			uint32_t nearChild = node.LeftFirst;
+			uint32_t farChild = node.LeftFirst + 1;
+			float nearDistance = IntersectAABB(ray, invDirection, m_Nodes[nearChild].BoundsMin, m_Nodes[nearChild].BoundsMax, tMax);
+			float farDistance = IntersectAABB(ray, invDirection, m_Nodes[farChild].BoundsMin, m_Nodes[farChild].BoundsMax, tMax);
+
+			if (farDistance < nearDistance)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if (nearDistance != miss)
+			{
+				// Build() limits the depth to StackSize, so this cannot overflow
+				if (farDistance != miss)
+					stack[stackSize++] = { farChild, farDistance };
+
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		// Pop the next subtree that can still contain a closer hit
+		while (stackSize > 0 && stack[stackSize - 1].Distance > tMax)
+			stackSize--;
+
+		if (stackSize == 0)
+			break;
+		nodeIndex = stack[--stackSize].NodeIndex;
+	}
+}
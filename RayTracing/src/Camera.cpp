@@ -4,17 +4,22 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef RT_HEADLESS
 #include "Walnut/Input/Input.h"
 
 using namespace Walnut;
+#endif
 
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
 {
 	m_ForwardDirection = glm::vec3(0, 0, -1);
 	m_Position = glm::vec3(0, 0, 6);
+	// Reprojection reads the view matrix before the camera is ever moved
+	RecalculateView();
 }
 
+#ifndef RT_HEADLESS
 bool Camera::OnUpdate(float ts)
 {
 	glm::vec2 mousePos = Input::GetMousePosition();
@@ -82,13 +87,11 @@ bool Camera::OnUpdate(float ts)
 	}
 
 	if (moved)
-	{
 		RecalculateView();
-		RecalculateRayDirections();
-	}
 
 	return moved;
 }
+#endif
 
 void Camera::OnResize(uint32_t width, uint32_t height)
 {
@@ -99,7 +102,38 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	m_ViewportHeight = height;
 
 	RecalculateProjection();
-	RecalculateRayDirections();
+	RecalculateRayBasis();
+}
+
+void Camera::SetView(const glm::vec3& position, const glm::vec3& forwardDirection)
+{
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(forwardDirection);
+
+	RecalculateView();
+}
+
+void Camera::SetProjectionType(ProjectionType type, float orthographicHeight)
+{
+	m_ProjectionType = type;
+	m_OrthographicHeight = orthographicHeight;
+	RecalculateRayBasis();
+}
+
+void Camera::SetLens(float lensRadius, float focusDistance)
+{
+	m_LensRadius = glm::max(lensRadius, 0.0f);
+	m_FocusDistance = glm::max(focusDistance, m_NearClip);
+}
+
+void Camera::SetVerticalFOV(float verticalFOV)
+{
+	m_VerticalFOV = verticalFOV;
+	if (m_ViewportWidth == 0 || m_ViewportHeight == 0)
+		return;
+
+	RecalculateProjection();
+	RecalculateRayBasis();
 }
 
 float Camera::GetRotationSpeed()
@@ -117,22 +151,50 @@ void Camera::RecalculateView()
 {
 	m_View = glm::lookAt(m_Position, m_Position + m_ForwardDirection, glm::vec3(0, 1, 0));
 	m_InverseView = glm::inverse(m_View);
+
+	RecalculateRayBasis();
 }
 
-void Camera::RecalculateRayDirections()
+void Camera::RecalculateRayBasis()
 {
-	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+	if (m_ViewportWidth == 0 || m_ViewportHeight == 0)
+		return;
 
-	for (uint32_t y = 0; y < m_ViewportHeight; y++)
-	{
-		for (uint32_t x = 0; x < m_ViewportWidth; x++)
-		{
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
-		}
-	}
+	// Same frame as glm::lookAt in RecalculateView()
+	m_Right = glm::normalize(glm::cross(m_ForwardDirection, glm::vec3(0, 1, 0)));
+	m_Up = glm::cross(m_Right, m_ForwardDirection);
+
+	float aspectRatio = (float)m_ViewportWidth / (float)m_ViewportHeight;
+	float halfHeight = m_ProjectionType == ProjectionType::Perspective
+		? glm::tan(glm::radians(m_VerticalFOV) * 0.5f)
+		: m_OrthographicHeight * 0.5f;
+	float halfWidth = halfHeight * aspectRatio;
+	m_HalfFilmSize = glm::vec2(halfWidth, halfHeight);
+
+	m_PixelRight = m_Right * (2.0f * halfWidth / (float)m_ViewportWidth);
+	m_PixelUp = m_Up * (2.0f * halfHeight / (float)m_ViewportHeight);
+	m_BottomLeft = -m_Right * halfWidth - m_Up * halfHeight;
+	if (m_ProjectionType == ProjectionType::Perspective)
+		m_BottomLeft += m_ForwardDirection;
+}
+
+bool Camera::ProjectToPixel(const glm::vec3& position, glm::vec2& pixel, float& depth) const
+{
+	// View space is the ray basis: x along m_Right, y along m_Up, looking down -z
+	glm::vec3 view = glm::vec3(m_View * glm::vec4(position, 1.0f));
+	depth = -view.z;
+	if (depth <= 0.0f)
+		return false;
+
+	glm::vec2 film(view.x, view.y);
+	if (m_ProjectionType == ProjectionType::Perspective)
+		film = film / depth;
+	pixel = (film / m_HalfFilmSize * 0.5f + 0.5f) * glm::vec2((float)m_ViewportWidth, (float)m_ViewportHeight);
+	return true;
+}
+
+float Camera::GetPixelSize(float depth) const
+{
+	float size = 2.0f * m_HalfFilmSize.y / (float)glm::max(m_ViewportHeight, 1u);
+	return m_ProjectionType == ProjectionType::Perspective ? size * depth : size;
 }
@@ -1,16 +1,55 @@
 #pragma once
 
+#include "Ray.h"
+
 #include <glm/glm.hpp>
 #include <vector>
 
 class Camera
 {
+public:
+	enum class ProjectionType
+	{
+		Perspective = 0, Orthographic
+	};
+
 public:
 	Camera(float verticalFOV, float nearClip, float farClip);
 
+#ifndef RT_HEADLESS
 	bool OnUpdate(float ts);
+#endif
 	void OnResize(uint32_t width, uint32_t height);
 
+	// Places the camera without going through mouse/keyboard input (headless runs, scene files)
+	void SetView(const glm::vec3& position, const glm::vec3& forwardDirection);
+
+	// Orthographic cameras look straight along the forward direction; orthographicHeight is the
+	// world-space height of the view
+	void SetProjectionType(ProjectionType type, float orthographicHeight = 4.0f);
+	// Thin lens depth of field. A lens radius of 0 is a pinhole.
+	void SetLens(float lensRadius, float focusDistance);
+	void SetVerticalFOV(float verticalFOV);
+
+	float GetVerticalFOV() const { return m_VerticalFOV; }
+	ProjectionType GetProjectionType() const { return m_ProjectionType; }
+	float GetOrthographicHeight() const { return m_OrthographicHeight; }
+	float GetLensRadius() const { return m_LensRadius; }
+	float GetFocusDistance() const { return m_FocusDistance; }
+
+	// Primary ray through pixel (x, y) offset by pixelOffset in [0, 1)^2, with lensSample in
+	// [0, 1)^2 picking the point on the lens. Built from the per-view basis vectors, so nothing
+	// is stored per pixel and any thread can call it.
+	Ray GenerateRay(uint32_t x, uint32_t y, const glm::vec2& pixelOffset, const glm::vec2& lensSample) const;
+	// The reverse for a pinhole: where a world-space position lands on the film, in pixels
+	// (pixel (x, y) spans x to x + 1), and its depth along the view direction. False if it is
+	// behind the camera.
+	bool ProjectToPixel(const glm::vec3& position, glm::vec2& pixel, float& depth) const;
+	// World-space height of a pixel at a depth along the view direction
+	float GetPixelSize(float depth) const;
+
+	uint32_t GetViewportWidth() const { return m_ViewportWidth; }
+	uint32_t GetViewportHeight() const { return m_ViewportHeight; }
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
 	const glm::mat4& GetView() const { return m_View; }
@@ -19,13 +58,13 @@ public:
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
-	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
-
 	float GetRotationSpeed();
 private:
 	void RecalculateProjection();
 	void RecalculateView();
-	void RecalculateRayDirections();
+	void RecalculateRayBasis();
+
+	static glm::vec2 SampleDisk(const glm::vec2& sample);
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -39,10 +78,71 @@ private:
 	glm::vec3 m_Position{0.0f, 0.0f, 0.0f};
 	glm::vec3 m_ForwardDirection{0.0f, 0.0f, 0.0f};
 
-	// Cached ray directions
-	std::vector<glm::vec3> m_RayDirections;
+	ProjectionType m_ProjectionType = ProjectionType::Perspective;
+	float m_OrthographicHeight = 4.0f;
+	float m_LensRadius = 0.0f;
+	float m_FocusDistance = 6.0f;
+
+	// Perspective: direction through pixel (x, y) is m_BottomLeft + x * m_PixelRight + y * m_PixelUp,
+	// unnormalized with a forward component of 1. Orthographic: the same sum is the ray origin.
+	glm::vec3 m_BottomLeft{ 0.0f };
+	glm::vec3 m_PixelRight{ 0.0f };
+	glm::vec3 m_PixelUp{ 0.0f };
+	glm::vec3 m_Right{ 1.0f, 0.0f, 0.0f };
+	glm::vec3 m_Up{ 0.0f, 1.0f, 0.0f };
+	glm::vec2 m_HalfFilmSize{ 1.0f }; // At a depth of 1 for perspective
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 };
+
+inline glm::vec2 Camera::SampleDisk(const glm::vec2& sample)
+{
+	// Shirley-Chiu concentric mapping, keeps strata of the square sample intact
+	glm::vec2 offset = sample * 2.0f - 1.0f;
+	if (offset.x == 0.0f && offset.y == 0.0f)
+		return glm::vec2(0.0f);
+
+	constexpr float quarterPi = 0.785398163f;
+	float radius, theta;
+	if (glm::abs(offset.x) > glm::abs(offset.y))
+	{
+		radius = offset.x;
+		theta = quarterPi * (offset.y / offset.x);
+	}
+	else
+	{
+		radius = offset.y;
+		theta = 2.0f * quarterPi - quarterPi * (offset.x / offset.y);
+	}
+	return radius * glm::vec2(glm::cos(theta), glm::sin(theta));
+}
+
+inline Ray Camera::GenerateRay(uint32_t x, uint32_t y, const glm::vec2& pixelOffset, const glm::vec2& lensSample) const
+{
+	glm::vec3 film = m_BottomLeft + ((float)x + pixelOffset.x) * m_PixelRight + ((float)y + pixelOffset.y) * m_PixelUp;
+
+	Ray ray;
+	if (m_ProjectionType == ProjectionType::Orthographic)
+	{
+		ray.Origin = m_Position + film;
+		ray.Direction = m_ForwardDirection;
+		return ray;
+	}
+
+	if (m_LensRadius <= 0.0f)
+	{
+		ray.Origin = m_Position;
+		ray.Direction = glm::normalize(film);
+		return ray;
+	}
+
+	// film has a forward component of 1, so scaling it reaches the plane in focus
+	glm::vec3 focusPoint = m_Position + film * m_FocusDistance;
+	glm::vec2 lens = SampleDisk(lensSample) * m_LensRadius;
+
+	ray.Origin = m_Position + lens.x * m_Right + lens.y * m_Up;
+	ray.Direction = glm::normalize(focusPoint - ray.Origin);
+	return ray;
+}
@@ -0,0 +1,450 @@
+#include "ChunkCache.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Utils
+{
+	static constexpr char ChunkMagic[8] = { 'R', 'T', 'C', 'H', 'U', 'N', 'K', '\0' };
+	static constexpr uint32_t ChunkVersion = 1;
+	static constexpr uint64_t ChunkAlignment = 64;
+
+	// Stored in the writer's byte order and struct layout, like compiled scenes; ElementSizes
+	// catches a file written by a build with different structs
+	struct ChunkFileHeader
+	{
+		char Magic[8];
+		uint32_t Version;
+		uint32_t MaxLeafSize;
+		uint32_t ElementSizes[6]; // Material, Light, Sphere, Box, BVHNode, PrimitiveRef
+		uint32_t ChunkCount;
+		uint32_t MaterialCount;
+		uint32_t LightCount;
+		CameraDescription Camera;
+		uint64_t ChunksOffset, MaterialsOffset, LightsOffset;
+	};
+
+	// A chunk's arrays follow each other from Offset, each aligned: spheres, boxes, BVH nodes,
+	// primitive indices, Primitives, LeafPrimitives and the ten SIMD lane arrays
+	struct ChunkRecord
+	{
+		AABB Bounds;
+		uint64_t Offset;
+		uint32_t SphereCount, BoxCount, NodeCount;
+	};
+
+	static void GetElementSizes(uint32_t sizes[6])
+	{
+		const uint32_t elementSizes[6] = { sizeof(Material), sizeof(Light), sizeof(Sphere), sizeof(Box), sizeof(BVHNode), sizeof(PrimitiveRef) };
+		std::memcpy(sizes, elementSizes, sizeof(elementSizes));
+	}
+
+	static uint64_t AlignUp(uint64_t value)
+	{
+		return (value + ChunkAlignment - 1) & ~(ChunkAlignment - 1);
+	}
+
+	// Byte sizes of a chunk's arrays, in file order
+	static std::vector<uint64_t> GetChunkSections(uint32_t sphereCount, uint32_t boxCount, uint32_t nodeCount)
+	{
+		uint64_t primitiveCount = (uint64_t)sphereCount + boxCount;
+		uint64_t laneCount = primitiveCount + Kernels::KernelPadding;
+		std::vector<uint64_t> sections = {
+			sphereCount * sizeof(Sphere), boxCount * sizeof(Box), nodeCount * sizeof(BVHNode),
+			primitiveCount * sizeof(uint32_t), primitiveCount * sizeof(PrimitiveRef), primitiveCount * sizeof(PrimitiveRef)
+		};
+		sections.insert(sections.end(), 10, laneCount * sizeof(float));
+		return sections;
+	}
+
+	static std::vector<float>* GetLanes(PrimitiveSoA& soa, int index)
+	{
+		std::vector<float>* lanes[10] = { &soa.CenterX, &soa.CenterY, &soa.CenterZ, &soa.Radius,
+			&soa.MinX, &soa.MinY, &soa.MinZ, &soa.MaxX, &soa.MaxY, &soa.MaxZ };
+		return lanes[index];
+	}
+
+	// Splits [first, first + count) of primitives (indices into centers) at the median along the
+	// longest axis of their centres until every range holds at most maxCount
+	static void Partition(std::vector<uint32_t>& primitives, const std::vector<glm::vec3>& centers, size_t first, size_t count,
+		size_t maxCount, std::vector<std::pair<size_t, size_t>>& ranges)
+	{
+		if (count <= maxCount)
+		{
+			ranges.push_back({ first, count });
+			return;
+		}
+
+		AABB centerBounds;
+		for (size_t i = first; i < first + count; i++)
+			centerBounds.Grow(centers[primitives[i]]);
+		glm::vec3 extent = centerBounds.Max - centerBounds.Min;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		size_t half = count / 2;
+		std::nth_element(primitives.begin() + first, primitives.begin() + first + half, primitives.begin() + first + count,
+			[&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+		Partition(primitives, centers, first, half, maxCount, ranges);
+		Partition(primitives, centers, first + half, count - half, maxCount, ranges);
+	}
+}
+
+bool ChunkCache::Write(const std::string& path, const Scene& scene, const CameraDescription& camera, uint32_t primitivesPerChunk)
+{
+	using namespace Utils;
+
+	// Spheres, then boxes
+	uint32_t sphereCount = (uint32_t)scene.Spheres.size();
+	std::vector<uint32_t> primitives(sphereCount + scene.Boxes.size());
+	std::vector<glm::vec3> centers(primitives.size());
+	for (uint32_t i = 0; i < (uint32_t)primitives.size(); i++)
+	{
+		primitives[i] = i;
+		PrimitiveRef primitive = i < sphereCount ? PrimitiveRef(PrimitiveType::Sphere, i) : PrimitiveRef(PrimitiveType::Box, i - sphereCount);
+		centers[i] = scene.GetPrimitiveBounds(primitive).GetCenter();
+	}
+
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (!primitives.empty())
+		Partition(primitives, centers, 0, primitives.size(), glm::max(primitivesPerChunk, 1u), ranges);
+
+	std::ofstream stream(path, std::ios::binary);
+	if (!stream)
+		return false;
+
+	static const char padding[ChunkAlignment] = {};
+	auto padTo = [&](uint64_t position)
+	{
+		uint64_t current = (uint64_t)stream.tellp();
+		stream.write(padding, (std::streamsize)(position - current));
+	};
+
+	ChunkFileHeader header{};
+	std::memcpy(header.Magic, ChunkMagic, sizeof(ChunkMagic));
+	header.Version = ChunkVersion;
+	header.MaxLeafSize = Kernels::GetLaneCount(Kernels::GetActiveISA());
+	GetElementSizes(header.ElementSizes);
+	header.ChunkCount = (uint32_t)ranges.size();
+	header.MaterialCount = (uint32_t)scene.Materials.size();
+	header.LightCount = (uint32_t)scene.Lights.size();
+	header.Camera = camera;
+	header.ChunksOffset = AlignUp(sizeof(ChunkFileHeader));
+	header.MaterialsOffset = AlignUp(header.ChunksOffset + ranges.size() * sizeof(ChunkRecord));
+	header.LightsOffset = AlignUp(header.MaterialsOffset + scene.Materials.size() * sizeof(Material));
+	uint64_t offset = AlignUp(header.LightsOffset + scene.Lights.size() * sizeof(Light));
+
+	// The records are only complete once every chunk is built, so they are written last
+	std::vector<ChunkRecord> records(ranges.size());
+	stream.write((const char*)&header, sizeof(header));
+	padTo(header.MaterialsOffset);
+	stream.write((const char*)scene.Materials.data(), (std::streamsize)(scene.Materials.size() * sizeof(Material)));
+	padTo(header.LightsOffset);
+	stream.write((const char*)scene.Lights.data(), (std::streamsize)(scene.Lights.size() * sizeof(Light)));
+
+	for (size_t c = 0; c < ranges.size() && stream; c++)
+	{
+		Geometry chunk;
+		for (size_t i = ranges[c].first; i < ranges[c].first + ranges[c].second; i++)
+		{
+			if (primitives[i] < sphereCount)
+				chunk.Spheres.push_back(scene.Spheres[primitives[i]]);
+			else
+				chunk.Boxes.push_back(scene.Boxes[primitives[i] - sphereCount]);
+		}
+		chunk.BuildAcceleration();
+
+		ChunkRecord& record = records[c];
+		record.Bounds = chunk.GetBounds();
+		record.Offset = offset;
+		record.SphereCount = (uint32_t)chunk.Spheres.size();
+		record.BoxCount = (uint32_t)chunk.Boxes.size();
+		record.NodeCount = (uint32_t)chunk.Accelerator.GetNodes().size();
+
+		const void* data[16] = {
+			chunk.Spheres.data(), chunk.Boxes.data(), chunk.Accelerator.GetNodes().data(),
+			chunk.Accelerator.GetPrimitiveIndices().data(), chunk.Primitives.data(), chunk.LeafPrimitives.data()
+		};
+		for (int lanes = 0; lanes < 10; lanes++)
+			data[6 + lanes] = GetLanes(chunk.LeafData, lanes)->data();
+
+		std::vector<uint64_t> sections = GetChunkSections(record.SphereCount, record.BoxCount, record.NodeCount);
+		for (size_t s = 0; s < sections.size(); s++)
+		{
+			padTo(offset);
+			stream.write((const char*)data[s], (std::streamsize)sections[s]);
+			offset = AlignUp(offset + sections[s]);
+		}
+	}
+	padTo(offset);
+
+	stream.seekp((std::streamoff)header.ChunksOffset);
+	stream.write((const char*)records.data(), (std::streamsize)(records.size() * sizeof(ChunkRecord)));
+	return (bool)stream;
+}
+
+bool ChunkCache::Load(const std::string& path, size_t memoryBudget, Scene& scene, CameraDescription& camera, std::string& error)
+{
+	using namespace Utils;
+
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream)
+	{
+		error = "Cannot open " + path;
+		return false;
+	}
+
+	ChunkFileHeader header;
+	uint32_t elementSizes[6];
+	GetElementSizes(elementSizes);
+	if (!stream.read((char*)&header, sizeof(header)) || std::memcmp(header.Magic, ChunkMagic, sizeof(ChunkMagic)) != 0 ||
+		header.Version != ChunkVersion || std::memcmp(header.ElementSizes, elementSizes, sizeof(elementSizes)) != 0)
+	{
+		error = path + ": not a chunked scene of version " + std::to_string(ChunkVersion) + " from this build";
+		return false;
+	}
+
+	std::vector<ChunkRecord> records(header.ChunkCount);
+	scene = Scene();
+	scene.Materials.resize(header.MaterialCount);
+	scene.Lights.resize(header.LightCount);
+	stream.seekg((std::streamoff)header.ChunksOffset);
+	stream.read((char*)records.data(), (std::streamsize)(records.size() * sizeof(ChunkRecord)));
+	stream.seekg((std::streamoff)header.MaterialsOffset);
+	stream.read((char*)scene.Materials.data(), (std::streamsize)(scene.Materials.size() * sizeof(Material)));
+	stream.seekg((std::streamoff)header.LightsOffset);
+	stream.read((char*)scene.Lights.data(), (std::streamsize)(scene.Lights.size() * sizeof(Light)));
+	if (!stream)
+	{
+		scene = Scene();
+		error = path + ": truncated";
+		return false;
+	}
+
+	auto cache = std::make_shared<ChunkCache>();
+	cache->m_Path = path;
+	cache->m_MaxLeafSize = header.MaxLeafSize;
+	cache->m_MaterialCount = header.MaterialCount;
+	cache->m_MemoryBudget = memoryBudget;
+
+	std::vector<Chunk> chunks(records.size());
+	std::vector<AABB> bounds(records.size());
+	for (size_t c = 0; c < records.size(); c++)
+	{
+		chunks[c].Bounds = bounds[c] = records[c].Bounds;
+		chunks[c].Offset = records[c].Offset;
+		chunks[c].SphereCount = records[c].SphereCount;
+		chunks[c].BoxCount = records[c].BoxCount;
+		chunks[c].NodeCount = records[c].NodeCount;
+	}
+	cache->m_Chunks.swap(chunks);
+	cache->m_Accelerator.Build(bounds, 1);
+	cache->m_File.open(path, std::ios::binary);
+	cache->m_Loader = std::thread([cache = cache.get()]() { cache->LoaderLoop(); });
+
+	scene.Chunks = std::move(cache);
+	scene.BuildAcceleration();
+	camera = header.Camera;
+	return true;
+}
+
+ChunkCache::~ChunkCache()
+{
+	if (!m_Loader.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_RequestCondition.notify_one();
+	m_Loader.join();
+}
+
+const Geometry* ChunkCache::Find(uint32_t chunkIndex)
+{
+	Chunk& chunk = m_Chunks[chunkIndex];
+	if (chunk.Resident)
+	{
+		if (chunk.LastUsed.load(std::memory_order_relaxed) != m_Frame)
+			chunk.LastUsed.store(m_Frame, std::memory_order_relaxed);
+		return chunk.Resident.get();
+	}
+
+	if (!chunk.Failed && !chunk.Requested.exchange(true, std::memory_order_relaxed))
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Requests.push_back(chunkIndex);
+			m_LoadsInFlight++;
+		}
+		m_RequestCondition.notify_one();
+	}
+	return nullptr;
+}
+
+void ChunkCache::BeginFrame(bool evict)
+{
+	m_Frame++;
+
+	std::vector<std::pair<uint32_t, std::unique_ptr<Geometry>>> loaded;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		loaded.swap(m_Loaded);
+	}
+
+	for (auto& [chunkIndex, geometry] : loaded)
+	{
+		Chunk& chunk = m_Chunks[chunkIndex];
+		if (!geometry)
+		{
+			// Left out rather than installed empty, which would render as nothing without a word
+			chunk.Failed = true;
+			chunk.Requested.store(false, std::memory_order_relaxed);
+			if (m_Error.empty())
+				m_Error = "Chunk " + std::to_string(chunkIndex) + " of " + m_Path + " is unreadable or corrupt";
+			continue;
+		}
+
+		chunk.Bytes = geometry->GetMemoryUsage();
+		chunk.Resident = std::move(geometry);
+		chunk.LastUsed.store(m_Frame, std::memory_order_relaxed);
+		chunk.Requested.store(false, std::memory_order_relaxed);
+		m_ResidentChunks.push_back(chunkIndex);
+		m_ResidentBytes += chunk.Bytes;
+		m_Loads++;
+	}
+
+	// Least recently used first; the chunks installed above are the most recent
+	std::sort(m_ResidentChunks.begin(), m_ResidentChunks.end(), [&](uint32_t a, uint32_t b)
+	{
+		return m_Chunks[a].LastUsed.load(std::memory_order_relaxed) < m_Chunks[b].LastUsed.load(std::memory_order_relaxed);
+	});
+	size_t evicted = 0;
+	while (evict && m_ResidentBytes > m_MemoryBudget && evicted < m_ResidentChunks.size() &&
+		m_Chunks[m_ResidentChunks[evicted]].LastUsed.load(std::memory_order_relaxed) != m_Frame)
+	{
+		Chunk& chunk = m_Chunks[m_ResidentChunks[evicted++]];
+		chunk.Resident.reset();
+		m_ResidentBytes -= chunk.Bytes;
+		chunk.Bytes = 0;
+		m_Evictions++;
+	}
+	m_ResidentChunks.erase(m_ResidentChunks.begin(), m_ResidentChunks.begin() + evicted);
+	m_PeakResidentBytes = std::max(m_PeakResidentBytes, m_ResidentBytes);
+}
+
+void ChunkCache::WaitForLoads()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_LoadedCondition.wait(lock, [this]() { return m_LoadsInFlight == 0; });
+}
+
+void ChunkCache::AddLookups(uint64_t hits, uint64_t misses)
+{
+	m_Hits.fetch_add(hits, std::memory_order_relaxed);
+	m_Misses.fetch_add(misses, std::memory_order_relaxed);
+}
+
+ChunkCache::Stats ChunkCache::GetStats() const
+{
+	Stats stats;
+	stats.ChunkCount = GetChunkCount();
+	stats.ResidentChunks = (uint32_t)m_ResidentChunks.size();
+	stats.Hits = m_Hits.load(std::memory_order_relaxed);
+	stats.Misses = m_Misses.load(std::memory_order_relaxed);
+	stats.Loads = m_Loads;
+	stats.Evictions = m_Evictions;
+	stats.FailedLoads = m_FailedLoads;
+	stats.ResidentBytes = m_ResidentBytes;
+	stats.PeakResidentBytes = m_PeakResidentBytes;
+	stats.MemoryBudget = m_MemoryBudget;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		stats.LoadMilliseconds = m_LoadMilliseconds;
+	}
+	return stats;
+}
+
+void ChunkCache::LoaderLoop()
+{
+	while (true)
+	{
+		uint32_t chunkIndex;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_RequestCondition.wait(lock, [this]() { return m_Stop || !m_Requests.empty(); });
+			if (m_Stop)
+				return;
+			chunkIndex = m_Requests.front();
+			m_Requests.erase(m_Requests.begin());
+		}
+
+		Walnut::Timer timer;
+		std::unique_ptr<Geometry> geometry = ReadChunk(m_Chunks[chunkIndex]);
+		float milliseconds = timer.ElapsedMillis();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_FailedLoads += !geometry;
+			m_Loaded.push_back({ chunkIndex, std::move(geometry) });
+			m_LoadMilliseconds += milliseconds;
+			m_LoadsInFlight--;
+		}
+		m_LoadedCondition.notify_all();
+	}
+}
+
+std::unique_ptr<Geometry> ChunkCache::ReadChunk(const Chunk& chunk)
+{
+	auto geometry = std::make_unique<Geometry>();
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> primitiveIndices;
+	uint32_t primitiveCount = chunk.SphereCount + chunk.BoxCount;
+	uint32_t laneCount = primitiveCount + Kernels::KernelPadding;
+
+	geometry->Spheres.resize(chunk.SphereCount);
+	geometry->Boxes.resize(chunk.BoxCount);
+	nodes.resize(chunk.NodeCount);
+	primitiveIndices.resize(primitiveCount);
+	geometry->Primitives.resize(primitiveCount);
+	geometry->LeafPrimitives.resize(primitiveCount);
+	void* data[16] = {
+		geometry->Spheres.data(), geometry->Boxes.data(), nodes.data(),
+		primitiveIndices.data(), geometry->Primitives.data(), geometry->LeafPrimitives.data()
+	};
+	for (int lanes = 0; lanes < 10; lanes++)
+	{
+		std::vector<float>* values = Utils::GetLanes(geometry->LeafData, lanes);
+		values->resize(laneCount);
+		data[6 + lanes] = values->data();
+	}
+
+	uint64_t offset = chunk.Offset;
+	std::vector<uint64_t> sections = Utils::GetChunkSections(chunk.SphereCount, chunk.BoxCount, chunk.NodeCount);
+	m_File.clear();
+	for (size_t s = 0; s < sections.size() && m_File; s++)
+	{
+		m_File.seekg((std::streamoff)offset);
+		m_File.read((char*)data[s], (std::streamsize)sections[s]);
+		offset = Utils::AlignUp(offset + sections[s]);
+	}
+
+	bool valid = (bool)m_File &&
+		std::all_of(primitiveIndices.begin(), primitiveIndices.end(), [&](uint32_t index) { return index < primitiveCount; }) &&
+		BVH::IsValid(nodes, primitiveIndices.size()) && geometry->HasValidPrimitives() &&
+		std::all_of(geometry->Spheres.begin(), geometry->Spheres.end(),
+			[&](const Sphere& sphere) { return sphere.MaterialIndex >= 0 && sphere.MaterialIndex < (int)m_MaterialCount; }) &&
+		std::all_of(geometry->Boxes.begin(), geometry->Boxes.end(),
+			[&](const Box& box) { return box.MaterialIndex >= 0 && box.MaterialIndex < (int)m_MaterialCount; });
+	if (!valid)
+		return nullptr;
+
+	geometry->LeafData.Count = primitiveCount;
+	geometry->Accelerator.Assign(std::move(nodes), std::move(primitiveIndices), m_MaxLeafSize);
+
+	// Leaves sized for another kernel width still work, but a matching build is faster
+	if (m_MaxLeafSize != Kernels::GetLaneCount(Kernels::GetActiveISA()))
+		geometry->BuildAcceleration();
+	return geometry;
+}
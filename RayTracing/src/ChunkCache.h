@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Scene.h"
+#include "SceneFile.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// World spheres and boxes kept on disk in spatially coherent chunks, each with its own bounds,
+// BVH and SIMD leaf data stored as they are in memory. Only a memory budget's worth of chunks
+// is resident; the rest is paged in on demand by a loader thread and the least recently used
+// chunks make room. The chunk bounds and the BVH over them stay resident.
+//
+// Rays ask for the chunks whose bounds they enter with Find(), which never waits: a missing
+// chunk is queued for loading and the renderer defers the sample that needed it to a later
+// frame. Loaded chunks are installed, and old ones evicted, only between frames (BeginFrame()),
+// so a chunk Find() returned stays valid for the rest of the frame.
+class ChunkCache
+{
+public:
+	struct Stats
+	{
+		uint32_t ChunkCount = 0;
+		uint32_t ResidentChunks = 0;
+		uint64_t Hits = 0;   // Chunks rays entered that were resident
+		uint64_t Misses = 0; // ... and that were not, and were queued for loading
+		uint64_t Loads = 0;
+		uint64_t Evictions = 0;
+		uint64_t FailedLoads = 0; // Unreadable or corrupt chunks, which stay out
+		size_t ResidentBytes = 0;
+		size_t PeakResidentBytes = 0;
+		size_t MemoryBudget = 0;
+		float LoadMilliseconds = 0.0f; // Spent reading chunks on the loader thread
+	};
+
+	// Splits the scene's world spheres and boxes into chunks of at most primitivesPerChunk,
+	// halving the primitives at the median of their longest axis until they fit, and writes
+	// them with their BVHs, the materials, the lights and the camera. Meshes, prototypes and
+	// instances are left out.
+	static bool Write(const std::string& path, const Scene& scene, const CameraDescription& camera, uint32_t primitivesPerChunk);
+
+	// Opens a file Write() produced: scene receives the materials, the lights and a cache of
+	// its chunks in Scene::Chunks, of which none is resident yet. memoryBudget bounds the bytes
+	// of resident chunk geometry; it should hold at least the chunks one path can pass through.
+	static bool Load(const std::string& path, size_t memoryBudget, Scene& scene, CameraDescription& camera, std::string& error);
+
+	ChunkCache() = default;
+	~ChunkCache();
+
+	ChunkCache(const ChunkCache&) = delete;
+	ChunkCache& operator=(const ChunkCache&) = delete;
+
+	// Over the chunk bounds, one chunk per leaf
+	const BVH& GetAccelerator() const { return m_Accelerator; }
+	uint32_t GetChunkCount() const { return (uint32_t)m_Chunks.size(); }
+	const AABB& GetBounds(uint32_t chunkIndex) const { return m_Chunks[chunkIndex].Bounds; }
+
+	// The chunk's geometry, or null after queueing it for the loader thread. Safe to call from
+	// any number of render threads.
+	const Geometry* Find(uint32_t chunkIndex);
+	// Resident geometry of a chunk Find() returned during this frame
+	const Geometry& GetResident(uint32_t chunkIndex) const { return *m_Chunks[chunkIndex].Resident; }
+
+	// Installs the chunks loaded since the last call and evicts the least recently used ones
+	// until the rest fits the budget; chunks installed now are evicted last, so the budget is
+	// exceeded by at most one frame's loads. Call between frames, while nothing calls Find().
+	// Without eviction the budget is ignored, for a path that needs more chunks than it holds.
+	void BeginFrame(bool evict = true);
+	// Waits until every chunk queued so far is loaded, for renders that cannot leave samples
+	// to later frames; BeginFrame() then installs them
+	void WaitForLoads();
+
+	// Lookups counted by the render threads, which flush them once per tile
+	void AddLookups(uint64_t hits, uint64_t misses);
+	Stats GetStats() const;
+
+	// Why a chunk BeginFrame() came to install could not be read, empty if none failed. A failed
+	// chunk is never resident, so samples that need it wait forever; the render is lost.
+	const std::string& GetError() const { return m_Error; }
+private:
+	struct Chunk
+	{
+		AABB Bounds;
+		uint64_t Offset = 0;
+		uint32_t SphereCount = 0, BoxCount = 0, NodeCount = 0;
+
+		std::unique_ptr<Geometry> Resident; // Changed only by BeginFrame()
+		bool Failed = false;                // Set by BeginFrame(); never requested again
+		size_t Bytes = 0;
+		std::atomic<uint64_t> LastUsed{ 0 }; // Frame of the last Find() that returned it
+		std::atomic<bool> Requested{ false }; // Queued or loaded but not installed yet
+	};
+
+	void LoaderLoop();
+	// Null if the chunk cannot be read or fails validation
+	std::unique_ptr<Geometry> ReadChunk(const Chunk& chunk);
+private:
+	std::string m_Path;
+	std::vector<Chunk> m_Chunks;
+	BVH m_Accelerator;
+	uint32_t m_MaxLeafSize = 0;
+	uint32_t m_MaterialCount = 0;
+	size_t m_MemoryBudget = 0;
+
+	uint64_t m_Frame = 1;
+	std::vector<uint32_t> m_ResidentChunks;
+	size_t m_ResidentBytes = 0, m_PeakResidentBytes = 0;
+	uint64_t m_Loads = 0, m_Evictions = 0, m_FailedLoads = 0;
+	std::string m_Error;
+	std::atomic<uint64_t> m_Hits{ 0 }, m_Misses{ 0 };
+
+	// Loader thread
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_RequestCondition, m_LoadedCondition;
+	std::vector<uint32_t> m_Requests;
+	std::vector<std::pair<uint32_t, std::unique_ptr<Geometry>>> m_Loaded;
+	uint32_t m_LoadsInFlight = 0; // Queued or being read
+	float m_LoadMilliseconds = 0.0f;
+	bool m_Stop = false;
+	std::ifstream m_File; // Loader thread only
+	std::thread m_Loader;
+};
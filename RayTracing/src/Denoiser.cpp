@@ -0,0 +1,622 @@
+#include "Denoiser.h"
+#include "AccumulationBuffer.h"
+#include "IntersectionKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+	#include <immintrin.h>
+	#define RT_DENOISE_SSE
+	#if !defined(_MSC_VER)
+		// As in IntersectionKernels.cpp: no fused multiply-adds in the AVX-512 filter, so it
+		// rounds like the narrower ones
+		#pragma GCC optimize("fp-contract=off")
+	#endif
+#endif
+
+namespace Utils
+{
+	// Rows per thread pool task
+	static constexpr uint32_t RowsPerTask = 8;
+
+	// B3 spline, the weights of the taps along each axis
+	static constexpr float Kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	// Albedo channels darker than this are not divided out, the lighting would blow up
+	static constexpr float MinAlbedo = 0.01f;
+	static constexpr float MinDepth = 1e-3f;
+	// Lighting differences are relative to the brighter of the two pixels, or to this in the dark
+	static constexpr float MinBrightness = 0.05f;
+	// Taps whose weight would fall below e^-MaxExponent are dropped rather than summed, as the
+	// denormals they end up as are slower than the whole rest of the filter
+	static constexpr float MaxExponent = 32.0f;
+
+	// Per iteration: the tap spacing, and how strongly each guide separates pixels
+	struct FilterPass
+	{
+		int Step;
+		float ColorScale, NormalScale, AlbedoScale;
+		float DepthScale[5][5]; // Per tap, 1 / (sigma * distance in pixels)
+		float Weights[5][5];
+	};
+
+	static FilterPass GetFilterPass(const Denoiser::Settings& settings, uint32_t iteration)
+	{
+		FilterPass pass;
+		pass.Step = 1 << iteration;
+
+		// The lighting sigma halves every iteration, as the noise it has to see through does
+		float colorSigma = settings.ColorSigma / (float)pass.Step;
+		pass.ColorScale = 1.0f / std::max(colorSigma * colorSigma, 1e-12f);
+		pass.NormalScale = 1.0f / std::max(settings.NormalSigma * settings.NormalSigma, 1e-12f);
+		pass.AlbedoScale = 1.0f / std::max(settings.AlbedoSigma * settings.AlbedoSigma, 1e-12f);
+		for (int ty = 0; ty < 5; ty++)
+		{
+			for (int tx = 0; tx < 5; tx++)
+			{
+				int distance = std::max(std::max(std::abs(tx - 2), std::abs(ty - 2)), 1) * pass.Step;
+				pass.DepthScale[ty][tx] = 1.0f / std::max(settings.DepthSigma * (float)distance, 1e-12f);
+				pass.Weights[ty][tx] = Kernel[ty] * Kernel[tx];
+			}
+		}
+		return pass;
+	}
+
+	// The planes a tap reads, in the order FilterPixel() and the FilterChunk functions use them
+	static constexpr int ValueCount = 11;
+	struct FilterPlanes
+	{
+		const float* Values[ValueCount]; // Lighting RGB and its brightness, normal XYZ, depth, albedo RGB
+		const float* InverseDepth;       // 1 / depth, read at the centre pixel only
+		float* Output[4];                // Lighting RGB and its brightness
+		int Width, Height;
+	};
+
+	static float Square(float value) { return value * value; }
+
+	static float Brightness(float r, float g, float b) { return (r + g + b) * (1.0f / 3.0f); }
+
+	static void FilterPixel(const FilterPlanes& planes, const FilterPass& pass, int x, int y)
+	{
+		const float* const* v = planes.Values;
+		size_t center = (size_t)y * planes.Width + x;
+		float depthScale = planes.InverseDepth[center];
+		float brightness = std::max(v[3][center], MinBrightness);
+
+		float weightSum = 0.0f;
+		float sum[3] = {};
+		for (int ty = 0; ty < 5; ty++)
+		{
+			int qy = y + (ty - 2) * pass.Step;
+			if (qy < 0 || qy >= planes.Height)
+				continue;
+
+			for (int tx = 0; tx < 5; tx++)
+			{
+				int qx = x + (tx - 2) * pass.Step;
+				if (qx < 0 || qx >= planes.Width)
+					continue;
+
+				size_t tap = (size_t)qy * planes.Width + qx;
+				float scale = std::max(v[3][tap], brightness);
+				float color = (Square(v[0][tap] - v[0][center]) + Square(v[1][tap] - v[1][center]) + Square(v[2][tap] - v[2][center])) / Square(scale);
+				float normal = Square(v[4][tap] - v[4][center]) + Square(v[5][tap] - v[5][center]) + Square(v[6][tap] - v[6][center]);
+				float depth = Square((v[7][tap] - v[7][center]) * depthScale * pass.DepthScale[ty][tx]);
+				float albedo = Square(v[8][tap] - v[8][center]) + Square(v[9][tap] - v[9][center]) + Square(v[10][tap] - v[10][center]);
+
+				float exponent = color * pass.ColorScale + normal * pass.NormalScale + depth + albedo * pass.AlbedoScale;
+				if (exponent > MaxExponent)
+					continue;
+
+				float weight = pass.Weights[ty][tx] * std::exp(-exponent);
+				weightSum += weight;
+				for (int c = 0; c < 3; c++)
+					sum[c] += weight * v[c][tap];
+			}
+		}
+
+		// The centre tap always counts, so weightSum > 0
+		for (int c = 0; c < 3; c++)
+			planes.Output[c][center] = sum[c] / weightSum;
+		planes.Output[3][center] = Brightness(planes.Output[0][center], planes.Output[1][center], planes.Output[2][center]);
+	}
+
+#ifdef RT_DENOISE_SSE
+	// e^x for -MaxExponent <= x <= 0: 2^(x log2 e) split into a power of two, put straight into
+	// the exponent bits, and a Taylor polynomial for the remaining fraction in [-0.5, 0.5]
+	// (relative error below 2e-6, and exact at 0)
+	static __m128 ExpNegative(__m128 x)
+	{
+		x = _mm_max_ps(x, _mm_set1_ps(-MaxExponent));
+		__m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+		__m128i integer = _mm_cvtps_epi32(t);
+		__m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(integer));
+
+		__m128 p = _mm_set1_ps(1.33335581e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+		__m128i exponent = _mm_slli_epi32(_mm_add_epi32(integer, _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+	}
+
+	static __m128 Brightness(__m128 r, __m128 g, __m128 b)
+	{
+		return _mm_mul_ps(_mm_add_ps(_mm_add_ps(r, g), b), _mm_set1_ps(1.0f / 3.0f));
+	}
+
+	static __m128 SquaredDistance(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		__m128 x = _mm_sub_ps(ax, bx);
+		__m128 y = _mm_sub_ps(ay, by);
+		__m128 z = _mm_sub_ps(az, bz);
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+	}
+
+	// FilterPixel() for pixels x to x + 3, which must all be in the image. Taps that are only
+	// partly in the image are gathered from clamped positions and masked out.
+	static void FilterChunkSSE(const FilterPlanes& planes, const FilterPass& pass, int x, int y)
+	{
+		const float* const* v = planes.Values;
+		size_t center = (size_t)y * planes.Width + x;
+		__m128 c[ValueCount];
+		for (int i = 0; i < ValueCount; i++)
+			c[i] = _mm_loadu_ps(v[i] + center);
+		__m128 depthScale = _mm_loadu_ps(planes.InverseDepth + center);
+		__m128 brightness = _mm_max_ps(c[3], _mm_set1_ps(MinBrightness));
+		__m128 colorScale = _mm_set1_ps(pass.ColorScale);
+		__m128 normalScale = _mm_set1_ps(pass.NormalScale);
+		__m128 albedoScale = _mm_set1_ps(pass.AlbedoScale);
+		__m128 maxExponent = _mm_set1_ps(MaxExponent);
+
+		// Kept in named registers rather than arrays, which GCC leaves on the stack
+		__m128 weightSum = _mm_setzero_ps();
+		__m128 red = _mm_setzero_ps(), green = _mm_setzero_ps(), blue = _mm_setzero_ps();
+		auto addTap = [&](auto load, __m128 mask, int ty, int tx)
+		{
+			__m128 r = load(0), g = load(1), b = load(2);
+			__m128 scale = _mm_max_ps(load(3), brightness);
+			__m128 color = _mm_div_ps(SquaredDistance(r, g, b, c[0], c[1], c[2]), _mm_mul_ps(scale, scale));
+			__m128 normal = SquaredDistance(load(4), load(5), load(6), c[4], c[5], c[6]);
+			__m128 depth = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(load(7), c[7]), depthScale), _mm_set1_ps(pass.DepthScale[ty][tx]));
+			__m128 albedo = SquaredDistance(load(8), load(9), load(10), c[8], c[9], c[10]);
+			__m128 exponent = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(color, colorScale), _mm_mul_ps(normal, normalScale)),
+				_mm_add_ps(_mm_mul_ps(depth, depth), _mm_mul_ps(albedo, albedoScale)));
+
+			__m128 weight = _mm_mul_ps(_mm_set1_ps(pass.Weights[ty][tx]), ExpNegative(_mm_sub_ps(_mm_setzero_ps(), exponent)));
+			weight = _mm_and_ps(weight, _mm_and_ps(mask, _mm_cmple_ps(exponent, maxExponent)));
+			weightSum = _mm_add_ps(weightSum, weight);
+			red = _mm_add_ps(red, _mm_mul_ps(weight, r));
+			green = _mm_add_ps(green, _mm_mul_ps(weight, g));
+			blue = _mm_add_ps(blue, _mm_mul_ps(weight, b));
+		};
+
+		for (int ty = 0; ty < 5; ty++)
+		{
+			int qy = y + (ty - 2) * pass.Step;
+			if (qy < 0 || qy >= planes.Height)
+				continue;
+			size_t row = (size_t)qy * planes.Width;
+
+			for (int tx = 0; tx < 5; tx++)
+			{
+				int qx = x + (tx - 2) * pass.Step;
+				if (qx + 3 < 0 || qx >= planes.Width)
+					continue;
+
+				if (qx >= 0 && qx + 3 < planes.Width)
+				{
+					size_t tap = row + qx;
+					addTap([&](int i) { return _mm_loadu_ps(v[i] + tap); }, _mm_castsi128_ps(_mm_set1_epi32(-1)), ty, tx);
+				}
+				else
+				{
+					size_t lanes[4];
+					alignas(16) int valid[4];
+					for (int lane = 0; lane < 4; lane++)
+					{
+						valid[lane] = qx + lane >= 0 && qx + lane < planes.Width ? -1 : 0;
+						lanes[lane] = row + std::min(std::max(qx + lane, 0), planes.Width - 1);
+					}
+					addTap([&](int i) { return _mm_setr_ps(v[i][lanes[0]], v[i][lanes[1]], v[i][lanes[2]], v[i][lanes[3]]); },
+						_mm_castsi128_ps(_mm_load_si128((const __m128i*)valid)), ty, tx);
+				}
+			}
+		}
+
+		__m128 r = _mm_div_ps(red, weightSum), g = _mm_div_ps(green, weightSum), b = _mm_div_ps(blue, weightSum);
+		_mm_storeu_ps(planes.Output[0] + center, r);
+		_mm_storeu_ps(planes.Output[1] + center, g);
+		_mm_storeu_ps(planes.Output[2] + center, b);
+		_mm_storeu_ps(planes.Output[3] + center, Brightness(r, g, b));
+	}
+
+	// The same filter eight and sixteen pixels at a time, with the same operations in the same
+	// order so every width gives the same image
+
+	RT_TARGET_AVX2
+	static __m256 ExpNegative(__m256 x)
+	{
+		x = _mm256_max_ps(x, _mm256_set1_ps(-MaxExponent));
+		__m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+		__m256i integer = _mm256_cvtps_epi32(t);
+		__m256 f = _mm256_sub_ps(t, _mm256_cvtepi32_ps(integer));
+
+		__m256 p = _mm256_set1_ps(1.33335581e-3f);
+		p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.61812911e-3f));
+		p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.55041087e-2f));
+		p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.40226507e-1f));
+		p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.93147181e-1f));
+		p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+		__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(integer, _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+	}
+
+	RT_TARGET_AVX2
+	static __m256 Brightness(__m256 r, __m256 g, __m256 b)
+	{
+		return _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(r, g), b), _mm256_set1_ps(1.0f / 3.0f));
+	}
+
+	RT_TARGET_AVX2
+	static __m256 SquaredDistance(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+	{
+		__m256 x = _mm256_sub_ps(ax, bx);
+		__m256 y = _mm256_sub_ps(ay, by);
+		__m256 z = _mm256_sub_ps(az, bz);
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+	}
+
+	RT_TARGET_AVX2
+	static void FilterChunkAVX2(const FilterPlanes& planes, const FilterPass& pass, int x, int y)
+	{
+		const float* const* v = planes.Values;
+		size_t center = (size_t)y * planes.Width + x;
+		__m256 c[ValueCount];
+		for (int i = 0; i < ValueCount; i++)
+			c[i] = _mm256_loadu_ps(v[i] + center);
+		__m256 depthScale = _mm256_loadu_ps(planes.InverseDepth + center);
+		__m256 brightness = _mm256_max_ps(c[3], _mm256_set1_ps(MinBrightness));
+		__m256 colorScale = _mm256_set1_ps(pass.ColorScale);
+		__m256 normalScale = _mm256_set1_ps(pass.NormalScale);
+		__m256 albedoScale = _mm256_set1_ps(pass.AlbedoScale);
+		__m256 maxExponent = _mm256_set1_ps(MaxExponent);
+
+		__m256 weightSum = _mm256_setzero_ps();
+		__m256 red = _mm256_setzero_ps(), green = _mm256_setzero_ps(), blue = _mm256_setzero_ps();
+		auto addTap = [&](auto load, __m256 mask, int ty, int tx) RT_TARGET_AVX2
+		{
+			__m256 r = load(0), g = load(1), b = load(2);
+			__m256 scale = _mm256_max_ps(load(3), brightness);
+			__m256 color = _mm256_div_ps(SquaredDistance(r, g, b, c[0], c[1], c[2]), _mm256_mul_ps(scale, scale));
+			__m256 normal = SquaredDistance(load(4), load(5), load(6), c[4], c[5], c[6]);
+			__m256 depth = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(load(7), c[7]), depthScale), _mm256_set1_ps(pass.DepthScale[ty][tx]));
+			__m256 albedo = SquaredDistance(load(8), load(9), load(10), c[8], c[9], c[10]);
+			__m256 exponent = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(color, colorScale), _mm256_mul_ps(normal, normalScale)),
+				_mm256_add_ps(_mm256_mul_ps(depth, depth), _mm256_mul_ps(albedo, albedoScale)));
+
+			__m256 weight = _mm256_mul_ps(_mm256_set1_ps(pass.Weights[ty][tx]), ExpNegative(_mm256_sub_ps(_mm256_setzero_ps(), exponent)));
+			weight = _mm256_and_ps(weight, _mm256_and_ps(mask, _mm256_cmp_ps(exponent, maxExponent, _CMP_LE_OQ)));
+			weightSum = _mm256_add_ps(weightSum, weight);
+			red = _mm256_add_ps(red, _mm256_mul_ps(weight, r));
+			green = _mm256_add_ps(green, _mm256_mul_ps(weight, g));
+			blue = _mm256_add_ps(blue, _mm256_mul_ps(weight, b));
+		};
+
+		for (int ty = 0; ty < 5; ty++)
+		{
+			int qy = y + (ty - 2) * pass.Step;
+			if (qy < 0 || qy >= planes.Height)
+				continue;
+			size_t row = (size_t)qy * planes.Width;
+
+			for (int tx = 0; tx < 5; tx++)
+			{
+				int qx = x + (tx - 2) * pass.Step;
+				if (qx + 7 < 0 || qx >= planes.Width)
+					continue;
+
+				if (qx >= 0 && qx + 7 < planes.Width)
+				{
+					size_t tap = row + qx;
+					addTap([&](int i) RT_TARGET_AVX2 { return _mm256_loadu_ps(v[i] + tap); }, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), ty, tx);
+				}
+				else
+				{
+					size_t lanes[8];
+					alignas(32) int valid[8];
+					for (int lane = 0; lane < 8; lane++)
+					{
+						valid[lane] = qx + lane >= 0 && qx + lane < planes.Width ? -1 : 0;
+						lanes[lane] = row + std::min(std::max(qx + lane, 0), planes.Width - 1);
+					}
+					auto gather = [&](int i) RT_TARGET_AVX2
+					{
+						alignas(32) float values[8];
+						for (int lane = 0; lane < 8; lane++)
+							values[lane] = v[i][lanes[lane]];
+						return _mm256_load_ps(values);
+					};
+					addTap(gather, _mm256_castsi256_ps(_mm256_load_si256((const __m256i*)valid)), ty, tx);
+				}
+			}
+		}
+
+		__m256 r = _mm256_div_ps(red, weightSum), g = _mm256_div_ps(green, weightSum), b = _mm256_div_ps(blue, weightSum);
+		_mm256_storeu_ps(planes.Output[0] + center, r);
+		_mm256_storeu_ps(planes.Output[1] + center, g);
+		_mm256_storeu_ps(planes.Output[2] + center, b);
+		_mm256_storeu_ps(planes.Output[3] + center, Brightness(r, g, b));
+	}
+
+	RT_TARGET_AVX512
+	static __m512 ExpNegative(__m512 x)
+	{
+		x = _mm512_max_ps(x, _mm512_set1_ps(-MaxExponent));
+		__m512 t = _mm512_mul_ps(x, _mm512_set1_ps(1.44269504f));
+		__m512i integer = _mm512_cvtps_epi32(t);
+		__m512 f = _mm512_sub_ps(t, _mm512_cvtepi32_ps(integer));
+
+		__m512 p = _mm512_set1_ps(1.33335581e-3f);
+		p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(9.61812911e-3f));
+		p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(5.55041087e-2f));
+		p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(2.40226507e-1f));
+		p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(6.93147181e-1f));
+		p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.0f));
+
+		__m512i exponent = _mm512_slli_epi32(_mm512_add_epi32(integer, _mm512_set1_epi32(127)), 23);
+		return _mm512_mul_ps(p, _mm512_castsi512_ps(exponent));
+	}
+
+	RT_TARGET_AVX512
+	static __m512 Brightness(__m512 r, __m512 g, __m512 b)
+	{
+		return _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(r, g), b), _mm512_set1_ps(1.0f / 3.0f));
+	}
+
+	RT_TARGET_AVX512
+	static __m512 SquaredDistance(__m512 ax, __m512 ay, __m512 az, __m512 bx, __m512 by, __m512 bz)
+	{
+		__m512 x = _mm512_sub_ps(ax, bx);
+		__m512 y = _mm512_sub_ps(ay, by);
+		__m512 z = _mm512_sub_ps(az, bz);
+		return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)), _mm512_mul_ps(z, z));
+	}
+
+	RT_TARGET_AVX512
+	static void FilterChunkAVX512(const FilterPlanes& planes, const FilterPass& pass, int x, int y)
+	{
+		const float* const* v = planes.Values;
+		size_t center = (size_t)y * planes.Width + x;
+		__m512 c[ValueCount];
+		for (int i = 0; i < ValueCount; i++)
+			c[i] = _mm512_loadu_ps(v[i] + center);
+		__m512 depthScale = _mm512_loadu_ps(planes.InverseDepth + center);
+		__m512 brightness = _mm512_max_ps(c[3], _mm512_set1_ps(MinBrightness));
+		__m512 colorScale = _mm512_set1_ps(pass.ColorScale);
+		__m512 normalScale = _mm512_set1_ps(pass.NormalScale);
+		__m512 albedoScale = _mm512_set1_ps(pass.AlbedoScale);
+		__m512 maxExponent = _mm512_set1_ps(MaxExponent);
+
+		__m512 weightSum = _mm512_setzero_ps();
+		__m512 red = _mm512_setzero_ps(), green = _mm512_setzero_ps(), blue = _mm512_setzero_ps();
+		auto addTap = [&](auto load, __mmask16 mask, int ty, int tx) RT_TARGET_AVX512
+		{
+			__m512 r = load(0), g = load(1), b = load(2);
+			__m512 scale = _mm512_max_ps(load(3), brightness);
+			__m512 color = _mm512_div_ps(SquaredDistance(r, g, b, c[0], c[1], c[2]), _mm512_mul_ps(scale, scale));
+			__m512 normal = SquaredDistance(load(4), load(5), load(6), c[4], c[5], c[6]);
+			__m512 depth = _mm512_mul_ps(_mm512_mul_ps(_mm512_sub_ps(load(7), c[7]), depthScale), _mm512_set1_ps(pass.DepthScale[ty][tx]));
+			__m512 albedo = SquaredDistance(load(8), load(9), load(10), c[8], c[9], c[10]);
+			__m512 exponent = _mm512_add_ps(
+				_mm512_add_ps(_mm512_mul_ps(color, colorScale), _mm512_mul_ps(normal, normalScale)),
+				_mm512_add_ps(_mm512_mul_ps(depth, depth), _mm512_mul_ps(albedo, albedoScale)));
+
+			mask &= _mm512_cmp_ps_mask(exponent, maxExponent, _CMP_LE_OQ);
+			__m512 weight = _mm512_maskz_mul_ps(mask, _mm512_set1_ps(pass.Weights[ty][tx]), ExpNegative(_mm512_sub_ps(_mm512_setzero_ps(), exponent)));
+			weightSum = _mm512_add_ps(weightSum, weight);
+			red = _mm512_add_ps(red, _mm512_mul_ps(weight, r));
+			green = _mm512_add_ps(green, _mm512_mul_ps(weight, g));
+			blue = _mm512_add_ps(blue, _mm512_mul_ps(weight, b));
+		};
+
+		for (int ty = 0; ty < 5; ty++)
+		{
+			int qy = y + (ty - 2) * pass.Step;
+			if (qy < 0 || qy >= planes.Height)
+				continue;
+			size_t row = (size_t)qy * planes.Width;
+
+			for (int tx = 0; tx < 5; tx++)
+			{
+				int qx = x + (tx - 2) * pass.Step;
+				if (qx + 15 < 0 || qx >= planes.Width)
+					continue;
+
+				if (qx >= 0 && qx + 15 < planes.Width)
+				{
+					size_t tap = row + qx;
+					addTap([&](int i) RT_TARGET_AVX512 { return _mm512_loadu_ps(v[i] + tap); }, (__mmask16)0xffff, ty, tx);
+				}
+				else
+				{
+					size_t lanes[16];
+					__mmask16 valid = 0;
+					for (int lane = 0; lane < 16; lane++)
+					{
+						if (qx + lane >= 0 && qx + lane < planes.Width)
+							valid |= (__mmask16)(1u << lane);
+						lanes[lane] = row + std::min(std::max(qx + lane, 0), planes.Width - 1);
+					}
+					auto gather = [&](int i) RT_TARGET_AVX512
+					{
+						alignas(64) float values[16];
+						for (int lane = 0; lane < 16; lane++)
+							values[lane] = v[i][lanes[lane]];
+						return _mm512_load_ps(values);
+					};
+					addTap(gather, valid, ty, tx);
+				}
+			}
+		}
+
+		__m512 r = _mm512_div_ps(red, weightSum), g = _mm512_div_ps(green, weightSum), b = _mm512_div_ps(blue, weightSum);
+		_mm512_storeu_ps(planes.Output[0] + center, r);
+		_mm512_storeu_ps(planes.Output[1] + center, g);
+		_mm512_storeu_ps(planes.Output[2] + center, b);
+		_mm512_storeu_ps(planes.Output[3] + center, Brightness(r, g, b));
+	}
+#endif
+}
+
+void Denoiser::Resize(uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+
+	// Whole 4 KiB pages plus one cache line
+	size_t pixelCount = (size_t)width * height;
+	m_PlaneStride = pixelCount > 0 ? (pixelCount + 1023) / 1024 * 1024 + 16 : 0;
+	m_Planes.assign(m_PlaneStride * PlaneCount, 0.0f);
+	m_Planes.shrink_to_fit();
+}
+
+void Denoiser::ClearFeatures()
+{
+	std::fill(GetPlane(Albedo), GetPlane(Color), 0.0f);
+}
+
+void Denoiser::AddFeatures(uint32_t pixelIndex, const PixelFeatures& features, uint32_t sampleCount)
+{
+	float weight = 1.0f / (float)sampleCount;
+	auto blend = [&](uint32_t plane, float value)
+	{
+		float& mean = GetPlane(plane)[pixelIndex];
+		mean += (value - mean) * weight;
+	};
+
+	for (uint32_t c = 0; c < 3; c++)
+	{
+		blend(Albedo + c, features.Albedo[c]);
+		blend(Normal + c, features.Normal[c]);
+	}
+	blend(Depth, features.Depth);
+}
+
+size_t Denoiser::GetMemoryUsage() const
+{
+	return m_Planes.size() * sizeof(float);
+}
+
+void Denoiser::Run(ThreadPool& threadPool, const Settings& settings, uint32_t* image)
+{
+	uint32_t taskCount = (m_Height + Utils::RowsPerTask - 1) / Utils::RowsPerTask;
+	auto forEachRows = [&](auto&& function)
+	{
+		threadPool.ParallelFor(taskCount,
+			[&](uint32_t task, uint32_t)
+			{
+				uint32_t firstRow = task * Utils::RowsPerTask;
+				function(firstRow, std::min(Utils::RowsPerTask, m_Height - firstRow));
+			});
+	};
+
+	forEachRows([&](uint32_t firstRow, uint32_t rowCount) { Demodulate(firstRow, rowCount); });
+
+	// Every iteration reads the whole previous one, so they cannot overlap
+	for (uint32_t iteration = 0; iteration < settings.Iterations; iteration++)
+		forEachRows([&](uint32_t firstRow, uint32_t rowCount) { FilterRows(settings, iteration, firstRow, rowCount); });
+	m_Result = GetColorPlanes(settings.Iterations, 0);
+
+	forEachRows([&](uint32_t firstRow, uint32_t rowCount) { WriteRows(firstRow, rowCount, image); });
+}
+
+void Denoiser::Demodulate(uint32_t firstRow, uint32_t rowCount)
+{
+	size_t begin = (size_t)firstRow * m_Width, end = (size_t)(firstRow + rowCount) * m_Width;
+	for (uint32_t c = 0; c < 3; c++)
+	{
+		const float* albedo = GetPlane(Albedo + c);
+		float* color = GetPlane(Color + c);
+		for (size_t i = begin; i < end; i++)
+		{
+			if (albedo[i] >= Utils::MinAlbedo)
+				color[i] /= albedo[i];
+		}
+	}
+
+	// What every iteration would otherwise work out again for each tap or centre pixel
+	const float* red = GetPlane(Color), * green = GetPlane(Color + 1), * blue = GetPlane(Color + 2);
+	const float* depth = GetPlane(Depth);
+	float* brightness = GetPlane(Color + 3);
+	float* inverseDepth = GetPlane(InverseDepth);
+	for (size_t i = begin; i < end; i++)
+	{
+		brightness[i] = Utils::Brightness(red[i], green[i], blue[i]);
+		inverseDepth[i] = 1.0f / std::max(depth[i], Utils::MinDepth);
+	}
+}
+
+void Denoiser::FilterRows(const Settings& settings, uint32_t iteration, uint32_t firstRow, uint32_t rowCount)
+{
+	uint32_t input = GetColorPlanes(iteration, 0);
+	uint32_t output = GetColorPlanes(iteration, 1);
+
+	Utils::FilterPass pass = Utils::GetFilterPass(settings, iteration);
+	Utils::FilterPlanes planes = {
+		{ GetPlane(input), GetPlane(input + 1), GetPlane(input + 2), GetPlane(input + 3), GetPlane(Normal), GetPlane(Normal + 1),
+		  GetPlane(Normal + 2), GetPlane(Depth), GetPlane(Albedo), GetPlane(Albedo + 1), GetPlane(Albedo + 2) },
+		GetPlane(InverseDepth),
+		{ GetPlane(output), GetPlane(output + 1), GetPlane(output + 2), GetPlane(output + 3) },
+		(int)m_Width, (int)m_Height
+	};
+
+#ifdef RT_DENOISE_SSE
+	Kernels::ISA isa = Kernels::GetActiveISA();
+#endif
+	for (int y = (int)firstRow; y < (int)(firstRow + rowCount); y++)
+	{
+		int x = 0;
+#ifdef RT_DENOISE_SSE
+		// The widest filter the intersection kernels use, then narrower ones for the rest of the
+		// row; SSE is part of the baseline
+		if (isa == Kernels::ISA::AVX512)
+		{
+			for (; x + 16 <= planes.Width; x += 16)
+				Utils::FilterChunkAVX512(planes, pass, x, y);
+		}
+		if (isa >= Kernels::ISA::AVX2)
+		{
+			for (; x + 8 <= planes.Width; x += 8)
+				Utils::FilterChunkAVX2(planes, pass, x, y);
+		}
+		for (; x + 4 <= planes.Width; x += 4)
+			Utils::FilterChunkSSE(planes, pass, x, y);
+#endif
+		for (; x < planes.Width; x++)
+			Utils::FilterPixel(planes, pass, x, y);
+	}
+}
+
+void Denoiser::WriteRows(uint32_t firstRow, uint32_t rowCount, uint32_t* image) const
+{
+	for (size_t i = (size_t)firstRow * m_Width; i < (size_t)(firstRow + rowCount) * m_Width; i++)
+	{
+		float color[3];
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			float albedo = GetPlane(Albedo + c)[i];
+			float value = GetPlane(m_Result + c)[i] * (albedo >= Utils::MinAlbedo ? albedo : 1.0f);
+			color[c] = std::min(std::max(value, 0.0f), 1.0f);
+		}
+		image[i] = AccumulationBuffer::ConvertToRGBA(color[0], color[1], color[2]);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// What a camera ray hit first, which tells the denoiser edges from noise and lets
+// Reprojection find the same surface from another camera
+struct PixelFeatures
+{
+	glm::vec3 Albedo{ 0.0f };
+	glm::vec3 Normal{ 0.0f }; // Facing the camera, zero on a miss
+	float Depth = 0.0f;       // Distance along the camera ray, 0 on a miss
+	glm::vec3 Position{ 0.0f };
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding A-Trous Wavelet
+// Transform for fast Global Illumination Filtering") for previews at a few samples per pixel.
+// The mean colour is divided by the mean albedo so only lighting is blurred, then filtered
+// by a 5x5 B3 spline kernel whose taps are 1, 2, 4, ... pixels apart in successive
+// iterations. A tap's weight falls off with how much it differs from the centre pixel in
+// relative lighting (tighter every iteration), normal, relative depth and albedo, so edges in
+// any of them stay sharp. Rows are split over the thread pool and filtered 4, 8 or 16 pixels at
+// a time with the instruction set the intersection kernels use.
+class Denoiser
+{
+public:
+	struct Settings
+	{
+		uint32_t Iterations = 4; // Filter radius 2 * (2^Iterations - 1) pixels
+		float ColorSigma = 4.0f;  // Relative to the brighter pixel's lighting, divided by 2^iteration
+		float NormalSigma = 0.2f;
+		float DepthSigma = 0.02f; // Relative to the centre pixel's depth, per pixel of tap distance
+		float AlbedoSigma = 0.1f;
+	};
+
+public:
+	void Resize(uint32_t width, uint32_t height);
+
+	// Features are running means like the colour; clear them whenever accumulation restarts
+	void ClearFeatures();
+	// sampleCount is the number of samples including this one
+	void AddFeatures(uint32_t pixelIndex, const PixelFeatures& features, uint32_t sampleCount);
+
+	// Planes of mean linear colour (0 red, 1 green, 2 blue), width * height pixels row by row,
+	// for the caller to fill before Run()
+	float* GetColorPlane(uint32_t channel) { return GetPlane(Color + channel); }
+
+	// Filters the colour planes and writes the result as clamped RGBA8
+	void Run(ThreadPool& threadPool, const Settings& settings, uint32_t* image);
+
+	size_t GetMemoryUsage() const;
+private:
+	// Planes of m_Planes. The colour is there twice as the iterations read one copy and write
+	// the other, each copy RGB and then its brightness.
+	enum Plane : uint32_t { Albedo = 0, Normal = 3, Depth = 6, InverseDepth = 7, Color = 8, PlaneCount = 16 };
+
+	float* GetPlane(uint32_t plane) { return m_Planes.data() + plane * m_PlaneStride; }
+	const float* GetPlane(uint32_t plane) const { return m_Planes.data() + plane * m_PlaneStride; }
+	// The colour planes iteration reads (0) or writes (1)
+	uint32_t GetColorPlanes(uint32_t iteration, uint32_t written) const { return Color + 4 * ((iteration + written) % 2); }
+
+	void Demodulate(uint32_t firstRow, uint32_t rowCount);
+	void FilterRows(const Settings& settings, uint32_t iteration, uint32_t firstRow, uint32_t rowCount);
+	void WriteRows(uint32_t firstRow, uint32_t rowCount, uint32_t* image) const;
+private:
+	uint32_t m_Width = 0, m_Height = 0;
+
+	// One allocation, with the planes a cache line out of step: a tap reads the same pixel of
+	// eleven of them, which as separate page-aligned buffers all land in the same cache sets
+	std::vector<float> m_Planes;
+	size_t m_PlaneStride = 0;
+	uint32_t m_Result = Color; // First colour plane of the last iteration's lighting
+};
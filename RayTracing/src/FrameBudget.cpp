@@ -0,0 +1,61 @@
+#include "FrameBudget.h"
+
+#include <glm/glm.hpp>
+
+namespace Utils
+{
+	// Weight of the latest frame in the cost estimate
+	static constexpr float CostSmoothing = 0.5f;
+	// Share of the budget the next step up has to fit in before the scale climbs
+	static constexpr float ClimbHeadroom = 0.7f;
+
+	// Largest scale step whose frames are expected to take at most milliseconds
+	static float GetFittingScale(float milliseconds, float fullFrameMilliseconds)
+	{
+		float scale = glm::sqrt(milliseconds / fullFrameMilliseconds);
+		return glm::floor(scale / FrameBudget::ScaleStep) * FrameBudget::ScaleStep;
+	}
+}
+
+void FrameBudget::AddFrameTime(float milliseconds)
+{
+	float fullFrameMilliseconds = milliseconds / (m_Scale * m_Scale);
+	if (m_FullFrameMilliseconds <= 0.0f)
+		m_FullFrameMilliseconds = fullFrameMilliseconds;
+	else
+		m_FullFrameMilliseconds += Utils::CostSmoothing * (fullFrameMilliseconds - m_FullFrameMilliseconds);
+}
+
+void FrameBudget::Update(bool viewChanging)
+{
+	if (m_Settings.Milliseconds <= 0.0f)
+	{
+		m_Scale = 1.0f;
+		return;
+	}
+
+	float minScale = glm::clamp(m_Settings.MinScale, ScaleStep, 1.0f);
+	if (!viewChanging)
+	{
+		if (++m_StillFrames > m_Settings.IdleFrames)
+			m_Scale = glm::min(m_Scale + ScaleStep, 1.0f);
+		return;
+	}
+
+	m_StillFrames = 0;
+	m_Scale = glm::max(m_Scale, minScale);
+	if (m_FullFrameMilliseconds <= 0.0f)
+		return;
+
+	float fitting = Utils::GetFittingScale(m_Settings.Milliseconds, m_FullFrameMilliseconds);
+	if (fitting < m_Scale)
+		m_Scale = glm::max(fitting, minScale);
+	else if (Utils::GetFittingScale(Utils::ClimbHeadroom * m_Settings.Milliseconds, m_FullFrameMilliseconds) > m_Scale)
+		m_Scale = glm::min(m_Scale + ScaleStep, 1.0f);
+}
+
+void FrameBudget::GetRenderSize(uint32_t viewportWidth, uint32_t viewportHeight, uint32_t& width, uint32_t& height) const
+{
+	width = glm::min(glm::max((uint32_t)(viewportWidth * m_Scale + 0.5f), 1u), viewportWidth);
+	height = glm::min(glm::max((uint32_t)(viewportHeight * m_Scale + 0.5f), 1u), viewportHeight);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// Keeps interactive frames within a time budget by rendering at a fraction of the viewport's
+// resolution while the view changes, for the caller to upscale when it displays the image.
+// A frame's cost is taken to grow with its pixel count, so every measured frame updates a
+// smoothed estimate of what a full-resolution frame costs. While the view changes the scale
+// drops straight to the largest step that fits, and climbs one step at a time only when the
+// next one fits with room to spare, so it does not flip between two sizes. Once the view has
+// been still for a few frames it steps back up to full resolution one step per frame, where
+// accumulation carries on. Every change of scale resizes the renderer, which restarts accumulation
+// unless it reprojects, when the samples so far carry over to the new resolution.
+class FrameBudget
+{
+public:
+	struct Settings
+	{
+		float Milliseconds = 0.0f; // Per frame while the view changes, 0 always renders at full resolution
+		float MinScale = 0.25f;    // Of the viewport's width and height
+		uint32_t IdleFrames = 2;   // Still frames before stepping back up
+	};
+
+	// Scales are multiples of this, so small changes in frame time do not resize the renderer
+	static constexpr float ScaleStep = 0.125f;
+public:
+	// How long the last frame took, rendered at GetScale()
+	void AddFrameTime(float milliseconds);
+
+	// Picks the scale of the next frame
+	void Update(bool viewChanging);
+
+	float GetScale() const { return m_Scale; }
+	// The viewport's size at the current scale, at least one pixel unless the viewport is empty
+	void GetRenderSize(uint32_t viewportWidth, uint32_t viewportHeight, uint32_t& width, uint32_t& height) const;
+
+	Settings& GetSettings() { return m_Settings; }
+	const Settings& GetSettings() const { return m_Settings; }
+private:
+	Settings m_Settings;
+
+	float m_Scale = 1.0f;
+	float m_FullFrameMilliseconds = 0.0f; // Estimated cost of a frame at full resolution, 0 until measured
+	uint32_t m_StillFrames = 0;
+};
@@ -0,0 +1,434 @@
+#include "IntersectionKernels.h"
+
+#include <immintrin.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#else
+	#include <cpuid.h>
+	// AVX-512F implies FMA, and GCC would fuse the separate multiplies and adds, making the wide
+	// kernels round differently from the scalar one. Contraction stays off for the whole file.
+	#pragma GCC optimize("fp-contract=off")
+#endif
+
+void PrimitiveSoA::Resize(uint32_t count)
+{
+	Count = count;
+
+	uint32_t lanes = count + Kernels::KernelPadding;
+	for (std::vector<float>* array : { &CenterX, &CenterY, &CenterZ, &Radius, &MinX, &MinY, &MinZ, &MaxX, &MaxY, &MaxZ })
+		array->resize(lanes);
+
+	for (uint32_t lane = 0; lane < lanes; lane++)
+		SetEmpty(lane);
+}
+
+void PrimitiveSoA::SetSphere(uint32_t lane, const glm::vec3& center, float radius)
+{
+	SetEmpty(lane);
+
+	CenterX[lane] = center.x;
+	CenterY[lane] = center.y;
+	CenterZ[lane] = center.z;
+	Radius[lane] = glm::abs(radius);
+}
+
+void PrimitiveSoA::SetBox(uint32_t lane, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	SetEmpty(lane);
+
+	MinX[lane] = boundsMin.x;
+	MinY[lane] = boundsMin.y;
+	MinZ[lane] = boundsMin.z;
+	MaxX[lane] = boundsMax.x;
+	MaxY[lane] = boundsMax.y;
+	MaxZ[lane] = boundsMax.z;
+}
+
+void PrimitiveSoA::SetEmpty(uint32_t lane)
+{
+	CenterX[lane] = CenterY[lane] = CenterZ[lane] = 0.0f;
+	Radius[lane] = -1.0f;
+
+	// Inverted bounds mark the lane as "not a box"
+	MinX[lane] = MinY[lane] = MinZ[lane] = 1.0f;
+	MaxX[lane] = MaxY[lane] = MaxZ[lane] = -1.0f;
+}
+
+namespace Kernels
+{
+	static constexpr float s_Miss = std::numeric_limits<float>::infinity();
+
+	// Same operand order as _mm_min_ps/_mm_max_ps, so NaNs resolve identically in every kernel
+	static float Min(float a, float b) { return a < b ? a : b; }
+	static float Max(float a, float b) { return a > b ? a : b; }
+
+	static int IntersectLeafScalar(const PrimitiveSoA& soa, uint32_t first, uint32_t count, const Ray& ray, float tMax, float& hitDistance)
+	{
+		const float a = glm::dot(ray.Direction, ray.Direction);
+		const glm::vec3 invDirection = 1.0f / ray.Direction;
+
+		int closestLane = -1;
+		float closestT = s_Miss;
+		for (uint32_t lane = first; lane < first + count; lane++)
+		{
+			float t = s_Miss;
+
+			float ox = ray.Origin.x - soa.CenterX[lane];
+			float oy = ray.Origin.y - soa.CenterY[lane];
+			float oz = ray.Origin.z - soa.CenterZ[lane];
+			float radius = soa.Radius[lane];
+
+			float b = 2.0f * (ox * ray.Direction.x + oy * ray.Direction.y + oz * ray.Direction.z);
+			float c = (ox * ox + oy * oy + oz * oz) - radius * radius;
+			float discriminant = b * b - (4.0f * a) * c;
+			if (radius >= 0.0f && discriminant >= 0.0f)
+			{
+				float sphereT = (-b - std::sqrt(discriminant)) / (2.0f * a);
+				if (sphereT > 0.0f && sphereT < tMax)
+					t = sphereT;
+			}
+
+			float t0x = (soa.MinX[lane] - ray.Origin.x) * invDirection.x, t1x = (soa.MaxX[lane] - ray.Origin.x) * invDirection.x;
+			float t0y = (soa.MinY[lane] - ray.Origin.y) * invDirection.y, t1y = (soa.MaxY[lane] - ray.Origin.y) * invDirection.y;
+			float t0z = (soa.MinZ[lane] - ray.Origin.z) * invDirection.z, t1z = (soa.MaxZ[lane] - ray.Origin.z) * invDirection.z;
+			float tNear = Max(Max(Min(t0x, t1x), Min(t0y, t1y)), Min(t0z, t1z));
+			float tFar = Min(Min(Max(t0x, t1x), Max(t0y, t1y)), Max(t0z, t1z));
+			if (soa.MinX[lane] <= soa.MaxX[lane] && tNear <= tFar && tFar >= 0.0f)
+			{
+				float boxT = tNear >= 0.0f ? tNear : tFar;
+				if (boxT <= tMax)
+					t = boxT;
+			}
+
+			if (t < closestT)
+			{
+				closestT = t;
+				closestLane = (int)lane;
+			}
+		}
+
+		hitDistance = closestT;
+		return closestLane;
+	}
+
+	static int IntersectLeafSSE(const PrimitiveSoA& soa, uint32_t first, uint32_t count, const Ray& ray, float tMax, float& hitDistance)
+	{
+		const float aScalar = glm::dot(ray.Direction, ray.Direction);
+		const glm::vec3 invDirection = 1.0f / ray.Direction;
+
+		const __m128 originX = _mm_set1_ps(ray.Origin.x), originY = _mm_set1_ps(ray.Origin.y), originZ = _mm_set1_ps(ray.Origin.z);
+		const __m128 directionX = _mm_set1_ps(ray.Direction.x), directionY = _mm_set1_ps(ray.Direction.y), directionZ = _mm_set1_ps(ray.Direction.z);
+		const __m128 invX = _mm_set1_ps(invDirection.x), invY = _mm_set1_ps(invDirection.y), invZ = _mm_set1_ps(invDirection.z);
+		const __m128 fourA = _mm_set1_ps(4.0f * aScalar), twoA = _mm_set1_ps(2.0f * aScalar);
+		const __m128 two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps(), miss = _mm_set1_ps(s_Miss);
+		const __m128 maxT = _mm_set1_ps(tMax);
+		const __m128 laneIndex = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+		int closestLane = -1;
+		float closestT = s_Miss;
+		for (uint32_t base = first; base < first + count; base += 4)
+		{
+			__m128 active = _mm_cmplt_ps(laneIndex, _mm_set1_ps((float)(first + count - base)));
+
+			// Spheres
+			__m128 ox = _mm_sub_ps(originX, _mm_loadu_ps(&soa.CenterX[base]));
+			__m128 oy = _mm_sub_ps(originY, _mm_loadu_ps(&soa.CenterY[base]));
+			__m128 oz = _mm_sub_ps(originZ, _mm_loadu_ps(&soa.CenterZ[base]));
+			__m128 radius = _mm_loadu_ps(&soa.Radius[base]);
+
+			__m128 b = _mm_mul_ps(two, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, directionX), _mm_mul_ps(oy, directionY)), _mm_mul_ps(oz, directionZ)));
+			__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)), _mm_mul_ps(radius, radius));
+			__m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(fourA, c));
+			__m128 sphereT = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(discriminant)), twoA);
+
+			__m128 sphereHit = _mm_and_ps(_mm_cmpge_ps(radius, zero), _mm_cmpge_ps(discriminant, zero));
+			sphereHit = _mm_and_ps(sphereHit, _mm_and_ps(_mm_cmpgt_ps(sphereT, zero), _mm_cmplt_ps(sphereT, maxT)));
+
+			// Boxes
+			__m128 minX = _mm_loadu_ps(&soa.MinX[base]);
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(minX, originX), invX), t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&soa.MaxX[base]), originX), invX);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&soa.MinY[base]), originY), invY), t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&soa.MaxY[base]), originY), invY);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&soa.MinZ[base]), originZ), invZ), t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&soa.MaxZ[base]), originZ), invZ);
+			__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+			__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+			__m128 nearInFront = _mm_cmpge_ps(tNear, zero);
+			__m128 boxT = _mm_or_ps(_mm_and_ps(nearInFront, tNear), _mm_andnot_ps(nearInFront, tFar));
+			__m128 boxHit = _mm_and_ps(_mm_cmple_ps(minX, _mm_loadu_ps(&soa.MaxX[base])), _mm_cmple_ps(tNear, tFar));
+			boxHit = _mm_and_ps(boxHit, _mm_and_ps(_mm_cmpge_ps(tFar, zero), _mm_cmple_ps(boxT, maxT)));
+
+			__m128 t = _mm_or_ps(_mm_and_ps(boxHit, boxT), _mm_andnot_ps(boxHit, miss));
+			t = _mm_or_ps(_mm_and_ps(sphereHit, sphereT), _mm_andnot_ps(sphereHit, t));
+			t = _mm_or_ps(_mm_and_ps(active, t), _mm_andnot_ps(active, miss));
+
+			// Horizontal minimum, then the first lane holding it
+			__m128 minimum = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+			minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+			float minimumT = _mm_cvtss_f32(minimum);
+			if (minimumT < closestT)
+			{
+				int mask = _mm_movemask_ps(_mm_cmpeq_ps(t, minimum));
+				int lane = 0;
+				while (!(mask & (1 << lane)))
+					lane++;
+
+				closestT = minimumT;
+				closestLane = (int)base + lane;
+			}
+		}
+
+		hitDistance = closestT;
+		return closestLane;
+	}
+
+	RT_TARGET_AVX2
+	static int IntersectLeafAVX2(const PrimitiveSoA& soa, uint32_t first, uint32_t count, const Ray& ray, float tMax, float& hitDistance)
+	{
+		const float aScalar = glm::dot(ray.Direction, ray.Direction);
+		const glm::vec3 invDirection = 1.0f / ray.Direction;
+
+		const __m256 originX = _mm256_set1_ps(ray.Origin.x), originY = _mm256_set1_ps(ray.Origin.y), originZ = _mm256_set1_ps(ray.Origin.z);
+		const __m256 directionX = _mm256_set1_ps(ray.Direction.x), directionY = _mm256_set1_ps(ray.Direction.y), directionZ = _mm256_set1_ps(ray.Direction.z);
+		const __m256 invX = _mm256_set1_ps(invDirection.x), invY = _mm256_set1_ps(invDirection.y), invZ = _mm256_set1_ps(invDirection.z);
+		const __m256 fourA = _mm256_set1_ps(4.0f * aScalar), twoA = _mm256_set1_ps(2.0f * aScalar);
+		const __m256 two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps(), miss = _mm256_set1_ps(s_Miss);
+		const __m256 maxT = _mm256_set1_ps(tMax);
+		const __m256 laneIndex = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+
+		int closestLane = -1;
+		float closestT = s_Miss;
+		for (uint32_t base = first; base < first + count; base += 8)
+		{
+			__m256 active = _mm256_cmp_ps(laneIndex, _mm256_set1_ps((float)(first + count - base)), _CMP_LT_OQ);
+
+			__m256 ox = _mm256_sub_ps(originX, _mm256_loadu_ps(&soa.CenterX[base]));
+			__m256 oy = _mm256_sub_ps(originY, _mm256_loadu_ps(&soa.CenterY[base]));
+			__m256 oz = _mm256_sub_ps(originZ, _mm256_loadu_ps(&soa.CenterZ[base]));
+			__m256 radius = _mm256_loadu_ps(&soa.Radius[base]);
+
+			__m256 b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, directionX), _mm256_mul_ps(oy, directionY)), _mm256_mul_ps(oz, directionZ)));
+			__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy)), _mm256_mul_ps(oz, oz)), _mm256_mul_ps(radius, radius));
+			__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(fourA, c));
+			__m256 sphereT = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), _mm256_sqrt_ps(discriminant)), twoA);
+
+			__m256 sphereHit = _mm256_and_ps(_mm256_cmp_ps(radius, zero, _CMP_GE_OQ), _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ));
+			sphereHit = _mm256_and_ps(sphereHit, _mm256_and_ps(_mm256_cmp_ps(sphereT, zero, _CMP_GT_OQ), _mm256_cmp_ps(sphereT, maxT, _CMP_LT_OQ)));
+
+			__m256 minX = _mm256_loadu_ps(&soa.MinX[base]), maxX = _mm256_loadu_ps(&soa.MaxX[base]);
+			__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(minX, originX), invX), t1x = _mm256_mul_ps(_mm256_sub_ps(maxX, originX), invX);
+			__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&soa.MinY[base]), originY), invY), t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&soa.MaxY[base]), originY), invY);
+			__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&soa.MinZ[base]), originZ), invZ), t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&soa.MaxZ[base]), originZ), invZ);
+			__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+			__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+			__m256 boxT = _mm256_blendv_ps(tFar, tNear, _mm256_cmp_ps(tNear, zero, _CMP_GE_OQ));
+			__m256 boxHit = _mm256_and_ps(_mm256_cmp_ps(minX, maxX, _CMP_LE_OQ), _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+			boxHit = _mm256_and_ps(boxHit, _mm256_and_ps(_mm256_cmp_ps(tFar, zero, _CMP_GE_OQ), _mm256_cmp_ps(boxT, maxT, _CMP_LE_OQ)));
+
+			__m256 t = _mm256_blendv_ps(miss, boxT, boxHit);
+			t = _mm256_blendv_ps(t, sphereT, sphereHit);
+			t = _mm256_blendv_ps(miss, t, active);
+
+			__m256 minimum = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+			minimum = _mm256_min_ps(minimum, _mm256_permute_ps(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+			minimum = _mm256_min_ps(minimum, _mm256_permute2f128_ps(minimum, minimum, 0x01));
+			float minimumT = _mm256_cvtss_f32(minimum);
+			if (minimumT < closestT)
+			{
+				int mask = _mm256_movemask_ps(_mm256_cmp_ps(t, minimum, _CMP_EQ_OQ));
+				int lane = 0;
+				while (!(mask & (1 << lane)))
+					lane++;
+
+				closestT = minimumT;
+				closestLane = (int)base + lane;
+			}
+		}
+
+		hitDistance = closestT;
+		return closestLane;
+	}
+
+	RT_TARGET_AVX512
+	static int IntersectLeafAVX512(const PrimitiveSoA& soa, uint32_t first, uint32_t count, const Ray& ray, float tMax, float& hitDistance)
+	{
+		const float aScalar = glm::dot(ray.Direction, ray.Direction);
+		const glm::vec3 invDirection = 1.0f / ray.Direction;
+
+		const __m512 originX = _mm512_set1_ps(ray.Origin.x), originY = _mm512_set1_ps(ray.Origin.y), originZ = _mm512_set1_ps(ray.Origin.z);
+		const __m512 directionX = _mm512_set1_ps(ray.Direction.x), directionY = _mm512_set1_ps(ray.Direction.y), directionZ = _mm512_set1_ps(ray.Direction.z);
+		const __m512 invX = _mm512_set1_ps(invDirection.x), invY = _mm512_set1_ps(invDirection.y), invZ = _mm512_set1_ps(invDirection.z);
+		const __m512 fourA = _mm512_set1_ps(4.0f * aScalar), twoA = _mm512_set1_ps(2.0f * aScalar);
+		const __m512 two = _mm512_set1_ps(2.0f), zero = _mm512_setzero_ps(), miss = _mm512_set1_ps(s_Miss);
+		const __m512 maxT = _mm512_set1_ps(tMax);
+
+		int closestLane = -1;
+		float closestT = s_Miss;
+		for (uint32_t base = first; base < first + count; base += 16)
+		{
+			uint32_t remaining = first + count - base;
+			__mmask16 active = remaining >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << remaining) - 1);
+
+			__m512 ox = _mm512_sub_ps(originX, _mm512_loadu_ps(&soa.CenterX[base]));
+			__m512 oy = _mm512_sub_ps(originY, _mm512_loadu_ps(&soa.CenterY[base]));
+			__m512 oz = _mm512_sub_ps(originZ, _mm512_loadu_ps(&soa.CenterZ[base]));
+			__m512 radius = _mm512_loadu_ps(&soa.Radius[base]);
+
+			__m512 b = _mm512_mul_ps(two, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ox, directionX), _mm512_mul_ps(oy, directionY)), _mm512_mul_ps(oz, directionZ)));
+			__m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ox, ox), _mm512_mul_ps(oy, oy)), _mm512_mul_ps(oz, oz)), _mm512_mul_ps(radius, radius));
+			__m512 discriminant = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(fourA, c));
+			__m512 sphereT = _mm512_div_ps(_mm512_sub_ps(_mm512_sub_ps(zero, b), _mm512_sqrt_ps(discriminant)), twoA);
+
+			__mmask16 sphereHit = _mm512_cmp_ps_mask(radius, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ) &
+				_mm512_cmp_ps_mask(sphereT, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(sphereT, maxT, _CMP_LT_OQ);
+
+			__m512 minX = _mm512_loadu_ps(&soa.MinX[base]), maxX = _mm512_loadu_ps(&soa.MaxX[base]);
+			__m512 t0x = _mm512_mul_ps(_mm512_sub_ps(minX, originX), invX), t1x = _mm512_mul_ps(_mm512_sub_ps(maxX, originX), invX);
+			__m512 t0y = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&soa.MinY[base]), originY), invY), t1y = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&soa.MaxY[base]), originY), invY);
+			__m512 t0z = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&soa.MinZ[base]), originZ), invZ), t1z = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&soa.MaxZ[base]), originZ), invZ);
+			__m512 tNear = _mm512_max_ps(_mm512_max_ps(_mm512_min_ps(t0x, t1x), _mm512_min_ps(t0y, t1y)), _mm512_min_ps(t0z, t1z));
+			__m512 tFar = _mm512_min_ps(_mm512_min_ps(_mm512_max_ps(t0x, t1x), _mm512_max_ps(t0y, t1y)), _mm512_max_ps(t0z, t1z));
+
+			__m512 boxT = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_GE_OQ), tFar, tNear);
+			__mmask16 boxHit = _mm512_cmp_ps_mask(minX, maxX, _CMP_LE_OQ) & _mm512_cmp_ps_mask(tNear, tFar, _CMP_LE_OQ) &
+				_mm512_cmp_ps_mask(tFar, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(boxT, maxT, _CMP_LE_OQ);
+
+			__m512 t = _mm512_mask_blend_ps(boxHit, miss, boxT);
+			t = _mm512_mask_blend_ps(sphereHit, t, sphereT);
+			t = _mm512_mask_blend_ps(active, miss, t);
+
+			float minimumT = _mm512_reduce_min_ps(t);
+			if (minimumT < closestT)
+			{
+				uint32_t mask = _mm512_cmp_ps_mask(t, _mm512_set1_ps(minimumT), _CMP_EQ_OQ);
+				int lane = 0;
+				while (!(mask & (1u << lane)))
+					lane++;
+
+				closestT = minimumT;
+				closestLane = (int)base + lane;
+			}
+		}
+
+		hitDistance = closestT;
+		return closestLane;
+	}
+
+	static void CPUID(int leaf, int subleaf, int registers[4])
+	{
+#if defined(_MSC_VER)
+		__cpuidex(registers, leaf, subleaf);
+#else
+		unsigned int eax, ebx, ecx, edx;
+		__cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+		registers[0] = (int)eax;
+		registers[1] = (int)ebx;
+		registers[2] = (int)ecx;
+		registers[3] = (int)edx;
+#endif
+	}
+
+	// Which register states the OS saves on context switches
+	static uint64_t GetEnabledXState()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((uint64_t)edx << 32) | eax;
+#endif
+	}
+
+	static ISA DetectISA()
+	{
+		int registers[4];
+		CPUID(0, 0, registers);
+		int maxLeaf = registers[0];
+
+		CPUID(1, 0, registers);
+		bool osxsave = (registers[2] & (1 << 27)) != 0;
+		bool avx = (registers[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || maxLeaf < 7)
+			return ISA::SSE;
+
+		uint64_t xstate = GetEnabledXState();
+		bool ymmEnabled = (xstate & 0x6) == 0x6;
+		bool zmmEnabled = (xstate & 0xe6) == 0xe6;
+
+		CPUID(7, 0, registers);
+		bool avx2 = (registers[1] & (1 << 5)) != 0;
+		bool avx512f = (registers[1] & (1 << 16)) != 0;
+
+		if (avx512f && zmmEnabled)
+			return ISA::AVX512;
+		if (avx2 && ymmEnabled)
+			return ISA::AVX2;
+		return ISA::SSE;
+	}
+
+	ISA GetBestISA()
+	{
+		static const ISA s_BestISA = DetectISA();
+		return s_BestISA;
+	}
+
+	bool IsSupported(ISA isa)
+	{
+		return (int)isa <= (int)GetBestISA();
+	}
+
+	static std::atomic<int> s_ActiveISA{ -1 };
+
+	ISA GetActiveISA()
+	{
+		int isa = s_ActiveISA.load(std::memory_order_relaxed);
+		return isa < 0 ? GetBestISA() : (ISA)isa;
+	}
+
+	void SetActiveISA(ISA isa)
+	{
+		s_ActiveISA = IsSupported(isa) ? (int)isa : (int)GetBestISA();
+	}
+
+	LeafIntersectFn GetLeafIntersect(ISA isa)
+	{
+		switch (isa)
+		{
+			case ISA::Scalar: return IntersectLeafScalar;
+			case ISA::SSE:    return IntersectLeafSSE;
+			case ISA::AVX2:   return IntersectLeafAVX2;
+			case ISA::AVX512: return IntersectLeafAVX512;
+		}
+		return IntersectLeafScalar;
+	}
+
+	uint32_t GetLaneCount(ISA isa)
+	{
+		switch (isa)
+		{
+			case ISA::Scalar: return 4;
+			case ISA::SSE:    return 4;
+			case ISA::AVX2:   return 8;
+			case ISA::AVX512: return 16;
+		}
+		return 4;
+	}
+
+	const char* GetName(ISA isa)
+	{
+		switch (isa)
+		{
+			case ISA::Scalar: return "scalar";
+			case ISA::SSE:    return "sse";
+			case ISA::AVX2:   return "avx2";
+			case ISA::AVX512: return "avx512";
+		}
+		return "unknown";
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <cstdint>
+#include <vector>
+
+// Compiles a function for a wider instruction set than the build targets, to be called only
+// when Kernels::IsSupported() says the CPU has it
+#if defined(_MSC_VER)
+	#define RT_TARGET_AVX2
+	#define RT_TARGET_AVX512
+#else
+	#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+	#define RT_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// Structure-of-arrays copy of the scene's spheres and boxes, stored in BVH leaf order so a
+// leaf is a contiguous run of lanes. Every lane is either a sphere (Radius >= 0, box bounds
+// inverted) or a box (Radius < 0). The arrays carry KernelPadding extra empty lanes so a kernel
+// can always load a full vector.
+struct PrimitiveSoA
+{
+	std::vector<float> CenterX, CenterY, CenterZ, Radius;
+	std::vector<float> MinX, MinY, MinZ;
+	std::vector<float> MaxX, MaxY, MaxZ;
+
+	uint32_t Count = 0;
+
+	void Resize(uint32_t count);
+	void SetSphere(uint32_t lane, const glm::vec3& center, float radius);
+	void SetBox(uint32_t lane, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+	void SetEmpty(uint32_t lane);
+};
+
+namespace Kernels
+{
+	static constexpr uint32_t KernelPadding = 16;
+
+	enum class ISA
+	{
+		Scalar = 0, SSE, AVX2, AVX512
+	};
+
+	// Closest hit among lanes [first, first + count), processed GetLaneCount(isa) lanes at a time.
+	// Spheres hit in (0, tMax), boxes in [0, tMax]; a ray starting inside a box hits its exit.
+	// Returns the lane and writes hitDistance, or returns -1 on a miss.
+	using LeafIntersectFn = int(*)(const PrimitiveSoA& soa, uint32_t first, uint32_t count, const Ray& ray, float tMax, float& hitDistance);
+
+	// Widest instruction set this CPU and build support, detected once with CPUID
+	ISA GetBestISA();
+	bool IsSupported(ISA isa);
+
+	// The kernel the renderer uses; defaults to GetBestISA()
+	ISA GetActiveISA();
+	void SetActiveISA(ISA isa);
+
+	LeafIntersectFn GetLeafIntersect(ISA isa);
+	inline LeafIntersectFn GetLeafIntersect() { return GetLeafIntersect(GetActiveISA()); }
+
+	// Lanes per vector; also the BVH leaf size the scene builds for that kernel
+	uint32_t GetLaneCount(ISA isa);
+	const char* GetName(ISA isa);
+}
@@ -0,0 +1,415 @@
+#include "Light.h"
+#include "Sampler.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace Utils
+{
+	static constexpr float Pi = 3.14159265358979f;
+
+	static float Luminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// 1 - cos of the half angle a sphere covers seen from squared distance d2, without the
+	// cancellation of computing the cosine first for small, distant spheres
+	static float SphereConeSize(float r2, float d2)
+	{
+		float sin2Max = r2 / d2;
+		return sin2Max / (1.0f + glm::sqrt(glm::max(0.0f, 1.0f - sin2Max)));
+	}
+}
+
+float Light::GetPower() const
+{
+	float radiance = Utils::Luminance(Color) * Intensity;
+	switch (Type)
+	{
+		case LightType::Point:       return 4.0f * Utils::Pi * radiance;
+		case LightType::Directional: return 0.0f;
+		case LightType::Sphere:      return Utils::Pi * 4.0f * Utils::Pi * Radius * Radius * radiance;
+		case LightType::Rect:        return Utils::Pi * glm::length(glm::cross(EdgeU, EdgeV)) * radiance;
+	}
+	return 0.0f;
+}
+
+AABB Light::GetBounds() const
+{
+	AABB bounds;
+	switch (Type)
+	{
+		case LightType::Point:
+			bounds.Grow(Position);
+			break;
+		case LightType::Directional:
+			break;
+		case LightType::Sphere:
+			bounds.Grow(Position - Radius);
+			bounds.Grow(Position + Radius);
+			break;
+		case LightType::Rect:
+			bounds.Grow(Position);
+			bounds.Grow(Position + EdgeU);
+			bounds.Grow(Position + EdgeV);
+			bounds.Grow(Position + EdgeU + EdgeV);
+			break;
+	}
+	return bounds;
+}
+
+namespace Lights
+{
+	bool Sample(const Light& light, const glm::vec3& position, const glm::vec2& u, LightSample& sample)
+	{
+		switch (light.Type)
+		{
+			case LightType::Point:
+			{
+				glm::vec3 toLight = light.Position - position;
+				float distanceSquared = glm::dot(toLight, toLight);
+				if (distanceSquared == 0.0f)
+					return false;
+
+				sample.Distance = glm::sqrt(distanceSquared);
+				sample.Direction = toLight / sample.Distance;
+				sample.Radiance = light.GetEmission() / distanceSquared;
+				sample.Pdf = 1.0f;
+				return true;
+			}
+			case LightType::Directional:
+			{
+				sample.Direction = -glm::normalize(light.Direction);
+				sample.Distance = std::numeric_limits<float>::max();
+				sample.Radiance = light.GetEmission();
+				sample.Pdf = 1.0f;
+				return true;
+			}
+			case LightType::Sphere:
+			{
+				// Uniform over the cone of directions the sphere covers, which (unlike sampling its
+				// area) never picks a point on the far side
+				glm::vec3 toCenter = light.Position - position;
+				float distanceSquared = glm::dot(toCenter, toCenter);
+				float radiusSquared = light.Radius * light.Radius;
+				if (distanceSquared <= radiusSquared)
+					return false;
+
+				float distance = glm::sqrt(distanceSquared);
+				float coneSize = Utils::SphereConeSize(radiusSquared, distanceSquared);
+				float cosTheta = 1.0f - u.x * coneSize;
+				float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+				float phi = 2.0f * Utils::Pi * u.y;
+
+				glm::vec3 w = toCenter / distance, tangent, bitangent;
+				Sampling::BuildBasis(w, tangent, bitangent);
+				sample.Direction = glm::normalize(tangent * (sinTheta * glm::cos(phi)) + bitangent * (sinTheta * glm::sin(phi)) + w * cosTheta);
+
+				float discriminant = radiusSquared - distanceSquared * sinTheta * sinTheta;
+				sample.Distance = distance * cosTheta - glm::sqrt(glm::max(0.0f, discriminant));
+				sample.Radiance = light.GetEmission();
+				sample.Pdf = 1.0f / (2.0f * Utils::Pi * coneSize);
+				return true;
+			}
+			case LightType::Rect:
+			{
+				glm::vec3 normal = glm::cross(light.EdgeU, light.EdgeV);
+				float area = glm::length(normal);
+				if (area == 0.0f)
+					return false;
+
+				glm::vec3 toLight = light.Position + light.EdgeU * u.x + light.EdgeV * u.y - position;
+				float distanceSquared = glm::dot(toLight, toLight);
+				sample.Distance = glm::sqrt(distanceSquared);
+				sample.Direction = toLight / sample.Distance;
+
+				float cosLight = -glm::dot(sample.Direction, normal) / area;
+				if (cosLight <= 0.0f)
+					return false;
+
+				sample.Radiance = light.GetEmission();
+				sample.Pdf = distanceSquared / (cosLight * area);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	float GetPdf(const Light& light, const glm::vec3& position, const glm::vec3& direction, float distance)
+	{
+		switch (light.Type)
+		{
+			case LightType::Sphere:
+			{
+				glm::vec3 toCenter = light.Position - position;
+				float distanceSquared = glm::dot(toCenter, toCenter);
+				float radiusSquared = light.Radius * light.Radius;
+				if (distanceSquared <= radiusSquared)
+					return 0.0f;
+				return 1.0f / (2.0f * Utils::Pi * Utils::SphereConeSize(radiusSquared, distanceSquared));
+			}
+			case LightType::Rect:
+			{
+				glm::vec3 normal = glm::cross(light.EdgeU, light.EdgeV);
+				float area = glm::length(normal);
+				float cosLight = area > 0.0f ? -glm::dot(direction, normal) / area : 0.0f;
+				if (cosLight <= 0.0f)
+					return 0.0f;
+				return distance * distance / (cosLight * area);
+			}
+			default:
+				// Delta lights cannot be hit by a ray
+				return 0.0f;
+		}
+	}
+
+	float Intersect(const Light& light, const Ray& ray)
+	{
+		if (light.Type == LightType::Sphere)
+		{
+			glm::vec3 origin = ray.Origin - light.Position;
+			float a = glm::dot(ray.Direction, ray.Direction);
+			float b = glm::dot(origin, ray.Direction);
+			float c = glm::dot(origin, origin) - light.Radius * light.Radius;
+			float discriminant = b * b - a * c;
+			if (discriminant < 0.0f)
+				return -1.0f;
+			return (-b - glm::sqrt(discriminant)) / a;
+		}
+
+		if (light.Type == LightType::Rect)
+		{
+			// Only the emitting side; the edges are assumed to be at right angles
+			glm::vec3 normal = glm::cross(light.EdgeU, light.EdgeV);
+			float facing = glm::dot(ray.Direction, normal);
+			if (facing >= 0.0f)
+				return -1.0f;
+
+			float distance = glm::dot(light.Position - ray.Origin, normal) / facing;
+			glm::vec3 local = ray.Origin + ray.Direction * distance - light.Position;
+			float u = glm::dot(local, light.EdgeU) / glm::dot(light.EdgeU, light.EdgeU);
+			float v = glm::dot(local, light.EdgeV) / glm::dot(light.EdgeV, light.EdgeV);
+			if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f)
+				return -1.0f;
+			return distance;
+		}
+
+		return -1.0f;
+	}
+}
+
+void LightTree::Build(std::vector<Light> lights)
+{
+	Clear();
+	m_Lights = std::move(lights);
+	m_LightLeaves.assign(m_Lights.size(), std::numeric_limits<uint32_t>::max());
+
+	std::vector<AABB> bounds;
+	float directionalTotal = 0.0f;
+	for (uint32_t i = 0; i < (uint32_t)m_Lights.size(); i++)
+	{
+		const Light& light = m_Lights[i];
+		if (light.Type == LightType::Directional)
+		{
+			m_Directional.push_back(i);
+			directionalTotal += Utils::Luminance(light.Color) * light.Intensity;
+			m_DirectionalCdf.push_back(directionalTotal);
+		}
+		else
+		{
+			m_Positional.push_back(i);
+			bounds.push_back(light.GetBounds());
+		}
+	}
+
+	for (size_t i = 0; i < m_DirectionalCdf.size(); i++)
+		m_DirectionalCdf[i] = directionalTotal > 0.0f ? m_DirectionalCdf[i] / directionalTotal : (float)(i + 1) / m_DirectionalCdf.size();
+	if (!m_Directional.empty())
+		m_DirectionalProbability = m_Positional.empty() ? 1.0f : 0.5f;
+
+	if (m_Positional.empty())
+		return;
+
+	m_Hierarchy.Build(bounds, 1);
+
+	// Built on one thread, so children always come after their parent
+	const std::vector<BVHNode>& nodes = m_Hierarchy.GetNodes();
+	const std::vector<uint32_t>& primitiveIndices = m_Hierarchy.GetPrimitiveIndices();
+	m_NodePower.assign(nodes.size(), 0.0f);
+	m_NodeParents.assign(nodes.size(), 0);
+	for (uint32_t i = (uint32_t)nodes.size(); i-- > 0;)
+	{
+		const BVHNode& node = nodes[i];
+		if (node.IsLeaf())
+		{
+			for (uint32_t j = 0; j < node.Count; j++)
+			{
+				uint32_t lightIndex = m_Positional[primitiveIndices[node.LeftFirst + j]];
+				m_NodePower[i] += m_Lights[lightIndex].GetPower();
+				m_LightLeaves[lightIndex] = i;
+			}
+		}
+		else
+		{
+			m_NodePower[i] = m_NodePower[node.LeftFirst] + m_NodePower[node.LeftFirst + 1];
+			m_NodeParents[node.LeftFirst] = i;
+			m_NodeParents[node.LeftFirst + 1] = i;
+		}
+	}
+}
+
+void LightTree::Clear()
+{
+	m_Lights.clear();
+	m_Hierarchy.Clear();
+	m_Positional.clear();
+	m_NodePower.clear();
+	m_NodeParents.clear();
+	m_LightLeaves.clear();
+	m_Directional.clear();
+	m_DirectionalCdf.clear();
+	m_DirectionalProbability = 0.0f;
+}
+
+float LightTree::GetImportance(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float power, const glm::vec3& position, const glm::vec3& normal) const
+{
+	glm::vec3 toCenter = (boundsMin + boundsMax) * 0.5f - position;
+	glm::vec3 halfExtent = (boundsMax - boundsMin) * 0.5f;
+
+	// Nothing in the bounds can be in front of the surface
+	if (glm::dot(toCenter, normal) + glm::dot(halfExtent, glm::abs(normal)) <= 0.0f && normal != glm::vec3(0.0f))
+		return 0.0f;
+
+	// Inside or near the bounds the distance says little, so it is clamped to their size
+	float distanceSquared = glm::max(glm::dot(toCenter, toCenter), glm::max(glm::dot(halfExtent, halfExtent), 1e-6f));
+	return power / distanceSquared;
+}
+
+float LightTree::GetLeafImportance(uint32_t lightIndex, const glm::vec3& position, const glm::vec3& normal) const
+{
+	const Light& light = m_Lights[lightIndex];
+	AABB bounds = light.GetBounds();
+	return GetImportance(bounds.Min, bounds.Max, light.GetPower(), position, normal);
+}
+
+bool LightTree::Pick(const glm::vec3& position, const glm::vec3& normal, float u, uint32_t& lightIndex, float& probability) const
+{
+	constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+	probability = 1.0f;
+
+	if (!m_Directional.empty() && u < m_DirectionalProbability)
+	{
+		u /= m_DirectionalProbability;
+		size_t i = std::upper_bound(m_DirectionalCdf.begin(), m_DirectionalCdf.end(), u) - m_DirectionalCdf.begin();
+		i = std::min(i, m_DirectionalCdf.size() - 1);
+		lightIndex = m_Directional[i];
+		probability = m_DirectionalProbability * (m_DirectionalCdf[i] - (i > 0 ? m_DirectionalCdf[i - 1] : 0.0f));
+		return probability > 0.0f;
+	}
+	if (m_Hierarchy.IsEmpty())
+		return false;
+
+	if (m_DirectionalProbability > 0.0f)
+	{
+		probability = 1.0f - m_DirectionalProbability;
+		u = glm::min((u - m_DirectionalProbability) / probability, oneMinusEpsilon);
+	}
+
+	const std::vector<BVHNode>& nodes = m_Hierarchy.GetNodes();
+	uint32_t nodeIndex = 0;
+	while (!nodes[nodeIndex].IsLeaf())
+	{
+		uint32_t left = nodes[nodeIndex].LeftFirst;
+		float leftImportance = GetImportance(nodes[left].BoundsMin, nodes[left].BoundsMax, m_NodePower[left], position, normal);
+		float rightImportance = GetImportance(nodes[left + 1].BoundsMin, nodes[left + 1].BoundsMax, m_NodePower[left + 1], position, normal);
+		float total = leftImportance + rightImportance;
+		if (total <= 0.0f)
+			return false;
+
+		// The rest of u picks within the child, so one number serves the whole descent
+		float leftProbability = leftImportance / total;
+		if (u < leftProbability)
+		{
+			u /= leftProbability;
+			probability *= leftProbability;
+			nodeIndex = left;
+		}
+		else
+		{
+			u = (u - leftProbability) / (1.0f - leftProbability);
+			probability *= 1.0f - leftProbability;
+			nodeIndex = left + 1;
+		}
+		u = glm::min(u, oneMinusEpsilon);
+	}
+
+	// Lights that could not be split apart share a leaf
+	const BVHNode& leaf = nodes[nodeIndex];
+	const std::vector<uint32_t>& primitiveIndices = m_Hierarchy.GetPrimitiveIndices();
+	float total = 0.0f;
+	for (uint32_t j = 0; j < leaf.Count; j++)
+		total += GetLeafImportance(m_Positional[primitiveIndices[leaf.LeftFirst + j]], position, normal);
+	if (total <= 0.0f)
+		return false;
+
+	float target = u * total, sum = 0.0f;
+	for (uint32_t j = 0; j < leaf.Count; j++)
+	{
+		lightIndex = m_Positional[primitiveIndices[leaf.LeftFirst + j]];
+		float importance = GetLeafImportance(lightIndex, position, normal);
+		sum += importance;
+		if (target < sum && importance > 0.0f)
+		{
+			probability *= importance / total;
+			return true;
+		}
+	}
+	probability *= GetLeafImportance(lightIndex, position, normal) / total;
+	return probability > 0.0f;
+}
+
+float LightTree::GetProbability(const glm::vec3& position, const glm::vec3& normal, uint32_t lightIndex) const
+{
+	if (m_Lights[lightIndex].Type == LightType::Directional)
+	{
+		size_t i = std::find(m_Directional.begin(), m_Directional.end(), lightIndex) - m_Directional.begin();
+		return m_DirectionalProbability * (m_DirectionalCdf[i] - (i > 0 ? m_DirectionalCdf[i - 1] : 0.0f));
+	}
+
+	const std::vector<BVHNode>& nodes = m_Hierarchy.GetNodes();
+	const std::vector<uint32_t>& primitiveIndices = m_Hierarchy.GetPrimitiveIndices();
+	uint32_t nodeIndex = m_LightLeaves[lightIndex];
+	const BVHNode& leaf = nodes[nodeIndex];
+
+	float total = 0.0f;
+	for (uint32_t j = 0; j < leaf.Count; j++)
+		total += GetLeafImportance(m_Positional[primitiveIndices[leaf.LeftFirst + j]], position, normal);
+	if (total <= 0.0f)
+		return 0.0f;
+	float probability = (1.0f - m_DirectionalProbability) * GetLeafImportance(lightIndex, position, normal) / total;
+
+	// Up to the root, the share each ancestor gives the child on the light's side
+	while (nodeIndex != 0 && probability > 0.0f)
+	{
+		uint32_t parent = m_NodeParents[nodeIndex];
+		uint32_t left = nodes[parent].LeftFirst;
+		float leftImportance = GetImportance(nodes[left].BoundsMin, nodes[left].BoundsMax, m_NodePower[left], position, normal);
+		float rightImportance = GetImportance(nodes[left + 1].BoundsMin, nodes[left + 1].BoundsMax, m_NodePower[left + 1], position, normal);
+		float childTotal = leftImportance + rightImportance;
+		if (childTotal <= 0.0f)
+			return 0.0f;
+
+		probability *= (nodeIndex == left ? leftImportance : rightImportance) / childTotal;
+		nodeIndex = parent;
+	}
+	return probability;
+}
+
+size_t LightTree::GetMemoryUsage() const
+{
+	return m_Lights.capacity() * sizeof(Light) + m_Hierarchy.GetNodes().capacity() * sizeof(BVHNode) +
+		m_Hierarchy.GetPrimitiveIndices().capacity() * sizeof(uint32_t) + m_Positional.capacity() * sizeof(uint32_t) +
+		m_NodePower.capacity() * sizeof(float) + m_NodeParents.capacity() * sizeof(uint32_t) + m_LightLeaves.capacity() * sizeof(uint32_t) +
+		m_Directional.capacity() * sizeof(uint32_t) + m_DirectionalCdf.capacity() * sizeof(float);
+}
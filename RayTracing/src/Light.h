@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Ray.h"
+#include "BVH.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+enum class LightType : uint32_t
+{
+	Point = 0,   // Intensity in W/sr
+	Directional, // Irradiance, from infinitely far away
+	Sphere,      // Radiance, emitted outwards from the surface
+	Rect         // Radiance, emitted from the side EdgeU x EdgeV points to
+};
+
+// Flat so the compiled scene stores the array as it is
+struct Light
+{
+	LightType Type = LightType::Point;
+	glm::vec3 Color{ 1.0f };
+	float Intensity = 1.0f;
+
+	glm::vec3 Position{ 0.0f };     // Point, sphere centre or rectangle corner
+	float Radius = 0.0f;            // Sphere
+	glm::vec3 Direction{ 0.0f, -1.0f, 0.0f }; // Directional: the way the light travels
+	glm::vec3 EdgeU{ 1.0f, 0.0f, 0.0f }; // Rect: the two edges from the corner
+	glm::vec3 EdgeV{ 0.0f, 0.0f, 1.0f };
+
+	bool IsDelta() const { return Type == LightType::Point || Type == LightType::Directional; }
+	glm::vec3 GetEmission() const { return Color * Intensity; }
+	// Total emitted power (luminance), which the light tree picks lights by; 0 for directional lights
+	float GetPower() const;
+	AABB GetBounds() const;
+};
+
+// A direction towards a light from a shading point, for next-event estimation
+struct LightSample
+{
+	glm::vec3 Direction;
+	float Distance;     // To the point on the light, FLT_MAX for directional lights
+	glm::vec3 Radiance; // Arriving along Direction (scaled by 1 / distance^2 for point lights)
+	float Pdf;          // Solid angle density, 1 for delta lights
+};
+
+namespace Lights
+{
+	// Picks a direction towards the light. False if the point cannot be lit by it.
+	bool Sample(const Light& light, const glm::vec3& position, const glm::vec2& u, LightSample& sample);
+	// Solid angle density of Sample() picking a direction that reaches the light at distance
+	float GetPdf(const Light& light, const glm::vec3& position, const glm::vec3& direction, float distance);
+	// Distance along the ray to the emitting surface of a sphere or rect light, negative on a miss
+	float Intersect(const Light& light, const Ray& ray);
+}
+
+// Picks one light per shading point in O(log N) by walking a BVH over the lights from the root:
+// each step takes a child with a probability proportional to an estimate of how much it lights
+// the point (power over squared distance, zero if it is all behind the surface). Directional
+// lights have no position; they are picked by irradiance, with half the probability when there
+// are others. The same BVH finds the area lights a ray hits.
+class LightTree
+{
+public:
+	void Build(std::vector<Light> lights);
+	void Clear();
+
+	bool IsEmpty() const { return m_Lights.empty(); }
+	const std::vector<Light>& GetLights() const { return m_Lights; }
+
+	// Picks a light for a point with the given surface normal (zero for no orientation).
+	// Returns false if no light can contribute.
+	bool Pick(const glm::vec3& position, const glm::vec3& normal, float u, uint32_t& lightIndex, float& probability) const;
+	// Probability of Pick() choosing the light at that point
+	float GetProbability(const glm::vec3& position, const glm::vec3& normal, uint32_t lightIndex) const;
+
+	// Closest sphere or rect light hit before tMax, -1 if none; tMax becomes the distance
+	template<typename SkipFn>
+	int Intersect(const Ray& ray, float& tMax, SkipFn&& skip) const;
+
+	size_t GetMemoryUsage() const;
+private:
+	float GetImportance(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float power, const glm::vec3& position, const glm::vec3& normal) const;
+	float GetLeafImportance(uint32_t lightIndex, const glm::vec3& position, const glm::vec3& normal) const;
+private:
+	std::vector<Light> m_Lights;
+
+	BVH m_Hierarchy; // Over every light but the directional ones
+	std::vector<uint32_t> m_Positional; // Lights in the order the hierarchy indexes them
+	std::vector<float> m_NodePower;
+	std::vector<uint32_t> m_NodeParents;
+	std::vector<uint32_t> m_LightLeaves; // Leaf holding each light, UINT32_MAX for directional ones
+
+	std::vector<uint32_t> m_Directional;
+	std::vector<float> m_DirectionalCdf; // By irradiance, ending at 1
+	float m_DirectionalProbability = 0.0f;
+};
+
+template<typename SkipFn>
+int LightTree::Intersect(const Ray& ray, float& tMax, SkipFn&& skip) const
+{
+	int closest = -1;
+	m_Hierarchy.Traverse(ray, tMax,
+		[&](uint32_t primitive, float& leafTMax)
+		{
+			uint32_t lightIndex = m_Positional[primitive];
+			const Light& light = m_Lights[lightIndex];
+			if (light.IsDelta() || skip(lightIndex))
+				return;
+
+			float distance = Lights::Intersect(light, ray);
+			if (distance > 0.0f && distance < leafTMax)
+			{
+				leafTMax = distance;
+				closest = (int)lightIndex;
+			}
+		});
+	return closest;
+}
@@ -0,0 +1,236 @@
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <functional>
+#include <utility>
+
+namespace Utils
+{
+	// Hits this close to the origin are the surface the ray starts on
+	static constexpr float MinHitDistance = 1e-4f;
+	// Triangles per task when building in parallel
+	static constexpr uint32_t BlockSize = 1 << 16;
+
+	static float SignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	static uint32_t QuantizeUnorm16(float value)
+	{
+		return (uint32_t)(glm::clamp(value * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	static float DequantizeUnorm16(uint32_t value)
+	{
+		return (float)value * (2.0f / 65535.0f) - 1.0f;
+	}
+}
+
+void Mesh::BuildAcceleration(ThreadPool* threadPool)
+{
+	uint32_t triangleCount = GetTriangleCount();
+	uint32_t blockCount = (triangleCount + Utils::BlockSize - 1) / Utils::BlockSize;
+	auto forEachBlock = [&](const std::function<void(uint32_t, uint32_t)>& function)
+	{
+		auto run = [&](uint32_t block, uint32_t)
+		{
+			function(block * Utils::BlockSize, glm::min(triangleCount, (block + 1) * Utils::BlockSize));
+		};
+		if (threadPool)
+			threadPool->ParallelFor(blockCount, run);
+		else
+		{
+			for (uint32_t block = 0; block < blockCount; block++)
+				run(block, 0);
+		}
+	};
+
+	std::vector<AABB> bounds(triangleCount);
+	forEachBlock([&](uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++)
+			{
+				bounds[i].Grow(Positions[Indices[3 * i + 0]]);
+				bounds[i].Grow(Positions[Indices[3 * i + 1]]);
+				bounds[i].Grow(Positions[Indices[3 * i + 2]]);
+			}
+		});
+
+	Accelerator.Build(bounds, MaxLeafSize, TraversalCost, threadPool);
+	bounds = std::vector<AABB>();
+
+	// Store the triangles in leaf order, which makes leaves contiguous in memory and the
+	// BVH's primitive index list the identity, so it is dropped
+	const std::vector<uint32_t>& order = Accelerator.GetPrimitiveIndices();
+	std::vector<uint32_t> sorted(Indices.size());
+	forEachBlock([&](uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++)
+			{
+				sorted[3 * i + 0] = Indices[3 * order[i] + 0];
+				sorted[3 * i + 1] = Indices[3 * order[i] + 1];
+				sorted[3 * i + 2] = Indices[3 * order[i] + 2];
+			}
+		});
+	Indices = std::move(sorted);
+
+	std::vector<BVHNode> nodes = Accelerator.GetNodes();
+	Accelerator.Assign(std::move(nodes), {}, MaxLeafSize);
+}
+
+AABB Mesh::GetBounds() const
+{
+	AABB bounds;
+	if (!Accelerator.IsEmpty())
+	{
+		bounds.Min = Accelerator.GetNodes()[0].BoundsMin;
+		bounds.Max = Accelerator.GetNodes()[0].BoundsMax;
+		return bounds;
+	}
+
+	for (uint32_t index : Indices)
+		bounds.Grow(Positions[index]);
+	return bounds;
+}
+
+bool Mesh::Intersect(const Ray& ray, float& tMax, MeshHit& hit) const
+{
+	return Trace<false>(ray, tMax, hit);
+}
+
+bool Mesh::IsOccluded(const Ray& ray, float tMax) const
+{
+	MeshHit hit;
+	return Trace<true>(ray, tMax, hit);
+}
+
+template<bool AnyHit>
+bool Mesh::Trace(const Ray& ray, float& tMax, MeshHit& hit) const
+{
+	// Permute the axes so the ray's largest direction component is z, then shear the ray
+	// onto +z. Triangles are tested in that space with 2D edge functions, which agree on
+	// shared edges exactly.
+	const glm::vec3& direction = ray.Direction;
+	glm::vec3 absDirection = glm::abs(direction);
+	int kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+	int kx = kz == 2 ? 0 : kz + 1;
+	int ky = kx == 2 ? 0 : kx + 1;
+	if (direction[kz] < 0.0f)
+		std::swap(kx, ky);
+
+	float shearX = direction[kx] / direction[kz];
+	float shearY = direction[ky] / direction[kz];
+	float shearZ = 1.0f / direction[kz];
+
+	bool found = false;
+	Accelerator.TraverseLeaves(ray, tMax,
+		[&](uint32_t first, uint32_t count, float& leafTMax)
+		{
+			RT_PROFILE_COUNT(TriangleTests, count);
+			for (uint32_t triangle = first; triangle < first + count; triangle++)
+			{
+				const uint32_t* index = &Indices[3 * triangle];
+				glm::vec3 a = Positions[index[0]] - ray.Origin;
+				glm::vec3 b = Positions[index[1]] - ray.Origin;
+				glm::vec3 c = Positions[index[2]] - ray.Origin;
+
+				float ax = a[kx] - shearX * a[kz];
+				float ay = a[ky] - shearY * a[kz];
+				float bx = b[kx] - shearX * b[kz];
+				float by = b[ky] - shearY * b[kz];
+				float cx = c[kx] - shearX * c[kz];
+				float cy = c[ky] - shearY * c[kz];
+
+				float u = cx * by - cy * bx;
+				float v = ax * cy - ay * cx;
+				float w = bx * ay - by * ax;
+
+				// Exactly on an edge in single precision; double precision decides which side
+				if (u == 0.0f || v == 0.0f || w == 0.0f)
+				{
+					u = (float)((double)cx * (double)by - (double)cy * (double)bx);
+					v = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+					w = (float)((double)bx * (double)ay - (double)by * (double)ax);
+				}
+
+				if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+					continue;
+
+				float determinant = u + v + w;
+				if (determinant == 0.0f)
+					continue;
+
+				float scaledDistance = shearZ * (u * a[kz] + v * b[kz] + w * c[kz]);
+				float distance = scaledDistance / determinant;
+				if (distance <= Utils::MinHitDistance || distance >= leafTMax)
+					continue;
+
+				found = true;
+				if constexpr (AnyHit)
+				{
+					leafTMax = -1.0f;
+					return;
+				}
+
+				leafTMax = distance;
+				hit.Triangle = triangle;
+				hit.Barycentrics = glm::vec2(v / determinant, w / determinant);
+			}
+		});
+
+	return found;
+}
+
+glm::vec3 Mesh::GetNormal(const MeshHit& hit) const
+{
+	const uint32_t* index = &Indices[3 * hit.Triangle];
+	if (Normals.empty())
+	{
+		const glm::vec3& p0 = Positions[index[0]];
+		return glm::normalize(glm::cross(Positions[index[1]] - p0, Positions[index[2]] - p0));
+	}
+
+	float w0 = 1.0f - hit.Barycentrics.x - hit.Barycentrics.y;
+	glm::vec3 normal = DecodeNormal(Normals[index[0]]) * w0 +
+		DecodeNormal(Normals[index[1]]) * hit.Barycentrics.x +
+		DecodeNormal(Normals[index[2]]) * hit.Barycentrics.y;
+	return glm::normalize(normal);
+}
+
+size_t Mesh::GetMemoryUsage() const
+{
+	return Positions.capacity() * sizeof(glm::vec3) +
+		Normals.capacity() * sizeof(uint32_t) +
+		Indices.capacity() * sizeof(uint32_t) +
+		Accelerator.GetNodes().capacity() * sizeof(BVHNode) +
+		Accelerator.GetPrimitiveIndices().capacity() * sizeof(uint32_t);
+}
+
+uint32_t Mesh::EncodeNormal(const glm::vec3& normal)
+{
+	// Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the upper
+	glm::vec3 n = normal / (glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z));
+	float x = n.x, y = n.y;
+	if (n.z < 0.0f)
+	{
+		x = (1.0f - glm::abs(n.y)) * Utils::SignNotZero(n.x);
+		y = (1.0f - glm::abs(n.x)) * Utils::SignNotZero(n.y);
+	}
+	return Utils::QuantizeUnorm16(x) | (Utils::QuantizeUnorm16(y) << 16);
+}
+
+glm::vec3 Mesh::DecodeNormal(uint32_t encoded)
+{
+	float x = Utils::DequantizeUnorm16(encoded & 0xffff);
+	float y = Utils::DequantizeUnorm16(encoded >> 16);
+	float z = 1.0f - glm::abs(x) - glm::abs(y);
+	if (z < 0.0f)
+	{
+		float foldedX = (1.0f - glm::abs(y)) * Utils::SignNotZero(x);
+		y = (1.0f - glm::abs(x)) * Utils::SignNotZero(y);
+		x = foldedX;
+	}
+	return glm::normalize(glm::vec3(x, y, z));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Ray.h"
+#include "BVH.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+struct MeshHit
+{
+	uint32_t Triangle;      // Index into the (reordered) triangle list, Indices[3 * Triangle]
+	glm::vec2 Barycentrics; // Weights of the second and third vertex
+};
+
+// Indexed triangle mesh in world space with its own BVH over the triangles. The scene keeps a
+// second BVH over whole meshes, so a mesh is a single leaf entry there however large it is.
+//
+// Memory per triangle, for a closed mesh (about half as many vertices as triangles):
+//     Positions      12 B per vertex                 ~6 B
+//     Normals         4 B per vertex, octahedral     ~2 B (none for flat shaded meshes)
+//     Indices        12 B                            12 B
+//     BVH nodes      32 B per node                  ~32 B (about one node per triangle)
+//                                                    ~52 B
+// which GetMemoryUsage() reports and MemoryBudgetPerTriangle bounds. Importing and building
+// temporarily needs about as much again.
+struct Mesh
+{
+	static constexpr uint32_t MaxLeafSize = 4;
+	static constexpr float TraversalCost = 1.0f; // Relative to one triangle test, see BVH::Build()
+	static constexpr uint32_t MemoryBudgetPerTriangle = 56;
+
+	std::vector<glm::vec3> Positions;
+	std::vector<uint32_t> Normals; // Per vertex, EncodeNormal(); empty for flat shading
+	std::vector<uint32_t> Indices; // Three per triangle, in BVH leaf order once built
+	int MaterialIndex = 0;
+
+	std::string SourcePath; // File the mesh was imported from, as written in the scene
+
+	// Leaf ranges index triangles directly (BuildAcceleration() sorts Indices to match), so it
+	// holds no primitive indices and only TraverseLeaves() applies
+	BVH Accelerator;
+
+	uint32_t GetTriangleCount() const { return (uint32_t)(Indices.size() / 3); }
+
+	// Builds the triangle BVH and reorders the triangles into leaf order, in parallel if a
+	// thread pool is given
+	void BuildAcceleration(ThreadPool* threadPool = nullptr);
+
+	AABB GetBounds() const;
+
+	// Closest triangle hit in (0, tMax), either winding. Watertight (Woop, Benthin and Wald,
+	// "Watertight Ray/Triangle Intersection"): rays through shared edges or vertices always hit
+	// one of the triangles. Shortens tMax on a hit.
+	bool Intersect(const Ray& ray, float& tMax, MeshHit& hit) const;
+	// Whether any triangle is hit in (0, tMax), stopping at the first one found
+	bool IsOccluded(const Ray& ray, float tMax) const;
+
+	// Interpolated vertex normal, or the geometric normal for flat shaded meshes. Not flipped
+	// towards the ray.
+	glm::vec3 GetNormal(const MeshHit& hit) const;
+
+	// Bytes held by the buffers and the BVH
+	size_t GetMemoryUsage() const;
+
+	// Octahedral mapping into two 16-bit components
+	static uint32_t EncodeNormal(const glm::vec3& normal);
+	static glm::vec3 DecodeNormal(uint32_t encoded);
+private:
+	// Intersect() and IsOccluded(), which ends the traversal at the first hit
+	template<bool AnyHit>
+	bool Trace(const Ray& ray, float& tMax, MeshHit& hit) const;
+};
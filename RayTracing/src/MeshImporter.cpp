@@ -0,0 +1,1260 @@
+#include "MeshImporter.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace Utils
+{
+	// OBJ chunks are at least this large so small files are not split needlessly
+	static constexpr size_t MinChunkBytes = 1 << 20;
+	// Vertices or triangles per task when decoding binary PLY blocks
+	static constexpr uint32_t BlockSize = 1 << 16;
+
+	static bool IsBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	static void SkipBlanks(const char*& cursor, const char* end)
+	{
+		while (cursor < end && IsBlank(*cursor))
+			cursor++;
+	}
+
+	static void SkipWhitespace(const char*& cursor, const char* end)
+	{
+		while (cursor < end && (IsBlank(*cursor) || *cursor == '\n'))
+			cursor++;
+	}
+
+	static void SkipLine(const char*& cursor, const char* end)
+	{
+		const char* newline = (const char*)std::memchr(cursor, '\n', (size_t)(end - cursor));
+		cursor = newline ? newline + 1 : end;
+	}
+
+	static double PowerOfTen(int exponent)
+	{
+		// Exactly representable, so one multiply or divide rounds correctly
+		static const double exact[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		if (exponent >= 0 && exponent <= 22)
+			return exact[exponent];
+		return std::pow(10.0, (double)exponent);
+	}
+
+	// Decimal floats without strtof's locale handling, which dominates parse time. Results can
+	// be an ulp off the correctly rounded value, far below anything visible in geometry.
+	static bool ParseFloat(const char*& cursor, const char* end, float& value)
+	{
+		SkipBlanks(cursor, end);
+		const char* p = cursor;
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int exponent = 0, significantDigits = 0;
+		bool anyDigits = false;
+		auto addDigit = [&](char digit, bool fraction)
+		{
+			anyDigits = true;
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + (uint64_t)(digit - '0');
+				if (mantissa != 0)
+					significantDigits++;
+				if (fraction)
+					exponent--;
+			}
+			else if (!fraction)
+			{
+				exponent++;
+			}
+		};
+
+		for (; p < end && IsDigit(*p); p++)
+			addDigit(*p, false);
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && IsDigit(*p); p++)
+				addDigit(*p, true);
+		}
+
+		if (!anyDigits)
+		{
+			// "nan", "inf" and other spellings strtof understands
+			char buffer[32] = {};
+			size_t length = std::min((size_t)(end - cursor), sizeof(buffer) - 1);
+			std::memcpy(buffer, cursor, length);
+			char* parsedEnd;
+			value = std::strtof(buffer, &parsedEnd);
+			if (parsedEnd == buffer)
+				return false;
+			cursor += parsedEnd - buffer;
+			return true;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+				negativeExponent = *e++ == '-';
+
+			int exponentValue = 0;
+			const char* digits = e;
+			for (; e < end && IsDigit(*e); e++)
+				exponentValue = std::min(exponentValue * 10 + (*e - '0'), 100000);
+
+			if (e != digits)
+			{
+				exponent += negativeExponent ? -exponentValue : exponentValue;
+				p = e;
+			}
+		}
+
+		double result = (double)mantissa;
+		result = exponent < 0 ? result / PowerOfTen(-exponent) : result * PowerOfTen(exponent);
+		value = (float)(negative ? -result : result);
+		cursor = p;
+		return true;
+	}
+
+	static bool ParseInt(const char*& cursor, const char* end, int64_t& value)
+	{
+		const char* p = cursor;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		const char* digits = p;
+		int64_t result = 0;
+		for (; p < end && IsDigit(*p); p++)
+			result = std::min(result * 10 + (*p - '0'), (int64_t)1 << 40);
+
+		if (p == digits)
+			return false;
+
+		value = negative ? -result : result;
+		cursor = p;
+		return true;
+	}
+
+	static bool ParseVec3(const char*& cursor, const char* end, glm::vec3& value)
+	{
+		return ParseFloat(cursor, end, value.x) && ParseFloat(cursor, end, value.y) && ParseFloat(cursor, end, value.z);
+	}
+
+	static uint32_t CountLines(const char* begin, const char* position)
+	{
+		return 1 + (uint32_t)std::count(begin, position, '\n');
+	}
+
+	static bool CheckIndices(ThreadPool& pool, const std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		std::atomic<bool> valid{ true };
+		uint32_t blockCount = (uint32_t)((indices.size() + BlockSize - 1) / BlockSize);
+		pool.ParallelFor(blockCount,
+			[&](uint32_t block, uint32_t)
+			{
+				size_t last = std::min(indices.size(), (size_t)(block + 1) * BlockSize);
+				for (size_t i = (size_t)block * BlockSize; i < last; i++)
+				{
+					if (indices[i] >= vertexCount)
+					{
+						valid = false;
+						return;
+					}
+				}
+			});
+		return valid;
+	}
+
+	static void EncodeNormals(ThreadPool& pool, const std::vector<glm::vec3>& normals, std::vector<uint32_t>& encoded)
+	{
+		encoded.resize(normals.size());
+		uint32_t blockCount = (uint32_t)((normals.size() + BlockSize - 1) / BlockSize);
+		pool.ParallelFor(blockCount,
+			[&](uint32_t block, uint32_t)
+			{
+				size_t last = std::min(normals.size(), (size_t)(block + 1) * BlockSize);
+				for (size_t i = (size_t)block * BlockSize; i < last; i++)
+				{
+					// Vertices no face uses have no normal
+					float length = glm::length(normals[i]);
+					encoded[i] = Mesh::EncodeNormal(length > 0.0f ? normals[i] / length : glm::vec3(0.0f, 0.0f, 1.0f));
+				}
+			});
+	}
+
+	static std::string GetExtension(const std::string& path)
+	{
+		std::string extension = std::filesystem::path(path).extension().string();
+		for (char& c : extension)
+			c = (char)std::tolower((unsigned char)c);
+		return extension;
+	}
+
+	namespace OBJ
+	{
+		struct Corner
+		{
+			uint32_t Position, Normal;
+			bool RelativePosition, RelativeNormal, HasNormal;
+		};
+
+		// What one line-aligned piece of the file parses to. Indices are resolved against the
+		// whole file when the chunks are stitched together.
+		struct Chunk
+		{
+			std::vector<glm::vec3> Positions;
+			std::vector<glm::vec3> Normals;
+			std::vector<uint32_t> Indices;       // Three per triangle
+			std::vector<uint32_t> NormalIndices; // One per entry of Indices
+
+			// Negative (relative) indices are stored relative to this chunk's first vertex;
+			// these are the entries of Indices and NormalIndices that hold one
+			std::vector<uint32_t> RelativeIndices;
+			std::vector<uint32_t> RelativeNormalIndices;
+
+			bool MissingNormals = false;
+			const char* ErrorPosition = nullptr;
+		};
+
+		static bool ParseIndex(const char*& cursor, const char* end, size_t localCount, uint32_t& index, bool& relative)
+		{
+			int64_t value;
+			if (!ParseInt(cursor, end, value) || value == 0)
+				return false;
+
+			// Wraps for references into earlier chunks; adding the chunk offset wraps it back
+			relative = value < 0;
+			index = relative ? (uint32_t)((int64_t)localCount + value) : (uint32_t)(value - 1);
+			return true;
+		}
+
+		// v, v/vt, v//vn or v/vt/vn
+		static bool ParseCorner(const char*& cursor, const char* end, const Chunk& chunk, Corner& corner)
+		{
+			if (!ParseIndex(cursor, end, chunk.Positions.size(), corner.Position, corner.RelativePosition))
+				return false;
+
+			corner.HasNormal = false;
+			if (cursor < end && *cursor == '/')
+			{
+				// Texture coordinates are ignored
+				for (cursor++; cursor < end && *cursor != '/' && !IsBlank(*cursor) && *cursor != '\n'; cursor++);
+
+				if (cursor < end && *cursor == '/')
+				{
+					cursor++;
+					if (!ParseIndex(cursor, end, chunk.Normals.size(), corner.Normal, corner.RelativeNormal))
+						return false;
+					corner.HasNormal = true;
+				}
+			}
+			return true;
+		}
+
+		static void AddCorner(Chunk& chunk, const Corner& corner)
+		{
+			if (corner.RelativePosition)
+				chunk.RelativeIndices.push_back((uint32_t)chunk.Indices.size());
+			chunk.Indices.push_back(corner.Position);
+
+			if (chunk.MissingNormals)
+				return;
+
+			if (!corner.HasNormal)
+			{
+				// Normals are all or nothing
+				chunk.MissingNormals = true;
+				chunk.NormalIndices = std::vector<uint32_t>();
+				chunk.RelativeNormalIndices = std::vector<uint32_t>();
+				return;
+			}
+
+			if (corner.RelativeNormal)
+				chunk.RelativeNormalIndices.push_back((uint32_t)chunk.NormalIndices.size());
+			chunk.NormalIndices.push_back(corner.Normal);
+		}
+
+		// Polygons become a fan around their first corner
+		static bool ParseFace(const char*& cursor, const char* end, Chunk& chunk)
+		{
+			Corner first{}, previous{}, corner{};
+			uint32_t cornerCount = 0;
+			while (true)
+			{
+				SkipBlanks(cursor, end);
+				if (cursor == end || *cursor == '\n' || *cursor == '#')
+					break;
+
+				if (!ParseCorner(cursor, end, chunk, corner))
+					return false;
+
+				if (cornerCount == 0)
+					first = corner;
+				else if (cornerCount >= 2)
+				{
+					AddCorner(chunk, first);
+					AddCorner(chunk, previous);
+					AddCorner(chunk, corner);
+				}
+				previous = corner;
+				cornerCount++;
+			}
+			return cornerCount >= 3;
+		}
+
+		static void ParseChunk(const char* cursor, const char* end, Chunk& chunk)
+		{
+			while (cursor < end)
+			{
+				SkipBlanks(cursor, end);
+				const char* line = cursor;
+				bool valid = true;
+
+				if (end - cursor > 1 && cursor[0] == 'v' && IsBlank(cursor[1]))
+				{
+					cursor++;
+					valid = ParseVec3(cursor, end, chunk.Positions.emplace_back());
+				}
+				else if (end - cursor > 2 && cursor[0] == 'v' && cursor[1] == 'n' && IsBlank(cursor[2]))
+				{
+					cursor += 2;
+					valid = ParseVec3(cursor, end, chunk.Normals.emplace_back());
+				}
+				else if (end - cursor > 1 && cursor[0] == 'f' && IsBlank(cursor[1]))
+				{
+					cursor++;
+					valid = ParseFace(cursor, end, chunk);
+				}
+
+				if (!valid)
+				{
+					chunk.ErrorPosition = line;
+					return;
+				}
+				SkipLine(cursor, end);
+			}
+		}
+
+		// Copies a chunk's indices to their place in the mesh, resolving relative ones
+		static void Resolve(const std::vector<uint32_t>& source, const std::vector<uint32_t>& relative, uint32_t offset, uint32_t* destination)
+		{
+			std::copy(source.begin(), source.end(), destination);
+			for (uint32_t i : relative)
+				destination[i] += offset;
+		}
+	}
+
+	namespace PLY
+	{
+		enum class Format
+		{
+			Ascii, BinaryLittleEndian, BinaryBigEndian
+		};
+
+		enum class Type
+		{
+			Invalid = 0, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+		};
+
+		struct Property
+		{
+			std::string Name;
+			Type ValueType = Type::Invalid;
+			Type CountType = Type::Invalid; // Set for lists
+
+			bool IsList() const { return CountType != Type::Invalid; }
+		};
+
+		struct Element
+		{
+			std::string Name;
+			uint64_t Count = 0;
+			std::vector<Property> Properties;
+
+			int FindProperty(const char* name) const
+			{
+				for (size_t i = 0; i < Properties.size(); i++)
+				{
+					if (Properties[i].Name == name)
+						return (int)i;
+				}
+				return -1;
+			}
+		};
+
+		static Type ParseType(const std::string& name)
+		{
+			if (name == "char" || name == "int8")     return Type::Int8;
+			if (name == "uchar" || name == "uint8")   return Type::UInt8;
+			if (name == "short" || name == "int16")   return Type::Int16;
+			if (name == "ushort" || name == "uint16") return Type::UInt16;
+			if (name == "int" || name == "int32")     return Type::Int32;
+			if (name == "uint" || name == "uint32")   return Type::UInt32;
+			if (name == "float" || name == "float32") return Type::Float32;
+			if (name == "double" || name == "float64") return Type::Float64;
+			return Type::Invalid;
+		}
+
+		static uint32_t GetSize(Type type)
+		{
+			switch (type)
+			{
+				case Type::Int8:  case Type::UInt8:   return 1;
+				case Type::Int16: case Type::UInt16:  return 2;
+				case Type::Int32: case Type::UInt32: case Type::Float32: return 4;
+				case Type::Float64: return 8;
+				case Type::Invalid: break;
+			}
+			return 0;
+		}
+
+		static bool IsInteger(Type type)
+		{
+			return type != Type::Float32 && type != Type::Float64;
+		}
+
+		template<typename T>
+		static T Load(const uint8_t* data, bool swap)
+		{
+			uint8_t bytes[sizeof(T)];
+			std::memcpy(bytes, data, sizeof(T));
+			if (swap)
+				std::reverse(bytes, bytes + sizeof(T));
+
+			T value;
+			std::memcpy(&value, bytes, sizeof(T));
+			return value;
+		}
+
+		static double Read(const uint8_t* data, Type type, bool swap)
+		{
+			switch (type)
+			{
+				case Type::Int8:    return (double)(int8_t)data[0];
+				case Type::UInt8:   return (double)data[0];
+				case Type::Int16:   return (double)Load<int16_t>(data, swap);
+				case Type::UInt16:  return (double)Load<uint16_t>(data, swap);
+				case Type::Int32:   return (double)Load<int32_t>(data, swap);
+				case Type::UInt32:  return (double)Load<uint32_t>(data, swap);
+				case Type::Float32: return (double)Load<float>(data, swap);
+				case Type::Float64: return Load<double>(data, swap);
+				case Type::Invalid: break;
+			}
+			return 0.0;
+		}
+
+		// Index lists are read as unsigned; negative indices end up out of range
+		static uint32_t ReadIndex(const uint8_t* data, Type type, bool swap)
+		{
+			switch (type)
+			{
+				case Type::Int8:  case Type::UInt8:  return data[0];
+				case Type::Int16: case Type::UInt16: return Load<uint16_t>(data, swap);
+				case Type::Int32: case Type::UInt32: return Load<uint32_t>(data, swap);
+				default: return (uint32_t)Read(data, type, swap);
+			}
+		}
+
+		struct Header
+		{
+			Format FileFormat = Format::Ascii;
+			std::vector<Element> Elements;
+			size_t DataOffset = 0;
+		};
+
+		static bool ParseHeader(const MappedFile& file, Header& header, std::string& error)
+		{
+			const char* begin = (const char*)file.GetData();
+			const char* end = begin + file.GetSize();
+
+			const char* cursor = begin;
+			bool formatSeen = false;
+			for (uint32_t line = 1; cursor < end; line++)
+			{
+				const char* lineEnd = (const char*)std::memchr(cursor, '\n', (size_t)(end - cursor));
+				if (!lineEnd)
+					break;
+
+				std::istringstream stream(std::string(cursor, lineEnd));
+				cursor = lineEnd + 1;
+
+				std::string keyword;
+				stream >> keyword;
+				if (line == 1)
+				{
+					if (keyword != "ply")
+					{
+						error = "not a PLY file";
+						return false;
+					}
+				}
+				else if (keyword == "format")
+				{
+					std::string format;
+					stream >> format;
+					if (format == "ascii")
+						header.FileFormat = Format::Ascii;
+					else if (format == "binary_little_endian")
+						header.FileFormat = Format::BinaryLittleEndian;
+					else if (format == "binary_big_endian")
+						header.FileFormat = Format::BinaryBigEndian;
+					else
+					{
+						error = "unknown format '" + format + "'";
+						return false;
+					}
+					formatSeen = true;
+				}
+				else if (keyword == "element")
+				{
+					Element& element = header.Elements.emplace_back();
+					stream >> element.Name >> element.Count;
+				}
+				else if (keyword == "property")
+				{
+					if (header.Elements.empty())
+					{
+						error = "property outside an element";
+						return false;
+					}
+
+					Property property;
+					std::string type;
+					stream >> type;
+					if (type == "list")
+					{
+						std::string countType, valueType;
+						stream >> countType >> valueType;
+						property.CountType = ParseType(countType);
+						property.ValueType = ParseType(valueType);
+						if (property.CountType == Type::Invalid || !IsInteger(property.CountType))
+						{
+							error = "invalid list count type '" + countType + "'";
+							return false;
+						}
+					}
+					else
+					{
+						property.ValueType = ParseType(type);
+					}
+					stream >> property.Name;
+
+					if (property.ValueType == Type::Invalid)
+					{
+						error = "unknown property type on line " + std::to_string(line);
+						return false;
+					}
+					header.Elements.back().Properties.push_back(property);
+				}
+				else if (keyword == "end_header")
+				{
+					header.DataOffset = (size_t)(cursor - begin);
+					if (!formatSeen)
+					{
+						error = "missing format";
+						return false;
+					}
+					return true;
+				}
+				// comment, obj_info and unknown keywords are skipped
+			}
+
+			error = "missing end_header";
+			return false;
+		}
+
+		// Byte size of one item of an element without lists, 0 if it has lists
+		static uint32_t GetFixedStride(const Element& element)
+		{
+			uint32_t stride = 0;
+			for (const Property& property : element.Properties)
+			{
+				if (property.IsList())
+					return 0;
+				stride += GetSize(property.ValueType);
+			}
+			return stride;
+		}
+
+		// Vertex and face layout the importer extracts
+		struct Layout
+		{
+			int VertexElement = -1, FaceElement = -1;
+			int Position[3] = { -1, -1, -1 };
+			int Normal[3] = { -1, -1, -1 };
+			int FaceIndices = -1;
+
+			bool HasNormals() const { return Normal[0] >= 0 && Normal[1] >= 0 && Normal[2] >= 0; }
+		};
+
+		static bool FindLayout(const Header& header, Layout& layout, std::string& error)
+		{
+			for (size_t i = 0; i < header.Elements.size(); i++)
+			{
+				const Element& element = header.Elements[i];
+				if (element.Name == "vertex")
+				{
+					layout.VertexElement = (int)i;
+					const char* names[] = { "x", "y", "z", "nx", "ny", "nz" };
+					for (int axis = 0; axis < 3; axis++)
+					{
+						layout.Position[axis] = element.FindProperty(names[axis]);
+						layout.Normal[axis] = element.FindProperty(names[axis + 3]);
+					}
+				}
+				else if (element.Name == "face")
+				{
+					layout.FaceElement = (int)i;
+					layout.FaceIndices = element.FindProperty("vertex_indices");
+					if (layout.FaceIndices < 0)
+						layout.FaceIndices = element.FindProperty("vertex_index");
+				}
+			}
+
+			if (layout.VertexElement < 0 || layout.Position[0] < 0 || layout.Position[1] < 0 || layout.Position[2] < 0)
+			{
+				error = "no vertex positions";
+				return false;
+			}
+			if (layout.FaceElement < 0 || layout.FaceIndices < 0 || !header.Elements[layout.FaceElement].Properties[layout.FaceIndices].IsList())
+			{
+				error = "no face vertex index list";
+				return false;
+			}
+			return true;
+		}
+
+		static void AddPolygon(const uint32_t* corners, uint32_t cornerCount, std::vector<uint32_t>& indices)
+		{
+			for (uint32_t i = 2; i < cornerCount; i++)
+			{
+				indices.push_back(corners[0]);
+				indices.push_back(corners[i - 1]);
+				indices.push_back(corners[i]);
+			}
+		}
+
+		static bool ReadAscii(const Header& header, const Layout& layout, const char* cursor, const char* end,
+			Mesh& mesh, std::vector<glm::vec3>& normals, std::string& error)
+		{
+			std::vector<uint32_t> corners;
+			std::vector<float> values;
+			for (size_t e = 0; e < header.Elements.size(); e++)
+			{
+				const Element& element = header.Elements[e];
+				bool isVertex = (int)e == layout.VertexElement;
+				bool isFace = (int)e == layout.FaceElement;
+				if (isVertex)
+				{
+					mesh.Positions.resize(element.Count);
+					if (layout.HasNormals())
+						normals.resize(element.Count);
+				}
+
+				values.resize(element.Properties.size());
+				for (uint64_t item = 0; item < element.Count; item++)
+				{
+					for (size_t p = 0; p < element.Properties.size(); p++)
+					{
+						const Property& property = element.Properties[p];
+						SkipWhitespace(cursor, end);
+						if (!property.IsList())
+						{
+							if (!ParseFloat(cursor, end, values[p]))
+							{
+								error = "malformed " + element.Name + " " + std::to_string(item);
+								return false;
+							}
+							continue;
+						}
+
+						int64_t count;
+						if (!ParseInt(cursor, end, count) || count < 0)
+						{
+							error = "malformed list in " + element.Name + " " + std::to_string(item);
+							return false;
+						}
+
+						corners.clear();
+						for (int64_t i = 0; i < count; i++)
+						{
+							SkipWhitespace(cursor, end);
+							float value;
+							int64_t index;
+							bool valid = IsInteger(property.ValueType) ? ParseInt(cursor, end, index) : ParseFloat(cursor, end, value);
+							if (!valid)
+							{
+								error = "malformed list in " + element.Name + " " + std::to_string(item);
+								return false;
+							}
+							if (isFace && (int)p == layout.FaceIndices)
+								corners.push_back(IsInteger(property.ValueType) ? (uint32_t)index : (uint32_t)value);
+						}
+
+						if (isFace && (int)p == layout.FaceIndices)
+							AddPolygon(corners.data(), (uint32_t)corners.size(), mesh.Indices);
+					}
+
+					if (isVertex)
+					{
+						mesh.Positions[item] = { values[layout.Position[0]], values[layout.Position[1]], values[layout.Position[2]] };
+						if (layout.HasNormals())
+							normals[item] = { values[layout.Normal[0]], values[layout.Normal[1]], values[layout.Normal[2]] };
+					}
+				}
+			}
+			return true;
+		}
+
+		static bool ReadBinaryVertices(ThreadPool& pool, const Element& element, const Layout& layout, const uint8_t* data, bool swap,
+			Mesh& mesh, std::vector<glm::vec3>& normals)
+		{
+			uint32_t offsets[6] = {};
+			Type types[6] = {};
+			uint32_t stride = 0;
+			for (size_t p = 0; p < element.Properties.size(); p++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (layout.Position[axis] == (int)p)
+					{
+						offsets[axis] = stride;
+						types[axis] = element.Properties[p].ValueType;
+					}
+					if (layout.Normal[axis] == (int)p)
+					{
+						offsets[axis + 3] = stride;
+						types[axis + 3] = element.Properties[p].ValueType;
+					}
+				}
+				stride += GetSize(element.Properties[p].ValueType);
+			}
+
+			bool hasNormals = layout.HasNormals();
+			bool packedFloats = !swap && types[0] == Type::Float32 && types[1] == Type::Float32 && types[2] == Type::Float32;
+			mesh.Positions.resize(element.Count);
+			if (hasNormals)
+				normals.resize(element.Count);
+
+			uint32_t blockCount = (uint32_t)((element.Count + BlockSize - 1) / BlockSize);
+			pool.ParallelFor(blockCount,
+				[&](uint32_t block, uint32_t)
+				{
+					uint64_t last = std::min(element.Count, (uint64_t)(block + 1) * BlockSize);
+					for (uint64_t i = (uint64_t)block * BlockSize; i < last; i++)
+					{
+						const uint8_t* vertex = data + i * stride;
+						glm::vec3& position = mesh.Positions[i];
+						if (packedFloats)
+						{
+							std::memcpy(&position.x, vertex + offsets[0], sizeof(float));
+							std::memcpy(&position.y, vertex + offsets[1], sizeof(float));
+							std::memcpy(&position.z, vertex + offsets[2], sizeof(float));
+						}
+						else
+						{
+							for (int axis = 0; axis < 3; axis++)
+								position[axis] = (float)Read(vertex + offsets[axis], types[axis], swap);
+						}
+
+						if (hasNormals)
+						{
+							for (int axis = 0; axis < 3; axis++)
+								normals[i][axis] = (float)Read(vertex + offsets[axis + 3], types[axis + 3], swap);
+						}
+					}
+				});
+			return true;
+		}
+
+		// Walks an element item by item; collects the faces' index lists if 'indices' is set
+		static bool ReadBinaryElement(const Element& element, int listProperty, const uint8_t*& cursor, const uint8_t* end, bool swap,
+			std::vector<uint32_t>* indices)
+		{
+			std::vector<uint32_t> corners;
+			for (uint64_t item = 0; item < element.Count; item++)
+			{
+				for (size_t p = 0; p < element.Properties.size(); p++)
+				{
+					const Property& property = element.Properties[p];
+					uint32_t valueSize = GetSize(property.ValueType);
+					if (!property.IsList())
+					{
+						if ((size_t)(end - cursor) < valueSize)
+							return false;
+						cursor += valueSize;
+						continue;
+					}
+
+					uint32_t countSize = GetSize(property.CountType);
+					if ((size_t)(end - cursor) < countSize)
+						return false;
+					uint64_t count = (uint64_t)Read(cursor, property.CountType, swap);
+					cursor += countSize;
+					if ((uint64_t)(end - cursor) / valueSize < count)
+						return false;
+
+					if (indices && (int)p == listProperty)
+					{
+						corners.resize(count);
+						for (uint64_t i = 0; i < count; i++)
+							corners[i] = ReadIndex(cursor + i * valueSize, property.ValueType, swap);
+						AddPolygon(corners.data(), (uint32_t)count, *indices);
+					}
+					cursor += count * valueSize;
+				}
+			}
+			return true;
+		}
+
+		// Faces that are all triangles have a fixed size, so ranges of them decode in parallel.
+		// Returns false if the element is not laid out that way.
+		static bool ReadBinaryTriangles(ThreadPool& pool, const Element& element, int listProperty, const uint8_t* data, const uint8_t* end,
+			bool swap, std::vector<uint32_t>& indices)
+		{
+			const Property& list = element.Properties[listProperty];
+			uint32_t countSize = GetSize(list.CountType);
+			uint32_t indexSize = GetSize(list.ValueType);
+			if (!IsInteger(list.ValueType))
+				return false;
+
+			uint32_t listOffset = 0, stride = 0;
+			for (size_t p = 0; p < element.Properties.size(); p++)
+			{
+				const Property& property = element.Properties[p];
+				if ((int)p == listProperty)
+				{
+					listOffset = stride;
+					stride += countSize + 3 * indexSize;
+				}
+				else if (property.IsList())
+					return false;
+				else
+					stride += GetSize(property.ValueType);
+			}
+
+			// Every face has at least three corners, so the sizes only match if all have three
+			if ((uint64_t)(end - data) != element.Count * stride)
+				return false;
+
+			indices.resize(element.Count * 3);
+			std::atomic<bool> triangles{ true };
+			uint32_t blockCount = (uint32_t)((element.Count + BlockSize - 1) / BlockSize);
+			pool.ParallelFor(blockCount,
+				[&](uint32_t block, uint32_t)
+				{
+					uint64_t last = std::min(element.Count, (uint64_t)(block + 1) * BlockSize);
+					for (uint64_t i = (uint64_t)block * BlockSize; i < last; i++)
+					{
+						const uint8_t* face = data + i * stride + listOffset;
+						if (Read(face, list.CountType, swap) != 3.0)
+						{
+							triangles = false;
+							return;
+						}
+						for (int corner = 0; corner < 3; corner++)
+							indices[3 * i + corner] = ReadIndex(face + countSize + corner * indexSize, list.ValueType, swap);
+					}
+				});
+
+			if (!triangles)
+				indices.clear();
+			return triangles;
+		}
+
+		static bool ReadBinary(ThreadPool& pool, const Header& header, const Layout& layout, const uint8_t* cursor, const uint8_t* end,
+			Mesh& mesh, std::vector<glm::vec3>& normals, std::string& error)
+		{
+			bool swap = header.FileFormat == Format::BinaryBigEndian;
+			for (size_t e = 0; e < header.Elements.size(); e++)
+			{
+				const Element& element = header.Elements[e];
+				uint32_t stride = GetFixedStride(element);
+
+				if ((int)e == layout.VertexElement)
+				{
+					if (stride == 0)
+					{
+						error = "list properties on vertices are not supported";
+						return false;
+					}
+					if ((uint64_t)(end - cursor) / stride < element.Count)
+					{
+						error = "truncated vertex data";
+						return false;
+					}
+					ReadBinaryVertices(pool, element, layout, cursor, swap, mesh, normals);
+					cursor += element.Count * stride;
+				}
+				else if ((int)e == layout.FaceElement)
+				{
+					// The fixed size layout is only known to fit when nothing follows the faces
+					bool lastElement = e + 1 == header.Elements.size();
+					if (lastElement && ReadBinaryTriangles(pool, element, layout.FaceIndices, cursor, end, swap, mesh.Indices))
+						cursor = end;
+					else if (!ReadBinaryElement(element, layout.FaceIndices, cursor, end, swap, &mesh.Indices))
+					{
+						error = "truncated face data";
+						return false;
+					}
+				}
+				else if (stride > 0)
+				{
+					if ((uint64_t)(end - cursor) / stride < element.Count)
+					{
+						error = "truncated " + element.Name + " data";
+						return false;
+					}
+					cursor += element.Count * stride;
+				}
+				else if (!ReadBinaryElement(element, -1, cursor, end, swap, nullptr))
+				{
+					error = "truncated " + element.Name + " data";
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	// Buffered text output; std::ostream formatting is slow enough to matter for large meshes
+	class TextWriter
+	{
+	public:
+		explicit TextWriter(const std::string& path)
+			: m_Stream(path, std::ios::binary)
+		{
+			m_Buffer.reserve(1 << 20);
+		}
+
+		~TextWriter() { Flush(); }
+
+		template<typename... Args>
+		void Print(const char* format, Args... args)
+		{
+			char line[256];
+			int length = std::snprintf(line, sizeof(line), format, args...);
+			m_Buffer.append(line, (size_t)std::max(length, 0));
+			if (m_Buffer.size() > (1 << 20))
+				Flush();
+		}
+
+		void WriteBytes(const void* data, size_t size)
+		{
+			Flush();
+			m_Stream.write((const char*)data, (std::streamsize)size);
+		}
+
+		void Flush()
+		{
+			m_Stream.write(m_Buffer.data(), (std::streamsize)m_Buffer.size());
+			m_Buffer.clear();
+		}
+
+		bool IsGood() const { return (bool)m_Stream; }
+	private:
+		std::ofstream m_Stream;
+		std::string m_Buffer;
+	};
+}
+
+namespace MeshImporter
+{
+	bool Load(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount)
+	{
+		std::string extension = Utils::GetExtension(path);
+		if (extension == ".obj")
+			return LoadOBJ(path, mesh, error, workerCount);
+		if (extension == ".ply")
+			return LoadPLY(path, mesh, error, workerCount);
+
+		error = path + ": unsupported mesh format '" + extension + "'";
+		return false;
+	}
+
+	bool LoadOBJ(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount)
+	{
+		using namespace Utils::OBJ;
+
+		MappedFile file;
+		if (!file.Open(path))
+		{
+			error = "Cannot map " + path;
+			return false;
+		}
+
+		ThreadPool pool(workerCount);
+		const char* begin = (const char*)file.GetData();
+		const char* end = begin + file.GetSize();
+
+		// Chunk boundaries move forward to the next line start
+		size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.GetWorkerCount() * 4, file.GetSize() / Utils::MinChunkBytes));
+		std::vector<const char*> boundaries(chunkCount + 1);
+		boundaries[0] = begin;
+		boundaries[chunkCount] = end;
+		for (size_t i = 1; i < chunkCount; i++)
+		{
+			const char* boundary = std::max(begin + file.GetSize() * i / chunkCount, boundaries[i - 1]);
+			if (boundary > begin && boundary[-1] != '\n')
+				Utils::SkipLine(boundary, end);
+			boundaries[i] = boundary;
+		}
+
+		std::vector<Chunk> chunks(chunkCount);
+		pool.ParallelFor((uint32_t)chunkCount,
+			[&](uint32_t i, uint32_t)
+			{
+				ParseChunk(boundaries[i], boundaries[i + 1], chunks[i]);
+			});
+
+		for (const Chunk& chunk : chunks)
+		{
+			if (chunk.ErrorPosition)
+			{
+				error = path + ":" + std::to_string(Utils::CountLines(begin, chunk.ErrorPosition)) + ": malformed statement";
+				return false;
+			}
+		}
+
+		std::vector<uint64_t> positionOffsets(chunkCount + 1, 0), normalOffsets(chunkCount + 1, 0), indexOffsets(chunkCount + 1, 0);
+		bool hasNormals = true;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			positionOffsets[i + 1] = positionOffsets[i] + chunks[i].Positions.size();
+			normalOffsets[i + 1] = normalOffsets[i] + chunks[i].Normals.size();
+			indexOffsets[i + 1] = indexOffsets[i] + chunks[i].Indices.size();
+			hasNormals = hasNormals && !chunks[i].MissingNormals;
+		}
+
+		uint64_t positionCount = positionOffsets[chunkCount];
+		uint64_t indexCount = indexOffsets[chunkCount];
+		hasNormals = hasNormals && normalOffsets[chunkCount] > 0 && indexCount > 0;
+		if (positionCount >= std::numeric_limits<uint32_t>::max() || indexCount >= std::numeric_limits<uint32_t>::max())
+		{
+			error = path + ": more than 2^32 vertices or indices";
+			return false;
+		}
+
+		mesh = Mesh();
+		mesh.SourcePath = path;
+		mesh.Positions.resize(positionCount);
+		mesh.Indices.resize(indexCount);
+
+		std::vector<glm::vec3> normals;
+		std::vector<uint32_t> normalIndices;
+		if (hasNormals)
+		{
+			normals.resize(normalOffsets[chunkCount]);
+			normalIndices.resize(indexCount);
+		}
+
+		pool.ParallelFor((uint32_t)chunkCount,
+			[&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = chunks[i];
+				std::copy(chunk.Positions.begin(), chunk.Positions.end(), mesh.Positions.begin() + positionOffsets[i]);
+				Resolve(chunk.Indices, chunk.RelativeIndices, (uint32_t)positionOffsets[i], mesh.Indices.data() + indexOffsets[i]);
+
+				if (hasNormals)
+				{
+					std::copy(chunk.Normals.begin(), chunk.Normals.end(), normals.begin() + normalOffsets[i]);
+					Resolve(chunk.NormalIndices, chunk.RelativeNormalIndices, (uint32_t)normalOffsets[i], normalIndices.data() + indexOffsets[i]);
+				}
+
+				// Merged chunks are freed right away to keep the peak down
+				chunk = Chunk();
+			});
+
+		if (!Utils::CheckIndices(pool, mesh.Indices, positionCount) || (hasNormals && !Utils::CheckIndices(pool, normalIndices, normals.size())))
+		{
+			error = path + ": face index out of range";
+			mesh = Mesh();
+			return false;
+		}
+
+		if (hasNormals)
+		{
+			// OBJ normals belong to face corners; average the ones each position is used with
+			std::vector<glm::vec3> vertexNormals(positionCount, glm::vec3(0.0f));
+			for (size_t i = 0; i < indexCount; i++)
+				vertexNormals[mesh.Indices[i]] += normals[normalIndices[i]];
+
+			normals = std::vector<glm::vec3>();
+			normalIndices = std::vector<uint32_t>();
+			Utils::EncodeNormals(pool, vertexNormals, mesh.Normals);
+		}
+
+		mesh.BuildAcceleration(&pool);
+		return true;
+	}
+
+	bool LoadPLY(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount)
+	{
+		using namespace Utils::PLY;
+
+		MappedFile file;
+		if (!file.Open(path))
+		{
+			error = "Cannot map " + path;
+			return false;
+		}
+
+		Header header;
+		Layout layout;
+		if (!ParseHeader(file, header, error) || !FindLayout(header, layout, error))
+		{
+			error = path + ": " + error;
+			return false;
+		}
+
+		ThreadPool pool(workerCount);
+		mesh = Mesh();
+		mesh.SourcePath = path;
+
+		std::vector<glm::vec3> normals;
+		bool read;
+		if (header.FileFormat == Format::Ascii)
+		{
+			const char* data = (const char*)file.GetData();
+			read = ReadAscii(header, layout, data + header.DataOffset, data + file.GetSize(), mesh, normals, error);
+		}
+		else
+		{
+			const uint8_t* data = file.GetData();
+			read = ReadBinary(pool, header, layout, data + header.DataOffset, data + file.GetSize(), mesh, normals, error);
+		}
+
+		if (!read)
+		{
+			error = path + ": " + error;
+			mesh = Mesh();
+			return false;
+		}
+
+		if (!Utils::CheckIndices(pool, mesh.Indices, mesh.Positions.size()))
+		{
+			error = path + ": face index out of range";
+			mesh = Mesh();
+			return false;
+		}
+
+		mesh.Indices.shrink_to_fit();
+		if (!normals.empty())
+			Utils::EncodeNormals(pool, normals, mesh.Normals);
+
+		mesh.BuildAcceleration(&pool);
+		return true;
+	}
+
+	bool SaveOBJ(const std::string& path, const Mesh& mesh)
+	{
+		Utils::TextWriter writer(path);
+		writer.Print("# %u vertices, %u triangles\n", (uint32_t)mesh.Positions.size(), mesh.GetTriangleCount());
+
+		for (const glm::vec3& position : mesh.Positions)
+			writer.Print("v %.9g %.9g %.9g\n", position.x, position.y, position.z);
+		for (uint32_t encoded : mesh.Normals)
+		{
+			glm::vec3 normal = Mesh::DecodeNormal(encoded);
+			writer.Print("vn %.6g %.6g %.6g\n", normal.x, normal.y, normal.z);
+		}
+
+		// Normals are per vertex, so they share the position indices
+		bool hasNormals = !mesh.Normals.empty();
+		for (size_t i = 0; i < mesh.Indices.size(); i += 3)
+		{
+			uint32_t a = mesh.Indices[i] + 1, b = mesh.Indices[i + 1] + 1, c = mesh.Indices[i + 2] + 1;
+			if (hasNormals)
+				writer.Print("f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+			else
+				writer.Print("f %u %u %u\n", a, b, c);
+		}
+
+		writer.Flush();
+		return writer.IsGood();
+	}
+
+	bool SavePLY(const std::string& path, const Mesh& mesh, bool binary)
+	{
+		bool hasNormals = !mesh.Normals.empty();
+
+		Utils::TextWriter writer(path);
+		writer.Print("ply\nformat %s 1.0\n", binary ? "binary_little_endian" : "ascii");
+		writer.Print("element vertex %u\nproperty float x\nproperty float y\nproperty float z\n", (uint32_t)mesh.Positions.size());
+		if (hasNormals)
+			writer.Print("property float nx\nproperty float ny\nproperty float nz\n");
+		writer.Print("element face %u\nproperty list uchar int vertex_indices\nend_header\n", mesh.GetTriangleCount());
+
+		if (!binary)
+		{
+			for (size_t i = 0; i < mesh.Positions.size(); i++)
+			{
+				const glm::vec3& position = mesh.Positions[i];
+				if (hasNormals)
+				{
+					glm::vec3 normal = Mesh::DecodeNormal(mesh.Normals[i]);
+					writer.Print("%.9g %.9g %.9g %.6g %.6g %.6g\n", position.x, position.y, position.z, normal.x, normal.y, normal.z);
+				}
+				else
+				{
+					writer.Print("%.9g %.9g %.9g\n", position.x, position.y, position.z);
+				}
+			}
+			for (size_t i = 0; i < mesh.Indices.size(); i += 3)
+				writer.Print("3 %u %u %u\n", mesh.Indices[i], mesh.Indices[i + 1], mesh.Indices[i + 2]);
+
+			writer.Flush();
+			return writer.IsGood();
+		}
+
+		// Written in the machine's byte order, which the header assumes is little endian
+		std::vector<float> vertices;
+		vertices.reserve(mesh.Positions.size() * (hasNormals ? 6 : 3));
+		for (size_t i = 0; i < mesh.Positions.size(); i++)
+		{
+			vertices.insert(vertices.end(), { mesh.Positions[i].x, mesh.Positions[i].y, mesh.Positions[i].z });
+			if (hasNormals)
+			{
+				glm::vec3 normal = Mesh::DecodeNormal(mesh.Normals[i]);
+				vertices.insert(vertices.end(), { normal.x, normal.y, normal.z });
+			}
+		}
+		writer.WriteBytes(vertices.data(), vertices.size() * sizeof(float));
+		vertices = std::vector<float>();
+
+		std::vector<uint8_t> faces(mesh.GetTriangleCount() * 13);
+		for (uint32_t i = 0; i < mesh.GetTriangleCount(); i++)
+		{
+			faces[13 * i] = 3;
+			std::memcpy(&faces[13 * i + 1], &mesh.Indices[3 * i], 3 * sizeof(uint32_t));
+		}
+		writer.WriteBytes(faces.data(), faces.size());
+
+		writer.Flush();
+		return writer.IsGood();
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <string>
+
+// Wavefront OBJ and PLY (ascii, binary little and big endian) triangle mesh import.
+//
+// The file is memory mapped and parsed straight into the mesh's flat buffers; there are no
+// per-face or per-vertex objects in between. OBJ files are split into line-aligned chunks that
+// are parsed in parallel and then stitched together; binary PLY vertex and triangle blocks are
+// decoded in parallel ranges. Polygons are fan triangulated. Texture coordinates, materials,
+// groups and other PLY properties are ignored.
+//
+// OBJ normals are kept only if every face corner has one, averaged per position. PLY normals
+// come from the vertex element's nx, ny, nz. Without normals the mesh is flat shaded.
+namespace MeshImporter
+{
+	// Picks the format from the extension and builds the mesh BVH. workerCount includes the
+	// calling thread; 0 uses one per hardware thread.
+	bool Load(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount = 0);
+
+	bool LoadOBJ(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount = 0);
+	bool LoadPLY(const std::string& path, Mesh& mesh, std::string& error, uint32_t workerCount = 0);
+
+	// Writers for exporting generated meshes, mainly for the import benchmark
+	bool SaveOBJ(const std::string& path, const Mesh& mesh);
+	bool SavePLY(const std::string& path, const Mesh& mesh, bool binary = true);
+}
@@ -0,0 +1,200 @@
+#include "Profiler.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace Profiler
+{
+	namespace Detail
+	{
+		std::atomic<bool> s_Enabled{ false };
+		std::atomic<bool> s_Capturing{ false };
+	}
+
+	namespace Utils
+	{
+		// Every thread that ever recorded, kept after the thread exits so its totals are not lost
+		static std::mutex s_ThreadsMutex;
+		static std::vector<std::unique_ptr<Detail::ThreadData>> s_Threads;
+
+		static uint64_t s_CaptureStart = 0;
+	}
+
+	const char* GetName(Counter counter)
+	{
+		switch (counter)
+		{
+			case Counter::Paths:         return "paths";
+			case Counter::Rays:          return "rays";
+			case Counter::ShadowRays:    return "shadow_rays";
+			case Counter::Bounces:       return "bounces";
+			case Counter::SphereTests:   return "sphere_tests";
+			case Counter::BoxTests:      return "box_tests";
+			case Counter::TriangleTests: return "triangle_tests";
+			case Counter::InstanceTests: return "instance_tests";
+			case Counter::Count:         break;
+		}
+		return "unknown";
+	}
+
+	const char* GetName(Stage stage)
+	{
+		switch (stage)
+		{
+			case Stage::Frame:      return "frame";
+			case Stage::Tile:       return "tile";
+			case Stage::CameraRays: return "camera_rays";
+			case Stage::Trace:      return "trace";
+			case Stage::Accumulate: return "accumulate";
+			case Stage::Resolve:    return "resolve";
+			case Stage::Denoise:    return "denoise";
+			case Stage::Upload:     return "upload";
+			case Stage::Count:      break;
+		}
+		return "unknown";
+	}
+
+	Stats& Stats::operator+=(const Stats& other)
+	{
+		for (uint32_t i = 0; i < CounterCount; i++)
+			Counters[i] += other.Counters[i];
+		for (uint32_t i = 0; i < StageCount; i++)
+			Nanoseconds[i] += other.Nanoseconds[i];
+		return *this;
+	}
+
+	Stats Stats::operator-(const Stats& other) const
+	{
+		Stats result;
+		for (uint32_t i = 0; i < CounterCount; i++)
+			result.Counters[i] = Counters[i] - other.Counters[i];
+		for (uint32_t i = 0; i < StageCount; i++)
+			result.Nanoseconds[i] = Nanoseconds[i] - other.Nanoseconds[i];
+		return result;
+	}
+
+	bool IsCompiledIn()
+	{
+#ifdef RT_NO_PROFILING
+		return false;
+#else
+		return true;
+#endif
+	}
+
+	void SetEnabled(bool enabled)
+	{
+		Detail::s_Enabled = enabled && IsCompiledIn();
+	}
+
+	Stats CollectFrame()
+	{
+		Detail::ThreadData& caller = Detail::GetThreadData();
+
+		std::lock_guard<std::mutex> lock(Utils::s_ThreadsMutex);
+		Stats stats;
+		for (const std::unique_ptr<Detail::ThreadData>& thread : Utils::s_Threads)
+		{
+			stats += thread->Totals;
+			thread->Totals = Stats();
+		}
+
+		// The frame's counters become counter tracks in the trace
+		if (Detail::s_Capturing)
+		{
+			Detail::TraceEvent& event = caller.Events.emplace_back();
+			event.EventStage = Stage::Frame;
+			event.IsCounters = true;
+			event.Start = Detail::Now() - Utils::s_CaptureStart;
+			event.Duration = 0;
+			event.Arguments = stats;
+		}
+		return stats;
+	}
+
+	void BeginCapture()
+	{
+		std::lock_guard<std::mutex> lock(Utils::s_ThreadsMutex);
+		for (const std::unique_ptr<Detail::ThreadData>& thread : Utils::s_Threads)
+			thread->Events.clear();
+
+		Utils::s_CaptureStart = Detail::Now();
+		Detail::s_Capturing = true;
+	}
+
+	void EndCapture()
+	{
+		Detail::s_Capturing = false;
+	}
+
+	bool IsCapturing()
+	{
+		return Detail::s_Capturing;
+	}
+
+	bool WriteChromeTrace(const std::string& path)
+	{
+		std::ofstream stream(path);
+		stream << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+		std::lock_guard<std::mutex> lock(Utils::s_ThreadsMutex);
+		bool first = true;
+		for (const std::unique_ptr<Detail::ThreadData>& thread : Utils::s_Threads)
+		{
+			stream << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->ThreadIndex
+				<< ", \"args\": {\"name\": \"Thread " << thread->ThreadIndex << "\"}}";
+			first = false;
+
+			for (const Detail::TraceEvent& event : thread->Events)
+			{
+				if (event.IsCounters)
+				{
+					stream << ",\n{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << event.Start / 1000.0 << ", \"args\": {";
+					for (uint32_t i = 0; i < CounterCount; i++)
+						stream << (i ? ", " : "") << "\"" << GetName((Counter)i) << "\": " << event.Arguments.Counters[i];
+					stream << "}}";
+					continue;
+				}
+
+				// Microseconds, as the format expects
+				stream << ",\n{\"name\": \"" << GetName(event.EventStage) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->ThreadIndex
+					<< ", \"ts\": " << event.Start / 1000.0 << ", \"dur\": " << event.Duration / 1000.0;
+				if (event.EventStage == Stage::Tile)
+				{
+					stream << ", \"args\": {";
+					for (uint32_t i = 0; i < CounterCount; i++)
+						stream << "\"" << GetName((Counter)i) << "\": " << event.Arguments.Counters[i] << ", ";
+					for (Stage stage : { Stage::CameraRays, Stage::Trace, Stage::Accumulate })
+						stream << "\"" << GetName(stage) << "_ms\": " << event.Arguments.GetMilliseconds(stage) << (stage == Stage::Accumulate ? "" : ", ");
+					stream << "}";
+				}
+				stream << "}";
+			}
+		}
+		stream << "\n]}\n";
+		return (bool)stream;
+	}
+
+	namespace Detail
+	{
+		ThreadData* RegisterThread()
+		{
+			std::lock_guard<std::mutex> lock(Utils::s_ThreadsMutex);
+			ThreadData* thread = Utils::s_Threads.emplace_back(std::make_unique<ThreadData>()).get();
+			thread->ThreadIndex = (uint32_t)Utils::s_Threads.size() - 1;
+			return thread;
+		}
+
+		void RecordEvent(ThreadData& thread, Stage stage, uint64_t start, uint64_t end)
+		{
+			TraceEvent& event = thread.Events.emplace_back();
+			event.EventStage = stage;
+			// Scopes that began just before the capture start at 0
+			event.Start = start > Utils::s_CaptureStart ? start - Utils::s_CaptureStart : 0;
+			event.Duration = end - start;
+			if (stage == Stage::Tile)
+				event.Arguments = thread.Totals - thread.TileStart;
+		}
+	}
+}
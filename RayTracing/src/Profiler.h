@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Hot-path instrumentation: per-thread counters and stage timers, summed by CollectFrame(), and
+// a Chrome trace (chrome://tracing or Perfetto) of frames, tiles, resolves and uploads.
+// Nothing is recorded until SetEnabled(true); until then every macro costs one predictable
+// branch. Defining RT_NO_PROFILING (Dist builds) compiles the macros out entirely.
+namespace Profiler
+{
+	enum class Counter : uint32_t
+	{
+		Paths = 0,     // Camera samples
+		Rays,          // Extension rays, including the camera ray
+		ShadowRays,
+		Bounces,       // Extension rays that hit something and were shaded
+		SphereTests,   // Primitives tested, per type
+		BoxTests,
+		TriangleTests,
+		InstanceTests, // Instances entered in object space
+		Count
+	};
+
+	// Frame, Tile, Resolve and Upload are traced as events. The others run per ray or pixel and
+	// only add to their totals, which each tile's event carries as arguments.
+	enum class Stage : uint32_t
+	{
+		Frame = 0,
+		Tile,
+		CameraRays,
+		Trace,
+		Accumulate,
+		Resolve,
+		Denoise,
+		Upload,
+		Count
+	};
+
+	static constexpr uint32_t CounterCount = (uint32_t)Counter::Count;
+	static constexpr uint32_t StageCount = (uint32_t)Stage::Count;
+
+	const char* GetName(Counter counter);
+	const char* GetName(Stage stage);
+
+	struct Stats
+	{
+		std::array<uint64_t, CounterCount> Counters{};
+		std::array<uint64_t, StageCount> Nanoseconds{}; // Summed over threads
+
+		uint64_t Get(Counter counter) const { return Counters[(uint32_t)counter]; }
+		double GetMilliseconds(Stage stage) const { return Nanoseconds[(uint32_t)stage] * 1e-6; }
+
+		Stats& operator+=(const Stats& other);
+		Stats operator-(const Stats& other) const;
+	};
+
+	// False when compiled out
+	bool IsCompiledIn();
+	void SetEnabled(bool enabled);
+
+	// What every thread recorded since the last call. Call it between frames, while no other
+	// thread is recording.
+	Stats CollectFrame();
+
+	// Records trace events from BeginCapture() to EndCapture(), kept until the next BeginCapture()
+	void BeginCapture();
+	void EndCapture();
+	bool IsCapturing();
+	// Chrome trace event format, between frames as for CollectFrame()
+	bool WriteChromeTrace(const std::string& path);
+
+	namespace Detail
+	{
+		struct TraceEvent
+		{
+			Stage EventStage;
+			uint64_t Start;    // Nanoseconds since BeginCapture()
+			uint64_t Duration;
+			Stats Arguments;   // What the thread recorded during a tile, or a frame's counters
+			bool IsCounters = false;
+		};
+
+		struct ThreadData
+		{
+			uint32_t ThreadIndex = 0;
+			Stats Totals;
+			Stats TileStart; // Totals when the current tile began, while capturing
+			std::vector<TraceEvent> Events;
+		};
+
+		extern std::atomic<bool> s_Enabled;
+		extern std::atomic<bool> s_Capturing;
+
+		ThreadData* RegisterThread();
+		void RecordEvent(ThreadData& thread, Stage stage, uint64_t start, uint64_t end);
+
+		inline ThreadData& GetThreadData()
+		{
+			static thread_local ThreadData* s_ThreadData = nullptr;
+			if (!s_ThreadData)
+				s_ThreadData = RegisterThread();
+			return *s_ThreadData;
+		}
+
+		inline uint64_t Now()
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+	}
+
+	inline bool IsEnabled() { return Detail::s_Enabled.load(std::memory_order_relaxed); }
+
+	inline void Count(Counter counter, uint64_t amount = 1)
+	{
+		if (IsEnabled())
+			Detail::GetThreadData().Totals.Counters[(uint32_t)counter] += amount;
+	}
+
+	class ScopedTimer
+	{
+	public:
+		explicit ScopedTimer(Stage stage)
+			: m_Stage(stage), m_Active(IsEnabled())
+		{
+			if (!m_Active)
+				return;
+
+			// A tile's event reports what happened inside it
+			if (stage == Stage::Tile && Detail::s_Capturing.load(std::memory_order_relaxed))
+			{
+				Detail::ThreadData& thread = Detail::GetThreadData();
+				thread.TileStart = thread.Totals;
+			}
+			m_Start = Detail::Now();
+		}
+
+		~ScopedTimer()
+		{
+			if (!m_Active)
+				return;
+
+			uint64_t end = Detail::Now();
+			Detail::ThreadData& thread = Detail::GetThreadData();
+			thread.Totals.Nanoseconds[(uint32_t)m_Stage] += end - m_Start;
+
+			bool traced = m_Stage == Stage::Frame || m_Stage == Stage::Tile || m_Stage == Stage::Resolve || m_Stage == Stage::Denoise || m_Stage == Stage::Upload;
+			if (traced && Detail::s_Capturing.load(std::memory_order_relaxed))
+				Detail::RecordEvent(thread, m_Stage, m_Start, end);
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+	private:
+		Stage m_Stage;
+		bool m_Active;
+		uint64_t m_Start = 0;
+	};
+}
+
+#ifndef RT_NO_PROFILING
+	#define RT_PROFILE_JOIN_INNER(a, b) a##b
+	#define RT_PROFILE_JOIN(a, b) RT_PROFILE_JOIN_INNER(a, b)
+	#define RT_PROFILE_SCOPE(stage) ::Profiler::ScopedTimer RT_PROFILE_JOIN(profileScope, __LINE__)(::Profiler::Stage::stage)
+	#define RT_PROFILE_COUNT(counter, amount) ::Profiler::Count(::Profiler::Counter::counter, amount)
+#else
+	#define RT_PROFILE_SCOPE(stage)
+	#define RT_PROFILE_COUNT(counter, amount)
+#endif
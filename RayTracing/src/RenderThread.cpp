@@ -0,0 +1,192 @@
+#include "RenderThread.h"
+
+#include "Walnut/Timer.h"
+
+#include <cstring>
+
+namespace Utils
+{
+	// Frames cut short in a row before the next one is let finish, so a steady stream of
+	// messages (a camera being dragged) still shows frames
+	static constexpr uint32_t MaxConsecutiveCancels = 2;
+}
+
+RenderThread::RenderThread(Scene scene)
+	: m_Scene(std::move(scene)), m_Thread([this]() { Run(); })
+{
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_MessageMutex);
+		m_Stop = true;
+		m_Renderer.Cancel();
+	}
+	m_WakeCondition.notify_one();
+	m_Thread.join();
+}
+
+void RenderThread::Post(Message message, bool changesView)
+{
+	PostInternal([this, message = std::move(message)]() { message(m_Renderer, m_Scene, m_Camera); }, changesView);
+}
+
+void RenderThread::SetViewportSize(uint32_t width, uint32_t height)
+{
+	PostInternal([this, width, height]()
+	{
+		m_ViewportWidth = width;
+		m_ViewportHeight = height;
+	}, false);
+}
+
+void RenderThread::SetFrameBudget(const FrameBudget::Settings& settings)
+{
+	PostInternal([this, settings]() { m_FrameBudget.GetSettings() = settings; }, false);
+}
+
+void RenderThread::CaptureTrace(uint32_t frameCount, const std::string& path)
+{
+	PostInternal([this, frameCount, path]()
+	{
+		Profiler::BeginCapture();
+		m_CaptureFramesLeft = frameCount;
+		m_TracePath = path;
+		m_CaptureStatus.clear();
+		m_Renderer.ResetFrameIndex();
+	}, false);
+}
+
+void RenderThread::PostInternal(std::function<void()> message, bool changesView)
+{
+	// Cancelled under the lock, so the cancel cannot land after Run() has taken the message
+	// and cut short the frame that was meant to show it
+	{
+		std::lock_guard<std::mutex> lock(m_MessageMutex);
+		m_Messages.push_back(std::move(message));
+		m_ViewChanged |= changesView;
+		if (m_Cancellable)
+			m_Renderer.Cancel();
+	}
+	m_WakeCondition.notify_one();
+}
+
+void RenderThread::Run()
+{
+	std::vector<std::function<void()>> messages;
+	while (true)
+	{
+		bool viewChanged;
+		{
+			std::unique_lock<std::mutex> lock(m_MessageMutex);
+			m_WakeCondition.wait(lock, [this]() { return m_Stop || !m_Messages.empty() || !m_Idle; });
+			if (m_Stop)
+				return;
+
+			messages.swap(m_Messages);
+			viewChanged = m_ViewChanged;
+			m_ViewChanged = false;
+			m_Renderer.ClearCancel();
+			m_Cancellable = m_ConsecutiveCancels < Utils::MaxConsecutiveCancels;
+		}
+
+		if (!messages.empty())
+		{
+			std::lock_guard<std::mutex> lock(m_SceneMutex);
+			for (const std::function<void()>& message : messages)
+				message();
+			m_MessageCount += messages.size();
+			messages.clear();
+
+			if (m_Scene.HasPendingChanges())
+			{
+				Walnut::Timer timer;
+				m_LastChanges = m_Scene.CommitChanges();
+				m_LastCommitMilliseconds = timer.ElapsedMillis();
+			}
+		}
+
+		// One core is left to the thread that posts messages and shows the frames
+		Renderer::Settings& settings = m_Renderer.GetSettings();
+		if (settings.WorkerCount == 0)
+			settings.WorkerCount = glm::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+		m_Idle = m_ViewportWidth == 0 || m_ViewportHeight == 0;
+		if (m_Idle)
+			continue;
+
+		Walnut::Timer timer;
+		m_FrameBudget.Update(viewChanged);
+		uint32_t width, height;
+		m_FrameBudget.GetRenderSize(m_ViewportWidth, m_ViewportHeight, width, height);
+		m_Renderer.OnResize(width, height);
+		m_Camera.OnResize(width, height);
+		m_Renderer.Render(m_Scene, m_Camera);
+		m_Profile += Profiler::CollectFrame();
+		if (m_Renderer.WasCancelled())
+		{
+			// Counted as the whole frame it would have been, so the budget lowers the resolution
+			// until frames fit between messages
+			uint32_t sampledTiles = 0;
+			for (const Renderer::TileTiming& tile : m_Renderer.GetTileTimings())
+				sampledTiles += tile.Sampled;
+			if (sampledTiles > 0)
+				m_FrameBudget.AddFrameTime(timer.ElapsedMillis() * m_Renderer.GetTileCount() / sampledTiles);
+
+			m_CancelledFrames++;
+			m_ConsecutiveCancels++;
+			continue;
+		}
+		m_ConsecutiveCancels = 0;
+
+		// Render() does not resolve a converged image if resolves are left to the caller
+		if (m_Renderer.IsConverged())
+			m_Renderer.Resolve();
+
+		float renderMilliseconds = timer.ElapsedMillis();
+		m_FrameBudget.AddFrameTime(renderMilliseconds);
+		PublishFrame(renderMilliseconds);
+
+		m_Idle = m_Renderer.IsConverged() && m_FrameBudget.GetScale() == 1.0f;
+	}
+}
+
+void RenderThread::PublishFrame(float renderMilliseconds)
+{
+	if (m_CaptureFramesLeft > 0 && --m_CaptureFramesLeft == 0)
+	{
+		Profiler::EndCapture();
+		m_CaptureStatus = Profiler::WriteChromeTrace(m_TracePath) ? "Wrote " + m_TracePath : "Failed to write " + m_TracePath;
+	}
+
+	Frame& frame = m_Frames.GetBack();
+	frame.Width = m_Renderer.GetWidth();
+	frame.Height = m_Renderer.GetHeight();
+	frame.Pixels.resize((size_t)frame.Width * frame.Height);
+	std::memcpy(frame.Pixels.data(), m_Renderer.GetImageData(), frame.Pixels.size() * sizeof(uint32_t));
+	frame.Number = ++m_FrameNumber;
+	frame.AccumulatedFrames = m_Renderer.GetFrameIndex() - 1;
+	frame.MessageCount = m_MessageCount;
+
+	frame.RenderMilliseconds = renderMilliseconds;
+	frame.ResolveMilliseconds = m_Renderer.GetLastResolveTime();
+	frame.DenoiseMilliseconds = m_Renderer.GetLastDenoiseTime();
+	frame.RenderScale = m_FrameBudget.GetScale();
+	frame.WorkerCount = m_Renderer.GetWorkerCount();
+	frame.ActiveTileCount = m_Renderer.GetActiveTileCount();
+	frame.TileCount = m_Renderer.GetTileCount();
+	frame.Converged = m_Renderer.IsConverged();
+	frame.ReprojectedPixelCount = m_Renderer.GetLastReprojectedPixelCount();
+	frame.CancelledFrames = m_CancelledFrames;
+
+	frame.LastChanges = m_LastChanges;
+	frame.LastCommitMilliseconds = m_LastCommitMilliseconds;
+
+	frame.Profile = m_Profile;
+	m_Profile = Profiler::Stats();
+	frame.CaptureFramesLeft = m_CaptureFramesLeft;
+	frame.CaptureStatus = m_CaptureStatus;
+
+	m_Frames.Publish();
+}
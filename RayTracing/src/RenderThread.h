@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Renderer.h"
+#include "FrameBudget.h"
+#include "Profiler.h"
+#include "TripleBuffer.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs a Renderer on its own thread, so the UI keeps its refresh rate however long frames take.
+// The thread owns the renderer, the scene and a copy of the camera, and keeps accumulating
+// frames until the image has converged at full resolution. Every finished frame is copied into
+// a TripleBuffer the UI picks the latest one from without locking. Changes reach the thread as
+// messages: posting one cancels the frame in flight (tiles already started finish), unless the
+// two before it were cancelled too, and the thread applies all queued messages, in order,
+// before it starts the next. The resolution follows a FrameBudget, lowered while messages that
+// change the view keep arriving, and cancelled frames count as what they would have cost.
+class RenderThread
+{
+public:
+	using Message = std::function<void(Renderer& renderer, Scene& scene, Camera& camera)>;
+
+	// A finished frame and the renderer's state after it
+	struct Frame
+	{
+		std::vector<uint32_t> Pixels; // RGBA, bottom row first
+		uint32_t Width = 0, Height = 0;
+		uint64_t Number = 0;            // Frames published so far, 0 before the first
+		uint32_t AccumulatedFrames = 0; // Since accumulation restarted
+		uint64_t MessageCount = 0;      // Posted messages applied before the frame started
+
+		float RenderMilliseconds = 0.0f; // Resize, sampling and resolve
+		float ResolveMilliseconds = 0.0f;
+		float DenoiseMilliseconds = 0.0f;
+		float RenderScale = 1.0f;
+		uint32_t WorkerCount = 0;
+		uint32_t ActiveTileCount = 0, TileCount = 0;
+		bool Converged = false;
+		uint32_t ReprojectedPixelCount = 0;
+		uint64_t CancelledFrames = 0; // Cut short by messages, since the thread started
+
+		SceneChanges LastChanges; // Of the last commit of scene edits
+		float LastCommitMilliseconds = 0.0f;
+
+		// Recorded since the last published frame, cancelled frames included
+		Profiler::Stats Profile;
+		uint32_t CaptureFramesLeft = 0;
+		std::string CaptureStatus;
+	};
+
+public:
+	explicit RenderThread(Scene scene);
+	~RenderThread();
+
+	RenderThread(const RenderThread&) = delete;
+	RenderThread& operator=(const RenderThread&) = delete;
+
+	// Queues message for the render thread and cancels the frame in flight. changesView marks
+	// camera moves and scene edits, which the frame budget answers with a lower resolution.
+	// Scene edits are committed after the messages that made them.
+	void Post(Message message, bool changesView = false);
+
+	// Size of the image the UI displays; the thread waits while it is 0
+	void SetViewportSize(uint32_t width, uint32_t height);
+	void SetFrameBudget(const FrameBudget::Settings& settings);
+	// Writes a Chrome trace of the next frameCount frames to path, restarting accumulation so
+	// that there are frames to capture
+	void CaptureTrace(uint32_t frameCount, const std::string& path);
+
+	// Takes the latest frame published since the last call, if any, into GetFrame()
+	bool AcquireFrame() { return m_Frames.Acquire(); }
+	const Frame& GetFrame() const { return m_Frames.GetFront(); }
+
+	// The scene messages edit, for reading on other threads while holding the lock, which the
+	// render thread takes while it applies messages. Rendering only reads it.
+	std::unique_lock<std::mutex> LockScene() { return std::unique_lock<std::mutex>(m_SceneMutex); }
+	const Scene& GetScene() const { return m_Scene; }
+private:
+	void Run();
+	void PostInternal(std::function<void()> message, bool changesView);
+	void PublishFrame(float renderMilliseconds);
+private:
+	Renderer m_Renderer;
+	Scene m_Scene;
+	Camera m_Camera{ 45.0f, 0.1f, 100.0f };
+	std::mutex m_SceneMutex;
+
+	std::mutex m_MessageMutex;
+	std::condition_variable m_WakeCondition;
+	std::vector<std::function<void()>> m_Messages;
+	bool m_ViewChanged = false; // By a queued message
+	bool m_Cancellable = true;  // Messages cancel the frame in flight
+	bool m_Stop = false;
+
+	// Render thread only
+	FrameBudget m_FrameBudget;
+	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
+	bool m_Idle = true; // Converged at full resolution, or no viewport: wait for a message
+	uint64_t m_FrameNumber = 0;
+	uint64_t m_MessageCount = 0;
+	uint64_t m_CancelledFrames = 0;
+	uint32_t m_ConsecutiveCancels = 0;
+	SceneChanges m_LastChanges;
+	float m_LastCommitMilliseconds = 0.0f;
+	Profiler::Stats m_Profile;
+	uint32_t m_CaptureFramesLeft = 0;
+	std::string m_TracePath, m_CaptureStatus;
+
+	TripleBuffer<Frame> m_Frames;
+
+	std::thread m_Thread; // Last, so it starts with everything else constructed
+};
@@ -1,165 +1,1356 @@
 #include "Renderer.h"
-#include "Walnut/Random.h"
+#include "ChunkCache.h"
+#include "Profiler.h"
 
-#include <execution>
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
 
 namespace Utils
 {
-	static uint32_t ConvertToRGBA(const glm::vec4& color)
+	// Rays traced by the current thread, flushed into Renderer::m_RayCount once per tile
+	static thread_local uint64_t s_ThreadRayCount = 0;
+
+	// Set by the tracing functions when a ray needs a chunk that is not resident, so the sample
+	// being taken is thrown away and taken again once it is; reset before every sample
+	static thread_local bool s_ThreadSampleDeferred = false;
+	// Chunk lookups of the current thread, flushed into the ChunkCache once per tile
+	static thread_local uint64_t s_ThreadChunkHits = 0, s_ThreadChunkMisses = 0;
+
+	static bool TakeSampleDeferred()
+	{
+		bool deferred = s_ThreadSampleDeferred;
+		s_ThreadSampleDeferred = false;
+		return deferred;
+	}
+
+	static uint32_t GetBounceCount(const Renderer::Settings& settings)
+	{
+		return std::clamp(settings.MaxBounces, 1u, Renderer::MaxBounceLimit);
+	}
+
+	static constexpr float Pi = 3.14159265358979f;
+
+	// Scattering for scene lights: Lambertian diffuse mixed by Material::Metalic with a
+	// normalized Phong lobe around the mirror direction, which narrows as Roughness goes to 0
+	static float GetPhongExponent(const Material& material)
+	{
+		float roughness = glm::max(material.Roughness, 0.01f);
+		return 2.0f / (roughness * roughness) - 2.0f;
+	}
+
+	// BSDF times nothing (the caller multiplies in the cosine) and the density SampleBsdf()
+	// picks incoming with. Both vectors point away from the surface.
+	static glm::vec3 EvaluateBsdf(const Material& material, const glm::vec3& normal, const glm::vec3& outgoing, const glm::vec3& incoming, float& pdf)
+	{
+		float cosIncoming = glm::dot(normal, incoming);
+		if (cosIncoming <= 0.0f)
+		{
+			pdf = 0.0f;
+			return glm::vec3(0.0f);
+		}
+
+		float specular = glm::clamp(material.Metalic, 0.0f, 1.0f);
+		float exponent = GetPhongExponent(material);
+		float lobe = glm::pow(glm::max(glm::dot(glm::reflect(-outgoing, normal), incoming), 0.0f), exponent);
+
+		pdf = (1.0f - specular) * cosIncoming / Pi + specular * (exponent + 1.0f) / (2.0f * Pi) * lobe;
+		return material.Albedo * ((1.0f - specular) / Pi + specular * (exponent + 2.0f) / (2.0f * Pi) * lobe);
+	}
+
+	static glm::vec3 SampleBsdf(const Material& material, const glm::vec3& normal, const glm::vec3& outgoing, float uLobe, const glm::vec2& u,
+		glm::vec3& incoming, float& pdf)
+	{
+		glm::vec3 axis = normal;
+		float cosTheta = glm::sqrt(u.x); // Cosine-weighted
+		if (uLobe < material.Metalic)
+		{
+			axis = glm::reflect(-outgoing, normal);
+			cosTheta = glm::pow(u.x, 1.0f / (GetPhongExponent(material) + 1.0f));
+		}
+
+		float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = 2.0f * Pi * u.y;
+		glm::vec3 tangent, bitangent;
+		Sampling::BuildBasis(axis, tangent, bitangent);
+		incoming = tangent * (sinTheta * glm::cos(phi)) + bitangent * (sinTheta * glm::sin(phi)) + axis * cosTheta;
+
+		return EvaluateBsdf(material, normal, outgoing, incoming, pdf);
+	}
+
+	// Weight of a sample of density pdf against another strategy's otherPdf; written as a ratio
+	// so the huge densities of small lights do not overflow when squared
+	static float PowerHeuristic(float pdf, float otherPdf)
+	{
+		float ratio = otherPdf / pdf;
+		return 1.0f / (1.0f + ratio * ratio);
+	}
+
+	// Denoiser guides for a camera ray's hit, with the normal turned towards the camera
+	static PixelFeatures GetFeatures(const glm::vec3& direction, const glm::vec3& position, const glm::vec3& normal, float distance, const Material& material)
+	{
+		PixelFeatures features;
+		features.Albedo = material.Albedo;
+		features.Normal = glm::dot(normal, direction) > 0.0f ? -normal : normal;
+		features.Depth = distance;
+		features.Position = position;
+		return features;
+	}
+
+	// Whether samples taken with one camera can be reprojected into the other: only the
+	// position, direction and resolution may differ, and a lens blurs what a pixel sees
+	static bool CanReproject(const Camera& from, const Camera& to)
+	{
+		return from.GetVerticalFOV() == to.GetVerticalFOV() && from.GetProjectionType() == to.GetProjectionType() &&
+			from.GetOrthographicHeight() == to.GetOrthographicHeight() && from.GetLensRadius() == 0.0f && to.GetLensRadius() == 0.0f;
+	}
+
+	static bool IsSameCamera(const Camera& a, const Camera& b)
+	{
+		return a.GetView() == b.GetView() && a.GetProjection() == b.GetProjection() && CanReproject(a, b) &&
+			a.GetViewportWidth() == b.GetViewportWidth() && a.GetViewportHeight() == b.GetViewportHeight() &&
+			a.GetLensRadius() == b.GetLensRadius() && a.GetFocusDistance() == b.GetFocusDistance();
+	}
+
+	// Interleaves the bits of x and y (Z-order curve)
+	static uint32_t MortonCode(uint32_t x, uint32_t y)
+	{
+		auto spread = [](uint32_t v)
+		{
+			v &= 0x0000ffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+		return spread(x) | (spread(y) << 1);
+	}
+
+	// Primitive tests by type for the profiler. The kernels test every lane of a leaf.
+	static void CountLeafTests(const Geometry& geometry, uint32_t first, uint32_t count)
 	{
-		uint8_t r = (uint8_t)(color.r * 255.0f);
-		uint8_t g = (uint8_t)(color.g * 255.0f);
-		uint8_t b = (uint8_t)(color.b * 255.0f);
-		uint8_t a = (uint8_t)(color.a * 255.0f);
+#ifndef RT_NO_PROFILING
+		if (!Profiler::IsEnabled())
+			return;
 
-		uint32_t result = (a << 24) | (b << 16) | (g << 8) | r;
-		return result;
+		uint32_t spheres = 0;
+		for (uint32_t lane = first; lane < first + count; lane++)
+			spheres += geometry.LeafPrimitives[lane].GetType() == PrimitiveType::Sphere;
+		Profiler::Count(Profiler::Counter::SphereTests, spheres);
+		Profiler::Count(Profiler::Counter::BoxTests, count - spheres);
+#endif
 	}
 }
 void Renderer::OnResize(uint32_t width, uint32_t height)
 {
-	if (m_FinalImage)
+	// No resize
+	if (m_ImageData && m_Width == width && m_Height == height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+	
+	delete[] m_ImageData;
+	m_ImageData = new uint32_t[width * height];
+	memset(m_ImageData, 0, width * height * sizeof(uint32_t));
+
+	// While reprojecting, the samples so far become the history of the first frame at the new
+	// size, as after a camera move, so that a change of resolution does not start over
+	uint32_t frameIndex = m_FrameIndex;
+	m_HistoryBegun = m_Reprojecting && m_FrameIndex > 1;
+	if (m_HistoryBegun)
 	{
-		// No resize
-		if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height)
-			return;
-		m_FinalImage->Resize(width, height);
+		m_Reprojection.Begin(m_AccumulationBuffer, m_PixelSamples, m_SampledCamera, width, height);
 	}
 	else
 	{
-		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		m_AccumulationBuffer.Resize(width, height);
+		m_PixelSamples.assign((size_t)width * height, 0);
+		if (m_Reprojecting)
+			m_Reprojection.Resize(width, height);
 	}
-	
-	delete[] m_ImageData;
-	m_ImageData = new uint32_t[width * height];
-	
-	delete[] m_AccumulationData;
-	m_AccumulationData = new glm::vec4[width * height];
+	m_PendingSamples.assign((size_t)width * height, 0);
+	if (m_Denoising)
+		m_Denoiser.Resize(width, height);
+
+	UpdateTiles();
+	if (m_HistoryBegun)
+		m_FrameIndex = frameIndex;
+}
+
+void Renderer::UpdateTiles()
+{
+	m_TileSize = glm::max(m_Settings.TileSize, 1u);
+
+	uint32_t tilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+	uint32_t tilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+
+	std::vector<std::pair<uint32_t, TileTiming>> tiles;
+	tiles.reserve(tilesX * tilesY);
+	for (uint32_t ty = 0; ty < tilesY; ty++)
+	{
+		for (uint32_t tx = 0; tx < tilesX; tx++)
+		{
+			TileTiming tile{};
+			tile.X = tx * m_TileSize;
+			tile.Y = ty * m_TileSize;
+			tile.Width = glm::min(m_TileSize, m_Width - tile.X);
+			tile.Height = glm::min(m_TileSize, m_Height - tile.Y);
+			tiles.push_back({ Utils::MortonCode(tx, ty), tile });
+		}
+	}
+
+	std::sort(tiles.begin(), tiles.end(),
+		[](const auto& a, const auto& b) { return a.first < b.first; });
+
+	m_TileTimings.clear();
+	for (const auto& [code, tile] : tiles)
+		m_TileTimings.push_back(tile);
+
+	m_DirtyTiles.assign(m_TileTimings.size(), 1);
+	m_TileSamples.assign(m_TileTimings.size(), 0);
+	m_TileRenders.assign(m_TileTimings.size(), 0);
+	m_ConvergedTiles.assign(m_TileTimings.size(), 0);
+	m_DeferredSamples.assign(m_TileTimings.size(), {});
+
+	// Per-tile sample counts no longer match what is accumulated
+	m_FrameIndex = 1;
+}
+
+void Renderer::RenderTile(uint32_t tileIndex, uint32_t workerIndex)
+{
+	RT_PROFILE_SCOPE(Tile);
+	Walnut::Timer timer;
+
+	TileTiming& tile = m_TileTimings[tileIndex];
+	Sampler& sampler = *m_WorkerSamplers[workerIndex];
+	std::vector<DeferredSample>& deferred = m_DeferredSamples[tileIndex];
+	uint32_t takenSamples = 0;
+	if (!deferred.empty())
+		takenSamples += RetryDeferredSamples(tileIndex, sampler, m_MegakernelStates[workerIndex]);
+
+	// The tile may only be active for its deferred samples
+	bool limitReached = m_Settings.MaxSamples > 0 && m_TileSamples[tileIndex] >= m_Settings.MaxSamples;
+	if (!m_ConvergedTiles[tileIndex] && !limitReached)
+	{
+		uint32_t sampleIndex = m_TileRenders[tileIndex]++;
+		uint32_t pathCount = tile.Width * tile.Height;
+		const std::vector<glm::vec3>* colors;
+		const std::vector<PixelFeatures>* features;
+		const std::vector<uint8_t>* deferredPaths;
+		if (m_Settings.Integrator == IntegratorType::Wavefront)
+		{
+			WavefrontState& state = m_WavefrontStates[workerIndex];
+			RenderTileWavefront(tile, sampleIndex + 1, state);
+			colors = &state.Colors;
+			features = &state.Features;
+			deferredPaths = &state.Deferred;
+		}
+		else
+		{
+			MegakernelState& state = m_MegakernelStates[workerIndex];
+			state.Resize(pathCount);
+			for (uint32_t path = 0; path < pathCount; path++)
+			{
+				// Seeded by how often the tile has been rendered, so renders do not depend on the
+				// thread layout, and carried on through camera moves so new samples stay fresh
+				uint32_t x = tile.X + path % tile.Width;
+				uint32_t y = tile.Y + path / tile.Width;
+				state.Deferred[path] = !SamplePixel(x, y, sampleIndex, sampler, state.Colors[path], state.Features[path]);
+			}
+			colors = &state.Colors;
+			features = &state.Features;
+			deferredPaths = &state.Deferred;
+		}
+
+		RT_PROFILE_SCOPE(Accumulate);
+		for (uint32_t path = 0; path < pathCount; path++)
+		{
+			uint32_t x = tile.X + path % tile.Width;
+			uint32_t y = tile.Y + path / tile.Width;
+			if ((*deferredPaths)[path])
+			{
+				DeferSample(deferred, x, y, sampleIndex);
+				continue;
+			}
+
+			AddSample(x + y * m_Width, (*colors)[path], (*features)[path]);
+			takenSamples++;
+		}
+	}
+	m_DirtyTiles[tileIndex] = 1;
+
+	// Reprojected pixels start from different counts; deferred samples count as taken, so the
+	// sample limit is not overshot by the time they are
+	uint32_t sampleCount = std::numeric_limits<uint32_t>::max();
+	for (uint32_t y = tile.Y; y < tile.Y + tile.Height; y++)
+	{
+		for (uint32_t x = tile.X; x < tile.X + tile.Width; x++)
+			sampleCount = std::min(sampleCount, m_PixelSamples[x + y * m_Width] + m_PendingSamples[x + y * m_Width]);
+	}
+	m_TileSamples[tileIndex] = sampleCount;
+
+	if (m_Settings.TargetNoise > 0.0f && sampleCount >= glm::max(m_Settings.MinSamples, 2u))
+		m_ConvergedTiles[tileIndex] = GetTileError(tileIndex) < m_Settings.TargetNoise;
+
+	m_RayCount.fetch_add(Utils::s_ThreadRayCount, std::memory_order_relaxed);
+	Utils::s_ThreadRayCount = 0;
+	m_SampleCount.fetch_add(takenSamples, std::memory_order_relaxed);
+	if (m_ActiveScene->Chunks)
+	{
+		m_ActiveScene->Chunks->AddLookups(Utils::s_ThreadChunkHits, Utils::s_ThreadChunkMisses);
+		Utils::s_ThreadChunkHits = Utils::s_ThreadChunkMisses = 0;
+	}
+
+	tile.Worker = workerIndex;
+	tile.Milliseconds = timer.ElapsedMillis();
+	tile.Sampled = true;
+}
+
+bool Renderer::SamplePixel(uint32_t x, uint32_t y, uint32_t sampleIndex, Sampler& sampler, glm::vec3& color, PixelFeatures& features)
+{
+	sampler.StartPixel(x, y, sampleIndex);
+	Utils::s_ThreadSampleDeferred = false;
+	features = PixelFeatures(); // Left as a miss's if the camera ray hits nothing
+	color = glm::vec3((this->*m_PerPixel)(x, y, sampler, m_RecordingFeatures ? &features : nullptr));
+	return !Utils::TakeSampleDeferred();
+}
+
+void Renderer::DeferSample(std::vector<DeferredSample>& deferred, uint32_t x, uint32_t y, uint32_t sampleIndex)
+{
+	deferred.push_back({ x, y, sampleIndex });
+	m_PendingSamples[x + y * m_Width]++;
+}
+
+uint32_t Renderer::RetryDeferredSamples(uint32_t tileIndex, Sampler& sampler, MegakernelState& state)
+{
+	// With the megakernel whichever integrator deferred them: the wavefront integrator takes the
+	// same paths. The same sample index gives the sample the random numbers it had.
+	std::vector<DeferredSample>& deferred = m_DeferredSamples[tileIndex];
+	state.Resize((uint32_t)deferred.size());
+	for (size_t i = 0; i < deferred.size(); i++)
+	{
+		const DeferredSample& sample = deferred[i];
+		state.Deferred[i] = !SamplePixel(sample.X, sample.Y, sample.SampleIndex, sampler, state.Colors[i], state.Features[i]);
+	}
+
+	RT_PROFILE_SCOPE(Accumulate);
+	size_t remaining = 0;
+	for (size_t i = 0; i < deferred.size(); i++)
+	{
+		DeferredSample sample = deferred[i];
+		if (state.Deferred[i])
+		{
+			deferred[remaining++] = sample;
+			continue;
+		}
+
+		uint32_t pixelIndex = sample.X + sample.Y * m_Width;
+		m_PendingSamples[pixelIndex]--;
+		AddSample(pixelIndex, state.Colors[i], state.Features[i]);
+	}
+	uint32_t taken = (uint32_t)(deferred.size() - remaining);
+	deferred.resize(remaining);
+	return taken;
+}
+
+uint64_t Renderer::GetDeferredSampleCount() const
+{
+	uint64_t count = 0;
+	for (const std::vector<DeferredSample>& deferred : m_DeferredSamples)
+		count += deferred.size();
+	return count;
+}
+
+void Renderer::AddSample(uint32_t pixelIndex, const glm::vec3& color, const PixelFeatures& features)
+{
+	uint32_t& sampleCount = m_PixelSamples[pixelIndex];
+	m_AccumulationBuffer.Add(pixelIndex, color, ++sampleCount);
+	if (m_Denoising)
+		m_Denoiser.AddFeatures(pixelIndex, features, sampleCount);
+
+	if (m_Reprojecting)
+	{
+		if (m_GatheringHistory && sampleCount == 1)
+		{
+			sampleCount = m_Reprojection.Gather(pixelIndex, features, m_Settings.ReprojectionHistory, m_AccumulationBuffer);
+			if (sampleCount > 1)
+				m_ReprojectedPixelCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		m_Reprojection.Record(pixelIndex, features, *m_ActiveCamera);
+	}
+}
+
+float Renderer::GetTileError(uint32_t tileIndex) const
+{
+	// The noisiest pixel decides, so edges and shadows keep the whole tile going
+	const TileTiming& tile = m_TileTimings[tileIndex];
+	float error = 0.0f;
+	for (uint32_t y = tile.Y; y < tile.Y + tile.Height; y++)
+	{
+		for (uint32_t x = tile.X; x < tile.X + tile.Width; x++)
+		{
+			uint32_t pixelIndex = x + y * m_Width;
+			error = glm::max(error, m_AccumulationBuffer.GetStandardError(pixelIndex, m_PixelSamples[pixelIndex]));
+		}
+	}
+	return error;
+}
+
+void Renderer::ResolveTile(uint32_t tileIndex)
+{
+	const TileTiming& tile = m_TileTimings[tileIndex];
+	m_AccumulationBuffer.Resolve(tile.X, tile.Y, tile.Width, tile.Height, m_PixelSamples.data(), m_ImageData);
+
+	if (m_Settings.ShowConvergence)
+		ShadeConvergence(tileIndex);
+}
+
+void Renderer::Denoise()
+{
+	RT_PROFILE_SCOPE(Denoise);
+	Walnut::Timer timer;
+
+	// Tiles not sampled yet go in black
+	m_ThreadPool->ParallelFor((uint32_t)m_TileTimings.size(),
+		[this](uint32_t i, uint32_t)
+		{
+			const TileTiming& tile = m_TileTimings[i];
+			m_AccumulationBuffer.GetMeans(tile.X, tile.Y, tile.Width, tile.Height, m_PixelSamples.data(),
+				m_Denoiser.GetColorPlane(0), m_Denoiser.GetColorPlane(1), m_Denoiser.GetColorPlane(2));
+		});
+
+	m_Denoiser.Run(*m_ThreadPool, m_Settings.Denoising, m_ImageData);
+
+	if (m_Settings.ShowConvergence)
+	{
+		m_ThreadPool->ParallelFor((uint32_t)m_TileTimings.size(),
+			[this](uint32_t i, uint32_t)
+			{
+				ShadeConvergence(i);
+			});
+	}
+
+	m_LastDenoiseTime = timer.ElapsedMillis();
+}
+
+void Renderer::ShadeConvergence(uint32_t tileIndex)
+{
+	const TileTiming& tile = m_TileTimings[tileIndex];
+	bool converged = m_ConvergedTiles[tileIndex];
+	float targetNoise = glm::max(m_Settings.TargetNoise, std::numeric_limits<float>::min());
+
+	for (uint32_t y = tile.Y; y < tile.Y + tile.Height; y++)
+	{
+		for (uint32_t x = tile.X; x < tile.X + tile.Width; x++)
+		{
+			uint32_t& pixel = m_ImageData[x + y * m_Width];
+
+			// Keep a dim copy of the image under the mask
+			uint32_t gray = ((pixel & 0xff) + ((pixel >> 8) & 0xff) + ((pixel >> 16) & 0xff)) / 12;
+			uint32_t red = gray, green = gray;
+			if (converged)
+				green += 128;
+			else
+				red += (uint32_t)(191.0f * glm::min(m_AccumulationBuffer.GetStandardError(x + y * m_Width, m_PixelSamples[x + y * m_Width]) / targetNoise, 1.0f));
+
+			pixel = 0xff000000 | (gray << 16) | (green << 8) | red;
+		}
+	}
+}
+
+void Renderer::Resolve()
+{
+	if (!m_ThreadPool)
+		return;
+
+	Walnut::Timer timer;
+
+	// Switching the mask or the denoiser on or off changes tiles that have not been sampled
+	bool redrawAll = m_Settings.ShowConvergence != m_ShowingConvergence || m_Denoising != m_ShowingDenoised;
+	m_ShowingConvergence = m_Settings.ShowConvergence;
+	m_ShowingDenoised = m_Denoising;
+
+	m_ResolveTiles.clear();
+	for (uint32_t i = 0; i < (uint32_t)m_DirtyTiles.size(); i++)
+	{
+		if ((m_DirtyTiles[i] || redrawAll) && m_TileSamples[i] > 0)
+			m_ResolveTiles.push_back(i);
+		m_DirtyTiles[i] = 0;
+	}
+
+	m_LastDenoiseTime = 0.0f;
+	if (m_Denoising && !m_ResolveTiles.empty())
+	{
+		// The filter spreads every change over its whole radius, so all tiles are redone
+		Denoise();
+	}
+	else
+	{
+		RT_PROFILE_SCOPE(Resolve);
+		m_ThreadPool->ParallelFor((uint32_t)m_ResolveTiles.size(),
+			[this](uint32_t i, uint32_t)
+			{
+				ResolveTile(m_ResolveTiles[i]);
+			});
+	}
+
+	m_FramesSinceResolve = 0;
+	m_LastResolveTime = timer.ElapsedMillis();
+}
+
+void Renderer::Render(const Scene& scene, const Camera& camera)
+{
+	RT_PROFILE_SCOPE(Frame);
+	m_ActiveScene  = &scene;
+	m_ActiveCamera = &camera;
+	m_LeafIntersect = Kernels::GetLeafIntersect();
+	SelectIntegrator();
+	if (scene.Chunks)
+		scene.Chunks->BeginFrame();
+
+	const glm::vec3& rayOrigin = camera.GetPosition();
+
+
+	AccumulationBuffer::Format format = m_Settings.HalfPrecisionAccumulation ? AccumulationBuffer::Format::Float16 : AccumulationBuffer::Format::Float32;
+	if (format != m_AccumulationBuffer.GetFormat())
+	{
+		m_AccumulationBuffer.SetFormat(format);
+		m_FrameIndex = 1;
+	}
+
+	// The guides only accumulate while denoising, so turning it on starts over
+	if (m_Settings.Denoise != m_Denoising)
+	{
+		m_Denoising = m_Settings.Denoise;
+		m_Denoiser.Resize(m_Denoising ? m_Width : 0, m_Denoising ? m_Height : 0);
+		if (m_Denoising)
+			m_FrameIndex = 1;
+	}
+
+	// Likewise the first hits reprojection looks for
+	if (m_Settings.Reproject != m_Reprojecting)
+	{
+		m_Reprojecting = m_Settings.Reproject;
+		m_Reprojection.Resize(m_Reprojecting ? m_Width : 0, m_Reprojecting ? m_Height : 0);
+		if (m_Reprojecting)
+			m_FrameIndex = 1;
+	}
+	m_RecordingFeatures = m_Denoising || m_Reprojecting;
+
+	// Revisions are unique across scenes, so this also catches a different scene
+	if (scene.GetRevision() != m_SceneRevision)
+	{
+		m_SceneRevision = scene.GetRevision();
+		m_FrameIndex = 1;
+	}
+
+	// Every tile is sampled in the frame after a move, which is when pixels take in the history.
+	// OnResize() has already moved the samples into it if the resolution changed.
+	bool historyBegun = m_HistoryBegun;
+	m_HistoryBegun = false;
+	m_GatheringHistory = false;
+	if (!Utils::IsSameCamera(camera, m_SampledCamera))
+	{
+		m_GatheringHistory = m_Reprojecting && m_FrameIndex > 1 && Utils::CanReproject(m_SampledCamera, camera);
+		if (m_GatheringHistory && !historyBegun)
+			m_Reprojection.Begin(m_AccumulationBuffer, m_PixelSamples, m_SampledCamera);
+		else if (!m_GatheringHistory)
+			m_FrameIndex = 1;
+		m_SampledCamera = camera;
+	}
+	else if (historyBegun)
+		m_FrameIndex = 1;
+
+	if (m_FrameIndex == 1)
+	{
+		m_AccumulationBuffer.Clear();
+		if (m_Denoising)
+			m_Denoiser.ClearFeatures();
+		std::fill(m_PixelSamples.begin(), m_PixelSamples.end(), 0);
+		std::fill(m_TileRenders.begin(), m_TileRenders.end(), 0);
+	}
+
+	// Deferred samples belong to the camera they were taken with
+	if (m_FrameIndex == 1 || m_GatheringHistory)
+	{
+		std::fill(m_TileSamples.begin(), m_TileSamples.end(), 0);
+		std::fill(m_ConvergedTiles.begin(), m_ConvergedTiles.end(), (uint8_t)0);
+		for (std::vector<DeferredSample>& deferred : m_DeferredSamples)
+			deferred.clear();
+		std::fill(m_PendingSamples.begin(), m_PendingSamples.end(), 0);
+	}
+	m_ReprojectedPixelCount = 0;
+
+	m_RayCount = 0;
+	m_SampleCount = 0;
+
+	UpdateThreadPool();
+
+	if (m_Settings.TileSize != m_TileSize)
+		UpdateTiles();
+
+	// Converged tiles drop out, so the frame's threads all go to the tiles that are still noisy
+	m_ActiveTiles.clear();
+	for (uint32_t i = 0; i < (uint32_t)m_TileTimings.size(); i++)
+	{
+		TileTiming& tile = m_TileTimings[i];
+		tile.Sampled = false;
+		tile.Milliseconds = 0.0f;
+
+		bool limitReached = m_Settings.MaxSamples > 0 && m_TileSamples[i] >= m_Settings.MaxSamples;
+		bool sampling = !m_ConvergedTiles[i] && !limitReached;
+		if (!sampling && m_DeferredSamples[i].empty())
+			continue;
+
+		m_ActiveTiles.push_back(i);
+	}
+
+	m_ThreadPool->ParallelFor((uint32_t)m_ActiveTiles.size(),
+		[this](uint32_t i, uint32_t workerIndex)
+		{
+			if (!m_Cancelled.load(std::memory_order_relaxed))
+				RenderTile(m_ActiveTiles[i], workerIndex);
+		});
+	m_LastFrameCancelled = m_Cancelled.load(std::memory_order_relaxed);
+
+	m_LastFrameRayCount = m_RayCount;
+	m_LastFrameSampleCount = m_SampleCount;
+	if (m_GatheringHistory)
+		m_LastReprojectedPixelCount = m_ReprojectedPixelCount;
+
+	m_ActiveTileCount = 0;
+	for (uint32_t tileIndex : m_ActiveTiles)
+	{
+		bool limitReached = m_Settings.MaxSamples > 0 && m_TileSamples[tileIndex] >= m_Settings.MaxSamples;
+		if ((!m_ConvergedTiles[tileIndex] && !limitReached) || !m_DeferredSamples[tileIndex].empty())
+			m_ActiveTileCount++;
+	}
+
+	m_FramesSinceResolve++;
+	bool resolveDue = m_Settings.ResolveInterval > 0 && m_FramesSinceResolve >= m_Settings.ResolveInterval;
+	if (!m_LastFrameCancelled && (resolveDue || (m_ActiveTileCount == 0 && m_Settings.ResolveInterval > 0)))
+		Resolve();
+
+	if (m_Settings.Accumulate)
+		m_FrameIndex++;
+	else
+		m_FrameIndex = 1;
+
+}
+void Renderer::RenderRegions(const Scene& scene, const Camera& camera, std::vector<Region>& regions)
+{
+	RT_PROFILE_SCOPE(Frame);
+	m_ActiveScene  = &scene;
+	m_ActiveCamera = &camera;
+	m_LeafIntersect = Kernels::GetLeafIntersect();
+	SelectIntegrator();
+
+	UpdateThreadPool();
+
+	m_RayCount = 0;
+	std::vector<std::vector<DeferredSample>> deferred(regions.size());
+	if (scene.Chunks)
+		scene.Chunks->BeginFrame();
+	m_ThreadPool->ParallelFor((uint32_t)regions.size(),
+		[&](uint32_t i, uint32_t workerIndex)
+		{
+			RenderRegion(regions[i], workerIndex, deferred[i]);
+		});
+
+	// Nothing can be left to a later call, so wait for the chunks deferred samples asked for
+	// and take those again; they are summed after the others. A round that finishes none stops
+	// evicting, so samples whose paths need more chunks than the budget holds still finish.
+	// Samples that need a chunk which failed to load never do; the caller reports the error.
+	auto countDeferred = [&]()
+	{
+		size_t count = 0;
+		for (const std::vector<DeferredSample>& samples : deferred)
+			count += samples.size();
+		return count;
+	};
+	size_t lastDeferred = 0;
+	for (size_t deferredCount = countDeferred(); scene.Chunks && deferredCount > 0; deferredCount = countDeferred())
+	{
+		scene.Chunks->WaitForLoads();
+		scene.Chunks->BeginFrame(deferredCount != lastDeferred);
+		if (!scene.Chunks->GetError().empty())
+			break;
+		lastDeferred = deferredCount;
+		m_ThreadPool->ParallelFor((uint32_t)regions.size(),
+			[&](uint32_t i, uint32_t workerIndex)
+			{
+				Region& region = regions[i];
+				Sampler& sampler = *m_WorkerSamplers[workerIndex];
+				size_t remaining = 0;
+				for (const DeferredSample& sample : deferred[i])
+				{
+					glm::vec3 color;
+					PixelFeatures features;
+					if (!SamplePixel(sample.X, sample.Y, sample.SampleIndex, sampler, color, features))
+					{
+						deferred[i][remaining++] = sample;
+						continue;
+					}
+
+					float* pixel = &region.Pixels[3 * ((size_t)(sample.X - region.X) + (size_t)(sample.Y - region.Y) * region.Width)];
+					pixel[0] += color.r;
+					pixel[1] += color.g;
+					pixel[2] += color.b;
+				}
+				deferred[i].resize(remaining);
+
+				m_RayCount.fetch_add(Utils::s_ThreadRayCount, std::memory_order_relaxed);
+				Utils::s_ThreadRayCount = 0;
+				scene.Chunks->AddLookups(Utils::s_ThreadChunkHits, Utils::s_ThreadChunkMisses);
+				Utils::s_ThreadChunkHits = Utils::s_ThreadChunkMisses = 0;
+			});
+	}
+	m_LastFrameRayCount = m_RayCount;
+}
+
+void Renderer::RenderRegion(Region& region, uint32_t workerIndex, std::vector<DeferredSample>& deferred)
+{
+	RT_PROFILE_SCOPE(Tile);
+
+	// Summed in sample order, as the FP32 accumulation buffer does
+	region.Pixels.assign((size_t)region.Width * region.Height * 3, 0.0f);
+	TileTiming tile{ region.X, region.Y, region.Width, region.Height, workerIndex, 0.0f, true };
+	Sampler& sampler = *m_WorkerSamplers[workerIndex];
+	for (uint32_t sample = region.FirstSample; sample < region.FirstSample + region.SampleCount; sample++)
+	{
+		if (m_Settings.Integrator == IntegratorType::Wavefront)
+			RenderTileWavefront(tile, sample + 1, m_WavefrontStates[workerIndex]);
+
+		for (uint32_t path = 0; path < region.Width * region.Height; path++)
+		{
+			uint32_t x = region.X + path % region.Width;
+			uint32_t y = region.Y + path / region.Width;
+			glm::vec3 color;
+			bool taken;
+			if (m_Settings.Integrator == IntegratorType::Wavefront)
+			{
+				color = m_WavefrontStates[workerIndex].Colors[path];
+				taken = !m_WavefrontStates[workerIndex].Deferred[path];
+			}
+			else
+			{
+				PixelFeatures features;
+				taken = SamplePixel(x, y, sample, sampler, color, features);
+			}
+			if (!taken)
+			{
+				deferred.push_back({ x, y, sample });
+				continue;
+			}
+
+			float* pixel = &region.Pixels[3 * (size_t)path];
+			pixel[0] += color.r;
+			pixel[1] += color.g;
+			pixel[2] += color.b;
+		}
+	}
+
+	m_RayCount.fetch_add(Utils::s_ThreadRayCount, std::memory_order_relaxed);
+	Utils::s_ThreadRayCount = 0;
+	if (m_ActiveScene->Chunks)
+	{
+		m_ActiveScene->Chunks->AddLookups(Utils::s_ThreadChunkHits, Utils::s_ThreadChunkMisses);
+		Utils::s_ThreadChunkHits = Utils::s_ThreadChunkMisses = 0;
+	}
+}
+
+void Renderer::UpdateThreadPool()
+{
+	uint32_t workerCount = m_Settings.WorkerCount ? m_Settings.WorkerCount : glm::max(1u, std::thread::hardware_concurrency());
+	if (!m_ThreadPool || m_ThreadPool->GetWorkerCount() != workerCount)
+		m_ThreadPool = std::make_unique<ThreadPool>(workerCount);
+	if (m_Settings.Integrator == IntegratorType::Wavefront)
+		m_WavefrontStates.resize(m_ThreadPool->GetWorkerCount());
+	m_MegakernelStates.resize(m_ThreadPool->GetWorkerCount()); // Deferred samples are retried with the megakernel
+
+	// StartPixel() reseeds a sampler completely, so workers keep theirs across tiles and frames
+	if (m_WorkerSamplers.size() != m_ThreadPool->GetWorkerCount() || m_WorkerSamplerType != m_Settings.Sampling)
+	{
+		m_WorkerSamplers.resize(m_ThreadPool->GetWorkerCount());
+		for (std::unique_ptr<Sampler>& sampler : m_WorkerSamplers)
+			sampler = Sampler::Create(m_Settings.Sampling);
+		m_WorkerSamplerType = m_Settings.Sampling;
+	}
+}
+
+const char* Renderer::GetIntegratorName(IntegratorType type)
+{
+	switch (type)
+	{
+		case IntegratorType::Megakernel: return "megakernel";
+		case IntegratorType::Wavefront:  return "wavefront";
+	}
+	return "unknown";
+}
+
+void Renderer::MegakernelState::Resize(uint32_t sampleCount)
+{
+	Colors.resize(sampleCount);
+	Features.resize(sampleCount);
+	Deferred.resize(sampleCount);
+}
+
+void Renderer::WavefrontState::Resize(uint32_t pathCount, SamplerType sampling)
+{
+	Rays.resize(pathCount);
+	Colors.resize(pathCount);
+	Multipliers.resize(pathCount);
+	Hits.resize(pathCount);
+	Payloads.resize(pathCount);
+	LightCosines.resize(pathCount);
+	ShadowRays.resize(pathCount);
+	Occluded.resize(pathCount);
+	Deferred.resize(pathCount);
+	Throughputs.resize(pathCount);
+	BsdfPdfs.resize(pathCount);
+	LightContributions.resize(pathCount);
+	ShadowDistances.resize(pathCount);
+	Features.resize(pathCount);
+
+	// Only the selected sampler type is allocated; each path keeps its own state between stages
+	Samplers.resize(pathCount);
+	if (sampling == SamplerType::PCG)
+	{
+		PCGSamplers.resize(pathCount);
+		for (uint32_t i = 0; i < pathCount; i++)
+			Samplers[i] = &PCGSamplers[i];
+	}
+	else
+	{
+		SobolSamplers.resize(pathCount);
+		for (uint32_t i = 0; i < pathCount; i++)
+			Samplers[i] = &SobolSamplers[i];
+	}
+
+	ExtensionQueue.reserve(pathCount);
+	HitQueue.reserve(pathCount);
+	ShadeQueue.reserve(pathCount);
+	ShadowQueue.reserve(pathCount);
+}
+
+void Renderer::RenderTileWavefront(const TileTiming& tile, uint32_t sampleCount, WavefrontState& state)
+{
+	// Same paths as PerPixel(), with the same random numbers per pixel, but every stage runs over
+	// all paths of the tile before the next starts: one loop traces, one shades spheres, then
+	// boxes, then meshes, material by material, one traces shadow rays. Paths that miss drop out
+	// of the queues, so later bounces only touch live paths. The sample's colours are left in
+	// state.Colors.
+	uint32_t pathCount = tile.Width * tile.Height;
+	state.Resize(pathCount, m_Settings.Sampling);
+
+	state.ExtensionQueue.clear();
+	RT_PROFILE_COUNT(Paths, pathCount);
+	{
+		RT_PROFILE_SCOPE(CameraRays);
+		for (uint32_t path = 0; path < pathCount; path++)
+		{
+			uint32_t x = tile.X + path % tile.Width;
+			uint32_t y = tile.Y + path / tile.Width;
+
+			Sampler& sampler = *state.Samplers[path];
+			sampler.StartPixel(x, y, sampleCount - 1);
+			glm::vec2 pixelOffset = sampler.Get2D();
+			glm::vec2 lensSample = sampler.Get2D();
+			if (!m_Settings.Jitter)
+				pixelOffset = glm::vec2(0.0f);
+
+			state.Rays[path] = m_ActiveCamera->GenerateRay(x, y, pixelOffset, lensSample);
+			state.Colors[path] = glm::vec3(0.0f);
+			state.Multipliers[path] = 1.0f;
+			state.Throughputs[path] = glm::vec3(1.0f);
+			state.BsdfPdfs[path] = 0.0f;
+			state.Features[path] = PixelFeatures();
+			state.Deferred[path] = 0;
+			state.ExtensionQueue.push_back(path);
+		}
+	}
+
+	if (m_ActiveScene->HasLights())
+	{
+		TraceWavefrontPaths(state);
+		return;
+	}
+
+	uint32_t bounces = Utils::GetBounceCount(m_Settings);
+	for (uint32_t bounce = 0; bounce < bounces && !state.ExtensionQueue.empty(); bounce++)
+	{
+		// Extension rays. The sky is black, so a path that misses is finished.
+		state.HitQueue.clear();
+		{
+			RT_PROFILE_SCOPE(Trace);
+			for (uint32_t path : state.ExtensionQueue)
+			{
+				bool found = FindClosestHit(state.Rays[path], state.Hits[path]);
+				state.Deferred[path] |= Utils::TakeSampleDeferred();
+				if (found)
+					state.HitQueue.push_back(path);
+			}
+		}
+		Utils::s_ThreadRayCount += state.ExtensionQueue.size();
+		RT_PROFILE_COUNT(Rays, state.ExtensionQueue.size());
+		RT_PROFILE_COUNT(Bounces, state.HitQueue.size());
 
-	m_ImageHorizontalIter.resize(width);
-	m_ImageVerticalIter.resize(height);
+		SortHitQueue(state);
 
-	for (uint32_t i = 0; i < width; i++)
-		m_ImageHorizontalIter[i] = i;
-	
-	for (uint32_t i = 0; i < height; i++)
-		m_ImageVerticalIter[i] = i;
+		// Hit points and the ray towards the light, which moves with the bounce as in PerPixel()
+		glm::vec3 pointOnLight((float)((bounce / 2) % 2), -1.0f, (float)(bounce % 2));
+		for (uint32_t path : state.ShadeQueue)
+		{
+			const HitRecord& hit = state.Hits[path];
+			HitPayload& payload = state.Payloads[path];
+			payload = ClosestHit(state.Rays[path], hit);
+			if (bounce == 0 && m_RecordingFeatures)
+				state.Features[path] = Utils::GetFeatures(state.Rays[path].Direction, payload.WorldPosition, payload.WorldNormal, payload.HitDistance,
+					m_ActiveScene->Materials[payload.MaterialIndex]);
+
+			glm::vec3 randomPoint = state.Samplers[path]->Vec3(-0.2f, -0.1f);
+			glm::vec3 lightDir = glm::normalize(randomPoint + pointOnLight);
+			state.LightCosines[path] = glm::max(glm::dot(payload.WorldNormal, -lightDir), 0.0f);
 
-}
+			Ray& shadowRay = state.ShadowRays[path];
+			shadowRay.Origin = payload.WorldPosition;
+			shadowRay.Direction = -lightDir;
+		}
 
-void Renderer::Render(const Scene& scene, const Camera& camera)
-{
-	m_ActiveScene  = &scene;
-	m_ActiveCamera = &camera;
+		if (m_Settings.Shadows)
+		{
+			RT_PROFILE_SCOPE(Trace);
+			for (uint32_t path : state.ShadeQueue)
+			{
+				state.Occluded[path] = IsOccluded(state.ShadowRays[path], std::numeric_limits<float>::max());
+				state.Deferred[path] |= Utils::TakeSampleDeferred();
+			}
+			Utils::s_ThreadRayCount += state.ShadeQueue.size();
+			RT_PROFILE_COUNT(ShadowRays, state.ShadeQueue.size());
+		}
+		else
+		{
+			for (uint32_t path : state.ShadeQueue)
+				state.Occluded[path] = 0;
+		}
 
-	const glm::vec3& rayOrigin = camera.GetPosition();
+		// Light and the next direction. Every shaded path continues, in sorted order.
+		for (uint32_t path : state.ShadeQueue)
+		{
+			const HitPayload& payload = state.Payloads[path];
+			Ray& ray = state.Rays[path];
+			float multiplier = state.Multipliers[path];
 
+			if (!state.Occluded[path])
+			{
+				const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+				glm::vec3 sphereColor = material.Albedo * state.LightCosines[path];
+				Sampler& sampler = *state.Samplers[path];
+				for (int w = 0; w < 4; w++)
+				{
+					if (sampler.Get1D() > 0.85f)
+						break;
 
-	if (m_FrameIndex == 1)
-		memset(m_AccumulationData, 0, 
-			m_FinalImage->GetWidth() * m_FinalImage->GetHeight() * sizeof(glm::vec4));
+					ray.Direction = glm::reflect(ray.Direction,
+						payload.WorldNormal + material.Roughness * sampler.Vec3(-0.5f, 0.5f));
+					state.Colors[path] += sphereColor * multiplier;
+				}
+			}
 
-	std::for_each(std::execution::par, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(),
-		[this](uint32_t y)
+			ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+			state.Multipliers[path] = multiplier * 0.4f;
+		}
+
+		std::swap(state.ExtensionQueue, state.ShadeQueue);
+	}
+}
+
+void Renderer::TraceWavefrontPaths(WavefrontState& state)
+{
+	// TracePath() a stage at a time, with the same random numbers per path
+	const std::vector<Light>& lights = m_ActiveScene->LightHierarchy.GetLights();
+	uint32_t bounces = Utils::GetBounceCount(m_Settings);
+	for (uint32_t bounce = 0; bounce < bounces && !state.ExtensionQueue.empty(); bounce++)
+	{
+		// Extension rays. Emission from lights they reach is weighted against the light tree
+		// from the previous hit, which Payloads still holds.
+		state.HitQueue.clear();
 		{
-			std::for_each(m_ImageHorizontalIter.begin(), m_ImageHorizontalIter.end(),
-				[this, y](uint32_t x)
+			RT_PROFILE_SCOPE(Trace);
+			for (uint32_t path : state.ExtensionQueue)
+			{
+				const Ray& ray = state.Rays[path];
+				HitRecord& hit = state.Hits[path];
+				bool found = FindClosestHit(ray, hit);
+				state.Deferred[path] |= Utils::TakeSampleDeferred();
+
+				float distance = found ? hit.Distance : std::numeric_limits<float>::max();
+				int lightIndex = IntersectLights(ray, distance);
+				if (lightIndex >= 0)
 				{
-					glm::vec4 color = PerPixel(x, y);
-					m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color;
+					float weight = GetEmissionWeight(state.Payloads[path], state.BsdfPdfs[path], ray, distance, lightIndex);
+					state.Colors[path] += state.Throughputs[path] * lights[lightIndex].GetEmission() * weight;
+				}
+				else if (found)
+					state.HitQueue.push_back(path);
+			}
+		}
+		Utils::s_ThreadRayCount += state.ExtensionQueue.size();
+		RT_PROFILE_COUNT(Rays, state.ExtensionQueue.size());
+		RT_PROFILE_COUNT(Bounces, state.HitQueue.size());
 
-					glm::vec4 accumulatedColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-					accumulatedColor /= (float)m_FrameIndex;
-					 
+		SortHitQueue(state);
 
-					accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-					m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
-				});
-		});
+		// Emission, a light sample and the next direction, material by material
+		state.ShadowQueue.clear();
+		state.ExtensionQueue.clear();
+		for (uint32_t path : state.ShadeQueue)
+		{
+			const HitRecord& hit = state.Hits[path];
+			Ray& ray = state.Rays[path];
+			HitPayload payload = ClosestHit(ray, hit);
+			glm::vec3 outgoing = -ray.Direction;
+			if (glm::dot(payload.WorldNormal, outgoing) < 0.0f)
+				payload.WorldNormal = -payload.WorldNormal;
+
+			glm::vec3& throughput = state.Throughputs[path];
+			const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+			if (material.IsEmissive())
+			{
+				float weight = GetEmissionWeight(state.Payloads[path], state.BsdfPdfs[path], ray, hit.Distance, GetEmitterLight(hit));
+				state.Colors[path] += throughput * material.GetEmission() * weight;
+			}
+			if (bounce == 0 && m_RecordingFeatures)
+				state.Features[path] = Utils::GetFeatures(ray.Direction, payload.WorldPosition, payload.WorldNormal, hit.Distance, material);
+			state.Payloads[path] = payload;
+
+			Sampler& sampler = *state.Samplers[path];
+			float uPick = sampler.Get1D();
+			glm::vec2 uLight = sampler.Get2D();
+			float uLobe = sampler.Get1D();
+			glm::vec2 uBsdf = sampler.Get2D();
+
+			glm::vec3 contribution;
+			if (SampleDirectLight(payload, material, outgoing, uPick, uLight, state.ShadowRays[path], state.ShadowDistances[path], contribution))
+			{
+				state.LightContributions[path] = throughput * contribution;
+				state.ShadowQueue.push_back(path);
+			}
 
+			glm::vec3 incoming;
+			float& bsdfPdf = state.BsdfPdfs[path];
+			glm::vec3 bsdf = Utils::SampleBsdf(material, payload.WorldNormal, outgoing, uLobe, uBsdf, incoming, bsdfPdf);
+			if (bsdfPdf == 0.0f)
+				continue;
 
-	m_FinalImage->SetData(m_ImageData);
+			throughput *= bsdf * (glm::dot(payload.WorldNormal, incoming) / bsdfPdf);
+			ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+			ray.Direction = incoming;
+			state.ExtensionQueue.push_back(path);
+		}
 
-	if (m_Settings.Accumulate)
-		m_FrameIndex++;
-	else
-		m_FrameIndex = 1;
+		if (m_Settings.Shadows)
+		{
+			RT_PROFILE_SCOPE(Trace);
+			for (uint32_t path : state.ShadowQueue)
+			{
+				if (!IsOccluded(state.ShadowRays[path], state.ShadowDistances[path]))
+					state.Colors[path] += state.LightContributions[path];
+				state.Deferred[path] |= Utils::TakeSampleDeferred();
+			}
+			Utils::s_ThreadRayCount += state.ShadowQueue.size();
+			RT_PROFILE_COUNT(ShadowRays, state.ShadowQueue.size());
+		}
+		else
+		{
+			for (uint32_t path : state.ShadowQueue)
+				state.Colors[path] += state.LightContributions[path];
+		}
+	}
+}
+
+void Renderer::SortHitQueue(WavefrontState& state)
+{
+	// Counting sort on (primitive type, material). Stable, so each bucket stays in path (screen) order.
+	uint32_t materialCount = glm::max((uint32_t)m_ActiveScene->Materials.size(), 1u);
+	uint32_t bucketCount = 3 * materialCount;
+	auto key = [&](uint32_t path)
+	{
+		const HitRecord& hit = state.Hits[path];
+		return (uint32_t)hit.Primitive.GetType() * materialCount + (uint32_t)GetMaterialIndex(hit);
+	};
+
+	state.BucketOffsets.assign(bucketCount + 1, 0);
+	for (uint32_t path : state.HitQueue)
+		state.BucketOffsets[key(path) + 1]++;
+	for (uint32_t bucket = 0; bucket < bucketCount; bucket++)
+		state.BucketOffsets[bucket + 1] += state.BucketOffsets[bucket];
+
+	state.ShadeQueue.resize(state.HitQueue.size());
+	for (uint32_t path : state.HitQueue)
+		state.ShadeQueue[state.BucketOffsets[key(path)]++] = path;
+}
+
+void Renderer::SelectIntegrator()
+{
+	const Scene& scene = *m_ActiveScene;
+	uint32_t features = IntegratorFeatures::AllGeometry;
+	if (m_Settings.Specialize)
+	{
+		features = 0;
+		if (!scene.Spheres.empty())
+			features |= IntegratorFeatures::Spheres;
+		if (!scene.Boxes.empty())
+			features |= IntegratorFeatures::Boxes;
+		if (!scene.Meshes.empty())
+			features |= IntegratorFeatures::Meshes;
+		if (!scene.Instances.empty())
+			features |= IntegratorFeatures::Instances;
+		if (scene.Chunks)
+			features |= IntegratorFeatures::Spheres | IntegratorFeatures::Boxes | IntegratorFeatures::Instances;
+	}
+	if (m_Settings.Shadows)
+		features |= IntegratorFeatures::Shadows;
+	if (scene.HasLights())
+		features |= IntegratorFeatures::SceneLights;
+
+	// Variant i traces spheres and boxes, plus meshes and instances as set in i << 2
+	static_assert(IntegratorFeatures::Specialized >> 2 == 3);
+	static const PerPixelFn* table = GetPerPixelTable(std::make_index_sequence<4>());
+	m_PerPixel = table[(features & IntegratorFeatures::Specialized) >> 2];
+	m_IntegratorFeatures = features;
+}
 
+template<size_t... Variants>
+const Renderer::PerPixelFn* Renderer::GetPerPixelTable(std::index_sequence<Variants...>)
+{
+	static const PerPixelFn table[] = { &Renderer::PerPixel<IntegratorFeatures::Spheres | IntegratorFeatures::Boxes | (uint32_t)(Variants << 2)>... };
+	return table;
 }
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+
+template<uint32_t Geometry>
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, Sampler& sampler, PixelFeatures* features)
 {
+	// Always drawn so the later dimensions do not shift when jitter is toggled
+	glm::vec2 pixelOffset = sampler.Get2D();
+	glm::vec2 lensSample = sampler.Get2D();
+	if (!m_Settings.Jitter)
+		pixelOffset = glm::vec2(0.0f);
+
+	RT_PROFILE_COUNT(Paths, 1);
 	Ray ray;
-	ray.Origin = m_ActiveCamera->GetPosition();
-	ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_FinalImage->GetWidth()];
+	{
+		RT_PROFILE_SCOPE(CameraRays);
+		ray = m_ActiveCamera->GenerateRay(x, y, pixelOffset, lensSample);
+	}
 
+	if ((m_IntegratorFeatures & IntegratorFeatures::SceneLights) != 0)
+		return glm::vec4(TracePath<Geometry>(ray, sampler, features), 1.0f);
+	return glm::vec4(TraceBuiltInLight<Geometry>(ray, sampler, features), 1.0f);
+}
 
+template<uint32_t Geometry>
+glm::vec3 Renderer::TraceBuiltInLight(Ray ray, Sampler& sampler, PixelFeatures* features)
+{
 	glm::vec3 color(0.0f);
 	float multiplier = 1.0f;
-	int repeticoes = 2;
+	uint32_t bounces = Utils::GetBounceCount(m_Settings);
+	for (uint32_t bounce = 0; bounce < bounces; bounce++)
+	{
+		Renderer::HitPayload payload = TraceRay<Geometry>(ray);
+		RT_PROFILE_COUNT(Rays, 1);
 
-	for (int i = 0; i < repeticoes; i++)
-	{	
-		for (int j = 0; j < repeticoes; j++)
-		{
-			Renderer::HitPayload payload = TraceRay(ray);
+		if (payload.HitDistance < 0.0f)
+			break;
+		RT_PROFILE_COUNT(Bounces, 1);
 
-			if (payload.HitDistance < 0.0f)
-			{	
-				glm::vec3 skyColor = glm::vec3(0.0f);
-				color += skyColor * multiplier;
-				break;
-			} 
+		if (features && bounce == 0)
+			*features = Utils::GetFeatures(ray.Direction, payload.WorldPosition, payload.WorldNormal, payload.HitDistance, m_ActiveScene->Materials[payload.MaterialIndex]);
 
-			glm::vec3 randomPoint = Walnut::Random::Vec3(-0.2f, -0.1f);
-			glm::vec3 pointOnLight =  glm::vec3((float)i, -1.0f, (float)j);//glm::vec3(-1.0f);
+		glm::vec3 randomPoint = sampler.Vec3(-0.2f, -0.1f);
+		glm::vec3 pointOnLight((float)((bounce / 2) % 2), -1.0f, (float)(bounce % 2));
 
-			glm::vec3 lightDir = glm::normalize(randomPoint + pointOnLight);
+		glm::vec3 lightDir = glm::normalize(randomPoint + pointOnLight);
 
-			float d = glm::max(glm::dot(payload.WorldNormal, -lightDir), 0.0f); // == cos(alngulo entre eles)
+		float d = glm::max(glm::dot(payload.WorldNormal, -lightDir), 0.0f); // == cos(alngulo entre eles)
 
+		bool occluded = false;
+		if ((m_IntegratorFeatures & IntegratorFeatures::Shadows) != 0)
+		{
 			Ray lightRay;
 			lightRay.Origin = payload.WorldPosition;
 			lightRay.Direction = -lightDir;
 
-			Renderer::HitPayload lightPayload = TraceRay(lightRay);
+			occluded = TraceShadowRay<Geometry>(lightRay);
+			RT_PROFILE_COUNT(ShadowRays, 1);
+		}
 
-			const Sphere& sphere = m_ActiveScene->Spheres[payload.ObjectIndex];
-			const Material& material = m_ActiveScene->Materials[sphere.MaterialIndex];
+		if (!occluded)
+		{
+			const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+			glm::vec3 sphereColor = material.Albedo;
+			sphereColor *= d;
 
-			if (lightPayload.HitDistance < 0.0f)
+			for (int w = 0; w < 4; w++)
 			{
-				glm::vec3 sphereColor = material.Albedo;
-				sphereColor *= d;
-						
-				for (int w = 0; w < 4; w++)
-				{	
-					float q = Walnut::Random::Float();
-					if (q > 0.85f)
-					{
-						color += glm::vec3(0.0f);
-						//multiplier *= 0.2f;
-						w += 4;
-					}
-					else 
-					{
-						
-							ray.Direction = glm::reflect(ray.Direction,
-								payload.WorldNormal + material.Roughness * Walnut::Random::Vec3(-0.5f, 0.5f));
+				if (sampler.Get1D() > 0.85f)
+					break;
 
-						color += sphereColor * multiplier;
-					}	
-				}
+				ray.Direction = glm::reflect(ray.Direction,
+					payload.WorldNormal + material.Roughness * sampler.Vec3(-0.5f, 0.5f));
+
+				color += sphereColor * multiplier;
 			}
-			else { color += glm::vec3(0.0f) * d; }
+		}
 
-			ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+		ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+
+		multiplier *= 0.4f;
+	}
+
+	return color;
+}
+
+template<uint32_t Geometry>
+glm::vec3 Renderer::TracePath(Ray ray, Sampler& sampler, PixelFeatures* features)
+{
+	const Scene& scene = *m_ActiveScene;
+	const std::vector<Light>& lights = scene.LightHierarchy.GetLights();
+
+	glm::vec3 color(0.0f);
+	glm::vec3 throughput(1.0f);
+	HitPayload previous{}; // Where the ray left from
+	float bsdfPdf = 0.0f;  // Density of its direction, 0 for the camera ray
 
-			multiplier *= 0.4f;
+	uint32_t bounces = Utils::GetBounceCount(m_Settings);
+	for (uint32_t bounce = 0; bounce < bounces; bounce++)
+	{
+		HitRecord hit;
+		bool found;
+		{
+			RT_PROFILE_SCOPE(Trace);
+			Utils::s_ThreadRayCount++;
+			found = FindClosestHit<Geometry>(ray, hit);
+		}
+		RT_PROFILE_COUNT(Rays, 1);
+
+		float distance = found ? hit.Distance : std::numeric_limits<float>::max();
+		int lightIndex = IntersectLights(ray, distance);
+		if (lightIndex >= 0)
+		{
+			color += throughput * lights[lightIndex].GetEmission() * GetEmissionWeight(previous, bsdfPdf, ray, distance, lightIndex);
+			break;
+		}
+		// The sky is black
+		if (!found)
+			break;
+		RT_PROFILE_COUNT(Bounces, 1);
+
+		HitPayload payload = ClosestHit<Geometry>(ray, hit);
+		glm::vec3 outgoing = -ray.Direction;
+		if (glm::dot(payload.WorldNormal, outgoing) < 0.0f)
+			payload.WorldNormal = -payload.WorldNormal;
+
+		const Material& material = scene.Materials[payload.MaterialIndex];
+		if (material.IsEmissive())
+			color += throughput * material.GetEmission() * GetEmissionWeight(previous, bsdfPdf, ray, hit.Distance, GetEmitterLight(hit));
+		if (features && bounce == 0)
+			*features = Utils::GetFeatures(ray.Direction, payload.WorldPosition, payload.WorldNormal, hit.Distance, material);
+
+		float uPick = sampler.Get1D();
+		glm::vec2 uLight = sampler.Get2D();
+		float uLobe = sampler.Get1D();
+		glm::vec2 uBsdf = sampler.Get2D();
+
+		Ray shadowRay;
+		float maxDistance;
+		glm::vec3 contribution;
+		if (SampleDirectLight(payload, material, outgoing, uPick, uLight, shadowRay, maxDistance, contribution))
+		{
+			bool occluded = false;
+			if ((m_IntegratorFeatures & IntegratorFeatures::Shadows) != 0)
+			{
+				RT_PROFILE_COUNT(ShadowRays, 1);
+				occluded = TraceShadowRay<Geometry>(shadowRay, maxDistance);
+			}
+			if (!occluded)
+				color += throughput * contribution;
+		}
 
-		}		
+		glm::vec3 incoming;
+		glm::vec3 bsdf = Utils::SampleBsdf(material, payload.WorldNormal, outgoing, uLobe, uBsdf, incoming, bsdfPdf);
+		if (bsdfPdf == 0.0f)
+			break;
+
+		throughput *= bsdf * (glm::dot(payload.WorldNormal, incoming) / bsdfPdf);
+		previous = payload;
+		ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+		ray.Direction = incoming;
 	}
 
-	return glm::vec4(color, 1.0f);
+	return color;
+}
+
+int Renderer::IntersectLights(const Ray& ray, float& distance) const
+{
+	// Emissive spheres are in the light tree for sampling but are hit as geometry
+	uint32_t placedLights = (uint32_t)m_ActiveScene->Lights.size();
+	return m_ActiveScene->LightHierarchy.Intersect(ray, distance,
+		[&](uint32_t lightIndex) { return lightIndex >= placedLights; });
+}
+
+int Renderer::GetEmitterLight(const HitRecord& hit) const
+{
+	if (hit.Instance != -1 || hit.Primitive.GetType() != PrimitiveType::Sphere)
+		return -1;
+	return m_ActiveScene->GetSphereLight(hit.Primitive.GetIndex());
+}
+
+float Renderer::GetEmissionWeight(const HitPayload& from, float bsdfPdf, const Ray& ray, float distance, int lightIndex) const
+{
+	if (bsdfPdf == 0.0f || lightIndex < 0)
+		return 1.0f;
+
+	const LightTree& lights = m_ActiveScene->LightHierarchy;
+	float lightPdf = lights.GetProbability(from.WorldPosition, from.WorldNormal, (uint32_t)lightIndex) *
+		Lights::GetPdf(lights.GetLights()[lightIndex], from.WorldPosition, ray.Direction, distance);
+	return Utils::PowerHeuristic(bsdfPdf, lightPdf);
+}
+
+bool Renderer::SampleDirectLight(const HitPayload& payload, const Material& material, const glm::vec3& outgoing, float uPick, const glm::vec2& uLight,
+	Ray& shadowRay, float& maxDistance, glm::vec3& contribution) const
+{
+	const LightTree& lights = m_ActiveScene->LightHierarchy;
+	uint32_t lightIndex;
+	float pickProbability;
+	if (!lights.Pick(payload.WorldPosition, payload.WorldNormal, uPick, lightIndex, pickProbability))
+		return false;
+
+	const Light& light = lights.GetLights()[lightIndex];
+	LightSample sample;
+	if (!Lights::Sample(light, payload.WorldPosition, uLight, sample))
+		return false;
+
+	float bsdfPdf;
+	glm::vec3 bsdf = Utils::EvaluateBsdf(material, payload.WorldNormal, outgoing, sample.Direction, bsdfPdf);
+	if (bsdfPdf == 0.0f)
+		return false;
+
+	float lightPdf = pickProbability * sample.Pdf;
+	float weight = light.IsDelta() ? 1.0f : Utils::PowerHeuristic(lightPdf, bsdfPdf);
+	contribution = bsdf * sample.Radiance * (glm::dot(payload.WorldNormal, sample.Direction) * weight / lightPdf);
+
+	// Lights do not block light. Stopping short of the light keeps an emissive sphere from
+	// shadowing itself.
+	shadowRay.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+	shadowRay.Direction = sample.Direction;
+	maxDistance = sample.Distance * 0.999f;
+	return true;
 }
 
 std::pair<float, float> Renderer::intersectBox(const Ray& ray, const Box& box)
@@ -178,117 +1369,489 @@ std::pair<float, float> Renderer::intersectBox(const Ray& ray, const Box& box)
 	return { minVal, maxVal };
 }
 
-std::pair<float, float> Renderer::intersectPlane(const Ray& ray, const Plane& plane) {
-	float denominator = plane.a * ray.Direction.x + plane.b * ray.Direction.y + plane.c * ray.Direction.z;
-	if (denominator == 0.0f) {
-		return { -1.0f, -1.0f }; // Ray is parallel to the plane  
-	}
-	float t = -(plane.a * ray.Origin.x + plane.b * ray.Origin.y + plane.c * ray.Origin.z + plane.d) / denominator;
-	if (denominator < 0.0f || denominator > 0.0f) {
-		return { t, t };
+float Renderer::IntersectSphere(const Ray& ray, const Sphere& sphere)
+{
+	float radius = sphere.Radius;
+	glm::vec3 origin = ray.Origin - sphere.Position;
+
+	float a = glm::dot(ray.Direction, ray.Direction);
+	float b = 2.0f * glm::dot(origin, ray.Direction);
+	float c = glm::dot(origin, origin) - radius * radius;
+
+	float discriminant = b * b - 4.0f * a * c;
+	if (discriminant < 0.0f)
+		return -1.0f;
+
+	return (-b - glm::sqrt(discriminant)) / (2.0f * a);
+}
+
+float Renderer::IntersectBox(const Ray& ray, const Box& box)
+{
+	auto [tNear, tFar] = intersectBox(ray, box);
+	if (tNear > tFar || tFar < 0.0f)
+		return -1.0f;
+
+	// A ray starting inside the box hits its far side
+	return tNear >= 0.0f ? tNear : tFar;
+}
+
+template<uint32_t Features>
+Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+{
+	RT_PROFILE_SCOPE(Trace);
+	Utils::s_ThreadRayCount++;
+
+	HitRecord hit;
+	if (!FindClosestHit<Features>(ray, hit))
+		return Miss(ray);
+
+	return ClosestHit<Features>(ray, hit);
+}
+
+template<uint32_t Features>
+bool Renderer::FindClosestHit(const Ray& ray, HitRecord& hit)
+{
+	hit.Distance = std::numeric_limits<float>::max(); // tambm poderia utilizar o FLT_MAX
+	hit.Instance = -1;
+	bool found = IntersectGeometry<Features>(*m_ActiveScene, ray, hit);
+	if constexpr ((Features & IntegratorFeatures::Instances) == 0)
+		return found;
+
+	// Instances are entered in object space. The direction is not renormalized, so distances
+	// along the object space ray are the same as in world space.
+	float closestInstanceT = hit.Distance;
+	auto intersectInstance = [&](uint32_t instanceIndex, float& tMax)
+	{
+		RT_PROFILE_COUNT(InstanceTests, 1);
+		const AffineTransform& toObject = m_ActiveScene->InverseTransforms[instanceIndex];
+		Ray objectRay;
+		objectRay.Origin = toObject.TransformPoint(ray.Origin);
+		objectRay.Direction = toObject.TransformVector(ray.Direction);
+
+		HitRecord instanceHit;
+		instanceHit.Distance = tMax;
+		const Prototype& prototype = m_ActiveScene->Prototypes[m_ActiveScene->Instances[instanceIndex].PrototypeIndex];
+		if (!IntersectGeometry<IntegratorFeatures::AllGeometry>(prototype, objectRay, instanceHit))
+			return;
+
+		tMax = instanceHit.Distance;
+		hit = instanceHit;
+		hit.Instance = (int)instanceIndex;
+		found = true;
+	};
+
+	if (!m_ActiveScene->InstanceAccelerator.IsEmpty())
+		m_ActiveScene->InstanceAccelerator.Traverse(ray, closestInstanceT, intersectInstance);
+	else
+	{
+		for (uint32_t i = 0; i < (uint32_t)m_ActiveScene->InverseTransforms.size(); i++)
+			intersectInstance(i, closestInstanceT);
 	}
-	else {
-		return { -1.0f, -1.0f }; // Ray is intersecting the plane from behind  
+
+	// A deferred sample's path ends at its first missing chunk
+	if (m_ActiveScene->Chunks)
+	{
+		if (IntersectChunks(ray, hit))
+			found = true;
+		if (Utils::s_ThreadSampleDeferred)
+			found = false;
 	}
+	return found;
+}
+
+bool Renderer::IntersectChunks(const Ray& ray, HitRecord& hit)
+{
+	// Past the nearest missing chunk a hit could not save the sample, so the traversal stops there
+	ChunkCache& chunks = *m_ActiveScene->Chunks;
+	const glm::vec3 invDirection = 1.0f / ray.Direction;
+	float missingDistance = std::numeric_limits<float>::max();
+	float closestT = hit.Distance;
+	bool found = false;
+	chunks.GetAccelerator().Traverse(ray, closestT,
+		[&](uint32_t chunkIndex, float& tMax)
+		{
+			const Geometry* geometry = chunks.Find(chunkIndex);
+			if (!geometry)
+			{
+				Utils::s_ThreadChunkMisses++;
+				const AABB& bounds = chunks.GetBounds(chunkIndex);
+				missingDistance = glm::min(missingDistance, BVH::IntersectAABB(ray, invDirection, bounds.Min, bounds.Max, tMax));
+				tMax = glm::min(tMax, missingDistance);
+				return;
+			}
+			Utils::s_ThreadChunkHits++;
+
+			HitRecord chunkHit;
+			chunkHit.Distance = tMax;
+			if (!IntersectGeometry<IntegratorFeatures::AllGeometry>(*geometry, ray, chunkHit))
+				return;
+
+			tMax = chunkHit.Distance;
+			hit = chunkHit;
+			hit.Instance = -2 - (int)chunkIndex;
+			found = true;
+		});
 
+	if (missingDistance < hit.Distance)
+		Utils::s_ThreadSampleDeferred = true;
+	return found;
 }
 
-Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+template<uint32_t Features>
+bool Renderer::IntersectGeometry(const Geometry& geometry, const Ray& ray, HitRecord& hit)
 {
-	int closestObject = -1;
-	float hitDistance = std::numeric_limits<float>::max(); // tambm poderia utilizar o FLT_MAX
-	int indentifier = -1;
+	PrimitiveRef closestObject;
+	bool found = false;
+	float hitDistance = hit.Distance;
 
-	for (size_t i = 0; i < m_ActiveScene->Spheres.size(); i++)
+	if constexpr ((Features & (IntegratorFeatures::Spheres | IntegratorFeatures::Boxes)) != 0)
 	{
-		const Sphere& sphere = m_ActiveScene->Spheres[i];
-		float radius = sphere.Radius;
-		glm::vec3 origin = ray.Origin - sphere.Position;
+		if (!geometry.Accelerator.IsEmpty())
+		{
+			geometry.Accelerator.TraverseLeaves(ray, hitDistance,
+				[&](uint32_t first, uint32_t count, float& tMax)
+				{
+					Utils::CountLeafTests(geometry, first, count);
 
-		float a = glm::dot(ray.Direction, ray.Direction);
-		float b = 2.0f * glm::dot(origin, ray.Direction);
-		float c = glm::dot(origin, origin) - radius * radius;
+					float closestT;
+					int lane = m_LeafIntersect(geometry.LeafData, first, count, ray, tMax, closestT);
+					if (lane < 0)
+						return;
 
-		float discriminant = b * b - 4.0f * a * c;
-		if (discriminant < 0.0f)
-			continue;
+					tMax = closestT;
+					closestObject = geometry.LeafPrimitives[lane];
+					found = true;
+				});
+		}
+		else
+		{
+			if constexpr ((Features & IntegratorFeatures::Spheres) != 0)
+			{
+				RT_PROFILE_COUNT(SphereTests, geometry.Spheres.size());
+				for (size_t i = 0; i < geometry.Spheres.size(); i++)
+				{
+					float closestT = IntersectSphere(ray, geometry.Spheres[i]);
+					if (closestT > 0.0f && closestT < hitDistance)
+					{
+						hitDistance = closestT;
+						closestObject = PrimitiveRef(PrimitiveType::Sphere, (uint32_t)i);
+						found = true;
+					}
+				}
+			}
+
+			if constexpr ((Features & IntegratorFeatures::Boxes) != 0)
+			{
+				RT_PROFILE_COUNT(BoxTests, geometry.Boxes.size());
+				for (size_t i = 0; i < geometry.Boxes.size(); i++)
+				{
+					float closestT = IntersectBox(ray, geometry.Boxes[i]);
+					if (closestT >= 0.0f && closestT <= hitDistance)
+					{
+						hitDistance = closestT;
+						closestObject = PrimitiveRef(PrimitiveType::Box, (uint32_t)i);
+						found = true;
+					}
+				}
+			}
+		}
+	}
+
+	// Meshes are tested after the primitives, so their BVHs are pruned by any closer hit found there
+	if constexpr ((Features & IntegratorFeatures::Meshes) != 0)
+	{
+		const std::vector<Mesh>& meshes = geometry.Meshes;
+		MeshHit meshHit{};
+		auto intersectMesh = [&](uint32_t meshIndex, float& tMax)
+		{
+			if (meshes[meshIndex].Intersect(ray, tMax, meshHit))
+			{
+				closestObject = PrimitiveRef(PrimitiveType::Mesh, meshIndex);
+				found = true;
+			}
+		};
+
+		if (!geometry.MeshAccelerator.IsEmpty())
+			geometry.MeshAccelerator.Traverse(ray, hitDistance, intersectMesh);
+		else
+		{
+			for (uint32_t i = 0; i < (uint32_t)meshes.size(); i++)
+				intersectMesh(i, hitDistance);
+		}
+		hit.Mesh = meshHit;
+	}
+
+	if (!found)
+		return false;
+
+	hit.Distance = hitDistance;
+	hit.Primitive = closestObject;
+	return true;
+}
+
+template<uint32_t Features>
+bool Renderer::TraceShadowRay(const Ray& ray, float maxDistance)
+{
+	RT_PROFILE_SCOPE(Trace);
+	Utils::s_ThreadRayCount++;
 
-		float closestT = (-b - glm::sqrt(discriminant)) / (2.0f * a);
+	return IsOccluded<Features>(ray, maxDistance);
+}
 
-		if (closestT > 0.0f && closestT < hitDistance)
+template<uint32_t Features>
+bool Renderer::IsOccluded(const Ray& ray, float maxDistance)
+{
+	if (IsGeometryOccluded<Features>(*m_ActiveScene, ray, maxDistance))
+		return true;
+	if constexpr ((Features & IntegratorFeatures::Instances) == 0)
+		return false;
+
+	bool occluded = false;
+	float instanceTMax = maxDistance;
+	auto intersectInstance = [&](uint32_t instanceIndex, float& tMax)
+	{
+		RT_PROFILE_COUNT(InstanceTests, 1);
+		const AffineTransform& toObject = m_ActiveScene->InverseTransforms[instanceIndex];
+		Ray objectRay;
+		objectRay.Origin = toObject.TransformPoint(ray.Origin);
+		objectRay.Direction = toObject.TransformVector(ray.Direction);
+
+		const Prototype& prototype = m_ActiveScene->Prototypes[m_ActiveScene->Instances[instanceIndex].PrototypeIndex];
+		if (IsGeometryOccluded<IntegratorFeatures::AllGeometry>(prototype, objectRay, maxDistance))
 		{
-			hitDistance = closestT;
-			closestObject = (int)i;
-			indentifier = 0;
+			occluded = true;
+			tMax = -1.0f;
 		}
+	};
+
+	if (!m_ActiveScene->InstanceAccelerator.IsEmpty())
+		m_ActiveScene->InstanceAccelerator.Traverse(ray, instanceTMax, intersectInstance);
+	else
+	{
+		for (uint32_t i = 0; i < (uint32_t)m_ActiveScene->InverseTransforms.size() && !occluded; i++)
+			intersectInstance(i, instanceTMax);
+	}
+
+	if (!occluded && m_ActiveScene->Chunks)
+		return IsChunkOccluded(ray, maxDistance);
+	return occluded;
+}
+
+bool Renderer::IsChunkOccluded(const Ray& ray, float maxDistance)
+{
+	// A resident occluder settles it whatever the missing chunks hold
+	ChunkCache& chunks = *m_ActiveScene->Chunks;
+	bool occluded = false, missing = false;
+	float chunkTMax = maxDistance;
+	chunks.GetAccelerator().Traverse(ray, chunkTMax,
+		[&](uint32_t chunkIndex, float& tMax)
+		{
+			const Geometry* geometry = chunks.Find(chunkIndex);
+			if (!geometry)
+			{
+				Utils::s_ThreadChunkMisses++;
+				missing = true;
+				return;
+			}
+			Utils::s_ThreadChunkHits++;
+
+			if (IsGeometryOccluded<IntegratorFeatures::AllGeometry>(*geometry, ray, maxDistance))
+			{
+				occluded = true;
+				tMax = -1.0f;
+			}
+		});
 
+	// Counted as occluded, as the sample is thrown away anyway
+	if (!occluded && missing)
+	{
+		Utils::s_ThreadSampleDeferred = true;
+		return true;
 	}
+	return occluded;
+}
 
-	for (size_t i = 0; i < m_ActiveScene->Boxes.size(); i++)
+template<uint32_t Features>
+bool Renderer::IsGeometryOccluded(const Geometry& geometry, const Ray& ray, float maxDistance)
+{
+	// The same tests as IntersectGeometry(), ending the traversal (tMax < 0) at the first hit
+	bool occluded = false;
+	float tMax = maxDistance;
+	if constexpr ((Features & (IntegratorFeatures::Spheres | IntegratorFeatures::Boxes)) != 0)
 	{
-		const Box& box = m_ActiveScene->Boxes[i];
-		// Calcula a interseo do raio com a caixa
-		for (size_t j = 0; j < 6; j++) 
+		if (!geometry.Accelerator.IsEmpty())
+		{
+			geometry.Accelerator.TraverseLeaves(ray, tMax,
+				[&](uint32_t first, uint32_t count, float& leafTMax)
+				{
+					Utils::CountLeafTests(geometry, first, count);
+
+					float closestT;
+					if (m_LeafIntersect(geometry.LeafData, first, count, ray, leafTMax, closestT) < 0)
+						return;
+
+					occluded = true;
+					leafTMax = -1.0f;
+				});
+		}
+		else
 		{
-			auto [tmin, tmax] = intersectPlane(ray, box.planes[j]);
-			if (tmin <= tmax && tmax >= 0.0f && tmax <= hitDistance) {
-				// Check if the intersection point is within the box's bounds  
-				glm::vec3 intersectionPoint = ray.Origin + tmax * ray.Direction;
-				if (intersectionPoint.x >= box.Position.x && intersectionPoint.x <= box.Position.x + box.Width &&
-					intersectionPoint.y >= box.Position.y && intersectionPoint.y <= box.Position.y + box.Height &&
-					intersectionPoint.z >= box.Position.z && intersectionPoint.z <= box.Position.z + box.Depth) 
+			if constexpr ((Features & IntegratorFeatures::Spheres) != 0)
+			{
+				for (const Sphere& sphere : geometry.Spheres)
 				{
-					hitDistance = tmax;
-					closestObject = (int)i;
-					indentifier = 1;
+					RT_PROFILE_COUNT(SphereTests, 1);
+					float closestT = IntersectSphere(ray, sphere);
+					if (closestT > 0.0f && closestT < maxDistance)
+						return true;
 				}
 			}
 
+			if constexpr ((Features & IntegratorFeatures::Boxes) != 0)
+			{
+				for (const Box& box : geometry.Boxes)
+				{
+					RT_PROFILE_COUNT(BoxTests, 1);
+					float closestT = IntersectBox(ray, box);
+					if (closestT >= 0.0f && closestT <= maxDistance)
+						return true;
+				}
+			}
 		}
+		if (occluded)
+			return true;
 	}
 
-	if (closestObject < 0)
-		return Miss(ray);
+	if constexpr ((Features & IntegratorFeatures::Meshes) != 0)
+	{
+		const std::vector<Mesh>& meshes = geometry.Meshes;
+		tMax = maxDistance;
+		auto intersectMesh = [&](uint32_t meshIndex, float& meshTMax)
+		{
+			if (meshes[meshIndex].IsOccluded(ray, maxDistance))
+			{
+				occluded = true;
+				meshTMax = -1.0f;
+			}
+		};
 
-	return ClosestHit(ray, hitDistance, closestObject, indentifier);
+		if (!geometry.MeshAccelerator.IsEmpty())
+			geometry.MeshAccelerator.Traverse(ray, tMax, intersectMesh);
+		else
+		{
+			for (uint32_t i = 0; i < (uint32_t)meshes.size() && !occluded; i++)
+				intersectMesh(i, tMax);
+		}
+	}
 
-	
+	return occluded;
 }
 
-Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex, int indentifier)
+const Geometry& Renderer::GetHitGeometry(const HitRecord& hit) const
 {
-	Renderer::HitPayload payload;
-	payload.HitDistance = hitDistance;
-	payload.ObjectIndex = objectIndex;
+	if (hit.Instance == -1)
+		return *m_ActiveScene;
+	if (hit.Instance < -1)
+		return m_ActiveScene->Chunks->GetResident((uint32_t)(-2 - hit.Instance));
+	return m_ActiveScene->Prototypes[m_ActiveScene->Instances[hit.Instance].PrototypeIndex];
+}
 
-	if (indentifier == 0)
+int Renderer::GetMaterialIndex(const HitRecord& hit) const
+{
+	const Geometry& geometry = GetHitGeometry(hit);
+	switch (hit.Primitive.GetType())
 	{
-		const Sphere& closestObject = m_ActiveScene->Spheres[objectIndex];
+		case PrimitiveType::Sphere: return geometry.Spheres[hit.Primitive.GetIndex()].MaterialIndex;
+		case PrimitiveType::Box:    return geometry.Boxes[hit.Primitive.GetIndex()].MaterialIndex;
+		case PrimitiveType::Mesh:   return geometry.Meshes[hit.Primitive.GetIndex()].MaterialIndex;
+	}
+	return 0;
+}
+
+template<uint32_t Features>
+Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, const HitRecord& hit)
+{
+	if ((Features & IntegratorFeatures::Instances) == 0 || hit.Instance == -1)
+		return ClosestHit<Features>(*m_ActiveScene, ray, hit);
+	// Chunks are in world space
+	if (hit.Instance < -1)
+		return ClosestHit<IntegratorFeatures::AllGeometry>(GetHitGeometry(hit), ray, hit);
+
+	// Shade in object space, then bring the hit point and normal back to world space
+	const AffineTransform& toObject = m_ActiveScene->InverseTransforms[hit.Instance];
+	const Instance& instance = m_ActiveScene->Instances[hit.Instance];
+	Ray objectRay;
+	objectRay.Origin = toObject.TransformPoint(ray.Origin);
+	objectRay.Direction = toObject.TransformVector(ray.Direction);
+
+	HitPayload payload = ClosestHit<IntegratorFeatures::AllGeometry>(GetHitGeometry(hit), objectRay, hit);
+	payload.WorldPosition = glm::vec3(instance.Transform * glm::vec4(payload.WorldPosition, 1.0f));
+	payload.WorldNormal = glm::normalize(toObject.TransformNormal(payload.WorldNormal));
+	return payload;
+}
 
-		const Material& material = m_ActiveScene->Materials[closestObject.MaterialIndex];
+template<uint32_t Features>
+Renderer::HitPayload Renderer::ClosestHit(const Geometry& geometry, const Ray& ray, const HitRecord& hit)
+{
+	Renderer::HitPayload payload;
+	payload.HitDistance = hit.Distance;
 
-		glm::vec3 origin = ray.Origin - closestObject.Position;
+	// Cases for primitive types the variant leaves out are empty
+	uint32_t objectIndex = hit.Primitive.GetIndex();
+	switch (hit.Primitive.GetType())
+	{
+		case PrimitiveType::Sphere:
+		{
+			if constexpr ((Features & IntegratorFeatures::Spheres) == 0)
+				break;
+			const Sphere& closestObject = geometry.Spheres[objectIndex];
 
-		payload.WorldPosition = origin + ray.Direction * hitDistance;
-		payload.WorldNormal = glm::normalize(payload.WorldPosition);
+			glm::vec3 origin = ray.Origin - closestObject.Position;
 
-		payload.WorldPosition += closestObject.Position;
-	}
-	else {
-		const Box& closestObject = m_ActiveScene->Boxes[objectIndex];
+			payload.WorldPosition = origin + ray.Direction * hit.Distance;
+			payload.WorldNormal = glm::normalize(payload.WorldPosition);
 
-		const Material& material = m_ActiveScene->Materials[closestObject.MaterialIndex];
+			payload.WorldPosition += closestObject.Position;
+			payload.MaterialIndex = closestObject.MaterialIndex;
+			break;
+		}
+		case PrimitiveType::Mesh:
+		{
+			if constexpr ((Features & IntegratorFeatures::Meshes) == 0)
+				break;
+			const Mesh& mesh = geometry.Meshes[objectIndex];
 
-		glm::vec3 origin = ray.Origin - closestObject.Position;
+			payload.WorldPosition = ray.Origin + ray.Direction * hit.Distance;
+			payload.WorldNormal = mesh.GetNormal(hit.Mesh);
 
-		payload.WorldPosition = origin + ray.Direction * hitDistance;
-		payload.WorldNormal = glm::normalize(payload.WorldPosition);
+			// Triangles are two-sided; shade the side the ray came from
+			if (glm::dot(payload.WorldNormal, ray.Direction) > 0.0f)
+				payload.WorldNormal = -payload.WorldNormal;
 
-		payload.WorldPosition += closestObject.Position + 
-			glm::vec3(closestObject.Width, closestObject.Height, closestObject.Depth);
+			payload.MaterialIndex = mesh.MaterialIndex;
+			break;
+		}
+		case PrimitiveType::Box:
+		{
+			if constexpr ((Features & IntegratorFeatures::Boxes) == 0)
+				break;
+			const Box& closestObject = geometry.Boxes[objectIndex];
+
+			// The normal of the face hit is along the axis where the point is furthest out
+			// relative to the box's half size
+			glm::vec3 halfSize = glm::vec3(closestObject.Width, closestObject.Height, closestObject.Depth) * 0.5f;
+			payload.WorldPosition = ray.Origin + ray.Direction * hit.Distance;
+			glm::vec3 local = (payload.WorldPosition - closestObject.Position - halfSize) / halfSize;
+			glm::vec3 distance = glm::abs(local);
+			int axis = distance.x > distance.y ? (distance.x > distance.z ? 0 : 2) : (distance.y > distance.z ? 1 : 2);
+			payload.WorldNormal = glm::vec3(0.0f);
+			payload.WorldNormal[axis] = local[axis] < 0.0f ? -1.0f : 1.0f;
+
+			payload.MaterialIndex = closestObject.MaterialIndex;
+			break;
+		}
 	}
 
-
 	return payload;
 }
 
@@ -1,19 +1,102 @@
 #pragma once
 
-#include "Walnut/Image.h"
 #include "Camera.h"
 #include "Scene.h"
 #include "Ray.h"
+#include "ThreadPool.h"
+#include "AccumulationBuffer.h"
+#include "Sampler.h"
+#include "Denoiser.h"
+#include "Reprojection.h"
 
 #include <memory>
+#include <atomic>
+#include <limits>
+#include <utility>
 #include <glm/glm.hpp>
 
+enum class IntegratorType
+{
+	Megakernel = 0, // Each pixel's whole path at once, PerPixel()
+	Wavefront       // One bounce of every path in a tile at a time, through sorted queues
+};
+
+// What the megakernel runs with for the settings and the active scene. Only meshes and
+// instances, whose traversal is the costly part of a ray, select a PerPixel() instantiation of
+// their own; the other bits are tested in the path loop.
+namespace IntegratorFeatures
+{
+	enum : uint32_t
+	{
+		Spheres     = 1 << 0,
+		Boxes       = 1 << 1,
+		Meshes      = 1 << 2,
+		Instances   = 1 << 3, // Also Scene::Chunks
+		Shadows     = 1 << 4,
+		SceneLights = 1 << 5, // TracePath() instead of the built-in light
+
+		AllGeometry = Spheres | Boxes | Meshes | Instances,
+		Specialized = Meshes | Instances
+	};
+}
+
 class Renderer
 {
 public:
 	struct Settings
 	{
 		bool Accumulate = true;
+		IntegratorType Integrator = IntegratorType::Megakernel;
+		SamplerType Sampling = SamplerType::Sobol;
+		bool Jitter = true; // Random sub-pixel positions, which antialiases edges as frames accumulate
+
+		uint32_t MaxBounces = 4; // Path length, 1 to MaxBounceLimit
+		bool Shadows = true;     // False lights every hit as if nothing were in the way
+		// Compile the megakernel's variant for the primitive types in the scene only; false uses
+		// the variant that tests all of them, for comparison
+		bool Specialize = true;
+
+		uint32_t TileSize = 32;   // Edge length in pixels of the square tiles handed to workers
+		uint32_t WorkerCount = 0; // Render threads including the caller, 0 for one per hardware thread
+
+		bool HalfPrecisionAccumulation = false;
+		uint32_t ResolveInterval = 1; // Resolve every N rendered frames, 0 to only resolve on Resolve()
+
+		// A tile stops being sampled once every pixel's standard error (in display units) is below
+		// TargetNoise, checked from MinSamples on. 0 samples every tile every frame.
+		float TargetNoise = 0.01f;
+		uint32_t MinSamples = 16;
+		uint32_t MaxSamples = 100; // Per pixel, 0 for no limit
+
+		bool ShowConvergence = false; // Converged tiles in green, the rest shaded red by remaining noise
+
+		// Filter the whole image on every resolve, guided by the albedo, normal and depth camera
+		// rays hit. Turning it on restarts accumulation, since the guides accumulate with the colour.
+		bool Denoise = false;
+		Denoiser::Settings Denoising;
+
+		// When the camera moves, carry each pixel's samples over to where its surface is now
+		// seen (see Reprojection) instead of restarting accumulation, keeping at most
+		// ReprojectionHistory of them. Any other camera change still restarts.
+		bool Reproject = false;
+		uint32_t ReprojectionHistory = 32;
+	};
+
+	struct TileTiming
+	{
+		uint32_t X, Y, Width, Height;
+		uint32_t Worker;
+		float Milliseconds;
+		bool Sampled; // False if the tile was skipped as converged
+	};
+
+	// A rectangle of the camera's image for RenderRegions(), in the same bottom-up pixel
+	// coordinates as Render(), and the samples to take in it
+	struct Region
+	{
+		uint32_t X, Y, Width, Height;
+		uint32_t FirstSample = 0, SampleCount = 1;
+		std::vector<float> Pixels; // Sum of the samples' RGB, row by row from the bottom
 	};
 
 public:
@@ -23,45 +106,289 @@ public:
 
 	void Render(const Scene& scene, const Camera& camera);
 
-	std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
+	// Renders each region's samples on the thread pool, without the accumulation buffer or the
+	// image, so memory only grows with the regions. Uses the integrator, sampler and jitter
+	// settings; samples are seeded as in Render(), so a region of samples 0 to n - 1 holds the
+	// same sums as n accumulated frames would, and sums of consecutive sample ranges add up.
+	void RenderRegions(const Scene& scene, const Camera& camera, std::vector<Region>& regions);
+
+	// Converts the accumulated samples of every tile rendered since the last resolve into the
+	// RGBA image. Render() calls this every Settings::ResolveInterval frames.
+	void Resolve();
 
+	// Makes the Render() call in progress, and any after it until ClearCancel(), skip every
+	// tile not yet started and not resolve. The samples already taken stay valid, as every
+	// pixel counts its own. Any thread may call it, so RenderThread can cut a frame short when
+	// a message arrives.
+	void Cancel() { m_Cancelled.store(true, std::memory_order_relaxed); }
+	void ClearCancel() { m_Cancelled.store(false, std::memory_order_relaxed); }
+	// The last Render() call was cut short
+	bool WasCancelled() const { return m_LastFrameCancelled; }
+
+	// RGBA pixels as of the last Resolve()
+	const uint32_t* GetImageData() const { return m_ImageData; }
+	uint32_t GetWidth() const { return m_Width; }
+	uint32_t GetHeight() const { return m_Height; }
+
+	// Number of rays (camera, shadow and bounce) traced by the last Render() call
+	uint64_t GetLastFrameRayCount() const { return m_LastFrameRayCount; }
+
+	// How long each tile of the last Render() call took and which worker rendered it, in dispatch order
+	const std::vector<TileTiming>& GetTileTimings() const { return m_TileTimings; }
+	uint32_t GetWorkerCount() const { return m_ThreadPool ? m_ThreadPool->GetWorkerCount() : 0; }
+
+	float GetLastResolveTime() const { return m_LastResolveTime; }
+	// Part of the last resolve, 0 if it did not denoise
+	float GetLastDenoiseTime() const { return m_LastDenoiseTime; }
+	size_t GetAccumulationMemoryUsage() const { return m_AccumulationBuffer.GetMemoryUsage() + m_Reprojection.GetMemoryUsage(); }
+	// Pixels whose samples the last camera move carried over
+	uint32_t GetLastReprojectedPixelCount() const { return m_LastReprojectedPixelCount; }
+
+	// Restarts accumulation. Render() does this by itself for scene edits and camera changes.
 	void ResetFrameIndex() { m_FrameIndex = 1; }
 
+	// Every tile has reached the target noise or the sample limit; further Render() calls do nothing
+	bool IsConverged() const { return m_FrameIndex > 1 && m_ActiveTileCount == 0; }
+	uint32_t GetActiveTileCount() const { return m_ActiveTileCount; }
+	uint32_t GetTileCount() const { return (uint32_t)m_TileTimings.size(); }
+
+	// Pixel samples the last Render() call accumulated
+	uint64_t GetLastFrameSampleCount() const { return m_LastFrameSampleCount; }
+	// Samples waiting for chunks of Scene::Chunks to be loaded; Render() retries them first
+	uint64_t GetDeferredSampleCount() const;
+
 	Settings& GetSettings() { return m_Settings; }
 
+	static const char* GetIntegratorName(IntegratorType type);
+
+	static constexpr uint32_t MaxBounceLimit = 8;
+	// IntegratorFeatures of the megakernel variant the last Render() or RenderRegions() call used
+	uint32_t GetIntegratorFeatures() const { return m_IntegratorFeatures; }
+
 	uint32_t GetFrameIndex() { return m_FrameIndex; }
 
+	// Distance along the ray to the primitive, negative on a miss. A ray starting inside a
+	// sphere misses it (the near root is behind it); one starting inside a box hits its far side.
+	static float IntersectSphere(const Ray& ray, const Sphere& sphere);
+	static float IntersectBox(const Ray& ray, const Box& box);
+	// Entry and exit distances of the box's slabs, entry > exit if the ray's line misses it
+	static std::pair<float, float> intersectBox(const Ray& ray, const Box& box);
+
 private:
+	// 32 bytes
 	struct HitPayload
 	{
 		float HitDistance;
 		glm::vec3 WorldPosition;
 		glm::vec3 WorldNormal;
+		int MaterialIndex;
+	};
 
-		uint32_t ObjectIndex;
+	// Closest intersection along a ray, before any shading, 24 bytes
+	struct HitRecord
+	{
+		float Distance;
+		PrimitiveRef Primitive; // Sphere, box or mesh of the hit geometry
+		int Instance;           // Scene::Instances index, -1 for the scene's own geometry, -2 - i for chunk i
+		MeshHit Mesh;           // For mesh hits
 	};
 
-	glm::vec4 PerPixel(uint32_t x, uint32_t y); //RayGen
+	// Paths of the tile a worker is rendering with the wavefront integrator. Everything is
+	// indexed by path (the pixel's position in the tile); the queues hold path indices.
+	struct WavefrontState
+	{
+		std::vector<Ray> Rays;
+		std::vector<glm::vec3> Colors;
+		std::vector<float> Multipliers;
+		std::vector<HitRecord> Hits;
+		std::vector<HitPayload> Payloads;
+		std::vector<float> LightCosines;
+		std::vector<Ray> ShadowRays;
+		std::vector<uint8_t> Occluded;
+		std::vector<uint8_t> Deferred; // Waiting for a chunk, so the sample is taken again later
+
+		// Scene lights only; Payloads then keep the last bounce's hit until the next is shaded
+		std::vector<glm::vec3> Throughputs;
+		std::vector<float> BsdfPdfs;
+		std::vector<glm::vec3> LightContributions;
+		std::vector<float> ShadowDistances;
+
+		std::vector<PCGSampler> PCGSamplers;
+		std::vector<SobolSampler> SobolSamplers;
+		std::vector<Sampler*> Samplers;
 
+		std::vector<uint32_t> ExtensionQueue; // Paths with a ray to trace this bounce
+		std::vector<uint32_t> HitQueue;       // Paths whose ray hit something, in path order
+		std::vector<uint32_t> ShadeQueue;     // HitQueue sorted by primitive type and material
+		std::vector<uint32_t> ShadowQueue;    // Paths with a shadow ray to trace
+		std::vector<uint32_t> BucketOffsets;
+
+		std::vector<PixelFeatures> Features; // Of the camera rays' hits, while denoising
+
+		void Resize(uint32_t pathCount, SamplerType sampling);
+	};
+
+	// Megakernel samples a worker has taken, kept until they are accumulated in one pass.
+	// Indexed by path for a tile, or by position in the list for deferred samples.
+	struct MegakernelState
+	{
+		std::vector<glm::vec3> Colors;
+		std::vector<PixelFeatures> Features;
+		std::vector<uint8_t> Deferred;
+
+		void Resize(uint32_t sampleCount);
+	};
+
+	// A pixel sample that needed a chunk which was not resident
+	struct DeferredSample
+	{
+		uint32_t X, Y;
+		uint32_t SampleIndex;
+	};
+
+	void UpdateTiles();
+	void UpdateThreadPool();
+	void RenderTile(uint32_t tileIndex, uint32_t workerIndex);
+	// One megakernel sample of a pixel; false if it was deferred, leaving color undefined
+	bool SamplePixel(uint32_t x, uint32_t y, uint32_t sampleIndex, Sampler& sampler, glm::vec3& color, PixelFeatures& features);
+	void DeferSample(std::vector<DeferredSample>& deferred, uint32_t x, uint32_t y, uint32_t sampleIndex);
+	// Takes the tile's deferred samples again, keeping those that are deferred once more.
+	// Returns how many were accumulated.
+	uint32_t RetryDeferredSamples(uint32_t tileIndex, Sampler& sampler, MegakernelState& state);
+	void AddSample(uint32_t pixelIndex, const glm::vec3& color, const PixelFeatures& features);
+	void RenderRegion(Region& region, uint32_t workerIndex, std::vector<DeferredSample>& deferred);
+	void RenderTileWavefront(const TileTiming& tile, uint32_t sampleCount, WavefrontState& state);
+	void TraceWavefrontPaths(WavefrontState& state);
+	void SortHitQueue(WavefrontState& state);
+	void ResolveTile(uint32_t tileIndex);
+	// Resolves every tile through the denoiser
+	void Denoise();
+	void ShadeConvergence(uint32_t tileIndex);
+	float GetTileError(uint32_t tileIndex) const;
+
+	// features, if not null, receives what the camera ray hit
+	using PerPixelFn = glm::vec4 (Renderer::*)(uint32_t x, uint32_t y, Sampler& sampler, PixelFeatures* features);
+
+	// Picks the PerPixel() variant for the settings and the active scene
+	void SelectIntegrator();
+	template<size_t... Variants>
+	static const PerPixelFn* GetPerPixelTable(std::index_sequence<Variants...>);
+
+	// Geometry is the primitive types traced, from IntegratorFeatures
+	template<uint32_t Geometry>
+	glm::vec4 PerPixel(uint32_t x, uint32_t y, Sampler& sampler, PixelFeatures* features); //RayGen
+
+	// Paths of scenes without lights or emissive materials, lit by a light that moves with the
+	// bounce; the sky is black, so a path that misses is finished
+	template<uint32_t Geometry>
+	glm::vec3 TraceBuiltInLight(Ray ray, Sampler& sampler, PixelFeatures* features);
+
+	// Paths lit by the scene's lights and emissive materials: next-event estimation with one
+	// light from the light tree per bounce, combined with the BSDF's own samples by multiple
+	// importance sampling (power heuristic). Used instead of the built-in light when the scene
+	// has any.
+	template<uint32_t Geometry>
+	glm::vec3 TracePath(Ray ray, Sampler& sampler, PixelFeatures* features);
+	// Closest sphere or rect light before distance (which it shortens), -1 if none
+	int IntersectLights(const Ray& ray, float& distance) const;
+	// Light tree index of the emitter a hit is on, -1 if next-event estimation does not sample it
+	int GetEmitterLight(const HitRecord& hit) const;
+	// Weight of emission reached by a BSDF sample of density bsdfPdf from 'from', 0 for camera rays
+	float GetEmissionWeight(const HitPayload& from, float bsdfPdf, const Ray& ray, float distance, int lightIndex) const;
+	// Picks a light and a point on it for a hit whose normal faces 'outgoing'. Returns false if
+	// it cannot contribute, otherwise the shadow ray and what it adds if nothing is in the way.
+	bool SampleDirectLight(const HitPayload& payload, const Material& material, const glm::vec3& outgoing, float uPick, const glm::vec2& uLight,
+		Ray& shadowRay, float& maxDistance, glm::vec3& contribution) const;
+
+	// The tracing functions only test the primitive types and instances in Features;
+	// prototypes are always searched for every type. The wavefront
+	// integrator uses the variants that test everything.
+	template<uint32_t Features>
 	HitPayload TraceRay(const Ray& ray);
-	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex, int indentifier);
+	template<uint32_t Features = IntegratorFeatures::AllGeometry>
+	bool FindClosestHit(const Ray& ray, HitRecord& hit);
+	// Closest hit closer than hit.Distance among one geometry's primitives and meshes
+	template<uint32_t Features>
+	bool IntersectGeometry(const Geometry& geometry, const Ray& ray, HitRecord& hit);
+	// Shadow rays only need to know whether anything is in the way: these stop at the first
+	// hit closer than maxDistance instead of searching for the closest one
+	template<uint32_t Features = IntegratorFeatures::AllGeometry>
+	bool TraceShadowRay(const Ray& ray, float maxDistance = std::numeric_limits<float>::max());
+	template<uint32_t Features = IntegratorFeatures::AllGeometry>
+	bool IsOccluded(const Ray& ray, float maxDistance);
+	template<uint32_t Features>
+	bool IsGeometryOccluded(const Geometry& geometry, const Ray& ray, float maxDistance);
+	// Scene::Chunks, in world space. A chunk that is not resident defers the sample if the ray
+	// enters it before the closest hit, or before maxDistance without another occluder.
+	bool IntersectChunks(const Ray& ray, HitRecord& hit);
+	bool IsChunkOccluded(const Ray& ray, float maxDistance);
+	const Geometry& GetHitGeometry(const HitRecord& hit) const;
+	int GetMaterialIndex(const HitRecord& hit) const;
+	template<uint32_t Features = IntegratorFeatures::AllGeometry>
+	HitPayload ClosestHit(const Ray& ray, const HitRecord& hit);
+	template<uint32_t Features>
+	HitPayload ClosestHit(const Geometry& geometry, const Ray& ray, const HitRecord& hit);
 	HitPayload Miss(const Ray& ray);
 
-	std::pair<float, float> intersectBox(const Ray& ray, const Box& box);
-	std::pair<float, float> Renderer::intersectPlane(const Ray& ray, const Plane& plane);
 	uint32_t m_FrameIndex = 1;
 
 private:
-	std::shared_ptr<Walnut::Image> m_FinalImage;
+	uint32_t m_Width = 0, m_Height = 0;
+
+	std::unique_ptr<ThreadPool> m_ThreadPool;
+	std::vector<WavefrontState> m_WavefrontStates; // One per worker
+	std::vector<MegakernelState> m_MegakernelStates; // One per worker
+	std::vector<std::unique_ptr<Sampler>> m_WorkerSamplers; // One per worker, of m_WorkerSamplerType
+	SamplerType m_WorkerSamplerType = SamplerType::Sobol;
 
-	std::vector<uint32_t> m_ImageHorizontalIter, m_ImageVerticalIter;
+	// Tiles in Morton order, so consecutive tiles (and each worker's block) are neighbours on screen
+	std::vector<TileTiming> m_TileTimings;
+	std::vector<uint8_t> m_DirtyTiles; // Sampled since the last resolve
+	std::vector<uint32_t> m_ResolveTiles;
+	std::vector<uint32_t> m_TileSamples; // Fewest samples of any of the tile's pixels
+	std::vector<uint32_t> m_TileRenders; // Since accumulation restarted, which seeds the samplers
+	std::vector<uint32_t> m_PixelSamples;
+	std::vector<uint8_t> m_ConvergedTiles;
+	std::vector<uint32_t> m_ActiveTiles;
+	std::vector<std::vector<DeferredSample>> m_DeferredSamples; // Per tile
+	std::vector<uint32_t> m_PendingSamples; // Per pixel, deferred samples counted as taken
+	uint32_t m_ActiveTileCount = 0;
+	bool m_ShowingConvergence = false;
+	uint32_t m_TileSize = 0;
 
 	const Scene*  m_ActiveScene  = nullptr;
+	uint64_t m_SceneRevision = 0; // Scene::GetRevision() the accumulation belongs to
 	const Camera* m_ActiveCamera = nullptr;
+	Camera m_SampledCamera{ 45.0f, 0.1f, 100.0f }; // The camera the accumulation belongs to
+	Kernels::LeafIntersectFn m_LeafIntersect = nullptr;
+	PerPixelFn m_PerPixel = nullptr;
+	uint32_t m_IntegratorFeatures = 0;
 
 	uint32_t* m_ImageData = nullptr;
-	glm::vec4* m_AccumulationData = nullptr;
+	AccumulationBuffer m_AccumulationBuffer;
+	uint32_t m_FramesSinceResolve = 0;
+	float m_LastResolveTime = 0.0f;
+
+	Denoiser m_Denoiser; // Sized only while denoising
+	bool m_Denoising = false;       // Settings::Denoise the accumulation belongs to
+	bool m_ShowingDenoised = false; // As of the last resolve
+	float m_LastDenoiseTime = 0.0f;
+
+	Reprojection m_Reprojection; // Sized only while reprojecting
+	bool m_Reprojecting = false;      // Settings::Reproject the accumulation belongs to
+	bool m_GatheringHistory = false;  // The camera moved, so the frame's samples take in the history
+	bool m_HistoryBegun = false;      // OnResize() moved the samples into the history
+	std::atomic<uint32_t> m_ReprojectedPixelCount{ 0 };
+	uint32_t m_LastReprojectedPixelCount = 0;
+	bool m_RecordingFeatures = false; // For the denoiser or reprojection
+
+	std::atomic<uint64_t> m_RayCount{ 0 };
+	uint64_t m_LastFrameRayCount = 0;
+	std::atomic<uint64_t> m_SampleCount{ 0 }; // Accumulated, so deferred samples count once
+	uint64_t m_LastFrameSampleCount = 0;
 
+	std::atomic<bool> m_Cancelled{ false };
+	bool m_LastFrameCancelled = false;
 
 	Settings m_Settings;
 };
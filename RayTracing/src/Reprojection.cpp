@@ -0,0 +1,137 @@
+#include "Reprojection.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Utils
+{
+	// A history pixel sees the same surface if its view depth is within this fraction of the
+	// depth, plus what the surface's slope adds over this many pixels of sample jitter and
+	// bilinear offset
+	static constexpr float DepthTolerance = 0.01f;
+	static constexpr float SlopePixels = 2.0f;
+	static constexpr float MinNormalCosine = 0.9f;
+	// Below this, the valid history pixels cover too little of the footprint to trust
+	static constexpr float MinHistoryWeight = 1e-3f;
+}
+
+void Reprojection::Resize(uint32_t width, uint32_t height)
+{
+	m_Width = m_HistoryWidth = width;
+	m_Height = m_HistoryHeight = height;
+	m_HistoryPixelShare = 1.0f;
+
+	size_t pixelCount = (size_t)width * height;
+	m_Surfaces.assign(pixelCount, glm::vec4(0.0f));
+	m_HistorySurfaces.assign(pixelCount, glm::vec4(0.0f));
+	m_HistorySamples.assign(pixelCount, 0);
+	for (std::vector<glm::vec4>* surfaces : { &m_Surfaces, &m_HistorySurfaces })
+		surfaces->shrink_to_fit();
+	m_HistorySamples.shrink_to_fit();
+	m_History.Resize(width, height);
+}
+
+void Reprojection::Record(uint32_t pixelIndex, const PixelFeatures& features, const Camera& camera)
+{
+	if (features.Depth <= 0.0f)
+	{
+		m_Surfaces[pixelIndex] = glm::vec4(0.0f);
+		return;
+	}
+
+	float depth = -(camera.GetView() * glm::vec4(features.Position, 1.0f)).z;
+	m_Surfaces[pixelIndex] = glm::vec4(features.Normal, depth);
+}
+
+void Reprojection::Begin(AccumulationBuffer& accumulation, std::vector<uint32_t>& sampleCounts, const Camera& previousCamera, uint32_t width, uint32_t height)
+{
+	m_History.SetFormat(accumulation.GetFormat());
+	std::swap(m_History, accumulation);
+	m_HistorySamples.swap(sampleCounts);
+	m_HistorySurfaces.swap(m_Surfaces);
+	m_HistoryCamera = previousCamera;
+	m_HistoryWidth = m_Width;
+	m_HistoryHeight = m_Height;
+
+	// The history's old buffers become the new accumulation, so they only need clearing, and
+	// resizing if the history was taken at another resolution or this one is new
+	m_Width = width;
+	m_Height = height;
+	size_t pixelCount = (size_t)width * height;
+	m_HistoryPixelShare = pixelCount > 0 ? std::min((float)((size_t)m_HistoryWidth * m_HistoryHeight) / (float)pixelCount, 1.0f) : 1.0f;
+	accumulation.Resize(width, height);
+	sampleCounts.assign(pixelCount, 0);
+	m_Surfaces.resize(pixelCount);
+}
+
+uint32_t Reprojection::Gather(uint32_t pixelIndex, const PixelFeatures& features, uint32_t maxHistory, AccumulationBuffer& accumulation) const
+{
+	// Misses hit the black sky, which needs no history
+	glm::vec2 pixel;
+	float depth;
+	if (features.Depth <= 0.0f || maxHistory == 0 || !m_HistoryCamera.ProjectToPixel(features.Position, pixel, depth))
+		return 1;
+
+	glm::vec3 view = m_HistoryCamera.GetProjectionType() == Camera::ProjectionType::Perspective
+		? glm::normalize(features.Position - m_HistoryCamera.GetPosition())
+		: m_HistoryCamera.GetDirection();
+	float cosine = glm::min(glm::abs(glm::dot(features.Normal, view)), 1.0f);
+	float slope = glm::sqrt(1.0f - cosine * cosine) / glm::max(cosine, 0.05f);
+	float tolerance = Utils::DepthTolerance * depth + Utils::SlopePixels * m_HistoryCamera.GetPixelSize(depth) * slope;
+
+	// Bilinear between the centres of the four history pixels around the point
+	glm::vec2 position = pixel - 0.5f;
+	int x0 = (int)std::floor(position.x);
+	int y0 = (int)std::floor(position.y);
+	glm::vec2 fraction = position - glm::vec2((float)x0, (float)y0);
+
+	glm::vec3 mean(0.0f);
+	float meanLuminanceSquared = 0.0f, sampleCount = 0.0f, weightSum = 0.0f;
+	for (int tap = 0; tap < 4; tap++)
+	{
+		int x = x0 + (tap & 1);
+		int y = y0 + (tap >> 1);
+		float weight = ((tap & 1) ? fraction.x : 1.0f - fraction.x) * ((tap >> 1) ? fraction.y : 1.0f - fraction.y);
+		if (x < 0 || y < 0 || x >= (int)m_HistoryWidth || y >= (int)m_HistoryHeight || weight <= 0.0f)
+			continue;
+
+		uint32_t index = (uint32_t)x + (uint32_t)y * m_HistoryWidth;
+		const glm::vec4& surface = m_HistorySurfaces[index];
+		uint32_t samples = m_HistorySamples[index];
+		if (samples == 0 || surface.w <= 0.0f || glm::abs(surface.w - depth) > tolerance ||
+			glm::dot(glm::vec3(surface), features.Normal) < Utils::MinNormalCosine)
+			continue;
+
+		glm::vec3 tapMean;
+		float tapLuminanceSquared;
+		m_History.GetMoments(index, samples, tapMean, tapLuminanceSquared);
+		mean += weight * tapMean;
+		meanLuminanceSquared += weight * tapLuminanceSquared;
+		sampleCount += weight * (float)samples;
+		weightSum += weight;
+	}
+
+	if (weightSum < Utils::MinHistoryWeight)
+		return 1;
+
+	// Capped so that history resampled over many moves fades out
+	uint32_t historyCount = std::min((uint32_t)(sampleCount / weightSum * m_HistoryPixelShare + 0.5f), maxHistory);
+	if (historyCount == 0)
+		return 1;
+
+	glm::vec3 sampleMean;
+	float sampleLuminanceSquared;
+	accumulation.GetMoments(pixelIndex, 1, sampleMean, sampleLuminanceSquared);
+
+	float historyWeight = (float)historyCount / weightSum;
+	float total = (float)(historyCount + 1);
+	accumulation.SetMoments(pixelIndex, (mean * historyWeight + sampleMean) / total,
+		(meanLuminanceSquared * historyWeight + sampleLuminanceSquared) / total, historyCount + 1);
+	return historyCount + 1;
+}
+
+size_t Reprojection::GetMemoryUsage() const
+{
+	return (m_Surfaces.size() + m_HistorySurfaces.size()) * sizeof(glm::vec4) + m_HistorySamples.size() * sizeof(uint32_t) +
+		m_History.GetMemoryUsage();
+}
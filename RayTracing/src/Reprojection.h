@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+#include "Camera.h"
+#include "Denoiser.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Carries accumulated samples across camera moves instead of starting over. Every sample
+// records the normal and view depth of its camera ray's first hit. When the camera moves,
+// Begin() moves the accumulation, its per-pixel sample counts and those hits into a history;
+// the first sample each pixel then takes from the new camera projects its own first hit into
+// the old camera and blends the history pixels around that point (bilinearly, renormalised)
+// that saw the same surface: close enough in view depth, allowing for the slope, and with a
+// similar normal. Pixels whose surface was hidden or off screen find none and start afresh.
+// The history keeps the resolution it was sampled at, so a resize is carried over the same way.
+class Reprojection
+{
+public:
+	void Resize(uint32_t width, uint32_t height);
+
+	// Records the first hit of the pixel's latest sample, taken with camera
+	void Record(uint32_t pixelIndex, const PixelFeatures& features, const Camera& camera);
+
+	// Moves accumulation, the per-pixel sampleCounts and the recorded hits into the history and
+	// leaves them cleared, as seen by previousCamera
+	void Begin(AccumulationBuffer& accumulation, std::vector<uint32_t>& sampleCounts, const Camera& previousCamera) { Begin(accumulation, sampleCounts, previousCamera, m_Width, m_Height); }
+	// Likewise when the resolution changes: the history keeps the old size, and accumulation,
+	// sampleCounts and the recorded hits are left cleared at the new one
+	void Begin(AccumulationBuffer& accumulation, std::vector<uint32_t>& sampleCounts, const Camera& previousCamera, uint32_t width, uint32_t height);
+
+	// For a pixel's first sample after Begin(), already added to accumulation: adds the history
+	// found at its first hit, at most maxHistory samples of it. Returns the pixel's sample count.
+	uint32_t Gather(uint32_t pixelIndex, const PixelFeatures& features, uint32_t maxHistory, AccumulationBuffer& accumulation) const;
+
+	size_t GetMemoryUsage() const;
+private:
+	uint32_t m_Width = 0, m_Height = 0;
+	uint32_t m_HistoryWidth = 0, m_HistoryHeight = 0;
+	// Share of a history pixel's samples that a pixel of the current size takes, below 1 when
+	// the resolution went up: the samples were spread over a larger area
+	float m_HistoryPixelShare = 1.0f;
+
+	// Facing normal in xyz and view depth in w of each pixel's latest first hit, 0 on a miss
+	std::vector<glm::vec4> m_Surfaces, m_HistorySurfaces;
+	AccumulationBuffer m_History;
+	std::vector<uint32_t> m_HistorySamples;
+	Camera m_HistoryCamera{ 45.0f, 0.1f, 100.0f };
+};
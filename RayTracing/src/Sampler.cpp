@@ -0,0 +1,165 @@
+#include "Sampler.h"
+
+namespace Utils
+{
+	// PCG-based integer hash (Jarzynski and Olano, "Hash Functions for GPU Rendering")
+	static uint32_t Hash(uint32_t value)
+	{
+		uint32_t state = value * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	static uint32_t HashCombine(uint32_t seed, uint32_t value)
+	{
+		return seed ^ (Hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+	}
+
+	static uint32_t ReverseBits(uint32_t value)
+	{
+		value = (value << 16) | (value >> 16);
+		value = ((value & 0x00ff00ffu) << 8) | ((value & 0xff00ff00u) >> 8);
+		value = ((value & 0x0f0f0f0fu) << 4) | ((value & 0xf0f0f0f0u) >> 4);
+		value = ((value & 0x33333333u) << 2) | ((value & 0xccccccccu) >> 2);
+		value = ((value & 0x55555555u) << 1) | ((value & 0xaaaaaaaau) >> 1);
+		return value;
+	}
+
+	// Each bit is flipped by a hash of the bits below it (Laine and Karras). Applied to reversed
+	// bits this is an Owen scramble, which permutes the sequence while keeping its strata.
+	static uint32_t LaineKarrasPermutation(uint32_t value, uint32_t seed)
+	{
+		value += seed;
+		value ^= value * 0x6c50b47cu;
+		value ^= value * 0xb82f1e52u;
+		value ^= value * 0xc7afe638u;
+		value ^= value * 0x8d22f6e6u;
+		return value;
+	}
+
+	static uint32_t NestedUniformScramble(uint32_t value, uint32_t seed)
+	{
+		return ReverseBits(LaineKarrasPermutation(ReverseBits(value), seed));
+	}
+
+	// XOR of the second dimension's direction numbers selected by each byte of the index
+	struct SobolTable
+	{
+		uint32_t Bytes[4][256];
+
+		SobolTable()
+		{
+			uint32_t directions[32];
+			uint32_t direction = 1u << 31;
+			for (uint32_t bit = 0; bit < 32; bit++, direction ^= direction >> 1)
+				directions[bit] = direction;
+
+			for (uint32_t byte = 0; byte < 4; byte++)
+			{
+				for (uint32_t value = 0; value < 256; value++)
+				{
+					uint32_t result = 0;
+					for (uint32_t bit = 0; bit < 8; bit++)
+					{
+						if (value & (1u << bit))
+							result ^= directions[byte * 8 + bit];
+					}
+					Bytes[byte][value] = result;
+				}
+			}
+		}
+	};
+	static const SobolTable s_SobolTable;
+
+	// Second Sobol dimension (the Pascal matrix); the first is just the reversed index
+	static uint32_t Sobol1(uint32_t index)
+	{
+		return s_SobolTable.Bytes[0][index & 0xff] ^ s_SobolTable.Bytes[1][(index >> 8) & 0xff] ^
+			s_SobolTable.Bytes[2][(index >> 16) & 0xff] ^ s_SobolTable.Bytes[3][index >> 24];
+	}
+
+	// Top 24 bits, so the result is exactly representable and below 1
+	static float ToFloat(uint32_t value)
+	{
+		return (float)(value >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+std::unique_ptr<Sampler> Sampler::Create(SamplerType type)
+{
+	switch (type)
+	{
+		case SamplerType::PCG:   return std::make_unique<PCGSampler>();
+		case SamplerType::Sobol: return std::make_unique<SobolSampler>();
+	}
+	return nullptr;
+}
+
+const char* Sampler::GetName(SamplerType type)
+{
+	switch (type)
+	{
+		case SamplerType::PCG:   return "pcg";
+		case SamplerType::Sobol: return "sobol";
+	}
+	return "unknown";
+}
+
+void PCGSampler::StartPixel(uint32_t x, uint32_t y, uint32_t sampleIndex)
+{
+	uint32_t seed = Utils::HashCombine(Utils::HashCombine(Utils::Hash(x), y), sampleIndex);
+	m_State = 0;
+	NextUInt();
+	m_State += seed;
+	NextUInt();
+}
+
+uint32_t PCGSampler::NextUInt()
+{
+	// PCG32 (XSH RR) with a fixed stream
+	uint64_t previous = m_State;
+	m_State = previous * 6364136223846793005ull + 1442695040888963407ull;
+
+	uint32_t shifted = (uint32_t)(((previous >> 18u) ^ previous) >> 27u);
+	uint32_t rotation = (uint32_t)(previous >> 59u);
+	return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+}
+
+float PCGSampler::Get1D()
+{
+	return Utils::ToFloat(NextUInt());
+}
+
+glm::vec2 PCGSampler::Get2D()
+{
+	float x = Get1D();
+	return glm::vec2(x, Get1D());
+}
+
+void SobolSampler::StartPixel(uint32_t x, uint32_t y, uint32_t sampleIndex)
+{
+	m_PixelSeed = Utils::HashCombine(Utils::Hash(x), y);
+	m_ReversedIndex = Utils::ReverseBits(sampleIndex);
+	m_Dimension = 0;
+}
+
+float SobolSampler::Get1D()
+{
+	uint32_t seed = Utils::HashCombine(m_PixelSeed, m_Dimension++);
+
+	// Shuffling the index per dimension decorrelates dimensions that all use the same Sobol
+	// component. The first component is the reversed index, so its reversals cancel out.
+	uint32_t reversedShuffledIndex = Utils::LaineKarrasPermutation(m_ReversedIndex, seed);
+	uint32_t value = Utils::NestedUniformScramble(reversedShuffledIndex, Utils::Hash(seed));
+	return Utils::ToFloat(value);
+}
+
+glm::vec2 SobolSampler::Get2D()
+{
+	uint32_t seed = Utils::HashCombine(m_PixelSeed, m_Dimension++);
+
+	uint32_t reversedShuffledIndex = Utils::LaineKarrasPermutation(m_ReversedIndex, seed);
+	uint32_t x = Utils::NestedUniformScramble(reversedShuffledIndex, Utils::HashCombine(seed, 0));
+	uint32_t y = Utils::NestedUniformScramble(Utils::Sobol1(Utils::ReverseBits(reversedShuffledIndex)), Utils::HashCombine(seed, 1));
+	return glm::vec2(Utils::ToFloat(x), Utils::ToFloat(y));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+
+enum class SamplerType
+{
+	PCG = 0, Sobol
+};
+
+// Source of the random numbers for one pixel sample. StartPixel() derives all state from the
+// pixel and sample index, so every pixel sees the same numbers no matter which thread renders
+// it or in what order. Each Get call consumes the next dimension of the sample.
+class Sampler
+{
+public:
+	virtual ~Sampler() = default;
+
+	virtual void StartPixel(uint32_t x, uint32_t y, uint32_t sampleIndex) = 0;
+
+	// Uniform in [0, 1)
+	virtual float Get1D() = 0;
+	virtual glm::vec2 Get2D() = 0;
+
+	glm::vec3 Vec3(float min, float max)
+	{
+		glm::vec2 xy = Get2D();
+		float z = Get1D();
+		return glm::vec3(xy.x, xy.y, z) * (max - min) + min;
+	}
+
+	static std::unique_ptr<Sampler> Create(SamplerType type);
+	static const char* GetName(SamplerType type);
+};
+
+// Independent numbers from a PCG32 stream seeded by hashing the pixel and sample index
+class PCGSampler : public Sampler
+{
+public:
+	void StartPixel(uint32_t x, uint32_t y, uint32_t sampleIndex) override;
+	float Get1D() override;
+	glm::vec2 Get2D() override;
+private:
+	uint32_t NextUInt();
+private:
+	uint64_t m_State = 0;
+};
+
+// Sobol (0, 2)-sequence with hash-based Owen scrambling per pixel and dimension (Burley 2020).
+// Successive sample indices of a pixel stratify every dimension and every Get2D() pair.
+class SobolSampler : public Sampler
+{
+public:
+	void StartPixel(uint32_t x, uint32_t y, uint32_t sampleIndex) override;
+	float Get1D() override;
+	glm::vec2 Get2D() override;
+private:
+	uint32_t m_PixelSeed = 0;
+	uint32_t m_ReversedIndex = 0;
+	uint32_t m_Dimension = 0;
+};
+
+namespace Sampling
+{
+	// Orthonormal tangents of a unit vector (Duff et al., "Building an Orthonormal Basis, Revisited"),
+	// to turn sampled angles around it into directions
+	inline void BuildBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+	{
+		float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+		tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+	}
+}
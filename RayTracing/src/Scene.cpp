@@ -0,0 +1,462 @@
+#include "Scene.h"
+
+#include <atomic>
+
+void Geometry::BuildAcceleration()
+{
+	Primitives.clear();
+	Primitives.reserve(Spheres.size() + Boxes.size());
+
+	for (uint32_t i = 0; i < (uint32_t)Spheres.size(); i++)
+		Primitives.push_back({ PrimitiveType::Sphere, i });
+	for (uint32_t i = 0; i < (uint32_t)Boxes.size(); i++)
+		Primitives.push_back({ PrimitiveType::Box, i });
+
+	Accelerator.Build(CollectPrimitiveBounds(), Kernels::GetLaneCount(Kernels::GetActiveISA()));
+
+	const std::vector<uint32_t>& primitiveIndices = Accelerator.GetPrimitiveIndices();
+	LeafPrimitives.resize(primitiveIndices.size());
+	for (size_t i = 0; i < primitiveIndices.size(); i++)
+		LeafPrimitives[i] = Primitives[primitiveIndices[i]];
+
+	LeafData.Resize((uint32_t)LeafPrimitives.size());
+	UpdateLeafData();
+
+	BuildMeshAcceleration();
+}
+
+void Geometry::RefitAcceleration()
+{
+	if (Primitives.size() != Spheres.size() + Boxes.size())
+	{
+		BuildAcceleration();
+		return;
+	}
+
+	Accelerator.Refit(CollectPrimitiveBounds());
+	UpdateLeafData();
+
+	BuildMeshAcceleration();
+}
+
+void Geometry::RefitPrimitives(const std::vector<uint32_t>& primitives)
+{
+	if (Primitives.size() != Spheres.size() + Boxes.size())
+	{
+		BuildAcceleration();
+		return;
+	}
+	if (Accelerator.IsEmpty() || primitives.empty())
+		return;
+
+	// Past about one in eight primitives a full sweep beats walking up from each leaf
+	if (primitives.size() * 8 > Primitives.size())
+	{
+		Accelerator.Refit(CollectPrimitiveBounds());
+		UpdateLeafData();
+		return;
+	}
+
+	Accelerator.RefitPrimitives(primitives, [&](uint32_t primitive)
+	{
+		return GetPrimitiveBounds(Primitives[primitive]);
+	});
+	for (uint32_t primitive : primitives)
+		UpdateLeafLane(Accelerator.GetPrimitiveSlot(primitive));
+}
+
+void Geometry::BuildMeshAcceleration()
+{
+	std::vector<AABB> bounds(Meshes.size());
+	for (size_t i = 0; i < Meshes.size(); i++)
+	{
+		if (Meshes[i].Accelerator.IsEmpty())
+			Meshes[i].BuildAcceleration();
+		bounds[i] = Meshes[i].GetBounds();
+	}
+
+	MeshAccelerator.Build(bounds, 1);
+}
+
+AABB Geometry::GetPrimitiveBounds(const PrimitiveRef& primitive) const
+{
+	AABB bounds;
+	switch (primitive.GetType())
+	{
+		case PrimitiveType::Sphere:
+		{
+			const Sphere& sphere = Spheres[primitive.GetIndex()];
+			bounds.Min = sphere.Position - glm::vec3(glm::abs(sphere.Radius));
+			bounds.Max = sphere.Position + glm::vec3(glm::abs(sphere.Radius));
+			break;
+		}
+		case PrimitiveType::Box:
+		{
+			const Box& box = Boxes[primitive.GetIndex()];
+			bounds.Grow(box.Position);
+			bounds.Grow(box.Position + glm::vec3(box.Width, box.Height, box.Depth));
+			break;
+		}
+		case PrimitiveType::Mesh:
+			bounds = Meshes[primitive.GetIndex()].GetBounds();
+			break;
+	}
+	return bounds;
+}
+
+void Geometry::UpdateLeafData()
+{
+	for (uint32_t lane = 0; lane < (uint32_t)LeafPrimitives.size(); lane++)
+		UpdateLeafLane(lane);
+}
+
+void Geometry::UpdateLeafLane(uint32_t lane)
+{
+	const PrimitiveRef& primitive = LeafPrimitives[lane];
+	if (primitive.GetType() == PrimitiveType::Sphere)
+	{
+		const Sphere& sphere = Spheres[primitive.GetIndex()];
+		LeafData.SetSphere(lane, sphere.Position, sphere.Radius);
+	}
+	else
+	{
+		const Box& box = Boxes[primitive.GetIndex()];
+		LeafData.SetBox(lane, box.Position, box.Position + glm::vec3(box.Width, box.Height, box.Depth));
+	}
+}
+
+std::vector<AABB> Geometry::CollectPrimitiveBounds() const
+{
+	std::vector<AABB> bounds(Primitives.size());
+	for (size_t i = 0; i < Primitives.size(); i++)
+		bounds[i] = GetPrimitiveBounds(Primitives[i]);
+	return bounds;
+}
+
+AABB Geometry::GetBounds() const
+{
+	AABB bounds;
+	if (!Accelerator.IsEmpty())
+	{
+		bounds.Grow(Accelerator.GetNodes()[0].BoundsMin);
+		bounds.Grow(Accelerator.GetNodes()[0].BoundsMax);
+	}
+	if (!MeshAccelerator.IsEmpty())
+	{
+		bounds.Grow(MeshAccelerator.GetNodes()[0].BoundsMin);
+		bounds.Grow(MeshAccelerator.GetNodes()[0].BoundsMax);
+	}
+	return bounds;
+}
+
+bool Geometry::HasValidPrimitives() const
+{
+	auto isValid = [this](PrimitiveRef primitive)
+	{
+		switch (primitive.GetType())
+		{
+			case PrimitiveType::Sphere: return primitive.GetIndex() < Spheres.size();
+			case PrimitiveType::Box:    return primitive.GetIndex() < Boxes.size();
+			default:                    return false;
+		}
+	};
+	return std::all_of(Primitives.begin(), Primitives.end(), isValid) && std::all_of(LeafPrimitives.begin(), LeafPrimitives.end(), isValid);
+}
+
+size_t Geometry::GetMemoryUsage() const
+{
+	size_t bytes = Spheres.capacity() * sizeof(Sphere) + Boxes.capacity() * sizeof(Box) +
+		Accelerator.GetNodes().capacity() * sizeof(BVHNode) + Accelerator.GetPrimitiveIndices().capacity() * sizeof(uint32_t) +
+		(Primitives.capacity() + LeafPrimitives.capacity()) * sizeof(PrimitiveRef) +
+		MeshAccelerator.GetNodes().capacity() * sizeof(BVHNode) + MeshAccelerator.GetPrimitiveIndices().capacity() * sizeof(uint32_t);
+	for (const std::vector<float>* lanes : { &LeafData.CenterX, &LeafData.CenterY, &LeafData.CenterZ, &LeafData.Radius,
+		&LeafData.MinX, &LeafData.MinY, &LeafData.MinZ, &LeafData.MaxX, &LeafData.MaxY, &LeafData.MaxZ })
+		bytes += lanes->capacity() * sizeof(float);
+	for (const Mesh& mesh : Meshes)
+		bytes += mesh.GetMemoryUsage();
+	return bytes;
+}
+
+void Scene::BuildAcceleration()
+{
+	Geometry::BuildAcceleration();
+	for (Prototype& prototype : Prototypes)
+		prototype.BuildAcceleration();
+
+	BuildInstanceAcceleration();
+	BuildLights();
+
+	m_ChangedPrimitives.clear();
+	m_ChangedInstances.clear();
+	m_ChangedMaterials.clear();
+	m_ChangedObjects = 0;
+	m_ChangedLights = 0;
+	m_StructureChanged = false;
+	m_Revision = NextRevision();
+}
+
+void Scene::BuildLights()
+{
+	m_HasEmissiveMaterials = false;
+	for (const Material& material : Materials)
+		m_HasEmissiveMaterials |= material.IsEmissive();
+	m_HasLights = !Lights.empty() || m_HasEmissiveMaterials;
+
+	std::vector<Light> lights = Lights;
+	m_SphereLights.clear();
+	for (uint32_t i = 0; i < (uint32_t)Spheres.size() && m_HasEmissiveMaterials; i++)
+	{
+		const Sphere& sphere = Spheres[i];
+		const Material& material = Materials[sphere.MaterialIndex];
+		if (!material.IsEmissive())
+			continue;
+
+		Light& light = lights.emplace_back();
+		light.Type = LightType::Sphere;
+		light.Color = material.EmissionColor;
+		light.Intensity = material.EmissionPower;
+		light.Position = sphere.Position;
+		light.Radius = sphere.Radius;
+
+		m_SphereLights.resize(Spheres.size(), -1);
+		m_SphereLights[i] = (int)lights.size() - 1;
+	}
+
+	LightHierarchy.Build(std::move(lights));
+}
+
+void Scene::RefitAcceleration()
+{
+	Geometry::RefitAcceleration();
+	for (Prototype& prototype : Prototypes)
+		prototype.RefitAcceleration();
+	BuildLights();
+
+	m_Revision = NextRevision();
+
+	if (InverseTransforms.size() != Instances.size())
+	{
+		BuildInstanceAcceleration();
+		return;
+	}
+
+	for (size_t i = 0; i < Instances.size(); i++)
+		InverseTransforms[i] = AffineTransform(glm::inverse(Instances[i].Transform));
+	InstanceAccelerator.Refit(CollectInstanceBounds());
+}
+
+void Scene::SetSphere(uint32_t index, const Sphere& sphere)
+{
+	Sphere& current = Spheres[index];
+	if (sphere.Position != current.Position || sphere.Radius != current.Radius)
+		m_ChangedPrimitives.push_back(index);
+	current = sphere;
+	m_ChangedObjects++;
+}
+
+void Scene::SetBox(uint32_t index, const Box& box)
+{
+	Box& current = Boxes[index];
+	if (box.Position != current.Position || box.Width != current.Width || box.Height != current.Height || box.Depth != current.Depth)
+		m_ChangedPrimitives.push_back((uint32_t)Spheres.size() + index);
+	current = box;
+	m_ChangedObjects++;
+}
+
+void Scene::SetMeshMaterial(uint32_t index, int materialIndex)
+{
+	Meshes[index].MaterialIndex = materialIndex;
+	m_ChangedObjects++;
+}
+
+void Scene::SetMaterial(uint32_t index, const Material& material)
+{
+	Materials[index] = material;
+	m_ChangedMaterials.push_back(index);
+}
+
+void Scene::SetInstanceTransform(uint32_t index, const glm::mat4& transform)
+{
+	Instances[index].Transform = transform;
+	m_ChangedInstances.push_back(index);
+	m_ChangedObjects++;
+}
+
+void Scene::SetLight(uint32_t index, const Light& light)
+{
+	Lights[index] = light;
+	m_ChangedLights++;
+}
+
+uint32_t Scene::AddSphere(const Sphere& sphere)
+{
+	Spheres.push_back(sphere);
+	m_StructureChanged = true;
+	m_ChangedObjects++;
+	return (uint32_t)Spheres.size() - 1;
+}
+
+uint32_t Scene::AddBox(const Box& box)
+{
+	Boxes.push_back(box);
+	m_StructureChanged = true;
+	m_ChangedObjects++;
+	return (uint32_t)Boxes.size() - 1;
+}
+
+uint32_t Scene::AddInstance(const Instance& instance)
+{
+	Instances.push_back(instance);
+	m_StructureChanged = true;
+	m_ChangedObjects++;
+	return (uint32_t)Instances.size() - 1;
+}
+
+uint32_t Scene::AddLight(const Light& light)
+{
+	Lights.push_back(light);
+	m_ChangedLights++;
+	return (uint32_t)Lights.size() - 1;
+}
+
+bool Scene::HasPendingChanges() const
+{
+	return m_StructureChanged || m_ChangedObjects != 0 || m_ChangedLights != 0 || !m_ChangedMaterials.empty();
+}
+
+SceneChanges Scene::CommitChanges()
+{
+	// An object edited several times is refitted once
+	for (std::vector<uint32_t>* indices : { &m_ChangedPrimitives, &m_ChangedInstances, &m_ChangedMaterials })
+	{
+		std::sort(indices->begin(), indices->end());
+		indices->erase(std::unique(indices->begin(), indices->end()), indices->end());
+	}
+
+	SceneChanges changes;
+	changes.Materials = (uint32_t)m_ChangedMaterials.size();
+	changes.Objects = m_ChangedObjects;
+	changes.Refitted = (uint32_t)(m_ChangedPrimitives.size() + m_ChangedInstances.size());
+	changes.Lights = m_ChangedLights;
+	changes.Rebuilt = m_StructureChanged;
+	if (changes.IsEmpty())
+		return changes;
+
+	if (m_StructureChanged)
+	{
+		// Also clears the pending edits and moves the revision on
+		BuildAcceleration();
+		return changes;
+	}
+
+	// Material indices and materials are read while shading; only the lights are built from
+	// them, and from the emissive spheres among the edited objects
+	Geometry::RefitPrimitives(m_ChangedPrimitives);
+	RefitInstances(m_ChangedInstances);
+	if (m_ChangedLights != 0 || !m_ChangedMaterials.empty() || (m_ChangedObjects != 0 && m_HasEmissiveMaterials))
+		BuildLights();
+
+	m_ChangedPrimitives.clear();
+	m_ChangedInstances.clear();
+	m_ChangedMaterials.clear();
+	m_ChangedObjects = 0;
+	m_ChangedLights = 0;
+	m_Revision = NextRevision();
+	return changes;
+}
+
+void Scene::RefitInstances(const std::vector<uint32_t>& instances)
+{
+	if (instances.empty())
+		return;
+	if (InverseTransforms.size() != Instances.size())
+	{
+		BuildInstanceAcceleration();
+		return;
+	}
+
+	for (uint32_t i : instances)
+		InverseTransforms[i] = AffineTransform(glm::inverse(Instances[i].Transform));
+
+	if (InstanceAccelerator.IsEmpty())
+		return;
+	if (instances.size() * 8 > Instances.size())
+		InstanceAccelerator.Refit(CollectInstanceBounds());
+	else
+		InstanceAccelerator.RefitPrimitives(instances, [&](uint32_t instance) { return GetInstanceBounds(instance); });
+}
+
+uint64_t Scene::NextRevision()
+{
+	static std::atomic<uint64_t> s_Revision{ 0 };
+	return ++s_Revision;
+}
+
+void Scene::BuildInstanceAcceleration()
+{
+	InverseTransforms.resize(Instances.size());
+	for (size_t i = 0; i < Instances.size(); i++)
+		InverseTransforms[i] = AffineTransform(glm::inverse(Instances[i].Transform));
+
+	InstanceAccelerator.Build(CollectInstanceBounds(), 1);
+}
+
+AABB Scene::GetInstanceBounds(uint32_t instanceIndex) const
+{
+	const Instance& instance = Instances[instanceIndex];
+	AABB objectBounds = Prototypes[instance.PrototypeIndex].GetBounds();
+	AABB bounds;
+	if (objectBounds.Min.x > objectBounds.Max.x)
+		return bounds;
+
+	// Bounds of the transformed corners
+	AffineTransform transform(instance.Transform);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point(
+			corner & 1 ? objectBounds.Max.x : objectBounds.Min.x,
+			corner & 2 ? objectBounds.Max.y : objectBounds.Min.y,
+			corner & 4 ? objectBounds.Max.z : objectBounds.Min.z);
+		bounds.Grow(transform.TransformPoint(point));
+	}
+	return bounds;
+}
+
+size_t Scene::GetInstanceMemoryUsage() const
+{
+	return Instances.capacity() * sizeof(Instance) + InverseTransforms.capacity() * sizeof(AffineTransform) +
+		InstanceAccelerator.GetNodes().capacity() * sizeof(BVHNode) + InstanceAccelerator.GetPrimitiveIndices().capacity() * sizeof(uint32_t);
+}
+
+uint64_t Scene::GetInstancedPrimitiveCount() const
+{
+	uint64_t count = Spheres.size() + Boxes.size();
+	for (const Instance& instance : Instances)
+		count += Prototypes[instance.PrototypeIndex].Spheres.size() + Prototypes[instance.PrototypeIndex].Boxes.size();
+	return count;
+}
+
+uint64_t Scene::GetInstancedTriangleCount() const
+{
+	std::vector<uint64_t> prototypeTriangles(Prototypes.size(), 0);
+	for (size_t i = 0; i < Prototypes.size(); i++)
+	{
+		for (const Mesh& mesh : Prototypes[i].Meshes)
+			prototypeTriangles[i] += mesh.GetTriangleCount();
+	}
+
+	uint64_t count = 0;
+	for (const Mesh& mesh : Meshes)
+		count += mesh.GetTriangleCount();
+	for (const Instance& instance : Instances)
+		count += prototypeTriangles[instance.PrototypeIndex];
+	return count;
+}
+
+std::vector<AABB> Scene::CollectInstanceBounds() const
+{
+	std::vector<AABB> bounds(Instances.size());
+	for (uint32_t i = 0; i < (uint32_t)Instances.size(); i++)
+		bounds[i] = GetInstanceBounds(i);
+	return bounds;
+}
@@ -4,14 +4,29 @@
 #include <vector>
 #include <array>
 #include <algorithm> // Para std::copy
+#include <string>
+#include <memory>
 #include "Ray.h"
+#include "BVH.h"
+#include "IntersectionKernels.h"
+#include "Mesh.h"
+#include "Light.h"
 
+class ChunkCache;
 
 struct Material
 {	
 	glm::vec3 Albedo{ 1.0f };
 	float Roughness = 1.0f;
 	float Metalic = 0.0f;
+
+	// Light given off by surfaces with this material. Emissive world spheres are also sampled
+	// as sphere lights; other emissive surfaces only add light where paths happen to hit them.
+	glm::vec3 EmissionColor{ 1.0f };
+	float EmissionPower = 0.0f;
+
+	glm::vec3 GetEmission() const { return EmissionColor * EmissionPower; }
+	bool IsEmissive() const { return EmissionPower > 0.0f; }
 };
 
 struct Sphere
@@ -22,43 +37,226 @@ struct Sphere
 	int MaterialIndex = 0;
 };
 
-struct Plane
-{
-	float a, b, c, d; // Coeficientes do plano na forma ax + by + cz + d = 0
-
-	// Construtor padro
-	Plane(float a = 0.0f, float b = 0.0f, float c = 0.0f, float d = 0.0f)
-		: a(a), b(b), c(c), d(d) {}
-};
-
-
 struct Box
 {
-	glm::vec3 Position{ 0.0f };
+	glm::vec3 Position{ 0.0f }; // Minimum corner
 	float Width = 0.5f;
 	float Height = 0.5f;
 	float Depth = 0.5f;
 	int MaterialIndex = 0;
+};
+
+enum class PrimitiveType : uint32_t
+{
+	Sphere = 0,
+	Box,
+	Mesh
+};
+
+// What a BVH leaf index or a hit refers to, packed in one word: the type in the top two bits
+// and the index into the geometry's Spheres, Boxes or Meshes below
+struct PrimitiveRef
+{
+	static constexpr uint32_t IndexBits = 30;
+	static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+
+	uint32_t Bits = 0;
+
+	PrimitiveRef() = default;
+	PrimitiveRef(PrimitiveType type, uint32_t index) : Bits((uint32_t)type << IndexBits | index) {}
 
-	Plane planes[6]; // Um array de seis planos para definir a caixa
+	PrimitiveType GetType() const { return (PrimitiveType)(Bits >> IndexBits); }
+	uint32_t GetIndex() const { return Bits & IndexMask; }
+};
+
+// Spheres, boxes and meshes with the acceleration structures over them. The scene's own
+// geometry is in world space, a prototype's in its object space.
+struct Geometry
+{
+	std::vector<Sphere> Spheres;
+	std::vector<Box> Boxes;
+	std::vector<Mesh> Meshes;
+
+	// Acceleration structure over Spheres and Boxes. Call BuildAcceleration() after adding or
+	// removing primitives and RefitAcceleration() after moving or resizing them.
+	// Until it is built the renderer falls back to testing every primitive.
+	BVH Accelerator;
+	std::vector<PrimitiveRef> Primitives;
+
+	// Spheres and boxes copied in BVH leaf order for the SIMD kernels: lane i holds
+	// LeafPrimitives[i], which is Primitives[Accelerator.GetPrimitiveIndices()[i]]
+	PrimitiveSoA LeafData;
+	std::vector<PrimitiveRef> LeafPrimitives;
+
+	// Top level over Meshes, one entry per mesh. Each mesh brings its own triangle BVH, which
+	// BuildAcceleration() only builds if the mesh does not have one yet.
+	BVH MeshAccelerator;
 
-	// Construtor que aceita seis planos
-	void SetPlanes(Plane p1, Plane p2, Plane p3, Plane p4, Plane p5, Plane p6)
+	void BuildAcceleration();
+	void RefitAcceleration();
+	// Refits only the leaves holding the given Primitives entries and their ancestors, and
+	// rewrites their SIMD lanes. Many changes fall back to RefitAcceleration(), a primitive
+	// list that no longer matches to BuildAcceleration().
+	void RefitPrimitives(const std::vector<uint32_t>& primitives);
+
+	AABB GetPrimitiveBounds(const PrimitiveRef& primitive) const;
+	// Bounds of everything, from the built acceleration structures
+	AABB GetBounds() const;
+	// Bytes held by the primitives, meshes and acceleration structures
+	size_t GetMemoryUsage() const;
+	// Whether Primitives and LeafPrimitives only name existing spheres and boxes, for geometry
+	// read from disk
+	bool HasValidPrimitives() const;
+private:
+	std::vector<AABB> CollectPrimitiveBounds() const;
+	void UpdateLeafData();
+	void UpdateLeafLane(uint32_t lane);
+	void BuildMeshAcceleration();
+};
+
+// Geometry stored once and placed any number of times by Instances
+struct Prototype : Geometry
+{
+	std::string Name;
+};
+
+struct Instance
+{
+	glm::mat4 Transform{ 1.0f }; // Object to world, any affine matrix
+	uint32_t PrototypeIndex = 0;
+};
+
+// The first three rows of an affine matrix, applied to points and directions. Tracing keeps
+// each instance's world-to-object transform in this form.
+struct AffineTransform
+{
+	glm::vec4 Rows[3];
+
+	AffineTransform() = default;
+	explicit AffineTransform(const glm::mat4& matrix)
+	{
+		for (int row = 0; row < 3; row++)
+			Rows[row] = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]);
+	}
+
+	glm::vec3 TransformPoint(const glm::vec3& point) const
+	{
+		return glm::vec3(
+			glm::dot(glm::vec3(Rows[0]), point) + Rows[0].w,
+			glm::dot(glm::vec3(Rows[1]), point) + Rows[1].w,
+			glm::dot(glm::vec3(Rows[2]), point) + Rows[2].w);
+	}
+
+	glm::vec3 TransformVector(const glm::vec3& vector) const
 	{
-		planes[0] = p1;
-		planes[1] = p2;
-		planes[2] = p3;
-		planes[3] = p4;
-		planes[4] = p5;
-		planes[5] = p6;
+		return glm::vec3(glm::dot(glm::vec3(Rows[0]), vector), glm::dot(glm::vec3(Rows[1]), vector), glm::dot(glm::vec3(Rows[2]), vector));
 	}
 
+	// Transpose of the upper 3x3 times the vector; for a world-to-object transform this takes
+	// object space normals to world space
+	glm::vec3 TransformNormal(const glm::vec3& normal) const
+	{
+		return glm::vec3(Rows[0]) * normal.x + glm::vec3(Rows[1]) * normal.y + glm::vec3(Rows[2]) * normal.z;
+	}
 };
 
-struct Scene
+// What Scene::CommitChanges() applied
+struct SceneChanges
+{
+	uint32_t Materials = 0; // Materials edited
+	uint32_t Objects = 0;   // Spheres, boxes, meshes and instances edited
+	uint32_t Refitted = 0;  // Objects whose bounds changed and were refitted
+	uint32_t Lights = 0;    // Lights edited or added
+	bool Rebuilt = false;   // Added objects forced a full build
+
+	bool IsEmpty() const { return Materials == 0 && Objects == 0 && Lights == 0 && !Rebuilt; }
+};
+
+// World geometry plus instanced prototypes, traced through a two-level hierarchy: the instance
+// BVH's leaves are instances, whose rays are moved into object space and traced through the
+// prototype's own BVHs. Every instance costs about 184 bytes however large its prototype is:
+//     Instance              68 B
+//     InverseTransforms     48 B
+//     InstanceAccelerator   68 B (two nodes and one index per instance)
+struct Scene : Geometry
 {
-	std::vector<Sphere> Spheres;
 	std::vector<Material> Materials;
-	std::vector<Box> Boxes;
-	std::vector<Plane> Planes;
-};
\ No newline at end of file
+
+	// Lights placed in the scene. With neither lights nor emissive materials the renderer falls
+	// back to its built-in light.
+	std::vector<Light> Lights;
+	// Lights plus the emissive world spheres, built by BuildLights()
+	LightTree LightHierarchy;
+
+	std::vector<Prototype> Prototypes;
+	std::vector<Instance> Instances;
+
+	// Built by BuildAcceleration() and refitted by RefitAcceleration(), in Instances order
+	BVH InstanceAccelerator;
+	std::vector<AffineTransform> InverseTransforms;
+
+	// More world spheres and boxes, streamed from disk in chunks; null for scenes held in memory
+	std::shared_ptr<ChunkCache> Chunks;
+
+	// Builds the world geometry, every prototype, the instance level and the lights
+	void BuildAcceleration();
+	// Rebuilds LightHierarchy from Lights, the materials and the world spheres
+	void BuildLights();
+	// Also picks up edited instance transforms; rebuilds if instances were added or removed
+	void RefitAcceleration();
+
+	// Edits that record what they touch. CommitChanges() then brings the acceleration
+	// structures up to date with the least work: material edits (including a primitive's
+	// material index) need none, moved or resized objects refit only their own leaves and
+	// ancestors, added objects rebuild. Prototype geometry is shared by its instances and is
+	// edited directly, followed by BuildAcceleration().
+	void SetSphere(uint32_t index, const Sphere& sphere);
+	void SetBox(uint32_t index, const Box& box);
+	void SetMeshMaterial(uint32_t index, int materialIndex);
+	void SetMaterial(uint32_t index, const Material& material);
+	void SetInstanceTransform(uint32_t index, const glm::mat4& transform);
+	void SetLight(uint32_t index, const Light& light);
+	uint32_t AddSphere(const Sphere& sphere);
+	uint32_t AddBox(const Box& box);
+	uint32_t AddInstance(const Instance& instance);
+	uint32_t AddLight(const Light& light);
+
+	bool HasPendingChanges() const;
+	SceneChanges CommitChanges();
+
+	// Changes whenever the scene is built, refitted or has changes committed (and differs
+	// between scenes), so a renderer can tell its accumulated samples are stale
+	uint64_t GetRevision() const { return m_Revision; }
+
+	// Lights or emissive materials, as of the last BuildLights()
+	bool HasLights() const { return m_HasLights; }
+	// LightHierarchy index of an emissive world sphere, -1 for other spheres
+	int GetSphereLight(uint32_t sphereIndex) const { return sphereIndex < m_SphereLights.size() ? m_SphereLights[sphereIndex] : -1; }
+
+	AABB GetInstanceBounds(uint32_t instanceIndex) const;
+	// Bytes held by the instances, their transforms and the instance BVH, not the prototypes
+	size_t GetInstanceMemoryUsage() const;
+	// Primitives and triangles as rendered, counting every instance's copy
+	uint64_t GetInstancedPrimitiveCount() const;
+	uint64_t GetInstancedTriangleCount() const;
+private:
+	void BuildInstanceAcceleration();
+	void RefitInstances(const std::vector<uint32_t>& instances);
+	std::vector<AABB> CollectInstanceBounds() const;
+
+	static uint64_t NextRevision();
+private:
+	uint64_t m_Revision = NextRevision();
+
+	// Pending edits, indices into Primitives (spheres then boxes), Instances and Materials
+	std::vector<uint32_t> m_ChangedPrimitives;
+	std::vector<uint32_t> m_ChangedInstances;
+	std::vector<uint32_t> m_ChangedMaterials;
+	uint32_t m_ChangedObjects = 0;
+	uint32_t m_ChangedLights = 0;
+	bool m_StructureChanged = false;
+
+	bool m_HasLights = false;
+	bool m_HasEmissiveMaterials = false;
+	std::vector<int> m_SphereLights; // Empty if no sphere is emissive
+};
@@ -0,0 +1,925 @@
+#include "SceneFile.h"
+#include "MappedFile.h"
+#include "MeshImporter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <glm/gtc/matrix_transform.hpp>
+#include <type_traits>
+
+namespace Utils
+{
+	static bool IsLineEnd(char c)
+	{
+		return c == '\0' || c == '\n' || c == '#';
+	}
+
+	static void SkipBlanks(const char*& cursor)
+	{
+		while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+			cursor++;
+	}
+
+	// Numbers never continue onto the next line
+	static bool ReadFloat(const char*& cursor, float& value)
+	{
+		SkipBlanks(cursor);
+		if (IsLineEnd(*cursor))
+			return false;
+
+		char* end;
+		value = std::strtof(cursor, &end);
+		if (end == cursor)
+			return false;
+
+		cursor = end;
+		return true;
+	}
+
+	static bool ReadInt(const char*& cursor, int& value)
+	{
+		SkipBlanks(cursor);
+		if (IsLineEnd(*cursor))
+			return false;
+
+		char* end;
+		value = (int)std::strtol(cursor, &end, 10);
+		if (end == cursor)
+			return false;
+
+		cursor = end;
+		return true;
+	}
+
+	// A bare word or a double-quoted string, for paths with spaces
+	static bool ReadString(const char*& cursor, std::string& value)
+	{
+		SkipBlanks(cursor);
+		if (*cursor == '"')
+		{
+			const char* first = ++cursor;
+			while (*cursor && *cursor != '"' && *cursor != '\n')
+				cursor++;
+			if (*cursor != '"')
+				return false;
+			value.assign(first, cursor++);
+			return true;
+		}
+
+		const char* first = cursor;
+		while (!IsLineEnd(*cursor) && *cursor != ' ' && *cursor != '\t' && *cursor != '\r')
+			cursor++;
+		value.assign(first, cursor);
+		return !value.empty();
+	}
+
+	static bool ReadVec3(const char*& cursor, glm::vec3& value)
+	{
+		return ReadFloat(cursor, value.x) && ReadFloat(cursor, value.y) && ReadFloat(cursor, value.z);
+	}
+
+	static bool ReadKeyword(const char*& cursor, const char*& keyword, size_t& length)
+	{
+		SkipBlanks(cursor);
+		keyword = cursor;
+		while ((*cursor >= 'a' && *cursor <= 'z') || (*cursor >= 'A' && *cursor <= 'Z'))
+			cursor++;
+		length = (size_t)(cursor - keyword);
+		return length > 0;
+	}
+
+	static bool IsKeyword(const char* keyword, size_t length, const char* expected)
+	{
+		return std::strlen(expected) == length && std::strncmp(keyword, expected, length) == 0;
+	}
+
+	// Consumes the keyword only if it is the expected one
+	static bool ReadOptionalKeyword(const char*& cursor, const char* expected)
+	{
+		const char* start = cursor;
+		const char* keyword;
+		size_t length;
+		if (ReadKeyword(cursor, keyword, length) && IsKeyword(keyword, length, expected))
+			return true;
+
+		cursor = start;
+		return false;
+	}
+
+	static int FindPrototype(const Scene& scene, const std::string& name)
+	{
+		for (size_t i = 0; i < scene.Prototypes.size(); i++)
+		{
+			if (scene.Prototypes[i].Name == name)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	// Name of the first kind of primitive with a material index outside the scene's, or null
+	static const char* FindBadMaterial(const Geometry& geometry, size_t materialCount)
+	{
+		auto outOfRange = [&](int materialIndex) { return materialIndex < 0 || materialIndex >= (int)materialCount; };
+		for (const Sphere& sphere : geometry.Spheres)
+		{
+			if (outOfRange(sphere.MaterialIndex))
+				return "sphere";
+		}
+		for (const Box& box : geometry.Boxes)
+		{
+			if (outOfRange(box.MaterialIndex))
+				return "box";
+		}
+		for (const Mesh& mesh : geometry.Meshes)
+		{
+			if (outOfRange(mesh.MaterialIndex))
+				return "mesh";
+		}
+		return nullptr;
+	}
+
+	static bool AreIndicesBelow(const std::vector<uint32_t>& indices, size_t count)
+	{
+		return std::all_of(indices.begin(), indices.end(), [&](uint32_t index) { return index < count; });
+	}
+
+	// sphere, box and mesh statements. Meshes without a file are exported beside the scene as
+	// "<scene>_<meshPrefix><i>.ply".
+	static bool WriteGeometry(std::ostream& stream, const Geometry& geometry, const std::string& path, const std::string& meshPrefix)
+	{
+		for (const Sphere& sphere : geometry.Spheres)
+		{
+			stream << "sphere " << sphere.Position.x << " " << sphere.Position.y << " " << sphere.Position.z << " "
+				<< sphere.Radius << " " << sphere.MaterialIndex << "\n";
+		}
+		for (const Box& box : geometry.Boxes)
+		{
+			stream << "box " << box.Position.x << " " << box.Position.y << " " << box.Position.z << " "
+				<< box.Width << " " << box.Height << " " << box.Depth << " " << box.MaterialIndex << "\n";
+		}
+
+		std::filesystem::path directory = std::filesystem::absolute(path).parent_path();
+		for (size_t i = 0; i < geometry.Meshes.size(); i++)
+		{
+			const Mesh& mesh = geometry.Meshes[i];
+
+			// Generated meshes have no file yet; they are exported next to the scene
+			std::filesystem::path meshPath = mesh.SourcePath;
+			if (meshPath.empty())
+			{
+				meshPath = directory / (std::filesystem::path(path).stem().string() + "_" + meshPrefix + std::to_string(i) + ".ply");
+				if (!MeshImporter::SavePLY(meshPath.string(), mesh))
+					return false;
+			}
+
+			std::error_code errorCode;
+			std::filesystem::path relative = std::filesystem::proximate(std::filesystem::absolute(meshPath), directory, errorCode);
+			stream << "mesh \"" << (errorCode ? meshPath : relative).generic_string() << "\" " << mesh.MaterialIndex << "\n";
+		}
+
+		return true;
+	}
+
+	static bool ReadTextFile(const std::string& path, std::string& text)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		if (!stream)
+			return false;
+
+		stream.seekg(0, std::ios::end);
+		text.resize((size_t)stream.tellg());
+		stream.seekg(0, std::ios::beg);
+		stream.read(text.data(), (std::streamsize)text.size());
+		return (bool)stream;
+	}
+
+	namespace Binary
+	{
+		static constexpr char Magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+		static constexpr uint32_t Version = 5;
+		static constexpr uint64_t Alignment = 64;
+
+		enum SectionIndex
+		{
+			Materials = 0, Spheres, Boxes,
+			Nodes, PrimitiveIndices, Primitives, LeafPrimitives,
+			LeafCenterX, LeafCenterY, LeafCenterZ, LeafRadius,
+			LeafMinX, LeafMinY, LeafMinZ, LeafMaxX, LeafMaxY, LeafMaxZ,
+			Meshes, MeshPaths, MeshPositions, MeshNormals, MeshIndices, MeshNodes,
+			MeshAcceleratorNodes, MeshAcceleratorIndices,
+			Prototypes, PrototypeNames, PrototypeSpheres, PrototypeBoxes,
+			Instances, InverseTransforms, InstanceAcceleratorNodes, InstanceAcceleratorIndices,
+			SceneLights,
+			SectionCount
+		};
+
+		// Prototype spheres and boxes are concatenated in prototype order, and so are their
+		// meshes, which follow the scene's own in the Mesh* sections. Only the small per-prototype
+		// primitive BVHs are rebuilt on load.
+		struct PrototypeRecord
+		{
+			uint32_t SphereCount;
+			uint32_t BoxCount;
+			uint32_t MeshCount;
+			uint32_t NameLength;
+		};
+
+		// Every mesh's buffers are concatenated into the Mesh* sections in mesh order
+		struct MeshRecord
+		{
+			uint32_t VertexCount;
+			uint32_t NormalCount;
+			uint32_t IndexCount;
+			uint32_t NodeCount;
+			int32_t MaterialIndex;
+			uint32_t PathLength;
+		};
+
+		struct Section
+		{
+			uint64_t Offset;
+			uint64_t Count;
+		};
+
+		// Everything is stored in the writer's byte order and struct layout; ElementSizes
+		// catches a cache written by a build with different structs
+		struct Header
+		{
+			char Magic[8];
+			uint32_t Version;
+			uint32_t MaxLeafSize;
+			uint32_t LeafCount;
+			uint32_t ElementSizes[SectionCount];
+			CameraDescription Camera;
+			Section Sections[SectionCount];
+		};
+
+		struct SectionData
+		{
+			const void* Data;
+			uint64_t Count;
+			uint32_t ElementSize;
+		};
+
+		template<typename T>
+		static SectionData Describe(const std::vector<T>& values)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Binary scene sections are copied as raw memory");
+			return { values.data(), values.size(), (uint32_t)sizeof(T) };
+		}
+
+		static uint64_t AlignUp(uint64_t value)
+		{
+			return (value + Alignment - 1) & ~(Alignment - 1);
+		}
+
+		template<typename T>
+		static std::vector<T> Concatenate(const std::vector<const Mesh*>& meshes, const std::vector<T>& (*select)(const Mesh&))
+		{
+			size_t count = 0;
+			for (const Mesh* mesh : meshes)
+				count += select(*mesh).size();
+
+			std::vector<T> values;
+			values.reserve(count);
+			for (const Mesh* mesh : meshes)
+				values.insert(values.end(), select(*mesh).begin(), select(*mesh).end());
+			return values;
+		}
+
+		// Elements [first, first + count) of a section; 'first' advances past them
+		template<typename T>
+		static bool ReadRange(const MappedFile& file, const Header& header, SectionIndex index, uint64_t& first, uint64_t count, std::vector<T>& values)
+		{
+			const Section& section = header.Sections[index];
+			if (header.ElementSizes[index] != sizeof(T) || section.Offset % Alignment != 0 ||
+				section.Offset > file.GetSize() || section.Count > (file.GetSize() - section.Offset) / sizeof(T) ||
+				first > section.Count || count > section.Count - first)
+				return false;
+
+			const T* data = (const T*)(file.GetData() + section.Offset) + first;
+			values.assign(data, data + count);
+			first += count;
+			return true;
+		}
+
+		template<typename T>
+		static bool Read(const MappedFile& file, const Header& header, SectionIndex index, std::vector<T>& values)
+		{
+			uint64_t first = 0;
+			return ReadRange(file, header, index, first, header.Sections[index].Count, values);
+		}
+	}
+}
+
+void CameraDescription::Apply(Camera& camera) const
+{
+	camera.SetVerticalFOV(VerticalFOV);
+	camera.SetView(Position, Direction);
+	if (OrthographicHeight > 0.0f)
+		camera.SetProjectionType(Camera::ProjectionType::Orthographic, OrthographicHeight);
+	else
+		camera.SetProjectionType(Camera::ProjectionType::Perspective);
+	camera.SetLens(LensRadius, FocusDistance);
+}
+
+namespace SceneFile
+{
+	bool LoadText(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error)
+	{
+		std::string text;
+		if (!Utils::ReadTextFile(path, text))
+		{
+			error = "Cannot read " + path;
+			return false;
+		}
+
+		scene = Scene();
+		camera = CameraDescription();
+
+		// Statements between 'prototype' and 'end' add to that prototype instead of the scene
+		Geometry* target = &scene;
+		int openPrototype = -1;
+
+		const char* cursor = text.c_str();
+		uint32_t line = 1;
+		for (; *cursor; line++)
+		{
+			const char* keyword;
+			size_t length;
+			bool valid = true;
+
+			if (Utils::ReadKeyword(cursor, keyword, length))
+			{
+				if (Utils::IsKeyword(keyword, length, "material"))
+				{
+					Material& material = scene.Materials.emplace_back();
+					valid = Utils::ReadVec3(cursor, material.Albedo) && Utils::ReadFloat(cursor, material.Roughness);
+					Utils::ReadFloat(cursor, material.Metalic);
+				}
+				else if (Utils::IsKeyword(keyword, length, "emission"))
+				{
+					if (scene.Materials.empty())
+					{
+						error = path + ":" + std::to_string(line) + ": 'emission' before any 'material'";
+						return false;
+					}
+					Material& material = scene.Materials.back();
+					valid = Utils::ReadVec3(cursor, material.EmissionColor) && Utils::ReadFloat(cursor, material.EmissionPower);
+				}
+				else if (Utils::IsKeyword(keyword, length, "light"))
+				{
+					if (openPrototype >= 0)
+					{
+						error = path + ":" + std::to_string(line) + ": lights cannot be placed inside a prototype";
+						return false;
+					}
+
+					Light& light = scene.Lights.emplace_back();
+					if (Utils::ReadOptionalKeyword(cursor, "point"))
+					{
+						light.Type = LightType::Point;
+						valid = Utils::ReadVec3(cursor, light.Position);
+					}
+					else if (Utils::ReadOptionalKeyword(cursor, "directional"))
+					{
+						light.Type = LightType::Directional;
+						valid = Utils::ReadVec3(cursor, light.Direction);
+					}
+					else if (Utils::ReadOptionalKeyword(cursor, "sphere"))
+					{
+						light.Type = LightType::Sphere;
+						valid = Utils::ReadVec3(cursor, light.Position) && Utils::ReadFloat(cursor, light.Radius);
+					}
+					else if (Utils::ReadOptionalKeyword(cursor, "rect"))
+					{
+						light.Type = LightType::Rect;
+						valid = Utils::ReadVec3(cursor, light.Position) && Utils::ReadVec3(cursor, light.EdgeU) && Utils::ReadVec3(cursor, light.EdgeV);
+					}
+					else
+						valid = false;
+					valid = valid && Utils::ReadVec3(cursor, light.Color) && Utils::ReadFloat(cursor, light.Intensity);
+				}
+				else if (Utils::IsKeyword(keyword, length, "sphere"))
+				{
+					Sphere& sphere = target->Spheres.emplace_back();
+					valid = Utils::ReadVec3(cursor, sphere.Position) && Utils::ReadFloat(cursor, sphere.Radius) &&
+						Utils::ReadInt(cursor, sphere.MaterialIndex);
+				}
+				else if (Utils::IsKeyword(keyword, length, "box"))
+				{
+					Box& box = target->Boxes.emplace_back();
+					valid = Utils::ReadVec3(cursor, box.Position) && Utils::ReadFloat(cursor, box.Width) &&
+						Utils::ReadFloat(cursor, box.Height) && Utils::ReadFloat(cursor, box.Depth) &&
+						Utils::ReadInt(cursor, box.MaterialIndex);
+				}
+				else if (Utils::IsKeyword(keyword, length, "mesh"))
+				{
+					std::string meshPath;
+					int materialIndex = 0;
+					valid = Utils::ReadString(cursor, meshPath) && Utils::ReadInt(cursor, materialIndex);
+					if (valid)
+					{
+						// Relative to the scene file
+						std::filesystem::path resolved = std::filesystem::path(path).parent_path() / meshPath;
+						std::string meshError;
+						Mesh& mesh = target->Meshes.emplace_back();
+						if (!MeshImporter::Load(resolved.lexically_normal().string(), mesh, meshError))
+						{
+							error = path + ":" + std::to_string(line) + ": " + meshError;
+							return false;
+						}
+						mesh.MaterialIndex = materialIndex;
+					}
+				}
+				else if (Utils::IsKeyword(keyword, length, "prototype"))
+				{
+					std::string name;
+					valid = Utils::ReadString(cursor, name);
+					if (valid && (openPrototype >= 0 || Utils::FindPrototype(scene, name) >= 0))
+					{
+						error = path + ":" + std::to_string(line) + ": " +
+							(openPrototype >= 0 ? "prototypes cannot be nested" : "prototype '" + name + "' is already defined");
+						return false;
+					}
+					if (valid)
+					{
+						openPrototype = (int)scene.Prototypes.size();
+						scene.Prototypes.emplace_back().Name = name;
+						target = &scene.Prototypes.back();
+					}
+				}
+				else if (Utils::IsKeyword(keyword, length, "end"))
+				{
+					if (openPrototype < 0)
+					{
+						error = path + ":" + std::to_string(line) + ": 'end' without 'prototype'";
+						return false;
+					}
+					openPrototype = -1;
+					target = &scene;
+				}
+				else if (Utils::IsKeyword(keyword, length, "instance"))
+				{
+					std::string name;
+					valid = Utils::ReadString(cursor, name);
+					int prototypeIndex = valid ? Utils::FindPrototype(scene, name) : -1;
+					if (valid && (openPrototype >= 0 || prototypeIndex < 0))
+					{
+						error = path + ":" + std::to_string(line) + ": " +
+							(openPrototype >= 0 ? "instances cannot be placed inside a prototype" : "unknown prototype '" + name + "'");
+						return false;
+					}
+
+					Instance& instance = scene.Instances.emplace_back();
+					instance.PrototypeIndex = (uint32_t)prototypeIndex;
+					if (valid && Utils::ReadOptionalKeyword(cursor, "matrix"))
+					{
+						for (int row = 0; row < 3 && valid; row++)
+						{
+							for (int column = 0; column < 4 && valid; column++)
+								valid = Utils::ReadFloat(cursor, instance.Transform[column][row]);
+						}
+					}
+					else if (valid)
+					{
+						glm::vec3 position;
+						float yaw = 0.0f, scale = 1.0f;
+						valid = Utils::ReadVec3(cursor, position);
+						if (Utils::ReadFloat(cursor, yaw))
+							Utils::ReadFloat(cursor, scale);
+
+						instance.Transform = glm::translate(glm::mat4(1.0f), position);
+						instance.Transform = glm::rotate(instance.Transform, glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+						instance.Transform = glm::scale(instance.Transform, glm::vec3(scale));
+					}
+				}
+				else if (Utils::IsKeyword(keyword, length, "camera"))
+				{
+					valid = Utils::ReadVec3(cursor, camera.Position) && Utils::ReadVec3(cursor, camera.Direction);
+					Utils::ReadFloat(cursor, camera.VerticalFOV);
+				}
+				else if (Utils::IsKeyword(keyword, length, "lens"))
+				{
+					valid = Utils::ReadFloat(cursor, camera.LensRadius) && Utils::ReadFloat(cursor, camera.FocusDistance);
+				}
+				else if (Utils::IsKeyword(keyword, length, "ortho"))
+				{
+					valid = Utils::ReadFloat(cursor, camera.OrthographicHeight);
+				}
+				else
+				{
+					error = path + ":" + std::to_string(line) + ": unknown statement '" + std::string(keyword, length) + "'";
+					return false;
+				}
+			}
+
+			Utils::SkipBlanks(cursor);
+			if (!valid || !Utils::IsLineEnd(*cursor))
+			{
+				error = path + ":" + std::to_string(line) + ": malformed statement";
+				return false;
+			}
+
+			while (*cursor && *cursor != '\n')
+				cursor++;
+			if (*cursor)
+				cursor++;
+		}
+
+		if (openPrototype >= 0)
+		{
+			error = path + ":" + std::to_string(line) + ": prototype '" + scene.Prototypes[openPrototype].Name + "' has no 'end'";
+			return false;
+		}
+
+		if (const char* kind = Utils::FindBadMaterial(scene, scene.Materials.size()))
+		{
+			error = path + ": " + kind + " material index out of range";
+			return false;
+		}
+		for (const Prototype& prototype : scene.Prototypes)
+		{
+			if (const char* kind = Utils::FindBadMaterial(prototype, scene.Materials.size()))
+			{
+				error = path + ": " + kind + " material index out of range in prototype '" + prototype.Name + "'";
+				return false;
+			}
+		}
+
+		scene.BuildAcceleration();
+		return true;
+	}
+
+	bool SaveText(const std::string& path, const Scene& scene, const CameraDescription& camera)
+	{
+		std::ofstream stream(path);
+		if (!stream)
+			return false;
+
+		stream.precision(9);
+		stream << "# RayTracing scene\n";
+		stream << "camera " << camera.Position.x << " " << camera.Position.y << " " << camera.Position.z << " "
+			<< camera.Direction.x << " " << camera.Direction.y << " " << camera.Direction.z << " " << camera.VerticalFOV << "\n";
+		if (camera.LensRadius > 0.0f)
+			stream << "lens " << camera.LensRadius << " " << camera.FocusDistance << "\n";
+		if (camera.OrthographicHeight > 0.0f)
+			stream << "ortho " << camera.OrthographicHeight << "\n";
+
+		for (const Material& material : scene.Materials)
+		{
+			stream << "material " << material.Albedo.r << " " << material.Albedo.g << " " << material.Albedo.b << " "
+				<< material.Roughness << " " << material.Metalic << "\n";
+			if (material.IsEmissive())
+			{
+				stream << "emission " << material.EmissionColor.r << " " << material.EmissionColor.g << " " << material.EmissionColor.b << " "
+					<< material.EmissionPower << "\n";
+			}
+		}
+
+		auto writeVec3 = [&](const glm::vec3& value)
+		{
+			stream << " " << value.x << " " << value.y << " " << value.z;
+		};
+		for (const Light& light : scene.Lights)
+		{
+			switch (light.Type)
+			{
+				case LightType::Point:       stream << "light point"; writeVec3(light.Position); break;
+				case LightType::Directional: stream << "light directional"; writeVec3(light.Direction); break;
+				case LightType::Sphere:      stream << "light sphere"; writeVec3(light.Position); stream << " " << light.Radius; break;
+				case LightType::Rect:        stream << "light rect"; writeVec3(light.Position); writeVec3(light.EdgeU); writeVec3(light.EdgeV); break;
+			}
+			writeVec3(light.Color);
+			stream << " " << light.Intensity << "\n";
+		}
+		if (!Utils::WriteGeometry(stream, scene, path, "mesh"))
+			return false;
+
+		for (size_t i = 0; i < scene.Prototypes.size(); i++)
+		{
+			const Prototype& prototype = scene.Prototypes[i];
+			stream << "prototype \"" << prototype.Name << "\"\n";
+			if (!Utils::WriteGeometry(stream, prototype, path, "prototype" + std::to_string(i) + "_mesh"))
+				return false;
+			stream << "end\n";
+		}
+
+		// Transforms as written are arbitrary affine matrices, so they are saved in full
+		for (const Instance& instance : scene.Instances)
+		{
+			stream << "instance \"" << scene.Prototypes[instance.PrototypeIndex].Name << "\" matrix";
+			for (int row = 0; row < 3; row++)
+			{
+				for (int column = 0; column < 4; column++)
+					stream << " " << instance.Transform[column][row];
+			}
+			stream << "\n";
+		}
+
+		return (bool)stream;
+	}
+
+	bool SaveBinary(const std::string& path, const Scene& scene, const CameraDescription& camera)
+	{
+		using namespace Utils::Binary;
+
+		const PrimitiveSoA& leafData = scene.LeafData;
+
+		std::vector<PrototypeRecord> prototypeRecords;
+		std::vector<char> prototypeNames;
+		std::vector<Sphere> prototypeSpheres;
+		std::vector<Box> prototypeBoxes;
+		std::vector<const Mesh*> meshes;
+		for (const Mesh& mesh : scene.Meshes)
+			meshes.push_back(&mesh);
+		for (const Prototype& prototype : scene.Prototypes)
+		{
+			prototypeRecords.push_back({ (uint32_t)prototype.Spheres.size(), (uint32_t)prototype.Boxes.size(),
+				(uint32_t)prototype.Meshes.size(), (uint32_t)prototype.Name.size() });
+			prototypeNames.insert(prototypeNames.end(), prototype.Name.begin(), prototype.Name.end());
+			prototypeSpheres.insert(prototypeSpheres.end(), prototype.Spheres.begin(), prototype.Spheres.end());
+			prototypeBoxes.insert(prototypeBoxes.end(), prototype.Boxes.begin(), prototype.Boxes.end());
+			for (const Mesh& mesh : prototype.Meshes)
+				meshes.push_back(&mesh);
+		}
+
+		std::vector<MeshRecord> meshRecords;
+		std::vector<char> meshPaths;
+		for (const Mesh* mesh : meshes)
+		{
+			meshRecords.push_back({ (uint32_t)mesh->Positions.size(), (uint32_t)mesh->Normals.size(), (uint32_t)mesh->Indices.size(),
+				(uint32_t)mesh->Accelerator.GetNodes().size(), mesh->MaterialIndex, (uint32_t)mesh->SourcePath.size() });
+			meshPaths.insert(meshPaths.end(), mesh->SourcePath.begin(), mesh->SourcePath.end());
+		}
+		std::vector<glm::vec3> meshPositions = Concatenate<glm::vec3>(meshes, [](const Mesh& mesh) -> const std::vector<glm::vec3>& { return mesh.Positions; });
+		std::vector<uint32_t> meshNormals = Concatenate<uint32_t>(meshes, [](const Mesh& mesh) -> const std::vector<uint32_t>& { return mesh.Normals; });
+		std::vector<uint32_t> meshIndices = Concatenate<uint32_t>(meshes, [](const Mesh& mesh) -> const std::vector<uint32_t>& { return mesh.Indices; });
+		std::vector<BVHNode> meshNodes = Concatenate<BVHNode>(meshes, [](const Mesh& mesh) -> const std::vector<BVHNode>& { return mesh.Accelerator.GetNodes(); });
+
+		SectionData sections[SectionCount] = {
+			Describe(scene.Materials), Describe(scene.Spheres), Describe(scene.Boxes),
+			Describe(scene.Accelerator.GetNodes()), Describe(scene.Accelerator.GetPrimitiveIndices()),
+			Describe(scene.Primitives), Describe(scene.LeafPrimitives),
+			Describe(leafData.CenterX), Describe(leafData.CenterY), Describe(leafData.CenterZ), Describe(leafData.Radius),
+			Describe(leafData.MinX), Describe(leafData.MinY), Describe(leafData.MinZ),
+			Describe(leafData.MaxX), Describe(leafData.MaxY), Describe(leafData.MaxZ),
+			Describe(meshRecords), Describe(meshPaths), Describe(meshPositions), Describe(meshNormals), Describe(meshIndices), Describe(meshNodes),
+			Describe(scene.MeshAccelerator.GetNodes()), Describe(scene.MeshAccelerator.GetPrimitiveIndices()),
+			Describe(prototypeRecords), Describe(prototypeNames), Describe(prototypeSpheres), Describe(prototypeBoxes),
+			Describe(scene.Instances), Describe(scene.InverseTransforms),
+			Describe(scene.InstanceAccelerator.GetNodes()), Describe(scene.InstanceAccelerator.GetPrimitiveIndices()),
+			Describe(scene.Lights),
+		};
+
+		Header header{};
+		std::memcpy(header.Magic, Magic, sizeof(Magic));
+		header.Version = Version;
+		header.MaxLeafSize = scene.Accelerator.GetMaxLeafSize();
+		header.LeafCount = leafData.Count;
+		header.Camera = camera;
+
+		uint64_t offset = AlignUp(sizeof(Header));
+		for (int i = 0; i < SectionCount; i++)
+		{
+			header.ElementSizes[i] = sections[i].ElementSize;
+			header.Sections[i] = { offset, sections[i].Count };
+			offset = AlignUp(offset + sections[i].Count * sections[i].ElementSize);
+		}
+
+		std::ofstream stream(path, std::ios::binary);
+		if (!stream)
+			return false;
+
+		static const char padding[Alignment] = {};
+		auto padTo = [&](uint64_t position)
+		{
+			uint64_t current = (uint64_t)stream.tellp();
+			stream.write(padding, (std::streamsize)(position - current));
+		};
+
+		stream.write((const char*)&header, sizeof(header));
+		for (int i = 0; i < SectionCount; i++)
+		{
+			padTo(header.Sections[i].Offset);
+			stream.write((const char*)sections[i].Data, (std::streamsize)(sections[i].Count * sections[i].ElementSize));
+		}
+		padTo(offset);
+
+		return (bool)stream;
+	}
+
+	bool LoadBinary(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error)
+	{
+		using namespace Utils::Binary;
+
+		MappedFile file;
+		if (!file.Open(path))
+		{
+			error = "Cannot map " + path;
+			return false;
+		}
+
+		Header header;
+		if (file.GetSize() < sizeof(Header))
+		{
+			error = path + ": truncated header";
+			return false;
+		}
+		std::memcpy(&header, file.GetData(), sizeof(Header));
+
+		if (std::memcmp(header.Magic, Magic, sizeof(Magic)) != 0 || header.Version != Version)
+		{
+			error = path + ": not a compiled scene of version " + std::to_string(Version);
+			return false;
+		}
+
+		scene = Scene();
+		std::vector<BVHNode> nodes;
+		std::vector<uint32_t> primitiveIndices;
+		PrimitiveSoA& leafData = scene.LeafData;
+
+		bool valid =
+			Read(file, header, Materials, scene.Materials) &&
+			Read(file, header, Spheres, scene.Spheres) &&
+			Read(file, header, Boxes, scene.Boxes) &&
+			Read(file, header, Nodes, nodes) &&
+			Read(file, header, PrimitiveIndices, primitiveIndices) &&
+			Read(file, header, Primitives, scene.Primitives) &&
+			Read(file, header, LeafPrimitives, scene.LeafPrimitives) &&
+			Read(file, header, LeafCenterX, leafData.CenterX) && Read(file, header, LeafCenterY, leafData.CenterY) &&
+			Read(file, header, LeafCenterZ, leafData.CenterZ) && Read(file, header, LeafRadius, leafData.Radius) &&
+			Read(file, header, LeafMinX, leafData.MinX) && Read(file, header, LeafMinY, leafData.MinY) &&
+			Read(file, header, LeafMinZ, leafData.MinZ) && Read(file, header, LeafMaxX, leafData.MaxX) &&
+			Read(file, header, LeafMaxY, leafData.MaxY) && Read(file, header, LeafMaxZ, leafData.MaxZ);
+
+		size_t primitiveCount = scene.Spheres.size() + scene.Boxes.size();
+		valid = valid && scene.Primitives.size() == primitiveCount && primitiveIndices.size() == primitiveCount &&
+			scene.LeafPrimitives.size() == primitiveCount && header.LeafCount == primitiveCount;
+		for (const std::vector<float>* lanes : { &leafData.CenterX, &leafData.CenterY, &leafData.CenterZ, &leafData.Radius,
+			&leafData.MinX, &leafData.MinY, &leafData.MinZ, &leafData.MaxX, &leafData.MaxY, &leafData.MaxZ })
+			valid = valid && lanes->size() == (size_t)header.LeafCount + Kernels::KernelPadding;
+
+		// Traversal indexes with everything below unchecked, so a stale or corrupt file must not get that far
+		valid = valid && !Utils::FindBadMaterial(scene, scene.Materials.size()) &&
+			BVH::IsValid(nodes, primitiveIndices.size()) && Utils::AreIndicesBelow(primitiveIndices, primitiveCount) &&
+			scene.HasValidPrimitives();
+
+		std::vector<PrototypeRecord> prototypeRecords;
+		std::vector<BVHNode> instanceAcceleratorNodes;
+		std::vector<uint32_t> instanceAcceleratorIndices;
+		valid = valid &&
+			Read(file, header, Prototypes, prototypeRecords) &&
+			Read(file, header, Instances, scene.Instances) && Read(file, header, InverseTransforms, scene.InverseTransforms) &&
+			Read(file, header, InstanceAcceleratorNodes, instanceAcceleratorNodes) &&
+			Read(file, header, InstanceAcceleratorIndices, instanceAcceleratorIndices) &&
+			Read(file, header, SceneLights, scene.Lights) &&
+			scene.InverseTransforms.size() == scene.Instances.size() && instanceAcceleratorIndices.size() == scene.Instances.size() &&
+			BVH::IsValid(instanceAcceleratorNodes, instanceAcceleratorIndices.size()) &&
+			Utils::AreIndicesBelow(instanceAcceleratorIndices, scene.Instances.size()) &&
+			std::all_of(scene.Instances.begin(), scene.Instances.end(),
+				[&](const Instance& instance) { return instance.PrototypeIndex < prototypeRecords.size(); });
+
+		uint64_t nameOffset = 0, sphereOffset = 0, boxOffset = 0;
+		size_t prototypeMeshCount = 0;
+		for (size_t i = 0; valid && i < prototypeRecords.size(); i++)
+		{
+			const PrototypeRecord& record = prototypeRecords[i];
+			Prototype& prototype = scene.Prototypes.emplace_back();
+			std::vector<char> name;
+			valid = ReadRange(file, header, PrototypeNames, nameOffset, record.NameLength, name) &&
+				ReadRange(file, header, PrototypeSpheres, sphereOffset, record.SphereCount, prototype.Spheres) &&
+				ReadRange(file, header, PrototypeBoxes, boxOffset, record.BoxCount, prototype.Boxes);
+			prototype.Name.assign(name.begin(), name.end());
+			prototypeMeshCount += record.MeshCount;
+		}
+
+		std::vector<MeshRecord> meshRecords;
+		std::vector<char> meshPaths;
+		std::vector<BVHNode> meshAcceleratorNodes;
+		std::vector<uint32_t> meshAcceleratorIndices;
+		valid = valid &&
+			Read(file, header, Meshes, meshRecords) && Read(file, header, MeshPaths, meshPaths) &&
+			Read(file, header, MeshAcceleratorNodes, meshAcceleratorNodes) && Read(file, header, MeshAcceleratorIndices, meshAcceleratorIndices) &&
+			prototypeMeshCount <= meshRecords.size() && meshAcceleratorIndices.size() == meshRecords.size() - prototypeMeshCount &&
+			BVH::IsValid(meshAcceleratorNodes, meshAcceleratorIndices.size()) &&
+			Utils::AreIndicesBelow(meshAcceleratorIndices, meshAcceleratorIndices.size());
+
+		// The scene's meshes first, then each prototype's
+		std::vector<Geometry*> meshOwners;
+		if (valid)
+		{
+			meshOwners.assign(meshRecords.size() - prototypeMeshCount, &scene);
+			for (size_t i = 0; i < scene.Prototypes.size(); i++)
+				meshOwners.insert(meshOwners.end(), prototypeRecords[i].MeshCount, &scene.Prototypes[i]);
+		}
+
+		uint64_t pathOffset = 0, positionOffset = 0, normalOffset = 0, indexOffset = 0, nodeOffset = 0;
+		for (size_t i = 0; valid && i < meshRecords.size(); i++)
+		{
+			const MeshRecord& record = meshRecords[i];
+			Mesh& mesh = meshOwners[i]->Meshes.emplace_back();
+			std::vector<BVHNode> meshNodes;
+			std::vector<char> meshPath;
+
+			valid = ReadRange(file, header, MeshPaths, pathOffset, record.PathLength, meshPath) &&
+				ReadRange(file, header, MeshPositions, positionOffset, record.VertexCount, mesh.Positions) &&
+				ReadRange(file, header, MeshNormals, normalOffset, record.NormalCount, mesh.Normals) &&
+				ReadRange(file, header, MeshIndices, indexOffset, record.IndexCount, mesh.Indices) &&
+				ReadRange(file, header, MeshNodes, nodeOffset, record.NodeCount, meshNodes) &&
+				record.MaterialIndex >= 0 && record.MaterialIndex < (int32_t)scene.Materials.size() &&
+				(mesh.Normals.empty() || mesh.Normals.size() == mesh.Positions.size()) && mesh.Indices.size() % 3 == 0 &&
+				Utils::AreIndicesBelow(mesh.Indices, mesh.Positions.size()) && BVH::IsValid(meshNodes, mesh.GetTriangleCount());
+
+			mesh.SourcePath.assign(meshPath.begin(), meshPath.end());
+			mesh.MaterialIndex = record.MaterialIndex;
+			mesh.Accelerator.Assign(std::move(meshNodes), {}, Mesh::MaxLeafSize);
+		}
+
+		for (const Prototype& prototype : scene.Prototypes)
+			valid = valid && !Utils::FindBadMaterial(prototype, scene.Materials.size());
+
+		if (!valid)
+		{
+			scene = Scene();
+			error = path + ": corrupt or incompatible sections";
+			return false;
+		}
+
+		leafData.Count = header.LeafCount;
+		scene.Accelerator.Assign(std::move(nodes), std::move(primitiveIndices), header.MaxLeafSize);
+		scene.MeshAccelerator.Assign(std::move(meshAcceleratorNodes), std::move(meshAcceleratorIndices), 1);
+		scene.InstanceAccelerator.Assign(std::move(instanceAcceleratorNodes), std::move(instanceAcceleratorIndices), 1);
+		for (Prototype& prototype : scene.Prototypes)
+			prototype.BuildAcceleration();
+		scene.BuildLights();
+		camera = header.Camera;
+
+		// Leaves sized for another kernel width still work, but a matching build is faster
+		if (header.MaxLeafSize != Kernels::GetLaneCount(Kernels::GetActiveISA()))
+			scene.BuildAcceleration();
+
+		return true;
+	}
+
+	std::string GetCachePath(const std::string& path)
+	{
+		return path + ".bin";
+	}
+
+	bool Load(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error, bool useCache)
+	{
+		char magic[sizeof(Utils::Binary::Magic)] = {};
+		{
+			std::ifstream stream(path, std::ios::binary);
+			if (!stream)
+			{
+				error = "Cannot read " + path;
+				return false;
+			}
+			stream.read(magic, sizeof(magic));
+		}
+
+		if (std::memcmp(magic, Utils::Binary::Magic, sizeof(magic)) == 0)
+			return LoadBinary(path, scene, camera, error);
+
+		if (!useCache)
+			return LoadText(path, scene, camera, error);
+
+		std::string cachePath = GetCachePath(path);
+		std::error_code errorCode;
+		auto textTime = std::filesystem::last_write_time(path, errorCode);
+		auto cacheTime = std::filesystem::last_write_time(cachePath, errorCode);
+		if (!errorCode && cacheTime >= textTime)
+		{
+			// The cache also holds the imported meshes, so it is stale if one of them changed
+			std::string cacheError;
+			bool fresh = LoadBinary(cachePath, scene, camera, cacheError);
+			auto checkMeshes = [&](const Geometry& geometry)
+			{
+				for (const Mesh& mesh : geometry.Meshes)
+				{
+					auto meshTime = std::filesystem::last_write_time(mesh.SourcePath, errorCode);
+					fresh = fresh && !errorCode && meshTime <= cacheTime;
+				}
+			};
+			checkMeshes(scene);
+			for (const Prototype& prototype : scene.Prototypes)
+				checkMeshes(prototype);
+
+			if (fresh)
+				return true;
+		}
+
+		if (!LoadText(path, scene, camera, error))
+			return false;
+
+		// A read-only scene directory just means no cache
+		SaveBinary(cachePath, scene, camera);
+		return true;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Scene.h"
+#include "Camera.h"
+
+#include <string>
+
+// Camera placement stored with a scene
+struct CameraDescription
+{
+	glm::vec3 Position{ 0.0f, 0.0f, 6.0f };
+	glm::vec3 Direction{ 0.0f, 0.0f, -1.0f };
+	float VerticalFOV = 45.0f;
+	float LensRadius = 0.0f;
+	float FocusDistance = 6.0f;
+	float OrthographicHeight = 0.0f; // Perspective if 0
+
+	void Apply(Camera& camera) const;
+};
+
+// Scenes on disk, in two forms:
+//
+// Text (.rtscene), one statement per line, '#' starts a comment:
+//     material <r> <g> <b> <roughness> [metallic]
+//     emission <r> <g> <b> <power>   makes the last material emissive
+//     sphere <x> <y> <z> <radius> <material>
+//     box <x> <y> <z> <width> <height> <depth> <material>
+//     mesh <path> <material>     .obj or .ply, relative to the scene file, quoted if it has spaces
+//     prototype <name>           sphere, box and mesh statements up to 'end' define the prototype
+//     end
+//     instance <prototype> <x> <y> <z> [<yawDegrees> [<scale>]]
+//     instance <prototype> matrix <12 numbers>   object to world, the top three rows
+//     light point <x> <y> <z> <r> <g> <b> <intensity>
+//     light directional <dirX> <dirY> <dirZ> <r> <g> <b> <irradiance>
+//     light sphere <x> <y> <z> <radius> <r> <g> <b> <radiance>
+//     light rect <x> <y> <z> <ux> <uy> <uz> <vx> <vy> <vz> <r> <g> <b> <radiance>
+//                                lit towards u x v, with edges u and v at right angles
+//     camera <x> <y> <z> <dirX> <dirY> <dirZ> [verticalFOV]
+//     lens <radius> <focusDistance>
+//     ortho <height>
+//
+// Binary (compiled), a header followed by 64-byte aligned arrays holding the scene vectors,
+// the built BVH, the SIMD leaf data, every mesh's buffers and BVH and the instances with their
+// BVH exactly as they are in memory. Loading maps the file and copies each array in one go;
+// nothing is parsed and only the prototypes' small sphere and box BVHs are built.
+namespace SceneFile
+{
+	bool LoadText(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error);
+	// Meshes that were not imported from a file are exported as "<name>_mesh<i>.ply" beside it,
+	// or "<name>_prototype<p>_mesh<i>.ply" for prototype meshes
+	bool SaveText(const std::string& path, const Scene& scene, const CameraDescription& camera);
+
+	// The scene's acceleration structure must be built
+	bool SaveBinary(const std::string& path, const Scene& scene, const CameraDescription& camera);
+	bool LoadBinary(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error);
+
+	// Loads either form, detected from the file contents. For text scenes with useCache set,
+	// "<path>.bin" is loaded instead when it is newer than the text and the meshes it uses, and
+	// written otherwise.
+	bool Load(const std::string& path, Scene& scene, CameraDescription& camera, std::string& error, bool useCache = true);
+
+	std::string GetCachePath(const std::string& path);
+}
@@ -0,0 +1,350 @@
+#include "Scenes.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace Utils
+{
+	static Material& AddMaterial(Scene& scene, const glm::vec3& albedo, float roughness)
+	{
+		Material& material = scene.Materials.emplace_back();
+		material.Albedo = albedo;
+		material.Roughness = roughness;
+		return material;
+	}
+
+	static void AddSphere(Geometry& scene, const glm::vec3& position, float radius, int materialIndex)
+	{
+		Sphere sphere;
+		sphere.Position = position;
+		sphere.Radius = radius;
+		sphere.MaterialIndex = materialIndex;
+
+		scene.Spheres.push_back(sphere);
+	}
+
+	static void AddBox(Geometry& scene, const glm::vec3& position, const glm::vec3& size, int materialIndex)
+	{
+		Box& box = scene.Boxes.emplace_back();
+		box.Position = position;
+		box.Width = size.x;
+		box.Height = size.y;
+		box.Depth = size.z;
+		box.MaterialIndex = materialIndex;
+	}
+
+	// Small integer hash so generated scenes are identical on every run
+	static float HashToFloat(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352dU;
+		x ^= x >> 15;
+		x *= 0x846ca68bU;
+		x ^= x >> 16;
+		return (float)x / (float)0xffffffffU;
+	}
+}
+
+namespace Scenes
+{
+	Scene CreateDefault()
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 1.0f, 0.0f, 1.0f }, 0.0f);
+		Utils::AddMaterial(scene, { 0.2f, 0.3f, 1.0f }, 0.0f);
+		Utils::AddMaterial(scene, { 1.0f, 0.0f, 1.0f }, 0.0f);
+
+		Utils::AddSphere(scene, { 0.0f, 0.0f, 0.0f }, 1.0f, 0);
+		Utils::AddSphere(scene, { 3.0f, 0.0f, 0.0f }, 2.0f, 1);
+
+		Utils::AddBox(scene, { 1.0f, 2.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, 2);
+
+		scene.BuildAcceleration();
+		return scene;
+	}
+
+	static Scene CreateSpheres()
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 1.0f, 0.0f, 1.0f }, 0.0f);
+		Utils::AddMaterial(scene, { 0.2f, 0.3f, 1.0f }, 0.1f);
+		Utils::AddMaterial(scene, { 0.8f, 0.8f, 0.8f }, 0.5f);
+
+		Utils::AddSphere(scene, { 0.0f, 0.0f, 0.0f }, 1.0f, 0);
+		Utils::AddSphere(scene, { 2.5f, 0.0f, -1.0f }, 1.5f, 1);
+		Utils::AddSphere(scene, { -2.5f, 0.0f, -1.0f }, 1.5f, 1);
+		Utils::AddSphere(scene, { 0.0f, -101.0f, 0.0f }, 100.0f, 2);
+
+		return scene;
+	}
+
+	static Scene CreateBoxes()
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 1.0f, 0.0f, 1.0f }, 0.0f);
+		Utils::AddMaterial(scene, { 0.2f, 0.3f, 1.0f }, 0.2f);
+
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+				Utils::AddBox(scene, { -2.0f + 1.5f * i, -2.0f + 1.5f * j, -1.0f }, { 1.0f, 1.0f, 1.0f }, (i + j) % 2);
+		}
+
+		return scene;
+	}
+
+	static Scene CreateMixed()
+	{
+		Scene scene = CreateDefault();
+
+		Utils::AddMaterial(scene, { 0.8f, 0.8f, 0.8f }, 0.5f);
+		Utils::AddSphere(scene, { 0.0f, -101.0f, 0.0f }, 100.0f, 3);
+		Utils::AddBox(scene, { -3.0f, -1.0f, -1.0f }, { 1.0f, 2.0f, 1.0f }, 1);
+
+		return scene;
+	}
+
+	// Spheres and boxes scattered in a slab in front of the default camera
+	static Scene CreateMany(uint32_t count)
+	{
+		Scene scene;
+
+		for (int i = 0; i < 8; i++)
+			Utils::AddMaterial(scene, { Utils::HashToFloat(3 * i), Utils::HashToFloat(3 * i + 1), Utils::HashToFloat(3 * i + 2) }, 0.0f);
+
+		float radius = glm::clamp(2.0f / glm::sqrt((float)count), 0.01f, 0.5f);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 position = {
+				Utils::HashToFloat(4 * i + 0) * 8.0f - 4.0f,
+				Utils::HashToFloat(4 * i + 1) * 8.0f - 4.0f,
+				Utils::HashToFloat(4 * i + 2) * -8.0f };
+			int materialIndex = (int)(Utils::HashToFloat(4 * i + 3) * 7.99f);
+
+			// One box for every seven spheres
+			if (i % 8 == 7)
+				Utils::AddBox(scene, position, glm::vec3(radius * 1.5f), materialIndex);
+			else
+				Utils::AddSphere(scene, position, radius, materialIndex);
+		}
+
+		return scene;
+	}
+
+	Mesh CreateSphereMesh(uint32_t triangleCount, const glm::vec3& center, float radius)
+	{
+		// Latitude rings between two poles, twice as many segments around as rings,
+		// for 2 * segments * (rings - 1) triangles
+		uint32_t rings = glm::max(2u, (uint32_t)glm::sqrt((float)triangleCount / 4.0f));
+		uint32_t segments = 2 * rings;
+
+		Mesh mesh;
+		mesh.Positions.reserve(2 + (size_t)(rings - 1) * segments);
+		mesh.Indices.reserve((size_t)6 * segments * (rings - 1));
+
+		auto addVertex = [&](const glm::vec3& direction)
+		{
+			mesh.Positions.push_back(center + direction * radius);
+			mesh.Normals.push_back(Mesh::EncodeNormal(direction));
+		};
+
+		const float pi = 3.14159265f;
+		addVertex({ 0.0f, 1.0f, 0.0f });
+		for (uint32_t ring = 1; ring < rings; ring++)
+		{
+			float theta = pi * (float)ring / (float)rings;
+			for (uint32_t segment = 0; segment < segments; segment++)
+			{
+				float phi = 2.0f * pi * (float)segment / (float)segments;
+				addVertex({ glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi) });
+			}
+		}
+		addVertex({ 0.0f, -1.0f, 0.0f });
+
+		uint32_t southPole = (uint32_t)mesh.Positions.size() - 1;
+		auto ringVertex = [&](uint32_t ring, uint32_t segment) { return 1 + (ring - 1) * segments + segment % segments; };
+		for (uint32_t segment = 0; segment < segments; segment++)
+		{
+			mesh.Indices.insert(mesh.Indices.end(), { 0, ringVertex(1, segment + 1), ringVertex(1, segment) });
+			for (uint32_t ring = 1; ring + 1 < rings; ring++)
+			{
+				uint32_t a = ringVertex(ring, segment), b = ringVertex(ring, segment + 1);
+				uint32_t c = ringVertex(ring + 1, segment), d = ringVertex(ring + 1, segment + 1);
+				mesh.Indices.insert(mesh.Indices.end(), { a, b, d, a, d, c });
+			}
+			mesh.Indices.insert(mesh.Indices.end(), { southPole, ringVertex(rings - 1, segment), ringVertex(rings - 1, segment + 1) });
+		}
+
+		return mesh;
+	}
+
+	// A smooth and a flat shaded triangle sphere; 'count' is the smooth one's triangle count
+	static Scene CreateMeshes(uint32_t count)
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 1.0f, 0.0f, 1.0f }, 0.0f);
+		Utils::AddMaterial(scene, { 0.2f, 0.3f, 1.0f }, 0.1f);
+		Utils::AddMaterial(scene, { 0.8f, 0.8f, 0.8f }, 0.5f);
+
+		Mesh& smooth = scene.Meshes.emplace_back(CreateSphereMesh(count, { 0.0f, 0.0f, 0.0f }, 1.0f));
+		smooth.MaterialIndex = 0;
+
+		Mesh& flat = scene.Meshes.emplace_back(CreateSphereMesh(200, { 2.5f, 0.0f, -1.0f }, 1.5f));
+		flat.Normals.clear();
+		flat.MaterialIndex = 1;
+
+		Utils::AddSphere(scene, { 0.0f, -101.0f, 0.0f }, 100.0f, 2);
+
+		return scene;
+	}
+
+	// 'count' instances of a tree (box trunk, triangle crown, sphere fruit) and a rock on a
+	// jittered grid, each turned, scaled and placed by its own transform
+	static Scene CreateForest(uint32_t count)
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 0.8f, 0.8f, 0.8f }, 0.5f);
+		Utils::AddMaterial(scene, { 0.4f, 0.25f, 0.1f }, 0.8f);
+		Utils::AddMaterial(scene, { 0.1f, 0.6f, 0.2f }, 0.6f);
+		Utils::AddMaterial(scene, { 1.0f, 0.1f, 0.1f }, 0.1f);
+		Utils::AddMaterial(scene, { 0.5f, 0.5f, 0.55f }, 0.9f);
+
+		Utils::AddSphere(scene, { 0.0f, -1001.0f, 0.0f }, 1000.0f, 0);
+
+		Prototype& tree = scene.Prototypes.emplace_back();
+		tree.Name = "tree";
+		Utils::AddBox(tree, { -0.08f, 0.0f, -0.08f }, { 0.16f, 0.7f, 0.16f }, 1);
+		Mesh& crown = tree.Meshes.emplace_back(CreateSphereMesh(320, { 0.0f, 1.05f, 0.0f }, 0.5f));
+		crown.MaterialIndex = 2;
+		Utils::AddSphere(tree, { 0.3f, 1.2f, 0.3f }, 0.08f, 3);
+
+		Prototype& rock = scene.Prototypes.emplace_back();
+		rock.Name = "rock";
+		Utils::AddBox(rock, { -0.2f, 0.0f, -0.15f }, { 0.4f, 0.25f, 0.3f }, 4);
+
+		const float spacing = 1.5f;
+		uint32_t side = glm::max(1u, (uint32_t)glm::ceil(glm::sqrt((float)count)));
+		scene.Instances.reserve(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t column = i % side, row = i / side;
+			glm::vec3 position(
+				((float)column - 0.5f * (float)(side - 1) + Utils::HashToFloat(3 * i) - 0.5f) * spacing,
+				-1.0f,
+				2.0f - ((float)row + Utils::HashToFloat(3 * i + 1)) * spacing);
+			float angle = Utils::HashToFloat(3 * i + 2) * glm::two_pi<float>();
+			float scale = 0.7f + 0.6f * Utils::HashToFloat(i ^ 0x9e3779b9U);
+
+			Instance& instance = scene.Instances.emplace_back();
+			instance.PrototypeIndex = i % 7 == 6 ? 1 : 0;
+			instance.Transform = glm::translate(glm::mat4(1.0f), position);
+			instance.Transform = glm::rotate(instance.Transform, angle, glm::vec3(0.0f, 1.0f, 0.0f));
+			instance.Transform = glm::scale(instance.Transform, glm::vec3(scale));
+		}
+
+		return scene;
+	}
+
+	// A long hall lit only by 'count' ceiling fixtures on a grid: mostly small rect lights
+	// facing down, with a sphere light in every tenth place and a point light in every tenth
+	// after that, plus a glowing sphere on the floor. The fixtures share a fixed total power.
+	static Scene CreateLights(uint32_t count)
+	{
+		Scene scene;
+
+		Utils::AddMaterial(scene, { 0.8f, 0.8f, 0.8f }, 1.0f);
+		Utils::AddMaterial(scene, { 0.8f, 0.3f, 0.2f }, 1.0f);
+		Utils::AddMaterial(scene, { 0.9f, 0.9f, 0.9f }, 0.2f).Metalic = 1.0f;
+		Material& glow = Utils::AddMaterial(scene, { 0.0f, 0.0f, 0.0f }, 1.0f);
+		glow.EmissionColor = { 1.0f, 0.6f, 0.2f };
+		glow.EmissionPower = 4.0f;
+
+		const float width = 8.0f, height = 4.0f, back = -24.0f, front = 8.0f;
+		Utils::AddBox(scene, { -0.5f * width, -1.1f, back }, { width, 0.1f, front - back }, 0);       // Floor
+		Utils::AddBox(scene, { -0.5f * width, height - 1.0f, back }, { width, 0.1f, front - back }, 0); // Ceiling
+		Utils::AddBox(scene, { -0.5f * width - 0.1f, -1.0f, back }, { 0.1f, height, front - back }, 1); // Walls
+		Utils::AddBox(scene, { 0.5f * width, -1.0f, back }, { 0.1f, height, front - back }, 0);
+		Utils::AddBox(scene, { -0.5f * width, -1.0f, back - 0.1f }, { width, height, 0.1f }, 0);
+		Utils::AddBox(scene, { -0.5f * width, -1.0f, front }, { width, height, 0.1f }, 0);
+
+		for (int i = 0; i < 6; i++)
+		{
+			float z = 2.0f - 4.0f * i;
+			Utils::AddBox(scene, { -2.5f, -1.0f, z }, { 0.4f, height, 0.4f }, 0);
+			Utils::AddBox(scene, { 2.1f, -1.0f, z }, { 0.4f, height, 0.4f }, 0);
+		}
+		Utils::AddSphere(scene, { 0.0f, 0.0f, -2.0f }, 1.0f, 2);
+		Utils::AddSphere(scene, { -1.2f, -0.6f, 0.0f }, 0.4f, 1);
+		Utils::AddSphere(scene, { 1.0f, -0.75f, 1.0f }, 0.25f, 3);
+
+		// Fixtures on a grid as square as the hall allows
+		uint32_t columns = glm::max(1u, (uint32_t)glm::sqrt((float)count * width / (front - back)));
+		uint32_t rows = (glm::max(count, 1u) + columns - 1) / columns;
+		const float size = 0.3f;
+		float fixturePower = 600.0f / (float)glm::max(count, 1u);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 center(
+				((float)(i % columns) + 0.5f) / (float)columns * (width - 1.0f) - 0.5f * (width - 1.0f),
+				height - 1.01f,
+				front - 0.5f - ((float)(i / columns) + 0.5f) / (float)rows * (front - back - 1.0f));
+			glm::vec3 color(1.0f, 0.85f + 0.15f * Utils::HashToFloat(i), 0.7f + 0.3f * Utils::HashToFloat(i ^ 0x5bd1e995U));
+
+			Light& light = scene.Lights.emplace_back();
+			light.Color = color;
+			if (i % 10 == 9)
+			{
+				light.Type = LightType::Sphere;
+				light.Position = center - glm::vec3(0.0f, 0.4f, 0.0f);
+				light.Radius = 0.5f * size;
+				light.Intensity = fixturePower / (4.0f * glm::pi<float>() * glm::pi<float>() * light.Radius * light.Radius);
+			}
+			else if (i % 10 == 8)
+			{
+				light.Type = LightType::Point;
+				light.Position = center - glm::vec3(0.0f, 0.2f, 0.0f);
+				light.Intensity = fixturePower / (4.0f * glm::pi<float>());
+			}
+			else
+			{
+				// Facing down
+				light.Type = LightType::Rect;
+				light.Position = center - glm::vec3(0.5f * size, 0.0f, 0.5f * size);
+				light.EdgeU = { size, 0.0f, 0.0f };
+				light.EdgeV = { 0.0f, 0.0f, size };
+				light.Intensity = fixturePower / (glm::pi<float>() * size * size);
+			}
+		}
+
+		return scene;
+	}
+
+	bool Create(const std::string& name, Scene& scene, uint32_t count)
+	{
+		if (name == "default")
+			scene = CreateDefault();
+		else if (name == "spheres")
+			scene = CreateSpheres();
+		else if (name == "boxes")
+			scene = CreateBoxes();
+		else if (name == "mixed")
+			scene = CreateMixed();
+		else if (name == "many")
+			scene = CreateMany(count);
+		else if (name == "meshes")
+			scene = CreateMeshes(count);
+		else if (name == "forest")
+			scene = CreateForest(count);
+		else if (name == "lights")
+			scene = CreateLights(count);
+		else
+			return false;
+
+		scene.BuildAcceleration();
+		return true;
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <string>
+
+// Built-in scenes, shared by the interactive app and the headless benchmark
+namespace Scenes
+{
+	// The two spheres and one box the app has always opened with.
+	// Scenes come back with their acceleration structure built.
+	Scene CreateDefault();
+
+	// Named scenes: "default", "spheres", "boxes", "mixed", "many", "meshes", "forest" and
+	// "lights". 'count' is the number of primitives for "many", of triangles for "meshes", of
+	// instances for "forest" and of lights for "lights" (ignored by the others). Returns false if the name is unknown.
+	bool Create(const std::string& name, Scene& scene, uint32_t count = 1000);
+
+	// Closed UV sphere with smooth normals and about triangleCount triangles, BVH not built
+	Mesh CreateSphereMesh(uint32_t triangleCount, const glm::vec3& center, float radius);
+}
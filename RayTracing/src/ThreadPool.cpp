@@ -0,0 +1,123 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t workerCount)
+{
+	if (workerCount == 0)
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (uint32_t i = 0; i < workerCount; i++)
+		m_Queues.push_back(std::make_unique<WorkerQueue>());
+
+	for (uint32_t i = 1; i < workerCount; i++)
+		m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_WakeCondition.notify_all();
+
+	for (std::thread& thread : m_Threads)
+		thread.join();
+}
+
+void ThreadPool::ParallelFor(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task)
+{
+	if (taskCount == 0)
+		return;
+
+	m_Task = &task;
+	m_RemainingTasks = taskCount;
+
+	// Contiguous blocks keep neighbouring tasks on the same worker
+	uint32_t workerCount = GetWorkerCount();
+	for (uint32_t worker = 0; worker < workerCount; worker++)
+	{
+		uint32_t begin = (uint32_t)((uint64_t)taskCount * worker / workerCount);
+		uint32_t end = (uint32_t)((uint64_t)taskCount * (worker + 1) / workerCount);
+
+		WorkerQueue& queue = *m_Queues[worker];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		for (uint32_t i = begin; i < end; i++)
+			queue.Tasks.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Generation++;
+	}
+	m_WakeCondition.notify_all();
+
+	RunTasks(0);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_DoneCondition.wait(lock, [this]() { return m_RemainingTasks == 0; });
+}
+
+void ThreadPool::WorkerLoop(uint32_t workerIndex)
+{
+	uint64_t generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WakeCondition.wait(lock, [&]() { return m_Stop || m_Generation != generation; });
+			if (m_Stop)
+				return;
+			generation = m_Generation;
+		}
+
+		RunTasks(workerIndex);
+	}
+}
+
+void ThreadPool::RunTasks(uint32_t workerIndex)
+{
+	uint32_t taskIndex;
+	while (PopTask(workerIndex, taskIndex))
+	{
+		(*m_Task.load())(taskIndex, workerIndex);
+
+		if (m_RemainingTasks.fetch_sub(1) == 1)
+		{
+			// Taking the lock orders this with the waiter's predicate check
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_DoneCondition.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::PopTask(uint32_t workerIndex, uint32_t& taskIndex)
+{
+	{
+		WorkerQueue& queue = *m_Queues[workerIndex];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (!queue.Tasks.empty())
+		{
+			taskIndex = queue.Tasks.front();
+			queue.Tasks.pop_front();
+			return true;
+		}
+	}
+
+	// Steal from the far end of someone else's block
+	uint32_t workerCount = GetWorkerCount();
+	for (uint32_t offset = 1; offset < workerCount; offset++)
+	{
+		WorkerQueue& victim = *m_Queues[(workerIndex + offset) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Tasks.empty())
+		{
+			taskIndex = victim.Tasks.back();
+			victim.Tasks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with one task deque each. ParallelFor() deals the task range out
+// in contiguous blocks, workers pop from the front of their own deque and, once it is empty,
+// steal from the back of the others'. The calling thread takes part as worker 0.
+class ThreadPool
+{
+public:
+	// workerCount includes the calling thread; 0 means one per hardware thread
+	explicit ThreadPool(uint32_t workerCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t GetWorkerCount() const { return (uint32_t)m_Queues.size(); }
+
+	// Runs task(taskIndex, workerIndex) for every index in [0, taskCount) and returns when all are done.
+	// Lower task indices are started first, so callers should order tasks by locality.
+	void ParallelFor(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task);
+private:
+	struct WorkerQueue
+	{
+		std::mutex Mutex;
+		std::deque<uint32_t> Tasks;
+	};
+
+	void WorkerLoop(uint32_t workerIndex);
+	void RunTasks(uint32_t workerIndex);
+	bool PopTask(uint32_t workerIndex, uint32_t& taskIndex);
+private:
+	std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+	std::vector<std::thread> m_Threads;
+
+	std::atomic<const std::function<void(uint32_t, uint32_t)>*> m_Task{ nullptr };
+	std::atomic<uint32_t> m_RemainingTasks{ 0 };
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCondition;
+	std::condition_variable m_DoneCondition;
+	uint64_t m_Generation = 0;
+	bool m_Stop = false;
+};
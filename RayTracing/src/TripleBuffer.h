@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands values from one producer thread to one consumer thread without locks or waiting. The
+// producer fills the back buffer and publishes it, swapping it with the middle one; the
+// consumer swaps the middle buffer with its front one when something new was published since.
+// Either side can run at any rate: the consumer always gets the latest published value, and
+// values it never picked up are overwritten.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Producer side
+	T& GetBack() { return m_Buffers[m_Back]; }
+	void Publish()
+	{
+		m_Back = m_Middle.exchange(m_Back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Consumer side. Returns false, keeping the front buffer, if nothing was published since.
+	bool Acquire()
+	{
+		if ((m_Middle.load(std::memory_order_relaxed) & FreshBit) == 0)
+			return false;
+		m_Front = m_Middle.exchange(m_Front, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+	const T& GetFront() const { return m_Buffers[m_Front]; }
+private:
+	static constexpr uint32_t IndexMask = 3;
+	static constexpr uint32_t FreshBit = 4; // The middle buffer has not been acquired yet
+
+	T m_Buffers[3];
+	uint32_t m_Back = 0;  // Producer's
+	uint32_t m_Front = 1; // Consumer's
+	std::atomic<uint32_t> m_Middle{ 2 };
+};
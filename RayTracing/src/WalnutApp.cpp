@@ -5,213 +5,383 @@
 #include "Walnut/Timer.h"
 #include "Walnut/Image.h"
 
-#include "Renderer.h"
+#include "RenderThread.h"
 #include "Camera.h"
+#include "Scenes.h"
+#include "SceneFile.h"
+#include "Profiler.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstdio>
+
 using namespace Walnut;
 
 class ExampleLayer : public Walnut::Layer
 {
 public:
-	ExampleLayer()
-		: m_Camera(45.0f, 0.1f, 100.0f) 
+	// Opens the built-in default scene unless a scene file is given
+	ExampleLayer(const std::string& scenePath = "")
+		: m_Camera(45.0f, 0.1f, 100.0f)
 	{
-		Material& firstSphere = m_Scene.Materials.emplace_back();
-		firstSphere.Albedo = { 1.0f, 0.0f, 1.0f };
-		firstSphere.Roughness = 0.0f;
-
-		Material& secondSphere = m_Scene.Materials.emplace_back();
-		secondSphere.Albedo = { 0.2f, 0.3f, 1.0f };
-		secondSphere.Roughness = 0.0f;
-
-		Material& firstBox = m_Scene.Materials.emplace_back();
-		firstBox.Albedo = { 1.0f, 0.0f, 1.0f };
-		firstBox.Roughness = 0.0f;
+		// Keeps the image converged while the camera moves
+		m_Settings.Reproject = true;
+		// Drops the resolution while the camera or scene changes, so frames keep up with the input
+		m_FrameBudget.Milliseconds = 16.0f;
 
+		Scene scene = Scenes::CreateDefault();
+		if (!scenePath.empty())
 		{
-			Sphere sphere;
-			sphere.Position = { 0.0f, 0.0f, 0.0f };
-			sphere.Radius = 1.0f;
-			sphere.MaterialIndex = 0;
-
-			m_Scene.Spheres.push_back(sphere);
+			Scene loaded;
+			CameraDescription camera;
+			std::string error;
+			if (SceneFile::Load(scenePath, loaded, camera, error))
+			{
+				scene = std::move(loaded);
+				camera.Apply(m_Camera);
+			}
+			else
+				std::fprintf(stderr, "%s\n", error.c_str());
 		}
 
-		{
-			Sphere sphere;
-			sphere.Position = { 3.0f, 0.0f, 0.0f };
-			sphere.Radius = 2.0f;
-			sphere.MaterialIndex = 1;
+		// Rendering runs on its own thread from here on; everything it uses goes to it as messages
+		m_RenderThread = std::make_unique<RenderThread>(std::move(scene));
+		PostSettings();
+		PostCamera(false);
+		m_RenderThread->SetFrameBudget(m_FrameBudget);
+	}
+	virtual void OnUpdate(float ts) override 
+	{
+		// The renderer sees the camera move and reprojects or restarts by itself
+		if (m_Camera.OnUpdate(ts))
+			PostCamera(true);
+	}
+	virtual void OnUIRender() override
+	{
+		// The latest frame the render thread finished, if there is a new one
+		if (m_RenderThread->AcquireFrame())
+			UploadFrame();
+		const RenderThread::Frame& frame = m_RenderThread->GetFrame();
 
-			m_Scene.Spheres.push_back(sphere);
+		ImGui::Begin("Settings");
+		ImGui::Text("Last render: %.3fms (%llu frames, %llu cancelled)", frame.RenderMilliseconds,
+			(unsigned long long)frame.Number, (unsigned long long)frame.CancelledFrames);
+		ImGui::Text("Last upload: %.3fms", m_LastUploadTime);
+
+		// Edits to the copy below are sent to the render thread as a whole
+		Renderer::Settings& settings = m_Settings;
+		bool settingsChanged = false, reset = false;
+		settingsChanged |= ImGui::Checkbox("Accumulate", &settings.Accumulate);
+
+		const char* samplers[] = { Sampler::GetName(SamplerType::PCG), Sampler::GetName(SamplerType::Sobol) };
+		reset |= ImGui::Combo("Sampler", (int*)&settings.Sampling, samplers, IM_ARRAYSIZE(samplers));
+
+		// Both integrators produce the same image, so switching keeps the accumulated samples
+		const char* integrators[] = { Renderer::GetIntegratorName(IntegratorType::Megakernel), Renderer::GetIntegratorName(IntegratorType::Wavefront) };
+		settingsChanged |= ImGui::Combo("Integrator", (int*)&settings.Integrator, integrators, IM_ARRAYSIZE(integrators));
+
+		settingsChanged |= ImGui::DragInt("Tile Size", (int*)&settings.TileSize, 1.0f, 8, 256);
+		// 0 leaves one hardware thread to the UI
+		settingsChanged |= ImGui::DragInt("Workers", (int*)&settings.WorkerCount, 0.1f, 0, 256);
+		ImGui::Text("Threads: %u", frame.WorkerCount);
+
+		settingsChanged |= ImGui::Checkbox("FP16 Accumulation", &settings.HalfPrecisionAccumulation);
+		settingsChanged |= ImGui::DragInt("Resolve Interval", (int*)&settings.ResolveInterval, 0.1f, 0, 64);
+		ImGui::Text("Last resolve: %.3fms", frame.ResolveMilliseconds);
+		if (ImGui::Button("Resolve"))
+			m_RenderThread->Post([](Renderer& renderer, Scene&, Camera&) { renderer.Resolve(); });
+
+		// Filters every resolve from the running means, so the accumulated samples are kept
+		Denoiser::Settings& denoising = settings.Denoising;
+		settingsChanged |= ImGui::Checkbox("Denoise", &settings.Denoise);
+		settingsChanged |= ImGui::SliderInt("Denoise Iterations", (int*)&denoising.Iterations, 1, 6);
+		settingsChanged |= ImGui::DragFloat("Color Sigma", &denoising.ColorSigma, 0.05f, 0.0f, 16.0f);
+		settingsChanged |= ImGui::DragFloat("Normal Sigma", &denoising.NormalSigma, 0.005f, 0.0f, 2.0f);
+		settingsChanged |= ImGui::DragFloat("Depth Sigma", &denoising.DepthSigma, 0.001f, 0.0f, 1.0f, "%.4f");
+		settingsChanged |= ImGui::DragFloat("Albedo Sigma", &denoising.AlbedoSigma, 0.005f, 0.0f, 2.0f);
+		ImGui::Text("Last denoise: %.3fms", frame.DenoiseMilliseconds);
+
+		settingsChanged |= ImGui::Checkbox("Reproject", &settings.Reproject);
+		settingsChanged |= ImGui::DragInt("Reprojection History", (int*)&settings.ReprojectionHistory, 0.1f, 0, 1024);
+		ImGui::Text("Reprojected: %u pixels", frame.ReprojectedPixelCount);
+
+		bool budgetChanged = ImGui::DragFloat("Frame Budget (ms)", &m_FrameBudget.Milliseconds, 0.1f, 0.0f, 1000.0f);
+		budgetChanged |= ImGui::DragFloat("Min Render Scale", &m_FrameBudget.MinScale, 0.005f, FrameBudget::ScaleStep, 1.0f);
+		if (budgetChanged)
+			m_RenderThread->SetFrameBudget(m_FrameBudget);
+		ImGui::Text("Render scale: %.3f (%ux%u)", frame.RenderScale, frame.Width, frame.Height);
+
+		settingsChanged |= ImGui::DragFloat("Target Noise", &settings.TargetNoise, 0.0005f, 0.0f, 0.5f, "%.4f");
+		settingsChanged |= ImGui::DragInt("Min Samples", (int*)&settings.MinSamples, 0.1f, 2, 1024);
+		settingsChanged |= ImGui::DragInt("Max Samples", (int*)&settings.MaxSamples, 1.0f, 0, 65536);
+		settingsChanged |= ImGui::Checkbox("Show Convergence", &settings.ShowConvergence);
+
+		settingsChanged |= ImGui::Checkbox("Jitter", &settings.Jitter);
+
+		// Both change the image; the specialized variants render the same one as the generic
+		reset |= ImGui::SliderInt("Max Bounces", (int*)&settings.MaxBounces, 1, (int)Renderer::MaxBounceLimit);
+		reset |= ImGui::Checkbox("Shadows", &settings.Shadows);
+		settingsChanged |= ImGui::Checkbox("Specialized Integrator", &settings.Specialize);
+
+		int projection = (int)m_Camera.GetProjectionType();
+		float orthographicHeight = m_Camera.GetOrthographicHeight();
+		float lensRadius = m_Camera.GetLensRadius();
+		float focusDistance = m_Camera.GetFocusDistance();
+		const char* projections[] = { "Perspective", "Orthographic" };
+
+		bool cameraChanged = ImGui::Combo("Projection", &projection, projections, IM_ARRAYSIZE(projections));
+		cameraChanged |= ImGui::DragFloat("Ortho Height", &orthographicHeight, 0.05f, 0.1f, 100.0f);
+		cameraChanged |= ImGui::DragFloat("Lens Radius", &lensRadius, 0.005f, 0.0f, 2.0f);
+		cameraChanged |= ImGui::DragFloat("Focus Distance", &focusDistance, 0.05f, 0.1f, 100.0f);
+		if (cameraChanged)
+		{
+			m_Camera.SetProjectionType((Camera::ProjectionType)projection, orthographicHeight);
+			m_Camera.SetLens(lensRadius, focusDistance);
+			PostCamera(true);
 		}
+		ImGui::Text("Active tiles: %u / %u%s", frame.ActiveTileCount, frame.TileCount, frame.Converged ? ", converged" : "");
 
-		Box& box = m_Scene.Boxes.emplace_back();
-		box.Position = { 1.0f, 2.0f, 1.0f };
-		box.Width = 1.0f;
-		box.Height = 1.0f;
-		box.Depth = 1.0f;
-		box.MaterialIndex = 2;
-
-		// Configurando os planos da caixa
-		Plane p1(1, 0, 0, -box.Position.x);
-		Plane p2(-1, 0, 0, box.Position.x + box.Width);
-		Plane p3(0, 1, 0, -box.Position.y);
-		Plane p4(0, -1, 0, box.Position.y + box.Height);
-		Plane p5(0, 0, 1, -box.Position.z);
-		Plane p6(0, 0, -1, box.Position.z + box.Depth);
+		reset |= ImGui::Button("Reset");
+		if (settingsChanged || reset)
+			PostSettings(reset);
 
-		// Inicializando a caixa com os seis planos
-		box.SetPlanes(p1, p2, p3, p4, p5, p6);
+		ImGui::End();
 
+		DrawProfilerPanel(frame);
+		DrawScenePanel(frame);
 
-		// Configurando os planos da caixa
-		{
-			Plane p1;
-			p1.a = 1.0f;
-			p1.d = -box.Position.x;
+		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
 
-			m_Scene.Planes.push_back(p1);
-		}
+		ImGui::Begin("Viewport");
 
+		uint32_t viewportWidth = (uint32_t)ImGui::GetContentRegionAvail().x;
+		uint32_t viewportHeight = (uint32_t)ImGui::GetContentRegionAvail().y;
+		if (viewportWidth != m_ViewportWidth || viewportHeight != m_ViewportHeight)
 		{
-			Plane p2;
-			p2.a = -1.0f;
-			p2.d = box.Position.x + box.Width;
-
-			m_Scene.Planes.push_back(p2);
+			m_ViewportWidth = viewportWidth;
+			m_ViewportHeight = viewportHeight;
+			m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
+			m_RenderThread->SetViewportSize(m_ViewportWidth, m_ViewportHeight);
 		}
 
-		{
-			Plane p3;
-			p3.b = 1;
-			p3.d = -box.Position.y;
+		// Stretched over the viewport when the frame budget renders it smaller, or while a
+		// frame of the new size is on its way
+		if (m_Image)
+			ImGui::Image(m_Image->GetDescriptorSet(), 
+				{ (float)m_ViewportWidth, (float)m_ViewportHeight }, 
+				ImVec2(0, 1), ImVec2(1, 0));
 
-			m_Scene.Planes.push_back(p3);
-		}
+		ImGui::End();
+		ImGui::PopStyleVar();
+	}
+
+	void DrawScenePanel(const RenderThread::Frame& frame)
+	{
+		ImGui::Begin("Scene");
 
+		// Edits are sent to the render thread, which commits them so that only what moved is
+		// refitted; the values shown are the scene's, read while it cannot change
+		std::unique_lock<std::mutex> lock = m_RenderThread->LockScene();
+		const Scene& scene = m_RenderThread->GetScene();
+		for (size_t i = 0; i < scene.Spheres.size(); i++)
 		{
-			Plane p4;
-			p4.b = -1.0f;
-			p4.d = box.Position.y + box.Height;
+			ImGui::PushID(i);
 
-			m_Scene.Planes.push_back(p4);
-		}
+			Sphere sphere = scene.Spheres[i];
+			bool sphereChanged = ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f);
+			sphereChanged |= ImGui::DragFloat("Radius", &sphere.Radius, 0.1f);
+			sphereChanged |= ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0.0f, (int)scene.Materials.size() - 1);
+			if (sphereChanged)
+				PostSceneEdit([i, sphere](Scene& edited) { edited.SetSphere((uint32_t)i, sphere); });
 
-		{
-			Plane p5;
-			p5.c = 1.0f;
-			p5.d = -box.Position.z;
+			ImGui::Separator();
 
-			m_Scene.Planes.push_back(p5);
+			ImGui::PopID();
 		}
 
-
+		for (size_t i = 0; i < scene.Meshes.size(); i++)
 		{
-			Plane p6;
-			p6.c = -1.0f;
-			p6.d = box.Position.z + box.Depth;
-
-			m_Scene.Planes.push_back(p6);
-		}
+			ImGui::PushID("Mesh");
+			ImGui::PushID(i);
 
+			const Mesh& mesh = scene.Meshes[i];
+			ImGui::Text("%s: %u triangles, %.1f MB", mesh.SourcePath.empty() ? "Mesh" : mesh.SourcePath.c_str(),
+				mesh.GetTriangleCount(), mesh.GetMemoryUsage() / (1024.0f * 1024.0f));
+			int materialIndex = mesh.MaterialIndex;
+			if (ImGui::DragInt("Material", &materialIndex, 1.0f, 0.0f, (int)scene.Materials.size() - 1))
+				PostSceneEdit([i, materialIndex](Scene& edited) { edited.SetMeshMaterial((uint32_t)i, materialIndex); });
 
+			ImGui::Separator();
 
-	}
-	virtual void OnUpdate(float ts) override 
-	{
-		if (m_Camera.OnUpdate(ts))
-			m_Renderer.ResetFrameIndex();
-	}
-	virtual void OnUIRender() override
-	{
-		ImGui::Begin("Settings");
-		ImGui::Text("Last render: %.3fms", m_LastRenderTime);
-		if (ImGui::Button("Render"))
-		{
-			Render();
+			ImGui::PopID();
+			ImGui::PopID();
 		}
 
-		ImGui::Checkbox("Accumulate", &m_Renderer.GetSettings().Accumulate);
-
-		if (ImGui::Button("Reset"))
-			m_Renderer.ResetFrameIndex();
-
-		ImGui::End();
+		if (!scene.Instances.empty())
+		{
+			std::vector<uint32_t> instanceCounts(scene.Prototypes.size(), 0);
+			for (const Instance& instance : scene.Instances)
+				instanceCounts[instance.PrototypeIndex]++;
 
-		
+			for (size_t i = 0; i < scene.Prototypes.size(); i++)
+			{
+				const Prototype& prototype = scene.Prototypes[i];
+				ImGui::Text("Prototype %s: %u instances, %.1f MB", prototype.Name.c_str(), instanceCounts[i],
+					prototype.GetMemoryUsage() / (1024.0f * 1024.0f));
+			}
+			ImGui::Text("Instances: %.1f MB", scene.GetInstanceMemoryUsage() / (1024.0f * 1024.0f));
 
-		ImGui::Begin("Scene");
+			ImGui::Separator();
+		}
 
-		for (size_t i = 0; i < m_Scene.Spheres.size(); i++)
+		for (size_t i = 0; i < scene.Materials.size(); i++)
 		{
 			ImGui::PushID(i);
 
-			Sphere& sphere = m_Scene.Spheres[i];
-			ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f);
-			ImGui::DragFloat("Radius", &sphere.Radius, 0.1f);
-			ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0.0f, (int)m_Scene.Materials.size() - 1);
+			Material material = scene.Materials[i];
+
+			bool materialChanged = ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
+			materialChanged |= ImGui::DragFloat("Roughness", &material.Roughness, 0.05f, 0.0f, 1.0f);
+			materialChanged |= ImGui::DragFloat("Metalic", &material.Metalic, 0.05f, 0.0f, 1.0f);
+			materialChanged |= ImGui::ColorEdit3("Emission", glm::value_ptr(material.EmissionColor));
+			materialChanged |= ImGui::DragFloat("Emission Power", &material.EmissionPower, 0.05f, 0.0f, FLT_MAX);
+			if (materialChanged)
+				PostSceneEdit([i, material](Scene& edited) { edited.SetMaterial((uint32_t)i, material); });
 
 			ImGui::Separator();
 
 			ImGui::PopID();
 		}
-		for (size_t i = 0; i < m_Scene.Materials.size(); i++)
+
+		for (size_t i = 0; i < scene.Lights.size(); i++)
 		{
+			ImGui::PushID("Light");
 			ImGui::PushID(i);
 
-			Material& material = m_Scene.Materials[i];
-
-			ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
-			ImGui::DragFloat("Roughness", &material.Roughness, 0.05f, 0.0f, 1.0f);
-			ImGui::DragFloat("Metalic", &material.Metalic, 0.05f, 0.0f, 1.0f);
+			static const char* typeNames[] = { "Point", "Directional", "Sphere", "Rect" };
+			Light light = scene.Lights[i];
+			ImGui::Text("%s light", typeNames[(int)light.Type]);
+
+			bool lightChanged = ImGui::ColorEdit3("Color", glm::value_ptr(light.Color));
+			lightChanged |= ImGui::DragFloat("Intensity", &light.Intensity, 0.1f, 0.0f, FLT_MAX);
+			if (light.Type == LightType::Directional)
+				lightChanged |= ImGui::DragFloat3("Direction", glm::value_ptr(light.Direction), 0.05f);
+			else
+				lightChanged |= ImGui::DragFloat3("Position", glm::value_ptr(light.Position), 0.1f);
+			if (light.Type == LightType::Sphere)
+				lightChanged |= ImGui::DragFloat("Radius", &light.Radius, 0.05f, 0.0f, FLT_MAX);
+			if (lightChanged)
+				PostSceneEdit([i, light](Scene& edited) { edited.SetLight((uint32_t)i, light); });
 
 			ImGui::Separator();
 
 			ImGui::PopID();
+			ImGui::PopID();
 		}
+		lock.unlock();
+
+		const SceneChanges& changes = frame.LastChanges;
+		ImGui::Text("Last edit: %u objects (%u refitted), %u materials, %u lights, %.3fms%s", changes.Objects, changes.Refitted,
+			changes.Materials, changes.Lights, frame.LastCommitMilliseconds, changes.Rebuilt ? ", rebuilt" : "");
 		
 		ImGui::End();
+	}
 
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
+	void DrawProfilerPanel(const RenderThread::Frame& frame)
+	{
+		ImGui::Begin("Profiler");
 
-		ImGui::Begin("Viewport");
+		if (!Profiler::IsCompiledIn())
+		{
+			ImGui::Text("Compiled out (RT_NO_PROFILING)");
+			ImGui::End();
+			return;
+		}
 
-		m_ViewportWidth = ImGui::GetContentRegionAvail().x;
-		m_ViewportHeight = ImGui::GetContentRegionAvail().y;
+		if (ImGui::Checkbox("Enabled", &m_Profiling))
+			Profiler::SetEnabled(m_Profiling);
 
-		auto image = m_Renderer.GetFinalImage();
-		if(image)
-			ImGui::Image(image->GetDescriptorSet(), 
-				{ (float)image->GetWidth(), (float)image->GetHeight() }, 
-				ImVec2(0, 1), ImVec2(1, 0));
+		// Collected on the render thread, summed over its workers. The upload happens here, so
+		// it is timed here.
+		Profiler::Stats profile = frame.Profile;
+		profile.Nanoseconds[(uint32_t)Profiler::Stage::Upload] = (uint64_t)(m_LastUploadTime * 1e6);
+		ImGui::Text("Last frame:");
+		for (uint32_t i = 0; i < Profiler::StageCount; i++)
+			ImGui::Text("  %-12s %9.3f ms", Profiler::GetName((Profiler::Stage)i), profile.GetMilliseconds((Profiler::Stage)i));
 
-		ImGui::End();
-		ImGui::PopStyleVar();
+		double paths = (double)std::max(profile.Get(Profiler::Counter::Paths), (uint64_t)1);
+		for (uint32_t i = 0; i < Profiler::CounterCount; i++)
+		{
+			uint64_t count = profile.Counters[i];
+			ImGui::Text("  %-14s %12llu  %8.2f / path", Profiler::GetName((Profiler::Counter)i), (unsigned long long)count, count / paths);
+		}
+
+		ImGui::Separator();
+		ImGui::DragInt("Capture Frames", &m_CaptureFrames, 0.1f, 1, 1000);
+		if (frame.CaptureFramesLeft == 0 && ImGui::Button("Capture Chrome Trace"))
+		{
+			m_Profiling = true;
+			Profiler::SetEnabled(true);
+			m_RenderThread->CaptureTrace((uint32_t)m_CaptureFrames, m_TracePath);
+		}
+		if (frame.CaptureFramesLeft > 0)
+			ImGui::Text("Capturing, %u frames left", frame.CaptureFramesLeft);
+		else if (!frame.CaptureStatus.empty())
+			ImGui::Text("%s", frame.CaptureStatus.c_str());
 
-		if (m_Renderer.GetFrameIndex() < 100)
-			Render();
+		ImGui::End();
 	}
-	void Render() 
+private:
+	// Walnut::Image only uploads whole images, and only from this thread
+	void UploadFrame()
 	{
+		const RenderThread::Frame& frame = m_RenderThread->GetFrame();
+		if (frame.Width == 0 || frame.Height == 0)
+			return;
+
 		Timer timer;
+		if (!m_Image)
+			m_Image = std::make_shared<Walnut::Image>(frame.Width, frame.Height, Walnut::ImageFormat::RGBA);
+		else if (m_Image->GetWidth() != frame.Width || m_Image->GetHeight() != frame.Height)
+			m_Image->Resize(frame.Width, frame.Height);
+		m_Image->SetData(frame.Pixels.data());
+		m_LastUploadTime = timer.ElapsedMillis();
+	}
+
+	void PostSettings(bool reset = false)
+	{
+		m_RenderThread->Post([settings = m_Settings, reset](Renderer& renderer, Scene&, Camera&)
+		{
+			renderer.GetSettings() = settings;
+			if (reset)
+				renderer.ResetFrameIndex();
+		});
+	}
 
-		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Renderer.Render(m_Scene, m_Camera);
+	// The renderer compares it with the camera its samples belong to, and reprojects or restarts
+	void PostCamera(bool changesView)
+	{
+		m_RenderThread->Post([camera = m_Camera](Renderer&, Scene&, Camera& renderCamera) { renderCamera = camera; }, changesView);
+	}
 
-		m_LastRenderTime = timer.ElapsedMillis();
+	template<typename Edit>
+	void PostSceneEdit(Edit edit)
+	{
+		m_RenderThread->Post([edit](Renderer&, Scene& scene, Camera&) { edit(scene); }, true);
 	}
 private:
-	Renderer m_Renderer;
+	std::unique_ptr<RenderThread> m_RenderThread;
+	std::shared_ptr<Walnut::Image> m_Image;
 	Camera m_Camera;
-	Scene m_Scene;
-	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
-
+	Renderer::Settings m_Settings;
+	FrameBudget::Settings m_FrameBudget;
+	float m_LastUploadTime = 0.0f;
 
-	float m_LastRenderTime = 0.0f;
+	bool m_Profiling = false;
+	int m_CaptureFrames = 30;
+	std::string m_TracePath = "trace.json";
+	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
@@ -220,7 +390,7 @@ Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
 	spec.Name = "RayTracing Example";
 
 	Walnut::Application* app = new Walnut::Application(spec);
-	app->PushLayer<ExampleLayer>();
+	app->PushLayer(std::make_shared<ExampleLayer>(argc > 1 ? argv[1] : ""));
 	app->SetMenubarCallback([app]()
 	{
 		if (ImGui::BeginMenu("File"))
@@ -0,0 +1,59 @@
+project "RayTracingHeadless"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   -- The renderer core without Walnut's window, Vulkan image, ImGui or GLFW
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+
+      "../RayTracing/src/**.h",
+      "../RayTracing/src/**.cpp",
+   }
+
+   removefiles
+   {
+      "../RayTracing/src/WalnutApp.cpp",
+   }
+
+   includedirs
+   {
+      "../RayTracing/src",
+
+      "../Walnut/vendor/glm",
+
+      "../Walnut/Walnut/src",
+   }
+
+   defines { "RT_HEADLESS" }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+      defines { "WL_PLATFORM_WINDOWS" }
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      defines { "WL_DEBUG" }
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "WL_RELEASE" }
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      defines { "WL_DIST", "RT_NO_PROFILING" }
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
@@ -0,0 +1,839 @@
+#include "DistributedRender.h"
+
+#include "SceneFile.h"
+#include "IntersectionKernels.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#ifndef _WIN32
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <spawn.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+
+	extern char** environ;
+#endif
+
+namespace DistributedRender
+{
+#ifndef _WIN32
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr uint32_t Magic = 0x52445452; // "RTDR"
+	static constexpr uint32_t ProtocolVersion = 2;
+
+	enum class MessageType : uint32_t
+	{
+		Hello = 1, // Worker to coordinator, HelloMessage
+		Job,       // JobMessage followed by the compiled scene
+		Lease,     // LeaseMessage
+		Result,    // ResultMessage followed by the lease's RGB sums
+		Done       // The image is complete
+	};
+
+	struct MessageHeader
+	{
+		uint32_t Magic;
+		MessageType Type;
+		uint64_t Size; // Bytes following the header
+	};
+
+	struct HelloMessage
+	{
+		uint32_t Version;
+		uint32_t Threads;
+	};
+
+	struct JobMessage
+	{
+		uint32_t Width, Height;
+		SamplerType Sampling;
+		IntegratorType Integrator;
+		uint32_t Jitter;
+		uint32_t MaxBounces;
+		uint32_t Shadows;
+	};
+
+	struct LeaseMessage
+	{
+		uint32_t Unit;
+		uint32_t X, Y, Width, Height;
+		uint32_t FirstSample, SampleCount;
+	};
+
+	struct ResultMessage
+	{
+		uint32_t Unit;
+		uint32_t Padding;
+		uint64_t Rays; // Traced since the previous result
+	};
+#endif
+}
+
+#ifndef _WIN32
+namespace Utils
+{
+	static bool SendAll(int socket, const void* data, size_t size)
+	{
+		const char* bytes = (const char*)data;
+		while (size > 0)
+		{
+			ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			size -= (size_t)sent;
+		}
+		return true;
+	}
+
+	static bool ReceiveAll(int socket, void* data, size_t size)
+	{
+		char* bytes = (char*)data;
+		while (size > 0)
+		{
+			ssize_t received = recv(socket, bytes, size, 0);
+			if (received <= 0)
+				return false;
+			bytes += received;
+			size -= (size_t)received;
+		}
+		return true;
+	}
+
+	static bool SendMessage(int socket, DistributedRender::MessageType type, const void* data, size_t size, const void* extra = nullptr,
+		size_t extraSize = 0)
+	{
+		DistributedRender::MessageHeader header{ DistributedRender::Magic, type, size + extraSize };
+		return SendAll(socket, &header, sizeof(header)) && SendAll(socket, data, size) && SendAll(socket, extra, extraSize);
+	}
+
+	static bool ReceiveMessage(int socket, DistributedRender::MessageType& type, std::vector<uint8_t>& payload)
+	{
+		DistributedRender::MessageHeader header;
+		if (!ReceiveAll(socket, &header, sizeof(header)) || header.Magic != DistributedRender::Magic)
+			return false;
+
+		type = header.Type;
+		payload.resize(header.Size);
+		return ReceiveAll(socket, payload.data(), payload.size());
+	}
+
+	// True if a message has started arriving within timeoutMs
+	static bool HasData(int socket, int timeoutMs)
+	{
+		pollfd descriptor{ socket, POLLIN, 0 };
+		return poll(&descriptor, 1, timeoutMs) > 0;
+	}
+
+	static void SetTimeouts(int socket, float seconds)
+	{
+		timeval timeout;
+		timeout.tv_sec = (time_t)seconds;
+		timeout.tv_usec = (suseconds_t)((seconds - (float)timeout.tv_sec) * 1e6f);
+		setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	}
+
+	// Opens a socket for "unix:<path>" or "<host>:<port>", bound and listening or connected
+	static int OpenSocket(const std::string& address, bool listening, std::string& error)
+	{
+		if (address.compare(0, 5, "unix:") == 0)
+		{
+			sockaddr_un socketAddress{};
+			socketAddress.sun_family = AF_UNIX;
+			std::string path = address.substr(5);
+			if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+			{
+				error = "Bad socket path in " + address;
+				return -1;
+			}
+			std::memcpy(socketAddress.sun_path, path.c_str(), path.size());
+
+			int socketHandle = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (listening)
+				unlink(path.c_str());
+			bool success = socketHandle >= 0 && (listening ?
+				bind(socketHandle, (sockaddr*)&socketAddress, sizeof(socketAddress)) == 0 && listen(socketHandle, 64) == 0 :
+				connect(socketHandle, (sockaddr*)&socketAddress, sizeof(socketAddress)) == 0);
+			if (!success)
+			{
+				error = std::string("Cannot ") + (listening ? "listen on " : "connect to ") + address + ": " + std::strerror(errno);
+				if (socketHandle >= 0)
+					close(socketHandle);
+				return -1;
+			}
+			return socketHandle;
+		}
+
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos)
+		{
+			error = "Address must be unix:<path> or <host>:<port>: " + address;
+			return -1;
+		}
+		std::string host = address.substr(0, colon);
+		std::string port = address.substr(colon + 1);
+
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = listening ? AI_PASSIVE : 0;
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses) != 0)
+		{
+			error = "Cannot resolve " + address;
+			return -1;
+		}
+
+		int socketHandle = -1;
+		for (addrinfo* candidate = addresses; candidate && socketHandle < 0; candidate = candidate->ai_next)
+		{
+			socketHandle = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+			if (socketHandle < 0)
+				continue;
+
+			// Leases and results are small and answered at once, so they must not wait for Nagle's
+			// algorithm
+			int enable = 1;
+			setsockopt(socketHandle, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+			bool success;
+			if (listening)
+			{
+				setsockopt(socketHandle, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+				success = bind(socketHandle, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(socketHandle, 64) == 0;
+			}
+			else
+			{
+				success = connect(socketHandle, candidate->ai_addr, candidate->ai_addrlen) == 0;
+			}
+			if (!success)
+			{
+				close(socketHandle);
+				socketHandle = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+
+		if (socketHandle < 0)
+			error = std::string("Cannot ") + (listening ? "listen on " : "connect to ") + address + ": " + std::strerror(errno);
+		return socketHandle;
+	}
+
+	static bool ReadFile(const std::filesystem::path& path, std::vector<uint8_t>& data)
+	{
+		std::ifstream stream(path, std::ios::binary | std::ios::ate);
+		if (!stream)
+			return false;
+		data.resize((size_t)stream.tellg());
+		stream.seekg(0);
+		return (bool)stream.read((char*)data.data(), data.size());
+	}
+}
+#endif
+
+namespace DistributedRender
+{
+#ifndef _WIN32
+	// Worker processes started by the coordinator. They exit when told the image is done; any
+	// that have not a moment later (a stalled one) are killed.
+	class SpawnedWorkers
+	{
+	public:
+		~SpawnedWorkers()
+		{
+			for (int attempt = 0; attempt < 20 && !m_Processes.empty(); attempt++)
+			{
+				Reap();
+				if (!m_Processes.empty())
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+			for (pid_t process : m_Processes)
+			{
+				kill(process, SIGKILL);
+				waitpid(process, nullptr, 0);
+			}
+		}
+
+		bool Spawn(const std::vector<std::string>& arguments, std::string& error)
+		{
+			std::vector<char*> argv;
+			for (const std::string& argument : arguments)
+				argv.push_back(const_cast<char*>(argument.c_str()));
+			argv.push_back(nullptr);
+
+			pid_t process;
+			int status = posix_spawn(&process, "/proc/self/exe", nullptr, nullptr, argv.data(), environ);
+			if (status != 0)
+			{
+				error = std::string("Cannot start a worker: ") + std::strerror(status);
+				return false;
+			}
+			m_Processes.push_back(process);
+			return true;
+		}
+	private:
+		void Reap()
+		{
+			m_Processes.erase(std::remove_if(m_Processes.begin(), m_Processes.end(),
+				[](pid_t process) { return waitpid(process, nullptr, WNOHANG) == process; }), m_Processes.end());
+		}
+	private:
+		std::vector<pid_t> m_Processes;
+	};
+
+	// A tile's range of samples. Units are numbered band by band, tile by tile, then by range.
+	struct Unit
+	{
+		uint32_t ActiveLeases = 0;
+		bool Done = false;
+		bool Queued = false; // In the queue to be leased again
+	};
+
+	struct Lease
+	{
+		uint32_t Unit;
+		Clock::time_point Start;
+		bool Overdue = false;
+	};
+
+	struct WorkerConnection
+	{
+		int Socket = -1;
+		uint32_t Threads = 1;
+		std::vector<Lease> Leases;
+	};
+
+	// A band with leased tiles, kept until it is written
+	struct PendingBand
+	{
+		std::vector<Renderer::Region> Regions;
+		std::vector<std::vector<std::vector<float>>> Ranges; // Sums of each tile's sample ranges
+		std::vector<uint32_t> RangesDone;
+		uint32_t TilesDone = 0;
+	};
+
+	class Coordinator
+	{
+	public:
+		Coordinator(const OfflineRender::Settings& settings, const CoordinatorSettings& coordinator, Result& result)
+			: m_Settings(settings), m_Coordinator(coordinator), m_Result(result) {}
+
+		~Coordinator()
+		{
+			for (WorkerConnection& worker : m_Workers)
+				close(worker.Socket);
+			if (m_ListenSocket >= 0)
+				close(m_ListenSocket);
+			if (m_Coordinator.Address.compare(0, 5, "unix:") == 0)
+				unlink(m_Coordinator.Address.c_str() + 5);
+		}
+
+		bool Run(const std::vector<uint8_t>& job, std::string& error)
+		{
+			if (!m_Output.Open(m_Settings, error))
+				return false;
+			m_Result.Bands = m_Output.GetBandCount();
+			m_Result.ResumedBands = m_Output.GetFirstBand();
+
+			m_ListenSocket = Utils::OpenSocket(m_Coordinator.Address, true, error);
+			if (m_ListenSocket < 0)
+				return false;
+
+			m_LeaseSamples = m_Coordinator.LeaseSamples ? std::min(m_Coordinator.LeaseSamples, m_Settings.Samples) : m_Settings.Samples;
+			m_RangesPerTile = (m_Settings.Samples + m_LeaseSamples - 1) / m_LeaseSamples;
+			m_UnitsPerBand = m_Output.GetTilesX() * m_RangesPerTile;
+			m_Units.resize((size_t)m_UnitsPerBand * m_Output.GetBandCount());
+			m_NextUnit = m_UnitsPerBand * m_Output.GetFirstBand();
+
+			if (!SpawnWorkers(error))
+				return false;
+
+			Walnut::Timer timer;
+			Clock::time_point lastWorkerSeen = Clock::now();
+			auto timeout = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(m_Coordinator.LeaseTimeout));
+			while (m_Output.GetNextBand() < m_Output.GetBandCount())
+			{
+				std::vector<pollfd> descriptors;
+				descriptors.push_back({ m_ListenSocket, POLLIN, 0 });
+				for (const WorkerConnection& worker : m_Workers)
+					descriptors.push_back({ worker.Socket, POLLIN, 0 });
+				poll(descriptors.data(), (nfds_t)descriptors.size(), 100);
+
+				if (descriptors[0].revents & POLLIN)
+					AcceptWorker(job);
+				for (size_t i = 1; i < descriptors.size(); i++)
+				{
+					if (descriptors[i].revents && !ReceiveResult(m_Workers[i - 1]))
+						DropWorker(m_Workers[i - 1]);
+				}
+
+				// Overdue leases go back in the queue once, and their worker gets no more until it
+				// returns something
+				Clock::time_point now = Clock::now();
+				for (WorkerConnection& worker : m_Workers)
+				{
+					for (Lease& lease : worker.Leases)
+					{
+						if (!lease.Overdue && now - lease.Start > timeout)
+						{
+							lease.Overdue = true;
+							Requeue(lease.Unit);
+						}
+					}
+				}
+
+				for (WorkerConnection& worker : m_Workers)
+				{
+					if (worker.Socket >= 0 && !HandOut(worker))
+						DropWorker(worker);
+				}
+				m_Workers.erase(std::remove_if(m_Workers.begin(), m_Workers.end(),
+					[](const WorkerConnection& worker) { return worker.Socket < 0; }), m_Workers.end());
+
+				if (!WriteCompleteBands(error))
+					return false;
+
+				if (!m_Workers.empty())
+					lastWorkerSeen = now;
+				else if (now - lastWorkerSeen > timeout)
+				{
+					error = "No workers connected to " + m_Coordinator.Address + " for " + std::to_string(m_Coordinator.LeaseTimeout) + " s";
+					return false;
+				}
+			}
+			m_Result.Milliseconds = timer.ElapsedMillis();
+
+			for (WorkerConnection& worker : m_Workers)
+				Utils::SendMessage(worker.Socket, MessageType::Done, nullptr, 0);
+
+			return m_Output.Finish(error);
+		}
+	private:
+		bool SpawnWorkers(std::string& error)
+		{
+			uint32_t threads = m_Coordinator.WorkerThreads;
+			if (threads == 0)
+				threads = std::max(1u, std::thread::hardware_concurrency() / std::max(1u, m_Coordinator.SpawnWorkers));
+
+			for (uint32_t i = 0; i < m_Coordinator.SpawnWorkers; i++)
+			{
+				std::vector<std::string> arguments = { "RayTracingHeadless", "--worker", m_Coordinator.Address, "--workers", std::to_string(threads),
+					"--isa", Kernels::GetName(Kernels::GetActiveISA()) };
+				if (i == 0 && m_Coordinator.FailAfter)
+					arguments.insert(arguments.end(), { "--fail-after", std::to_string(m_Coordinator.FailAfter) });
+				if (i == 0 && m_Coordinator.StallAfter)
+					arguments.insert(arguments.end(), { "--stall-after", std::to_string(m_Coordinator.StallAfter) });
+				if (!m_Spawned.Spawn(arguments, error))
+					return false;
+			}
+			return true;
+		}
+
+		void AcceptWorker(const std::vector<uint8_t>& job)
+		{
+			int socketHandle = accept4(m_ListenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+			if (socketHandle < 0)
+				return;
+
+			// A worker that does not finish a message within the lease timeout is treated as lost
+			Utils::SetTimeouts(socketHandle, m_Coordinator.LeaseTimeout);
+			int enable = 1;
+			setsockopt(socketHandle, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+			MessageType type;
+			std::vector<uint8_t> payload;
+			HelloMessage hello;
+			if (!Utils::ReceiveMessage(socketHandle, type, payload) || type != MessageType::Hello || payload.size() != sizeof(hello))
+			{
+				close(socketHandle);
+				return;
+			}
+			std::memcpy(&hello, payload.data(), sizeof(hello));
+			if (hello.Version != ProtocolVersion || !Utils::SendMessage(socketHandle, MessageType::Job, job.data(), job.size()))
+			{
+				close(socketHandle);
+				return;
+			}
+
+			WorkerConnection& worker = m_Workers.emplace_back();
+			worker.Socket = socketHandle;
+			worker.Threads = std::max(1u, hello.Threads);
+			m_Result.Workers++;
+		}
+
+		bool ReceiveResult(WorkerConnection& worker)
+		{
+			MessageType type;
+			std::vector<uint8_t> payload;
+			ResultMessage message;
+			if (!Utils::ReceiveMessage(worker.Socket, type, payload) || type != MessageType::Result || payload.size() < sizeof(message))
+				return false;
+			std::memcpy(&message, payload.data(), sizeof(message));
+
+			auto lease = std::find_if(worker.Leases.begin(), worker.Leases.end(), [&](const Lease& lease) { return lease.Unit == message.Unit; });
+			if (lease == worker.Leases.end())
+				return false;
+			worker.Leases.erase(lease);
+			m_Result.Rays += message.Rays;
+
+			Unit& unit = m_Units[message.Unit];
+			unit.ActiveLeases--;
+			if (unit.Done)
+			{
+				m_Result.DiscardedResults++;
+				return true;
+			}
+
+			uint32_t band = message.Unit / m_UnitsPerBand;
+			uint32_t tileX = message.Unit % m_UnitsPerBand / m_RangesPerTile;
+			uint32_t range = message.Unit % m_RangesPerTile;
+			PendingBand& pending = m_Bands[band];
+			const Renderer::Region& region = pending.Regions[tileX];
+			size_t floats = (size_t)region.Width * region.Height * 3;
+			if (payload.size() != sizeof(message) + floats * sizeof(float))
+				return false;
+
+			unit.Done = true;
+			std::vector<float>& sums = pending.Ranges[tileX][range];
+			sums.resize(floats);
+			std::memcpy(sums.data(), payload.data() + sizeof(message), floats * sizeof(float));
+			if (++pending.RangesDone[tileX] == m_RangesPerTile)
+				pending.TilesDone++;
+			return true;
+		}
+
+		void DropWorker(WorkerConnection& worker)
+		{
+			for (const Lease& lease : worker.Leases)
+			{
+				m_Units[lease.Unit].ActiveLeases--;
+				if (m_Units[lease.Unit].ActiveLeases == 0)
+					Requeue(lease.Unit);
+			}
+			worker.Leases.clear();
+			close(worker.Socket);
+			worker.Socket = -1;
+			m_Result.LostWorkers++;
+		}
+
+		void Requeue(uint32_t unitIndex)
+		{
+			Unit& unit = m_Units[unitIndex];
+			if (unit.Done || unit.Queued)
+				return;
+			unit.Queued = true;
+			m_Queue.push_front(unitIndex);
+			m_Result.Reissued++;
+		}
+
+		// Keeps two batches' worth of leases with every worker that is keeping up, so it starts on
+		// the next batch as soon as it sends a result
+		bool HandOut(WorkerConnection& worker)
+		{
+			for (const Lease& lease : worker.Leases)
+			{
+				if (lease.Overdue)
+					return true;
+			}
+
+			uint32_t capacity = 0;
+			for (const WorkerConnection& other : m_Workers)
+				capacity += 2 * other.Threads;
+			// Leasing runs a few bands ahead of the output so bands complete in order
+			uint32_t lookahead = std::max(2u, (capacity + m_UnitsPerBand - 1) / m_UnitsPerBand + 1);
+
+			while (worker.Leases.size() < 2 * worker.Threads)
+			{
+				uint32_t unitIndex;
+				if (!NextUnit(worker, lookahead, unitIndex))
+					break;
+
+				uint32_t band = unitIndex / m_UnitsPerBand;
+				uint32_t tileX = unitIndex % m_UnitsPerBand / m_RangesPerTile;
+				uint32_t range = unitIndex % m_RangesPerTile;
+				PendingBand& pending = m_Bands[band];
+				if (pending.Regions.empty())
+				{
+					m_Output.GetRegions(band, pending.Regions);
+					pending.Ranges.assign(pending.Regions.size(), std::vector<std::vector<float>>(m_RangesPerTile));
+					pending.RangesDone.assign(pending.Regions.size(), 0);
+				}
+
+				// Recorded first, so a failed send hands the unit out again with the worker's others
+				worker.Leases.push_back({ unitIndex, Clock::now() });
+				m_Units[unitIndex].ActiveLeases++;
+				m_Result.Leases++;
+
+				const Renderer::Region& region = pending.Regions[tileX];
+				LeaseMessage lease{ unitIndex, region.X, region.Y, region.Width, region.Height, range * m_LeaseSamples,
+					std::min(m_LeaseSamples, m_Settings.Samples - range * m_LeaseSamples) };
+				if (!Utils::SendMessage(worker.Socket, MessageType::Lease, &lease, sizeof(lease)))
+					return false;
+			}
+			return true;
+		}
+
+		// Units to lease again come first, then new ones
+		bool NextUnit(const WorkerConnection& worker, uint32_t lookahead, uint32_t& unitIndex)
+		{
+			for (auto queued = m_Queue.begin(); queued != m_Queue.end();)
+			{
+				Unit& unit = m_Units[*queued];
+				bool leasedHere = std::any_of(worker.Leases.begin(), worker.Leases.end(), [&](const Lease& lease) { return lease.Unit == *queued; });
+				if (unit.Done || !leasedHere)
+				{
+					unitIndex = *queued;
+					unit.Queued = false;
+					queued = m_Queue.erase(queued);
+					if (!unit.Done)
+						return true;
+				}
+				else
+				{
+					++queued;
+				}
+			}
+
+			if (m_NextUnit >= m_Units.size() || m_NextUnit / m_UnitsPerBand >= m_Output.GetNextBand() + lookahead)
+				return false;
+			unitIndex = m_NextUnit++;
+			return true;
+		}
+
+		// Adds up each tile's sample ranges in order, so the sums do not depend on which
+		// worker returned first
+		bool WriteCompleteBands(std::string& error)
+		{
+			while (true)
+			{
+				auto band = m_Bands.find(m_Output.GetNextBand());
+				if (band == m_Bands.end() || band->second.TilesDone < band->second.Regions.size())
+					return true;
+
+				PendingBand& pending = band->second;
+				for (size_t tileX = 0; tileX < pending.Regions.size(); tileX++)
+				{
+					std::vector<float>& sums = pending.Regions[tileX].Pixels;
+					sums = std::move(pending.Ranges[tileX][0]);
+					for (uint32_t range = 1; range < m_RangesPerTile; range++)
+					{
+						const std::vector<float>& rangeSums = pending.Ranges[tileX][range];
+						for (size_t i = 0; i < sums.size(); i++)
+							sums[i] += rangeSums[i];
+					}
+				}
+
+				if (!m_Output.WriteBand(pending.Regions, error))
+					return false;
+
+				size_t bandBytes = 0;
+				for (const Renderer::Region& region : pending.Regions)
+					bandBytes += region.Pixels.capacity() * sizeof(float);
+				m_Result.BandBytes = std::max(m_Result.BandBytes, bandBytes);
+				m_Bands.erase(band);
+			}
+		}
+	private:
+		const OfflineRender::Settings& m_Settings;
+		const CoordinatorSettings& m_Coordinator;
+		Result& m_Result;
+
+		OfflineRender::Output m_Output;
+		int m_ListenSocket = -1;
+		SpawnedWorkers m_Spawned;
+		std::vector<WorkerConnection> m_Workers;
+
+		uint32_t m_LeaseSamples = 0, m_RangesPerTile = 0, m_UnitsPerBand = 0;
+		std::vector<Unit> m_Units;
+		uint32_t m_NextUnit = 0;
+		std::deque<uint32_t> m_Queue; // Units to lease again
+		std::map<uint32_t, PendingBand> m_Bands;
+	};
+#endif
+
+	bool RunCoordinator(const Scene& scene, const Camera& camera, const Renderer::Settings& renderSettings, const OfflineRender::Settings& settings,
+		const CoordinatorSettings& coordinator, Result& result, std::string& error)
+	{
+#ifdef _WIN32
+		error = "Distributed rendering needs POSIX sockets";
+		return false;
+#else
+		if (scene.Accelerator.GetNodes().empty() && !(scene.Spheres.empty() && scene.Boxes.empty()))
+		{
+			error = "Distributed rendering needs the BVH";
+			return false;
+		}
+
+		// The job is the render settings and the scene in compiled form, camera included
+		CameraDescription cameraDescription;
+		cameraDescription.Position = camera.GetPosition();
+		cameraDescription.Direction = camera.GetDirection();
+		cameraDescription.VerticalFOV = camera.GetVerticalFOV();
+		cameraDescription.LensRadius = camera.GetLensRadius();
+		cameraDescription.FocusDistance = camera.GetFocusDistance();
+		if (camera.GetProjectionType() == Camera::ProjectionType::Orthographic)
+			cameraDescription.OrthographicHeight = camera.GetOrthographicHeight();
+
+		std::filesystem::path scenePath = std::filesystem::temp_directory_path() / ("RayTracingJob-" + std::to_string(getpid()) + ".bin");
+		std::vector<uint8_t> sceneData;
+		bool saved = SceneFile::SaveBinary(scenePath.string(), scene, cameraDescription) && Utils::ReadFile(scenePath, sceneData);
+		std::error_code errorCode;
+		std::filesystem::remove(scenePath, errorCode);
+		if (!saved)
+		{
+			error = "Cannot compile the scene for the workers";
+			return false;
+		}
+
+		JobMessage message{ settings.Width, settings.Height, renderSettings.Sampling, renderSettings.Integrator, renderSettings.Jitter,
+			renderSettings.MaxBounces, renderSettings.Shadows };
+		std::vector<uint8_t> job(sizeof(message) + sceneData.size());
+		std::memcpy(job.data(), &message, sizeof(message));
+		std::memcpy(job.data() + sizeof(message), sceneData.data(), sceneData.size());
+		sceneData = {};
+
+		Coordinator instance(settings, coordinator, result);
+		return instance.Run(job, error);
+#endif
+	}
+
+	bool RunWorker(const WorkerSettings& settings, std::string& error)
+	{
+#ifdef _WIN32
+		error = "Distributed rendering needs POSIX sockets";
+		return false;
+#else
+		// The coordinator may still be starting
+		int socketHandle = -1;
+		for (int attempt = 0; attempt < 100 && socketHandle < 0; attempt++)
+		{
+			socketHandle = Utils::OpenSocket(settings.Address, false, error);
+			if (socketHandle < 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		if (socketHandle < 0)
+			return false;
+
+		uint32_t threads = settings.Threads ? settings.Threads : std::max(1u, std::thread::hardware_concurrency());
+		HelloMessage hello{ ProtocolVersion, threads };
+		MessageType type;
+		std::vector<uint8_t> payload;
+		JobMessage job;
+		if (!Utils::SendMessage(socketHandle, MessageType::Hello, &hello, sizeof(hello)) || !Utils::ReceiveMessage(socketHandle, type, payload) ||
+			type != MessageType::Job || payload.size() < sizeof(job))
+		{
+			error = "No job from " + settings.Address;
+			close(socketHandle);
+			return false;
+		}
+		std::memcpy(&job, payload.data(), sizeof(job));
+
+		Scene scene;
+		CameraDescription cameraDescription;
+		std::filesystem::path scenePath = std::filesystem::temp_directory_path() / ("RayTracingWorker-" + std::to_string(getpid()) + ".bin");
+		{
+			std::ofstream stream(scenePath, std::ios::binary);
+			stream.write((const char*)payload.data() + sizeof(job), payload.size() - sizeof(job));
+		}
+		payload = {};
+		bool loaded = SceneFile::LoadBinary(scenePath.string(), scene, cameraDescription, error);
+		std::error_code errorCode;
+		std::filesystem::remove(scenePath, errorCode);
+		if (!loaded)
+		{
+			close(socketHandle);
+			return false;
+		}
+
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(job.Width, job.Height);
+		cameraDescription.Apply(camera);
+
+		Renderer renderer;
+		renderer.GetSettings().WorkerCount = threads;
+		renderer.GetSettings().Sampling = job.Sampling;
+		renderer.GetSettings().Integrator = job.Integrator;
+		renderer.GetSettings().Jitter = job.Jitter != 0;
+		renderer.GetSettings().MaxBounces = job.MaxBounces;
+		renderer.GetSettings().Shadows = job.Shadows != 0;
+
+		std::deque<LeaseMessage> leases;
+		std::vector<Renderer::Region> regions;
+		uint32_t completed = 0;
+		while (true)
+		{
+			// Waits for work, then takes whatever else has arrived
+			while (leases.empty() || Utils::HasData(socketHandle, 0))
+			{
+				if (!Utils::ReceiveMessage(socketHandle, type, payload))
+				{
+					error = "Lost the coordinator at " + settings.Address;
+					close(socketHandle);
+					return false;
+				}
+				if (type == MessageType::Done)
+				{
+					close(socketHandle);
+					return true;
+				}
+
+				LeaseMessage lease;
+				if (type != MessageType::Lease || payload.size() != sizeof(lease))
+					continue;
+				std::memcpy(&lease, payload.data(), sizeof(lease));
+				leases.push_back(lease);
+			}
+
+			// One lease per thread; the rest wait in the queue for the next batch
+			regions.resize(std::min<size_t>(threads, leases.size()));
+			for (size_t i = 0; i < regions.size(); i++)
+			{
+				const LeaseMessage& lease = leases[i];
+				regions[i].X = lease.X;
+				regions[i].Y = lease.Y;
+				regions[i].Width = lease.Width;
+				regions[i].Height = lease.Height;
+				regions[i].FirstSample = lease.FirstSample;
+				regions[i].SampleCount = lease.SampleCount;
+			}
+			renderer.RenderRegions(scene, camera, regions);
+
+			for (size_t i = 0; i < regions.size(); i++)
+			{
+				completed++;
+				if (settings.FailAfter && completed > settings.FailAfter)
+					std::_Exit(3);
+				while (settings.StallAfter && completed > settings.StallAfter)
+					std::this_thread::sleep_for(std::chrono::hours(1));
+
+				ResultMessage result{ leases.front().Unit, 0, i == 0 ? renderer.GetLastFrameRayCount() : 0 };
+				leases.pop_front();
+				const std::vector<float>& sums = regions[i].Pixels;
+				if (!Utils::SendMessage(socketHandle, MessageType::Result, &result, sizeof(result), sums.data(), sums.size() * sizeof(float)))
+				{
+					error = "Lost the coordinator at " + settings.Address;
+					close(socketHandle);
+					return false;
+				}
+			}
+		}
+#endif
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "OfflineRender.h"
+
+#include <cstdint>
+#include <string>
+
+// Offline renders spread over worker processes, on this machine or across a farm. The
+// coordinator loads the scene once and sends it, compiled, to every worker that connects, then
+// leases out tiles of the image with a range of their samples. Workers render their leases
+// with Renderer::RenderRegions() and send back the sample sums. The coordinator adds up a
+// tile's sample ranges in order and divides by the samples taken. It writes bands through
+// OfflineRender::Output as they complete, so the checkpoint and --resume work as they do for a
+// local offline render. A lease not returned within the lease timeout is also handed to
+// another worker, and the first result wins. The leases of a worker that disconnects are
+// handed out again.
+//
+// Addresses are "unix:<path>" for a Unix domain socket or "<host>:<port>" for TCP. Messages
+// are in the machine's byte order, like compiled scenes, so all machines must share it.
+namespace DistributedRender
+{
+	struct CoordinatorSettings
+	{
+		std::string Address;
+		uint32_t LeaseSamples = 0;  // Samples per lease, 0 for all of them (bit-identical to a local render)
+		float LeaseTimeout = 30.0f; // Seconds before a lease is also handed to another worker
+		uint32_t SpawnWorkers = 0;  // Local worker processes started by the coordinator
+		uint32_t WorkerThreads = 0; // Render threads per spawned worker, 0 to share the hardware threads
+		// Passed to the first spawned worker, see WorkerSettings
+		uint32_t FailAfter = 0, StallAfter = 0;
+	};
+
+	struct Result : OfflineRender::Result
+	{
+		uint32_t Workers = 0;          // Connected during the render
+		uint32_t LostWorkers = 0;      // Disconnected before the end
+		uint32_t Leases = 0;
+		uint32_t Reissued = 0;         // Tiles leased again after a timeout or a lost worker
+		uint32_t DiscardedResults = 0; // Leases returned after another worker's copy
+	};
+
+	struct WorkerSettings
+	{
+		std::string Address;
+		uint32_t Threads = 0;    // 0 for one per hardware thread
+		uint32_t FailAfter = 0;  // Exit without a word after this many leases, for testing
+		uint32_t StallAfter = 0; // Stop responding after this many leases, for testing
+	};
+
+	// Renders settings.OutputPath with the workers that connect to coordinator.Address. The
+	// scene's BVH must be built.
+	bool RunCoordinator(const Scene& scene, const Camera& camera, const Renderer::Settings& renderSettings, const OfflineRender::Settings& settings,
+		const CoordinatorSettings& coordinator, Result& result, std::string& error);
+
+	// Connects to a coordinator and renders its leases until the image is done
+	bool RunWorker(const WorkerSettings& settings, std::string& error);
+}
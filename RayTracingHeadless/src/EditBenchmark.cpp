@@ -0,0 +1,161 @@
+#include "EditBenchmark.h"
+
+#include "Scenes.h"
+
+#include "Walnut/Timer.h"
+
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace EditBenchmark
+{
+	static constexpr uint32_t Repetitions = 20;
+
+	static bool SameNodes(const BVH& a, const BVH& b)
+	{
+		return a.GetNodes().size() == b.GetNodes().size() &&
+			std::memcmp(a.GetNodes().data(), b.GetNodes().data(), a.GetNodes().size() * sizeof(BVHNode)) == 0;
+	}
+
+	static bool SameLanes(const PrimitiveSoA& a, const PrimitiveSoA& b)
+	{
+		return a.CenterX == b.CenterX && a.CenterY == b.CenterY && a.CenterZ == b.CenterZ && a.Radius == b.Radius &&
+			a.MinX == b.MinX && a.MinY == b.MinY && a.MinZ == b.MinZ && a.MaxX == b.MaxX && a.MaxY == b.MaxY && a.MaxZ == b.MaxZ;
+	}
+
+	struct Timings
+	{
+		double Commit = 0.0;
+		double Refit = 0.0;
+		double Build = 0.0;
+	};
+
+	// Runs edit(repetition) then times CommitChanges(), averaged over the repetitions, and checks
+	// the result against a full refit of a copy
+	template<typename EditFn>
+	static Timings TimeEdits(Scene& scene, EditFn&& edit, bool& match)
+	{
+		Timings timings;
+		for (uint32_t repetition = 0; repetition < Repetitions; repetition++)
+		{
+			edit(repetition);
+
+			Walnut::Timer timer;
+			scene.CommitChanges();
+			timings.Commit += timer.ElapsedMillis();
+		}
+
+		Scene reference = scene;
+		Walnut::Timer refitTimer;
+		reference.RefitAcceleration();
+		timings.Refit = refitTimer.ElapsedMillis();
+		match &= SameNodes(scene.Accelerator, reference.Accelerator) && SameLanes(scene.LeafData, reference.LeafData) &&
+			SameNodes(scene.InstanceAccelerator, reference.InstanceAccelerator);
+
+		Walnut::Timer buildTimer;
+		reference.BuildAcceleration();
+		timings.Build = buildTimer.ElapsedMillis();
+
+		timings.Commit /= Repetitions;
+		return timings;
+	}
+
+	static void WriteEntry(std::ostringstream& json, const char* scene, const char* edit, uint32_t objects, const Timings& timings, bool last)
+	{
+		json << "    { \"scene\": \"" << scene << "\", \"edit\": \"" << edit << "\", \"objects\": " << objects
+			<< ", \"commit_ms\": " << timings.Commit << ", \"full_refit_ms\": " << timings.Refit
+			<< ", \"full_build_ms\": " << timings.Build << " }" << (last ? "\n" : ",\n");
+	}
+
+	bool Run(uint32_t primitiveCount, std::string& report)
+	{
+		std::mt19937 engine(1234);
+		std::uniform_real_distribution<float> offset(-0.05f, 0.05f);
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"primitives\": " << primitiveCount << ",\n";
+		json << "  \"edits\": [\n";
+
+		bool match = true;
+		const uint32_t editCounts[] = { 1, 16, 256 };
+
+		Scene many;
+		Scenes::Create("many", many, primitiveCount);
+		uint32_t objectCount = (uint32_t)(many.Spheres.size() + many.Boxes.size());
+		for (uint32_t editCount : editCounts)
+		{
+			std::vector<uint32_t> objects(glm::min(editCount, objectCount));
+			for (uint32_t& object : objects)
+				object = engine() % objectCount;
+
+			Timings timings = TimeEdits(many, [&](uint32_t)
+			{
+				for (uint32_t object : objects)
+				{
+					glm::vec3 move(offset(engine), offset(engine), offset(engine));
+					if (object < many.Spheres.size())
+					{
+						Sphere sphere = many.Spheres[object];
+						sphere.Position += move;
+						many.SetSphere(object, sphere);
+					}
+					else
+					{
+						uint32_t boxIndex = object - (uint32_t)many.Spheres.size();
+						Box box = many.Boxes[boxIndex];
+						box.Position += move;
+						many.SetBox(boxIndex, box);
+					}
+				}
+			}, match);
+			WriteEntry(json, "many", "move", (uint32_t)objects.size(), timings, false);
+		}
+
+		// Materials and material indices are only read while shading
+		std::vector<BVHNode> nodesBefore = many.Accelerator.GetNodes();
+		Timings materialTimings = TimeEdits(many, [&](uint32_t repetition)
+		{
+			Material material = many.Materials[repetition % many.Materials.size()];
+			material.Roughness = 1.0f - material.Roughness;
+			many.SetMaterial(repetition % many.Materials.size(), material);
+
+			Sphere sphere = many.Spheres[repetition % many.Spheres.size()];
+			sphere.MaterialIndex = (sphere.MaterialIndex + 1) % (int)many.Materials.size();
+			many.SetSphere(repetition % many.Spheres.size(), sphere);
+		}, match);
+		match &= many.Accelerator.GetNodes().size() == nodesBefore.size() &&
+			std::memcmp(many.Accelerator.GetNodes().data(), nodesBefore.data(), nodesBefore.size() * sizeof(BVHNode)) == 0;
+		WriteEntry(json, "many", "material", 2, materialTimings, false);
+
+		Scene forest;
+		Scenes::Create("forest", forest, primitiveCount);
+		uint32_t instanceCount = (uint32_t)forest.Instances.size();
+		for (size_t e = 0; e < std::size(editCounts); e++)
+		{
+			std::vector<uint32_t> instances(glm::min(editCounts[e], instanceCount));
+			for (uint32_t& instance : instances)
+				instance = engine() % instanceCount;
+
+			Timings timings = TimeEdits(forest, [&](uint32_t)
+			{
+				for (uint32_t instance : instances)
+				{
+					glm::mat4 transform = forest.Instances[instance].Transform;
+					transform[3] += glm::vec4(offset(engine), 0.0f, offset(engine), 0.0f);
+					forest.SetInstanceTransform(instance, transform);
+				}
+			}, match);
+			WriteEntry(json, "forest", "move", (uint32_t)instances.size(), timings, e + 1 == std::size(editCounts));
+		}
+
+		json << "  ],\n";
+		json << "  \"match\": " << (match ? "true" : "false") << "\n";
+		json << "}\n";
+		report = json.str();
+		return match;
+	}
+}
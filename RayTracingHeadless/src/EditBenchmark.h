@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace EditBenchmark
+{
+	// Moves 1, 16 and 256 objects of the "many" scene with primitiveCount primitives, and as many
+	// instances of "forest", through Scene's edit API, timing CommitChanges() against a full
+	// RefitAcceleration() and BuildAcceleration(), plus a material-only commit. Writes a JSON
+	// report and returns false if a partial refit left different bounds than a full refit.
+	bool Run(uint32_t primitiveCount, std::string& report);
+}
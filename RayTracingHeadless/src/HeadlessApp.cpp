@@ -0,0 +1,506 @@
+#include "HeadlessOptions.h"
+#include "HeadlessReport.h"
+#include "Renderer.h"
+#include "FrameBudget.h"
+#include "Camera.h"
+#include "Scenes.h"
+#include "ImageWriter.h"
+#include "KernelBenchmark.h"
+#include "LoadBenchmark.h"
+#include "ImportBenchmark.h"
+#include "EditBenchmark.h"
+#include "IntegratorBenchmark.h"
+#include "RenderThreadBenchmark.h"
+#include "RegressionSuite.h"
+#include "OfflineRender.h"
+#include "DistributedRender.h"
+#include "MeshImporter.h"
+#include "SceneFile.h"
+#include "ChunkCache.h"
+#include "IntersectionKernels.h"
+#include "Profiler.h"
+
+#include "Walnut/Timer.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Renders N accumulated frames of a named scene without a window and reports
+// per-frame timings as JSON, so runs can be compared between commits and machines.
+
+namespace Utils
+{
+	// Bilinear, between pixel centres
+	static std::vector<uint32_t> UpscaleImage(const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight)
+	{
+		std::vector<uint32_t> result((size_t)targetWidth * targetHeight);
+		for (uint32_t y = 0; y < targetHeight; y++)
+		{
+			float sourceY = glm::clamp(((float)y + 0.5f) * height / targetHeight - 0.5f, 0.0f, (float)(height - 1));
+			uint32_t y0 = (uint32_t)sourceY;
+			uint32_t y1 = glm::min(y0 + 1, height - 1);
+			float fractionY = sourceY - (float)y0;
+			for (uint32_t x = 0; x < targetWidth; x++)
+			{
+				float sourceX = glm::clamp(((float)x + 0.5f) * width / targetWidth - 0.5f, 0.0f, (float)(width - 1));
+				uint32_t x0 = (uint32_t)sourceX;
+				uint32_t x1 = glm::min(x0 + 1, width - 1);
+				float fractionX = sourceX - (float)x0;
+
+				const uint32_t corners[4] = { pixels[x0 + y0 * width], pixels[x1 + y0 * width], pixels[x0 + y1 * width], pixels[x1 + y1 * width] };
+				const float weights[4] = { (1.0f - fractionX) * (1.0f - fractionY), fractionX * (1.0f - fractionY), (1.0f - fractionX) * fractionY, fractionX * fractionY };
+				uint32_t pixel = 0;
+				for (uint32_t channel = 0; channel < 32; channel += 8)
+				{
+					float value = 0.0f;
+					for (uint32_t corner = 0; corner < 4; corner++)
+						value += weights[corner] * (float)((corners[corner] >> channel) & 0xff);
+					pixel |= glm::min((uint32_t)(value + 0.5f), 255u) << channel;
+				}
+				result[x + (size_t)y * targetWidth] = pixel;
+			}
+		}
+		return result;
+	}
+
+	// Never sizes the renderer for the whole image, so only the band in flight is in memory
+	static int RunRenderThread(const BenchmarkOptions& options, Scene scene, const Camera& camera, Renderer::Settings settings)
+	{
+		// Every frame is resolved, as the app shows each one
+		settings.ResolveInterval = 1;
+		Profiler::SetEnabled(options.Profile);
+
+		RenderThreadBenchmark::Settings benchmark;
+		benchmark.Width = options.Width;
+		benchmark.Height = options.Height;
+		benchmark.Frames = options.Frames;
+		benchmark.OrbitDegrees = options.OrbitDegrees;
+		benchmark.OrbitTicks = options.OrbitFrames;
+		benchmark.FrameBudgetMs = options.FrameBudgetMs;
+
+		std::vector<uint32_t> image;
+		uint32_t width, height;
+		std::string report;
+		RenderThreadBenchmark::Run(std::move(scene), camera, settings, benchmark, image, width, height, report);
+
+		if (width != options.Width || height != options.Height)
+			image = UpscaleImage(image.data(), width, height, options.Width, options.Height);
+		if (!options.OutputPath.empty() && !ImageWriter::WritePPM(options.OutputPath, image.data(), options.Width, options.Height))
+		{
+			std::fprintf(stderr, "Failed to write %s\n", options.OutputPath.c_str());
+			return 1;
+		}
+		return HeadlessReport::Output(options, report) ? 0 : 1;
+	}
+
+	static int RenderOffline(const BenchmarkOptions& options, const Scene& scene, Camera& camera, Renderer& renderer)
+	{
+		OfflineRender::Settings settings;
+		settings.OutputPath = options.OfflinePath;
+		settings.Width = options.Width;
+		settings.Height = options.Height;
+		settings.Samples = options.OfflineSamples;
+		settings.TileSize = options.TileSize;
+		settings.Resume = options.Resume;
+
+		std::ostringstream description;
+		description << (!options.ChunksPath.empty() ? options.ChunksPath : !options.SceneFilePath.empty() ? options.SceneFilePath : options.SceneName) << " count=" << options.PrimitiveCount
+			<< " bvh=" << options.UseBVH << " sampler=" << Sampler::GetName(options.Sampling) << " jitter=" << options.Jitter
+			<< " ortho=" << options.OrthographicHeight << " lens=" << options.LensRadius << "/" << options.FocusDistance;
+		for (const std::string& meshPath : options.MeshPaths)
+			description << " mesh=" << meshPath;
+		settings.Description = description.str();
+
+		DistributedRender::Result result;
+		std::string error;
+		bool success;
+		if (options.DistributeAddress.empty())
+			success = OfflineRender::Run(renderer, scene, camera, settings, result, error);
+		else
+		{
+			DistributedRender::CoordinatorSettings coordinator = options.Coordinator;
+			coordinator.Address = options.DistributeAddress;
+			coordinator.WorkerThreads = options.WorkerCount;
+			coordinator.FailAfter = options.FailAfter;
+			coordinator.StallAfter = options.StallAfter;
+			camera.OnResize(options.Width, options.Height);
+			success = DistributedRender::RunCoordinator(scene, camera, renderer.GetSettings(), settings, coordinator, result, error);
+		}
+		if (!success)
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+
+		double seconds = result.Milliseconds / 1000.0;
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"output\": \"" << options.OfflinePath << "\",\n";
+		json << "  \"width\": " << options.Width << ",\n";
+		json << "  \"height\": " << options.Height << ",\n";
+		json << "  \"samples\": " << options.OfflineSamples << ",\n";
+		json << "  \"tile_size\": " << options.TileSize << ",\n";
+		json << "  \"integrator\": \"" << Renderer::GetIntegratorName(options.Integrator) << "\",\n";
+		json << "  \"bands\": " << result.Bands << ",\n";
+		json << "  \"resumed_bands\": " << result.ResumedBands << ",\n";
+		json << "  \"band_bytes\": " << result.BandBytes << ",\n";
+		json << "  \"total_ms\": " << result.Milliseconds << ",\n";
+		json << "  \"rays\": " << result.Rays << ",\n";
+		json << "  \"rays_per_sec\": " << (seconds > 0.0 ? result.Rays / seconds : 0.0);
+		if (!options.DistributeAddress.empty())
+		{
+			json << ",\n";
+			json << "  \"lease_samples\": " << options.Coordinator.LeaseSamples << ",\n";
+			json << "  \"connected_workers\": " << result.Workers << ",\n";
+			json << "  \"lost_workers\": " << result.LostWorkers << ",\n";
+			json << "  \"leases\": " << result.Leases << ",\n";
+			json << "  \"reissued_leases\": " << result.Reissued << ",\n";
+			json << "  \"discarded_results\": " << result.DiscardedResults;
+		}
+		json << "\n}\n";
+		return HeadlessReport::Output(options, json.str()) ? 0 : 1;
+	}
+
+	static bool SelectISA(const std::string& name)
+	{
+		for (Kernels::ISA isa : { Kernels::ISA::Scalar, Kernels::ISA::SSE, Kernels::ISA::AVX2, Kernels::ISA::AVX512 })
+		{
+			if (name != Kernels::GetName(isa))
+				continue;
+
+			if (!Kernels::IsSupported(isa))
+			{
+				std::fprintf(stderr, "This CPU does not support %s\n", name.c_str());
+				return false;
+			}
+			Kernels::SetActiveISA(isa);
+			return true;
+		}
+
+		std::fprintf(stderr, "Unknown instruction set '%s'\n", name.c_str());
+		return false;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!HeadlessOptions::Parse(argc, argv, options))
+	{
+		HeadlessOptions::PrintUsage();
+		return 1;
+	}
+
+	if (!options.ISAName.empty() && !Utils::SelectISA(options.ISAName))
+		return 1;
+
+	if (!options.WorkerAddress.empty())
+	{
+		DistributedRender::WorkerSettings settings;
+		settings.Address = options.WorkerAddress;
+		settings.Threads = options.WorkerCount;
+		settings.FailAfter = options.FailAfter;
+		settings.StallAfter = options.StallAfter;
+		std::string error;
+		if (!DistributedRender::RunWorker(settings, error))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (options.BenchmarkKernels)
+	{
+		std::string report;
+		bool match = KernelBenchmark::Run(options.KernelRays, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+		return match ? 0 : 2;
+	}
+
+	if (options.CheckRegression)
+	{
+		options.Regression.Directory = options.RegressionDirectory.empty() ? RegressionSuite::GetDefaultDirectory() : options.RegressionDirectory;
+		std::string report;
+		bool passed = RegressionSuite::Run(options.Regression, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+
+		std::string budgetPath = RegressionSuite::GetBudgetPath(options.Regression.Directory);
+		std::error_code errorCode;
+		if (!passed && !std::filesystem::exists(budgetPath, errorCode))
+			std::fprintf(stderr, "No frame time budgets in %s; record this machine's with --regression --update-budgets on a known-good build\n", budgetPath.c_str());
+		return passed ? 0 : 2;
+	}
+
+	if (options.BenchmarkLoad)
+	{
+		std::string report;
+		bool success = LoadBenchmark::Run(options.PrimitiveCount, options.LoadBenchmarkDirectory, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+		return success ? 0 : 1;
+	}
+
+	if (options.BenchmarkImport)
+	{
+		std::string report;
+		bool success = ImportBenchmark::Run(options.PrimitiveCount, options.WorkerCount, options.ImportBenchmarkDirectory, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+		return success ? 0 : 2;
+	}
+
+	if (options.BenchmarkEdits)
+	{
+		std::string report;
+		bool match = EditBenchmark::Run(options.PrimitiveCount, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+		return match ? 0 : 2;
+	}
+
+	if (options.BenchmarkIntegrators)
+	{
+		std::string report;
+		bool match = IntegratorBenchmark::Run(options.PrimitiveCount, options.Width, options.Height, options.Frames, options.WorkerCount, report);
+		if (!HeadlessReport::Output(options, report))
+			return 1;
+		return match ? 0 : 2;
+	}
+
+	// Scenes size their BVH leaves for the active kernel, so pick it first
+	Scene scene;
+	CameraDescription cameraDescription;
+	SceneInfo sceneInfo;
+	Walnut::Timer loadTimer;
+	if (!options.ChunksPath.empty())
+	{
+		std::string error;
+		size_t budget = (size_t)(glm::max(options.ChunkBudgetMB, 0.0f) * 1024.0f * 1024.0f);
+		if (!ChunkCache::Load(options.ChunksPath, budget, scene, cameraDescription, error))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+	else if (!options.SceneFilePath.empty())
+	{
+		std::string error;
+		if (!SceneFile::Load(options.SceneFilePath, scene, cameraDescription, error, options.UseSceneCache))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+	else if (!Scenes::Create(options.SceneName, scene, options.PrimitiveCount))
+	{
+		std::fprintf(stderr, "Unknown scene '%s'\n", options.SceneName.c_str());
+		return 1;
+	}
+
+	for (const std::string& meshPath : options.MeshPaths)
+	{
+		std::string error;
+		Mesh& mesh = scene.Meshes.emplace_back();
+		if (!MeshImporter::Load(meshPath, mesh, error, options.WorkerCount))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+
+		Material& material = scene.Materials.emplace_back();
+		material.Albedo = glm::vec3(0.8f);
+		material.Roughness = 0.5f;
+		mesh.MaterialIndex = (int)scene.Materials.size() - 1;
+	}
+	if (!options.MeshPaths.empty())
+		scene.BuildAcceleration();
+	sceneInfo.LoadMilliseconds = loadTimer.ElapsedMillis();
+
+	if ((!options.SaveScenePath.empty() && !SceneFile::SaveText(options.SaveScenePath, scene, cameraDescription)) ||
+		(!options.CompileScenePath.empty() && !SceneFile::SaveBinary(options.CompileScenePath, scene, cameraDescription)) ||
+		(!options.WriteChunksPath.empty() && !ChunkCache::Write(options.WriteChunksPath, scene, cameraDescription, options.ChunkSize)))
+	{
+		std::fprintf(stderr, "Failed to write the scene\n");
+		return 1;
+	}
+
+	sceneInfo.Primitives = (uint32_t)(scene.Spheres.size() + scene.Boxes.size());
+	for (const Mesh& mesh : scene.Meshes)
+	{
+		sceneInfo.Triangles += mesh.GetTriangleCount();
+		sceneInfo.MeshBytes += mesh.GetMemoryUsage();
+	}
+	if (options.UseBVH)
+	{
+		// Loading already built it; rebuild here to time it
+		Walnut::Timer timer;
+		scene.BuildAcceleration();
+		sceneInfo.BuildMilliseconds = timer.ElapsedMillis();
+		sceneInfo.BVHNodes = (uint32_t)scene.Accelerator.GetNodes().size();
+	}
+	else
+	{
+		scene.Accelerator.Clear();
+	}
+
+	sceneInfo.Prototypes = (uint32_t)scene.Prototypes.size();
+	sceneInfo.Instances = (uint32_t)scene.Instances.size();
+	for (const Prototype& prototype : scene.Prototypes)
+		sceneInfo.PrototypeBytes += prototype.GetMemoryUsage();
+	sceneInfo.InstanceBytes = scene.GetInstanceMemoryUsage();
+	sceneInfo.InstancedPrimitives = scene.GetInstancedPrimitiveCount();
+	sceneInfo.InstancedTriangles = scene.GetInstancedTriangleCount();
+	sceneInfo.Lights = (uint32_t)scene.LightHierarchy.GetLights().size();
+	sceneInfo.LightTreeBytes = scene.LightHierarchy.GetMemoryUsage();
+
+	Camera camera(45.0f, 0.1f, 100.0f);
+	camera.OnResize(options.Width, options.Height);
+	cameraDescription.Apply(camera);
+	// Lens and projection options override the scene file
+	if (options.OrthographicHeight > 0.0f)
+		camera.SetProjectionType(Camera::ProjectionType::Orthographic, options.OrthographicHeight);
+	if (options.LensRadius > 0.0f)
+		camera.SetLens(options.LensRadius, options.FocusDistance);
+
+	Renderer renderer;
+	renderer.GetSettings().TileSize = options.TileSize;
+	renderer.GetSettings().WorkerCount = options.WorkerCount;
+	renderer.GetSettings().HalfPrecisionAccumulation = options.HalfPrecision;
+	renderer.GetSettings().Denoise = options.Denoise;
+	renderer.GetSettings().Denoising.Iterations = options.DenoiseIterations;
+	renderer.GetSettings().Reproject = options.Reproject;
+	renderer.GetSettings().Sampling = options.Sampling;
+	renderer.GetSettings().Integrator = options.Integrator;
+	renderer.GetSettings().Jitter = options.Jitter;
+	renderer.GetSettings().MaxBounces = options.MaxBounces;
+	renderer.GetSettings().Shadows = options.Shadows;
+	renderer.GetSettings().Specialize = options.Specialize;
+	renderer.GetSettings().TargetNoise = options.TargetNoise;
+	renderer.GetSettings().MinSamples = options.MinSamples;
+	renderer.GetSettings().MaxSamples = options.MaxSamples;
+	renderer.GetSettings().ShowConvergence = options.ConvergenceMask;
+	if (!options.OfflinePath.empty())
+		return Utils::RenderOffline(options, scene, camera, renderer);
+	if (options.UseRenderThread)
+		return Utils::RunRenderThread(options, std::move(scene), camera, renderer.GetSettings());
+
+	// Resolves are driven from here so they can be timed apart from sampling
+	renderer.GetSettings().ResolveInterval = 0;
+	renderer.OnResize(options.Width, options.Height);
+
+	if (options.Profile && !Profiler::IsCompiledIn())
+		std::fprintf(stderr, "Profiling is compiled out of this build (RT_NO_PROFILING)\n");
+	Profiler::SetEnabled(options.Profile);
+
+	for (uint32_t i = 0; i < options.WarmupFrames; i++)
+		renderer.Render(scene, camera);
+	renderer.ResetFrameIndex();
+	Profiler::CollectFrame();
+	if (!options.TracePath.empty())
+		Profiler::BeginCapture();
+
+	std::vector<FrameTiming> frames;
+	frames.reserve(options.Frames);
+	TileStatistics tileStatistics;
+	Profiler::Stats profile;
+	FrameBudget frameBudget;
+	frameBudget.GetSettings().Milliseconds = options.FrameBudgetMs;
+	for (uint32_t i = 0; i < options.Frames; i++)
+	{
+		bool moving = i > 0 && options.OrbitDegrees != 0.0f && (options.OrbitFrames == 0 || i < options.OrbitFrames);
+		if (moving)
+		{
+			float angle = glm::radians(options.OrbitDegrees);
+			auto rotate = [&](const glm::vec3& v)
+			{
+				return glm::vec3(glm::cos(angle) * v.x + glm::sin(angle) * v.z, v.y, glm::cos(angle) * v.z - glm::sin(angle) * v.x);
+			};
+			camera.SetView(rotate(camera.GetPosition()), rotate(camera.GetDirection()));
+		}
+
+		// Resizing is part of the frame's cost, as it is in the app
+		Walnut::Timer timer;
+		if (options.FrameBudgetMs > 0.0f)
+		{
+			frameBudget.Update(moving);
+			uint32_t width, height;
+			frameBudget.GetRenderSize(options.Width, options.Height, width, height);
+			renderer.OnResize(width, height);
+			camera.OnResize(width, height);
+		}
+		renderer.Render(scene, camera);
+		uint32_t reprojectedPixels = moving ? renderer.GetLastReprojectedPixelCount() : 0;
+
+		// The last frame is always resolved so the output image is complete
+		float resolveMilliseconds = 0.0f;
+		bool converged = options.UntilConverged && renderer.IsConverged();
+		bool lastFrame = i + 1 == options.Frames || converged;
+		if (lastFrame || (options.ResolveInterval > 0 && (i + 1) % options.ResolveInterval == 0))
+		{
+			renderer.Resolve();
+			resolveMilliseconds = glm::max(renderer.GetLastResolveTime(), std::numeric_limits<float>::min());
+		}
+		frames.push_back({ timer.ElapsedMillis(), resolveMilliseconds, renderer.GetLastFrameRayCount(), renderer.GetLastFrameSampleCount(), reprojectedPixels,
+			renderer.GetWidth() * renderer.GetHeight(), moving });
+		frameBudget.AddFrameTime(frames.back().Milliseconds);
+
+		tileStatistics.Add(renderer.GetTileTimings(), renderer.GetWorkerCount());
+		profile += Profiler::CollectFrame();
+		if (converged)
+			break;
+	}
+	float convergedFraction = 1.0f - (float)renderer.GetActiveTileCount() / (float)renderer.GetTileCount();
+
+	if (!options.TracePath.empty())
+	{
+		Profiler::EndCapture();
+		if (!Profiler::WriteChromeTrace(options.TracePath))
+		{
+			std::fprintf(stderr, "Failed to write %s\n", options.TracePath.c_str());
+			return 1;
+		}
+	}
+
+	if (!options.TileTimingPath.empty() && !HeadlessReport::WriteTileTimings(options.TileTimingPath, renderer.GetTileTimings()))
+	{
+		std::fprintf(stderr, "Failed to write %s\n", options.TileTimingPath.c_str());
+		return 1;
+	}
+
+	// A frame the budget scaled down is upscaled as the app displays it
+	std::vector<uint32_t> upscaled;
+	const uint32_t* image = renderer.GetImageData();
+	if (renderer.GetWidth() != options.Width || renderer.GetHeight() != options.Height)
+	{
+		upscaled = Utils::UpscaleImage(image, renderer.GetWidth(), renderer.GetHeight(), options.Width, options.Height);
+		image = upscaled.data();
+	}
+	if (!options.OutputPath.empty() && !ImageWriter::WritePPM(options.OutputPath, image, options.Width, options.Height))
+	{
+		std::fprintf(stderr, "Failed to write %s\n", options.OutputPath.c_str());
+		return 1;
+	}
+
+	ChunkCache::Stats chunkStats;
+	if (scene.Chunks)
+		chunkStats = scene.Chunks->GetStats();
+	std::string report = HeadlessReport::Write(options, sceneInfo, frames, tileStatistics, renderer.GetAccumulationMemoryUsage(), convergedFraction,
+		scene.Chunks ? &chunkStats : nullptr, renderer.GetDeferredSampleCount(), options.Profile ? &profile : nullptr);
+	if (!HeadlessReport::Output(options, report))
+		return 1;
+
+	// The image is missing whatever the failed chunks hold
+	if (scene.Chunks && !scene.Chunks->GetError().empty())
+	{
+		std::fprintf(stderr, "%s\n", scene.Chunks->GetError().c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,471 @@
+#include "HeadlessOptions.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace HeadlessOptions
+{
+	static bool SelectSampler(const std::string& name, SamplerType& type)
+	{
+		for (SamplerType candidate : { SamplerType::PCG, SamplerType::Sobol })
+		{
+			if (name == Sampler::GetName(candidate))
+			{
+				type = candidate;
+				return true;
+			}
+		}
+
+		std::fprintf(stderr, "Unknown sampler '%s'\n", name.c_str());
+		return false;
+	}
+
+	static bool SelectIntegrator(const std::string& name, IntegratorType& type)
+	{
+		for (IntegratorType candidate : { IntegratorType::Megakernel, IntegratorType::Wavefront })
+		{
+			if (name == Renderer::GetIntegratorName(candidate))
+			{
+				type = candidate;
+				return true;
+			}
+		}
+
+		std::fprintf(stderr, "Unknown integrator '%s'\n", name.c_str());
+		return false;
+	}
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: RayTracingHeadless [options]\n"
+			"  --scene <name>      default | spheres | boxes | mixed | many | meshes | forest | lights (default: default)\n"
+			"  --count <n>         primitives for 'many', triangles for 'meshes', instances for 'forest', lights for 'lights' (default: 1000)\n"
+			"  --scene-file <f>    load a text or compiled scene instead of a built-in one\n"
+			"  --no-scene-cache    parse text scenes every time instead of using <f>.bin\n"
+			"  --save-scene <f>    write the scene as text\n"
+			"  --compile-scene <f> write the scene in compiled binary form\n"
+			"  --write-chunks <f>  write the scene's spheres and boxes in chunks for --chunks\n"
+			"  --chunk-size <n>    primitives per chunk for --write-chunks (default: 4096)\n"
+			"  --chunks <f>        stream the scene from a chunked file, paging chunks in as rays reach them\n"
+			"  --chunk-budget <MB> memory for resident chunks with --chunks (default: 64)\n"
+			"  --bench-load <dir>  time text against binary scene loading up to --count primitives, no rendering\n"
+			"  --mesh <file>       import an .obj or .ply mesh into the scene (repeatable)\n"
+			"  --bench-import <dir> time and check OBJ/PLY import of a --count triangle mesh, no rendering\n"
+			"  --bench-edits       time partial against full acceleration updates after edits, no rendering\n"
+			"  --width <px>        image width (default: 1280)\n"
+			"  --height <px>       image height (default: 720)\n"
+			"  --frames <n>        accumulated frames to time (default: 100)\n"
+			"  --warmup <n>        untimed frames rendered first (default: 0)\n"
+			"  --no-bvh            test every primitive instead of traversing the BVH\n"
+			"  --tile-size <px>    edge length of render tiles (default: 32)\n"
+			"  --workers <n>       render threads, 0 for one per hardware thread (default: 0)\n"
+			"  --tile-timings <f>  write the last frame's per-tile timings as CSV\n"
+			"  --profile           report per-stage times and ray/primitive test counters\n"
+			"  --trace <f>         also write the timed frames as a Chrome trace (implies --profile)\n"
+			"  --resolve-interval <n>  convert accumulation to RGBA every n frames, 0 for only the last (default: 1)\n"
+			"  --half              accumulate in FP16 instead of FP32\n"
+			"  --denoise           filter the image on every resolve, guided by albedo, normals and depth\n"
+			"  --denoise-iterations <n>  a-trous filter passes, each doubling the radius (default: 4)\n"
+			"  --target-noise <e>  stop sampling tiles whose per-pixel standard error is below e (default: 0, off)\n"
+			"  --min-samples <n>   samples before a tile may converge (default: 16)\n"
+			"  --max-samples <n>   per-pixel sample limit, 0 for none (default: 0)\n"
+			"  --until-converged   stop before --frames once every tile has converged\n"
+			"  --convergence-mask  write the convergence debug view instead of the image\n"
+			"  --sampler <name>    sobol | pcg (default: sobol)\n"
+			"  --integrator <name> megakernel | wavefront (default: megakernel)\n"
+			"  --no-jitter         sample every pixel at its corner\n"
+			"  --max-bounces <n>   path length, 1 to 8 (default: 4)\n"
+			"  --no-shadows        light every hit without tracing shadow rays\n"
+			"  --generic-integrator  use the megakernel variant that tests every primitive type\n"
+			"  --bench-integrators time specialized against generic megakernel variants per scene and setting\n"
+			"  --ortho <height>    orthographic camera showing <height> world units vertically\n"
+			"  --lens-radius <r>   thin lens depth of field (default: 0, pinhole)\n"
+			"  --orbit <degrees>   turn the camera around the vertical axis through the origin before every frame after the first\n"
+			"  --orbit-frames <n>  stop turning after n frames, 0 for never (default: 0)\n"
+			"  --reproject         carry samples over camera moves instead of restarting accumulation\n"
+			"  --frame-budget <ms> render at a lower resolution while the camera turns to stay within ms per frame, upscaled for --output\n"
+			"  --render-thread     render on a separate thread fed by a 60 Hz loop, as the app does; --orbit turns per tick\n"
+			"  --focus-distance <d> distance of the plane in focus (default: 6)\n"
+			"  --isa <name>        scalar | sse | avx2 | avx512 (default: best supported)\n"
+			"  --bench-kernels     time and cross-check the leaf intersection kernels, no rendering\n"
+			"  --rays <n>          rays for --bench-kernels (default: 20000)\n"
+			"  --regression [dir]  check the intersection routines, and the canonical scenes against golden images\n"
+			"                      and frame time budgets in dir (default: RayTracingHeadless/golden), no other rendering\n"
+			"  --update-golden     record every golden image and budget of --regression again\n"
+			"  --update-budgets    record only the frame time budgets of --regression, for this machine\n"
+			"  --budget-tolerance <f>  slowdown over a recorded budget --regression allows (default: 0.25)\n"
+			"  --output <file>     write the final image as PPM\n"
+			"  --offline <file>    render band by band of tiles to an .exr (float) or .png, no benchmark\n"
+			"  --samples <n>       samples per pixel for --offline (default: 64)\n"
+			"  --resume            continue an interrupted --offline render from its checkpoint\n"
+			"  --distribute <addr> render --offline with workers connecting to unix:<path> or [host]:<port>\n"
+			"  --spawn-workers <n> start n local workers for --distribute (default: 0)\n"
+			"  --lease-samples <n> samples per leased tile, 0 for all (default: 0)\n"
+			"  --lease-timeout <s> seconds before a lease is also given to another worker (default: 30)\n"
+			"  --worker <addr>     render leases for the coordinator at addr, using --workers threads\n"
+			"  --fail-after <n>    as a worker, exit after n leases (with --distribute, the first spawned one)\n"
+			"  --stall-after <n>   as a worker, stop responding after n leases\n"
+			"  --json <file>       write the report to a file instead of stdout\n");
+	}
+
+	bool Parse(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char* arg = argv[i];
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+			auto needsValue = [&]()
+			{
+				if (value)
+				{
+					i++;
+					return true;
+				}
+				std::fprintf(stderr, "Missing value for %s\n", arg);
+				return false;
+			};
+
+			if (std::strcmp(arg, "--scene") == 0)
+			{
+				if (!needsValue()) return false;
+				options.SceneName = value;
+			}
+			else if (std::strcmp(arg, "--count") == 0)
+			{
+				if (!needsValue()) return false;
+				options.PrimitiveCount = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--width") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Width = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--height") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Height = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--frames") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Frames = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--warmup") == 0)
+			{
+				if (!needsValue()) return false;
+				options.WarmupFrames = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--scene-file") == 0)
+			{
+				if (!needsValue()) return false;
+				options.SceneFilePath = value;
+			}
+			else if (std::strcmp(arg, "--no-scene-cache") == 0)
+			{
+				options.UseSceneCache = false;
+			}
+			else if (std::strcmp(arg, "--save-scene") == 0)
+			{
+				if (!needsValue()) return false;
+				options.SaveScenePath = value;
+			}
+			else if (std::strcmp(arg, "--compile-scene") == 0)
+			{
+				if (!needsValue()) return false;
+				options.CompileScenePath = value;
+			}
+			else if (std::strcmp(arg, "--write-chunks") == 0)
+			{
+				if (!needsValue()) return false;
+				options.WriteChunksPath = value;
+			}
+			else if (std::strcmp(arg, "--chunk-size") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ChunkSize = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--chunks") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ChunksPath = value;
+			}
+			else if (std::strcmp(arg, "--chunk-budget") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ChunkBudgetMB = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--bench-load") == 0)
+			{
+				if (!needsValue()) return false;
+				options.BenchmarkLoad = true;
+				options.LoadBenchmarkDirectory = value;
+			}
+			else if (std::strcmp(arg, "--mesh") == 0)
+			{
+				if (!needsValue()) return false;
+				options.MeshPaths.push_back(value);
+			}
+			else if (std::strcmp(arg, "--bench-import") == 0)
+			{
+				if (!needsValue()) return false;
+				options.BenchmarkImport = true;
+				options.ImportBenchmarkDirectory = value;
+			}
+			else if (std::strcmp(arg, "--no-bvh") == 0)
+			{
+				options.UseBVH = false;
+			}
+			else if (std::strcmp(arg, "--tile-size") == 0)
+			{
+				if (!needsValue()) return false;
+				options.TileSize = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--workers") == 0)
+			{
+				if (!needsValue()) return false;
+				options.WorkerCount = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--denoise") == 0)
+			{
+				options.Denoise = true;
+			}
+			else if (std::strcmp(arg, "--denoise-iterations") == 0)
+			{
+				if (!needsValue()) return false;
+				options.DenoiseIterations = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--resolve-interval") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ResolveInterval = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--half") == 0)
+			{
+				options.HalfPrecision = true;
+			}
+			else if (std::strcmp(arg, "--target-noise") == 0)
+			{
+				if (!needsValue()) return false;
+				options.TargetNoise = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--min-samples") == 0)
+			{
+				if (!needsValue()) return false;
+				options.MinSamples = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--max-samples") == 0)
+			{
+				if (!needsValue()) return false;
+				options.MaxSamples = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--until-converged") == 0)
+			{
+				options.UntilConverged = true;
+			}
+			else if (std::strcmp(arg, "--convergence-mask") == 0)
+			{
+				options.ConvergenceMask = true;
+			}
+			else if (std::strcmp(arg, "--offline") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OfflinePath = value;
+			}
+			else if (std::strcmp(arg, "--samples") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OfflineSamples = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--resume") == 0)
+			{
+				options.Resume = true;
+			}
+			else if (std::strcmp(arg, "--distribute") == 0)
+			{
+				if (!needsValue()) return false;
+				options.DistributeAddress = value;
+			}
+			else if (std::strcmp(arg, "--spawn-workers") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Coordinator.SpawnWorkers = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--lease-samples") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Coordinator.LeaseSamples = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--lease-timeout") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Coordinator.LeaseTimeout = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--worker") == 0)
+			{
+				if (!needsValue()) return false;
+				options.WorkerAddress = value;
+			}
+			else if (std::strcmp(arg, "--fail-after") == 0)
+			{
+				if (!needsValue()) return false;
+				options.FailAfter = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--stall-after") == 0)
+			{
+				if (!needsValue()) return false;
+				options.StallAfter = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--profile") == 0)
+			{
+				options.Profile = true;
+			}
+			else if (std::strcmp(arg, "--trace") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Profile = true;
+				options.TracePath = value;
+			}
+			else if (std::strcmp(arg, "--tile-timings") == 0)
+			{
+				if (!needsValue()) return false;
+				options.TileTimingPath = value;
+			}
+			else if (std::strcmp(arg, "--sampler") == 0)
+			{
+				if (!needsValue()) return false;
+				if (!SelectSampler(value, options.Sampling)) return false;
+			}
+			else if (std::strcmp(arg, "--integrator") == 0)
+			{
+				if (!needsValue()) return false;
+				if (!SelectIntegrator(value, options.Integrator)) return false;
+			}
+			else if (std::strcmp(arg, "--no-jitter") == 0)
+			{
+				options.Jitter = false;
+			}
+			else if (std::strcmp(arg, "--max-bounces") == 0)
+			{
+				if (!needsValue()) return false;
+				options.MaxBounces = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--no-shadows") == 0)
+			{
+				options.Shadows = false;
+			}
+			else if (std::strcmp(arg, "--generic-integrator") == 0)
+			{
+				options.Specialize = false;
+			}
+			else if (std::strcmp(arg, "--bench-integrators") == 0)
+			{
+				options.BenchmarkIntegrators = true;
+			}
+			else if (std::strcmp(arg, "--ortho") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OrthographicHeight = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--lens-radius") == 0)
+			{
+				if (!needsValue()) return false;
+				options.LensRadius = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--focus-distance") == 0)
+			{
+				if (!needsValue()) return false;
+				options.FocusDistance = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--orbit") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OrbitDegrees = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--orbit-frames") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OrbitFrames = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--reproject") == 0)
+			{
+				options.Reproject = true;
+			}
+			else if (std::strcmp(arg, "--render-thread") == 0)
+			{
+				options.UseRenderThread = true;
+			}
+			else if (std::strcmp(arg, "--frame-budget") == 0)
+			{
+				if (!needsValue()) return false;
+				options.FrameBudgetMs = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--isa") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ISAName = value;
+			}
+			else if (std::strcmp(arg, "--bench-kernels") == 0)
+			{
+				options.BenchmarkKernels = true;
+			}
+			else if (std::strcmp(arg, "--bench-edits") == 0)
+			{
+				options.BenchmarkEdits = true;
+			}
+			else if (std::strcmp(arg, "--regression") == 0)
+			{
+				// The directory is optional
+				options.CheckRegression = true;
+				if (value && value[0] != '-')
+				{
+					options.RegressionDirectory = value;
+					i++;
+				}
+			}
+			else if (std::strcmp(arg, "--update-golden") == 0)
+			{
+				options.Regression.UpdateGolden = true;
+			}
+			else if (std::strcmp(arg, "--update-budgets") == 0)
+			{
+				options.Regression.UpdateBudgets = true;
+			}
+			else if (std::strcmp(arg, "--budget-tolerance") == 0)
+			{
+				if (!needsValue()) return false;
+				options.Regression.BudgetTolerance = std::strtof(value, nullptr);
+			}
+			else if (std::strcmp(arg, "--rays") == 0)
+			{
+				if (!needsValue()) return false;
+				options.KernelRays = (uint32_t)std::strtoul(value, nullptr, 10);
+			}
+			else if (std::strcmp(arg, "--output") == 0)
+			{
+				if (!needsValue()) return false;
+				options.OutputPath = value;
+			}
+			else if (std::strcmp(arg, "--json") == 0)
+			{
+				if (!needsValue()) return false;
+				options.ReportPath = value;
+			}
+			else
+			{
+				std::fprintf(stderr, "Unknown option %s\n", arg);
+				return false;
+			}
+		}
+
+		if (options.Width == 0 || options.Height == 0 || options.Frames == 0 || options.TileSize == 0)
+		{
+			std::fprintf(stderr, "Width, height, frames and tile size must be non-zero\n");
+			return false;
+		}
+
+		return true;
+	}
+}
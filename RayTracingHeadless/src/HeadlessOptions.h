@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Renderer.h"
+#include "RegressionSuite.h"
+#include "DistributedRender.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions
+{
+	std::string SceneName = "default";
+	std::string SceneFilePath;  // Overrides SceneName if set
+	bool UseSceneCache = true;
+	std::string SaveScenePath;    // Text, skipped if empty
+	std::string CompileScenePath; // Binary, skipped if empty
+	std::string WriteChunksPath;  // Chunked for streaming, skipped if empty
+	uint32_t ChunkSize = 4096;    // Primitives per chunk
+	std::string ChunksPath;       // Streams the scene from this chunked file if set
+	float ChunkBudgetMB = 64.0f;  // Resident chunk geometry
+	std::vector<std::string> MeshPaths; // Imported and added to the scene
+	uint32_t PrimitiveCount = 1000;
+
+	uint32_t Width = 1280, Height = 720;
+	uint32_t Frames = 100;
+	uint32_t WarmupFrames = 0;
+
+	bool UseBVH = true;
+	uint32_t TileSize = 32;
+	uint32_t WorkerCount = 0;
+	uint32_t ResolveInterval = 1;
+	bool HalfPrecision = false;
+	bool Denoise = false;
+	uint32_t DenoiseIterations = 4;
+
+	// Adaptive sampling is off by default so frames stay comparable across runs
+	float TargetNoise = 0.0f;
+	uint32_t MinSamples = 16;
+	uint32_t MaxSamples = 0;
+	bool UntilConverged = false;
+	bool ConvergenceMask = false;
+	SamplerType Sampling = SamplerType::Sobol;
+	IntegratorType Integrator = IntegratorType::Megakernel;
+	bool Jitter = true;
+	uint32_t MaxBounces = 4;
+	bool Shadows = true;
+	bool Specialize = true;
+	float OrthographicHeight = 0.0f; // Perspective if 0
+	float LensRadius = 0.0f;
+	float FocusDistance = 6.0f;
+	bool Reproject = false;
+	float OrbitDegrees = 0.0f; // Camera turn around the vertical axis through the origin per frame
+	uint32_t OrbitFrames = 0;  // Frames the camera keeps turning for, 0 for all of them
+	float FrameBudgetMs = 0.0f; // Lowers the resolution of frames while the camera turns, 0 for off
+	bool UseRenderThread = false; // Renders on a RenderThread driven like the app's UI loop
+	std::string ISAName;        // Best supported if empty
+
+	bool BenchmarkKernels = false;
+	bool BenchmarkLoad = false;
+	std::string LoadBenchmarkDirectory = "scene-load-benchmark";
+	bool BenchmarkImport = false;
+	bool BenchmarkEdits = false;
+	bool BenchmarkIntegrators = false;
+	std::string ImportBenchmarkDirectory = "mesh-import-benchmark";
+	uint32_t KernelRays = 20000;
+	bool CheckRegression = false;
+	std::string RegressionDirectory; // Golden images and budgets, the committed ones if empty
+	RegressionSuite::Settings Regression;
+
+	std::string OfflinePath;    // Renders tile by tile straight to this .exr or .png instead of benchmarking
+	uint32_t OfflineSamples = 64;
+	bool Resume = false;
+	std::string DistributeAddress; // Renders --offline with worker processes connecting here
+	DistributedRender::CoordinatorSettings Coordinator;
+	std::string WorkerAddress;     // Serves the coordinator there instead of rendering anything itself
+	uint32_t FailAfter = 0, StallAfter = 0;
+
+	std::string OutputPath;     // PPM, skipped if empty
+	std::string ReportPath;     // JSON, stdout if empty
+	std::string TileTimingPath; // CSV of the last frame's tiles, skipped if empty
+	bool Profile = false;       // Counters and stage times in the report
+	std::string TracePath;      // Chrome trace of the timed frames, skipped if empty
+};
+
+namespace HeadlessOptions
+{
+	// Fills options from the command line. Returns false, after saying why on stderr, if an
+	// option is unknown, lacks its value or names something that does not exist.
+	bool Parse(int argc, char** argv, BenchmarkOptions& options);
+	void PrintUsage();
+}
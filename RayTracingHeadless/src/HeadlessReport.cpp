@@ -0,0 +1,204 @@
+#include "HeadlessReport.h"
+#include "IntersectionKernels.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace HeadlessReport
+{
+	std::string Write(const BenchmarkOptions& options, const SceneInfo& sceneInfo, const std::vector<FrameTiming>& frames,
+		const TileStatistics& tileStatistics, size_t accumulationBytes, float convergedFraction, const ChunkCache::Stats* chunkStats,
+		uint64_t deferredSamples, const Profiler::Stats* profile)
+	{
+		std::vector<float> sorted;
+		double totalMs = 0.0, resolveMs = 0.0;
+		uint32_t resolves = 0;
+		uint64_t totalRays = 0, totalSamples = 0, reprojectedPixels = 0, movedPixels = 0;
+		uint32_t movingFrames = 0, framesInBudget = 0;
+		for (const FrameTiming& frame : frames)
+		{
+			if (frame.Moving)
+			{
+				reprojectedPixels += frame.ReprojectedPixels;
+				movedPixels += frame.Pixels;
+				movingFrames++;
+				framesInBudget += frame.Milliseconds <= options.FrameBudgetMs;
+			}
+			sorted.push_back(frame.Milliseconds);
+			totalMs += frame.Milliseconds;
+			totalRays += frame.Rays;
+			totalSamples += frame.Samples;
+			if (frame.ResolveMilliseconds > 0.0f)
+			{
+				resolveMs += frame.ResolveMilliseconds;
+				resolves++;
+			}
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		double seconds = totalMs / 1000.0;
+		double samples = (double)totalSamples;
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"scene\": \"" << (!options.ChunksPath.empty() ? options.ChunksPath : !options.SceneFilePath.empty() ? options.SceneFilePath : options.SceneName) << "\",\n";
+		json << "  \"scene_load_ms\": " << sceneInfo.LoadMilliseconds << ",\n";
+		json << "  \"primitives\": " << sceneInfo.Primitives << ",\n";
+		json << "  \"triangles\": " << sceneInfo.Triangles << ",\n";
+		json << "  \"mesh_bytes\": " << sceneInfo.MeshBytes << ",\n";
+		json << "  \"prototypes\": " << sceneInfo.Prototypes << ",\n";
+		json << "  \"instances\": " << sceneInfo.Instances << ",\n";
+		json << "  \"prototype_bytes\": " << sceneInfo.PrototypeBytes << ",\n";
+		json << "  \"instance_bytes\": " << sceneInfo.InstanceBytes << ",\n";
+		json << "  \"instanced_primitives\": " << sceneInfo.InstancedPrimitives << ",\n";
+		json << "  \"instanced_triangles\": " << sceneInfo.InstancedTriangles << ",\n";
+		json << "  \"lights\": " << sceneInfo.Lights << ",\n";
+		json << "  \"light_tree_bytes\": " << sceneInfo.LightTreeBytes << ",\n";
+		json << "  \"bvh\": " << (options.UseBVH ? "true" : "false") << ",\n";
+		json << "  \"bvh_nodes\": " << sceneInfo.BVHNodes << ",\n";
+		json << "  \"bvh_build_ms\": " << sceneInfo.BuildMilliseconds << ",\n";
+		json << "  \"camera\": \"" << (options.OrthographicHeight > 0.0f ? "orthographic" : "perspective") << "\",\n";
+		json << "  \"lens_radius\": " << options.LensRadius << ",\n";
+		json << "  \"orbit_degrees\": " << options.OrbitDegrees << ",\n";
+		json << "  \"reproject\": " << (options.Reproject ? "true" : "false") << ",\n";
+		// Over the frames after a move, the share of pixels that kept their samples
+		json << "  \"reprojected_fraction\": " << (movedPixels > 0 ? reprojectedPixels / (double)movedPixels : 0.0) << ",\n";
+		json << "  \"frame_budget_ms\": " << options.FrameBudgetMs << ",\n";
+		// Share of the frames after a move that took no longer than the budget
+		json << "  \"frames_in_budget\": " << (movingFrames > 0 ? framesInBudget / (double)movingFrames : 0.0) << ",\n";
+		json << "  \"sampler\": \"" << Sampler::GetName(options.Sampling) << "\",\n";
+		json << "  \"integrator\": \"" << Renderer::GetIntegratorName(options.Integrator) << "\",\n";
+		json << "  \"max_bounces\": " << options.MaxBounces << ",\n";
+		json << "  \"shadows\": " << (options.Shadows ? "true" : "false") << ",\n";
+		json << "  \"specialized\": " << (options.Specialize ? "true" : "false") << ",\n";
+		json << "  \"isa\": \"" << Kernels::GetName(Kernels::GetActiveISA()) << "\",\n";
+		json << "  \"width\": " << options.Width << ",\n";
+		json << "  \"height\": " << options.Height << ",\n";
+		json << "  \"frames\": " << frames.size() << ",\n";
+		json << "  \"total_ms\": " << totalMs << ",\n";
+		json << "  \"mean_ms\": " << totalMs / frames.size() << ",\n";
+		json << "  \"min_ms\": " << sorted.front() << ",\n";
+		json << "  \"median_ms\": " << sorted[sorted.size() / 2] << ",\n";
+		json << "  \"max_ms\": " << sorted.back() << ",\n";
+		json << "  \"rays\": " << totalRays << ",\n";
+		json << "  \"rays_per_sec\": " << (seconds > 0.0 ? totalRays / seconds : 0.0) << ",\n";
+		json << "  \"samples\": " << totalSamples << ",\n";
+		json << "  \"samples_per_pixel\": " << samples / ((double)options.Width * options.Height) << ",\n";
+		json << "  \"target_noise\": " << options.TargetNoise << ",\n";
+		json << "  \"converged_tiles\": " << convergedFraction << ",\n";
+		json << "  \"samples_per_sec\": " << (seconds > 0.0 ? samples / seconds : 0.0) << ",\n";
+		json << "  \"accumulation\": \"" << (options.HalfPrecision ? "fp16" : "fp32") << "\",\n";
+		json << "  \"accumulation_bytes\": " << accumulationBytes << ",\n";
+		json << "  \"resolve_interval\": " << options.ResolveInterval << ",\n";
+		json << "  \"denoise\": " << (options.Denoise ? "true" : "false") << ",\n";
+		json << "  \"denoise_iterations\": " << options.DenoiseIterations << ",\n";
+		json << "  \"resolves\": " << resolves << ",\n";
+		json << "  \"resolve_ms_total\": " << resolveMs << ",\n";
+		json << "  \"resolve_ms_mean\": " << (resolves ? resolveMs / resolves : 0.0) << ",\n";
+
+		const std::vector<double>& workers = tileStatistics.WorkerMilliseconds;
+		double busiestWorker = workers.empty() ? 0.0 : *std::max_element(workers.begin(), workers.end());
+		double meanWorker = 0.0;
+		for (double worker : workers)
+			meanWorker += worker / workers.size();
+
+		json << "  \"workers\": " << workers.size() << ",\n";
+		json << "  \"tile_size\": " << options.TileSize << ",\n";
+		json << "  \"tiles_per_frame\": " << tileStatistics.TileCount / frames.size() << ",\n";
+		json << "  \"tile_ms_min\": " << (tileStatistics.TileCount ? tileStatistics.MinTileMilliseconds : 0.0f) << ",\n";
+		json << "  \"tile_ms_mean\": " << (tileStatistics.TileCount ? tileStatistics.TotalTileMilliseconds / tileStatistics.TileCount : 0.0) << ",\n";
+		json << "  \"tile_ms_max\": " << tileStatistics.MaxTileMilliseconds << ",\n";
+		json << "  \"worker_busy_ms\": [";
+		for (size_t i = 0; i < workers.size(); i++)
+			json << (i ? ", " : "") << workers[i];
+		json << "],\n";
+		// 1.0 means every worker was busy for the same time
+		json << "  \"worker_imbalance\": " << (meanWorker > 0.0 ? busiestWorker / meanWorker : 1.0) << ",\n";
+		if (chunkStats)
+		{
+			uint64_t lookups = chunkStats->Hits + chunkStats->Misses;
+			json << "  \"chunk_cache\": {\n";
+			json << "    \"chunks\": " << chunkStats->ChunkCount << ",\n";
+			json << "    \"resident_chunks\": " << chunkStats->ResidentChunks << ",\n";
+			json << "    \"budget_bytes\": " << chunkStats->MemoryBudget << ",\n";
+			json << "    \"resident_bytes\": " << chunkStats->ResidentBytes << ",\n";
+			json << "    \"peak_resident_bytes\": " << chunkStats->PeakResidentBytes << ",\n";
+			json << "    \"hits\": " << chunkStats->Hits << ",\n";
+			json << "    \"misses\": " << chunkStats->Misses << ",\n";
+			json << "    \"hit_rate\": " << (lookups ? chunkStats->Hits / (double)lookups : 1.0) << ",\n";
+			json << "    \"loads\": " << chunkStats->Loads << ",\n";
+			json << "    \"evictions\": " << chunkStats->Evictions << ",\n";
+			json << "    \"failed_loads\": " << chunkStats->FailedLoads << ",\n";
+			json << "    \"load_ms\": " << chunkStats->LoadMilliseconds << ",\n";
+			// Still waiting for their chunks when the run ended
+			json << "    \"deferred_samples\": " << deferredSamples << "\n";
+			json << "  },\n";
+		}
+		if (profile)
+		{
+			// Stage times are summed over threads, so they compare against worker_busy_ms
+			json << "  \"profile\": {\n";
+			json << "    \"counters\": {";
+			for (uint32_t i = 0; i < Profiler::CounterCount; i++)
+				json << (i ? ", " : " ") << "\"" << Profiler::GetName((Profiler::Counter)i) << "\": " << profile->Counters[i];
+			json << " },\n";
+			double paths = (double)std::max(profile->Get(Profiler::Counter::Paths), (uint64_t)1);
+			json << "    \"per_path\": { ";
+			for (Profiler::Counter counter : { Profiler::Counter::Rays, Profiler::Counter::ShadowRays, Profiler::Counter::Bounces })
+				json << (counter == Profiler::Counter::Rays ? "" : ", ") << "\"" << Profiler::GetName(counter) << "\": " << profile->Get(counter) / paths;
+			json << " },\n";
+			json << "    \"stage_ms\": {";
+			for (uint32_t i = 0; i < Profiler::StageCount; i++)
+				json << (i ? ", " : " ") << "\"" << Profiler::GetName((Profiler::Stage)i) << "\": " << profile->GetMilliseconds((Profiler::Stage)i);
+			json << " }\n";
+			json << "  },\n";
+		}
+		json << "  \"frame_ms\": [";
+		for (size_t i = 0; i < frames.size(); i++)
+			json << (i ? ", " : "") << frames[i].Milliseconds;
+		json << "]";
+		if (options.FrameBudgetMs > 0.0f)
+		{
+			json << ",\n  \"frame_pixels\": [";
+			for (size_t i = 0; i < frames.size(); i++)
+				json << (i ? ", " : "") << frames[i].Pixels;
+			json << "]";
+		}
+		json << "\n";
+		json << "}\n";
+
+		return json.str();
+	}
+
+	bool WriteTileTimings(const std::string& path, const std::vector<Renderer::TileTiming>& tiles)
+	{
+		std::ofstream stream(path);
+		stream << "order,x,y,width,height,sampled,worker,ms\n";
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			const Renderer::TileTiming& tile = tiles[i];
+			stream << i << "," << tile.X << "," << tile.Y << "," << tile.Width << "," << tile.Height << "," << tile.Sampled << ","
+				<< tile.Worker << "," << tile.Milliseconds << "\n";
+		}
+		return (bool)stream;
+	}
+
+	bool Output(const BenchmarkOptions& options, const std::string& report)
+	{
+		if (options.ReportPath.empty())
+		{
+			std::fputs(report.c_str(), stdout);
+			return true;
+		}
+
+		std::ofstream stream(options.ReportPath);
+		stream << report;
+		if (!stream)
+		{
+			std::fprintf(stderr, "Failed to write %s\n", options.ReportPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "HeadlessOptions.h"
+#include "ChunkCache.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+struct FrameTiming
+{
+	float Milliseconds;        // Sampling plus resolve
+	float ResolveMilliseconds; // 0 on frames that were not resolved
+	uint64_t Rays;
+	uint64_t Samples;
+	uint32_t ReprojectedPixels; // Carried over by the camera move before the frame
+	uint32_t Pixels;            // Rendered, fewer than the image's when the frame budget scaled it down
+	bool Moving;                // The camera moved before the frame
+};
+
+// Per-worker busy time summed over all timed frames, plus the spread of individual tiles
+struct TileStatistics
+{
+	std::vector<double> WorkerMilliseconds;
+	float MinTileMilliseconds = std::numeric_limits<float>::max();
+	float MaxTileMilliseconds = 0.0f;
+	double TotalTileMilliseconds = 0.0;
+	uint64_t TileCount = 0;
+
+	void Add(const std::vector<Renderer::TileTiming>& tiles, uint32_t workerCount)
+	{
+		WorkerMilliseconds.resize(workerCount, 0.0);
+		for (const Renderer::TileTiming& tile : tiles)
+		{
+			if (!tile.Sampled)
+				continue;
+
+			WorkerMilliseconds[tile.Worker] += tile.Milliseconds;
+			MinTileMilliseconds = std::min(MinTileMilliseconds, tile.Milliseconds);
+			MaxTileMilliseconds = std::max(MaxTileMilliseconds, tile.Milliseconds);
+			TotalTileMilliseconds += tile.Milliseconds;
+			TileCount++;
+		}
+	}
+};
+
+struct SceneInfo
+{
+	uint32_t Primitives = 0;
+	uint32_t BVHNodes = 0;
+	float BuildMilliseconds = 0.0f;
+	float LoadMilliseconds = 0.0f; // Including mesh imports
+	uint64_t Triangles = 0;
+	size_t MeshBytes = 0;
+	uint32_t Prototypes = 0;
+	uint32_t Instances = 0;
+	size_t PrototypeBytes = 0;
+	size_t InstanceBytes = 0;
+	uint64_t InstancedPrimitives = 0; // Counting every instance's copy, as rendered
+	uint64_t InstancedTriangles = 0;
+	uint32_t Lights = 0;          // Including emissive spheres
+	size_t LightTreeBytes = 0;
+};
+
+namespace HeadlessReport
+{
+	// The JSON report of a timed run: the scene, the options that shape the frames, frame and
+	// tile times, and the chunk cache's and profiler's statistics if they are not null
+	std::string Write(const BenchmarkOptions& options, const SceneInfo& sceneInfo, const std::vector<FrameTiming>& frames,
+		const TileStatistics& tileStatistics, size_t accumulationBytes, float convergedFraction, const ChunkCache::Stats* chunkStats,
+		uint64_t deferredSamples, const Profiler::Stats* profile);
+
+	// Writes a report to --json, or stdout if there is none
+	bool Output(const BenchmarkOptions& options, const std::string& report);
+
+	// One CSV row per tile, in render order
+	bool WriteTileTimings(const std::string& path, const std::vector<Renderer::TileTiming>& tiles);
+}
@@ -0,0 +1,53 @@
+#include "ImageWriter.h"
+
+#include <fstream>
+#include <vector>
+
+namespace ImageWriter
+{
+	bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height)
+	{
+		std::ofstream stream(path, std::ios::binary);
+		if (!stream)
+			return false;
+
+		stream << "P6\n" << width << " " << height << "\n255\n";
+
+		std::vector<uint8_t> row(width * 3);
+		for (uint32_t y = height; y-- > 0;)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint32_t pixel = pixels[x + y * width];
+				row[x * 3 + 0] = (uint8_t)(pixel & 0xff);
+				row[x * 3 + 1] = (uint8_t)((pixel >> 8) & 0xff);
+				row[x * 3 + 2] = (uint8_t)((pixel >> 16) & 0xff);
+			}
+			stream.write((const char*)row.data(), row.size());
+		}
+
+		return (bool)stream;
+	}
+
+	bool ReadPPM(const std::string& path, std::vector<uint32_t>& pixels, uint32_t& width, uint32_t& height)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		std::string magic;
+		uint32_t maxValue = 0;
+		if (!(stream >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width == 0 || height == 0)
+			return false;
+		stream.get(); // The single whitespace before the pixels
+
+		pixels.resize((size_t)width * height);
+		std::vector<uint8_t> row(width * 3);
+		for (uint32_t y = height; y-- > 0;)
+		{
+			if (!stream.read((char*)row.data(), row.size()))
+				return false;
+			for (uint32_t x = 0; x < width; x++)
+				pixels[x + y * width] = 0xff000000 | (uint32_t)row[x * 3] | ((uint32_t)row[x * 3 + 1] << 8) | ((uint32_t)row[x * 3 + 2] << 16);
+		}
+
+		return true;
+	}
+}
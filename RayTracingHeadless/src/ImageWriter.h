@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ImageWriter
+{
+	// Writes RGBA8 pixels (as produced by Renderer, bottom row first) as a binary PPM.
+	// The alpha channel is dropped and rows are flipped so the file reads top-down.
+	bool WritePPM(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height);
+	// Reads a binary PPM with 8-bit channels back into RGBA8 pixels, bottom row first, opaque
+	bool ReadPPM(const std::string& path, std::vector<uint32_t>& pixels, uint32_t& width, uint32_t& height);
+}
@@ -0,0 +1,109 @@
+#include "ImportBenchmark.h"
+
+#include "MeshImporter.h"
+#include "Scenes.h"
+
+#include "Walnut/Timer.h"
+
+#include <filesystem>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace Utils
+{
+	// Same counts, same bounds and, for every vertex, the same position up to the text precision
+	static bool IsSameMesh(const Mesh& imported, const Mesh& source)
+	{
+		if (imported.Positions.size() != source.Positions.size() || imported.GetTriangleCount() != source.GetTriangleCount() ||
+			imported.Normals.size() != source.Normals.size())
+			return false;
+
+		for (size_t i = 0; i < source.Positions.size(); i++)
+		{
+			if (glm::length(imported.Positions[i] - source.Positions[i]) > 1e-5f)
+				return false;
+		}
+
+		AABB importedBounds = imported.GetBounds(), sourceBounds = source.GetBounds();
+		return glm::length(importedBounds.Min - sourceBounds.Min) < 1e-5f && glm::length(importedBounds.Max - sourceBounds.Max) < 1e-5f;
+	}
+}
+
+namespace ImportBenchmark
+{
+	bool Run(uint32_t triangleCount, uint32_t workerCount, const std::string& directory, std::string& report)
+	{
+		if (workerCount == 0)
+			workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+		std::error_code errorCode;
+		std::filesystem::create_directories(directory, errorCode);
+
+		Mesh source = Scenes::CreateSphereMesh(triangleCount, glm::vec3(0.0f), 1.0f);
+		source.BuildAcceleration();
+
+		struct Format
+		{
+			const char* Name;
+			std::string Path;
+			bool Written;
+		};
+		std::string stem = (std::filesystem::path(directory) / ("sphere_" + std::to_string(source.GetTriangleCount()))).string();
+		Format formats[] = {
+			{ "obj", stem + ".obj", MeshImporter::SaveOBJ(stem + ".obj", source) },
+			{ "ply_binary", stem + ".ply", MeshImporter::SavePLY(stem + ".ply", source, true) },
+			{ "ply_ascii", stem + "_ascii.ply", MeshImporter::SavePLY(stem + "_ascii.ply", source, false) },
+		};
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"triangles\": " << source.GetTriangleCount() << ",\n";
+		json << "  \"vertices\": " << source.Positions.size() << ",\n";
+		json << "  \"workers\": " << workerCount << ",\n";
+		json << "  \"budget_bytes_per_triangle\": " << Mesh::MemoryBudgetPerTriangle << ",\n";
+		json << "  \"formats\": [\n";
+
+		bool success = true;
+		for (size_t i = 0; i < std::size(formats); i++)
+		{
+			const Format& format = formats[i];
+			success = success && format.Written;
+
+			Mesh single, parallel;
+			std::string error;
+
+			Walnut::Timer singleTimer;
+			bool singleLoaded = format.Written && MeshImporter::Load(format.Path, single, error, 1);
+			float singleMilliseconds = singleTimer.ElapsedMillis();
+
+			Walnut::Timer parallelTimer;
+			bool parallelLoaded = format.Written && MeshImporter::Load(format.Path, parallel, error, workerCount);
+			float parallelMilliseconds = parallelTimer.ElapsedMillis();
+
+			bool matches = singleLoaded && parallelLoaded && Utils::IsSameMesh(single, source) && Utils::IsSameMesh(parallel, source);
+			double bytesPerTriangle = parallelLoaded ? (double)parallel.GetMemoryUsage() / parallel.GetTriangleCount() : 0.0;
+			bool withinBudget = bytesPerTriangle <= Mesh::MemoryBudgetPerTriangle;
+			success = success && matches && withinBudget;
+
+			json << (i ? ",\n" : "");
+			json << "    { \"format\": \"" << format.Name << "\""
+				<< ", \"file_bytes\": " << std::filesystem::file_size(format.Path, errorCode)
+				<< ", \"single_ms\": " << singleMilliseconds
+				<< ", \"parallel_ms\": " << parallelMilliseconds
+				<< ", \"speedup\": " << (parallelMilliseconds > 0.0f ? singleMilliseconds / parallelMilliseconds : 0.0f)
+				<< ", \"mesh_bytes\": " << (parallelLoaded ? parallel.GetMemoryUsage() : 0)
+				<< ", \"bytes_per_triangle\": " << bytesPerTriangle
+				<< ", \"matches\": " << (matches ? "true" : "false")
+				<< ", \"within_budget\": " << (withinBudget ? "true" : "false")
+				<< " }";
+		}
+
+		json << "\n  ],\n";
+		json << "  \"success\": " << (success ? "true" : "false") << "\n";
+		json << "}\n";
+
+		report = json.str();
+		return success;
+	}
+}
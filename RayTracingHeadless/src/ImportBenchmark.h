@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace ImportBenchmark
+{
+	// Writes a generated closed mesh of about triangleCount triangles into directory as OBJ,
+	// binary PLY and ascii PLY, then imports each with one worker and with workerCount (0 for
+	// one per hardware thread). Writes a JSON report and returns false if a file could not be
+	// written, an import does not reproduce the mesh, or the imported mesh needs more than
+	// Mesh::MemoryBudgetPerTriangle bytes per triangle.
+	bool Run(uint32_t triangleCount, uint32_t workerCount, const std::string& directory, std::string& report);
+}
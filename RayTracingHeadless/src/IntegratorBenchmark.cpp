@@ -0,0 +1,128 @@
+#include "IntegratorBenchmark.h"
+
+#include "Renderer.h"
+#include "Scenes.h"
+
+#include "Walnut/Timer.h"
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+namespace IntegratorBenchmark
+{
+	struct Variant
+	{
+		const char* Scene;
+		uint32_t MaxBounces;
+		bool Shadows;
+	};
+
+	static std::string GetFeatureNames(uint32_t features)
+	{
+		static const std::pair<uint32_t, const char*> names[] = {
+			{ IntegratorFeatures::Spheres, "spheres" },
+			{ IntegratorFeatures::Boxes, "boxes" },
+			{ IntegratorFeatures::Meshes, "meshes" },
+			{ IntegratorFeatures::Instances, "instances" },
+			{ IntegratorFeatures::Shadows, "shadows" },
+			{ IntegratorFeatures::SceneLights, "scene_lights" }
+		};
+
+		std::string result;
+		for (const auto& [feature, name] : names)
+		{
+			if ((features & feature) == 0)
+				continue;
+			if (!result.empty())
+				result += "+";
+			result += name;
+		}
+		return result;
+	}
+
+	bool Run(uint32_t count, uint32_t width, uint32_t height, uint32_t frames, uint32_t workerCount, std::string& report)
+	{
+		// Every scene at the default settings, then bounce depths (3 has no variant of its own
+		// and reads the setting) and no shadows for one scene with and one without scene lights
+		std::vector<Variant> variants;
+		for (const char* scene : { "spheres", "boxes", "mixed", "many", "meshes", "forest", "lights" })
+			variants.push_back({ scene, 4, true });
+		for (const char* scene : { "mixed", "lights" })
+		{
+			for (uint32_t bounces : { 1u, 2u, 3u, 8u })
+				variants.push_back({ scene, bounces, true });
+			variants.push_back({ scene, 4, false });
+		}
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"count\": " << count << ",\n";
+		json << "  \"width\": " << width << ",\n";
+		json << "  \"height\": " << height << ",\n";
+		json << "  \"frames\": " << frames << ",\n";
+		json << "  \"variants\": [\n";
+
+		bool match = true;
+		std::string sceneName;
+		Scene scene;
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(width, height);
+		for (size_t v = 0; v < variants.size(); v++)
+		{
+			const Variant& variant = variants[v];
+			if (sceneName != variant.Scene)
+			{
+				sceneName = variant.Scene;
+				scene = Scene();
+				Scenes::Create(sceneName, scene, count);
+			}
+
+			// The two renderers take turns frame by frame, so both see the same machine state
+			Renderer renderers[2];
+			double milliseconds[2] = {};
+			for (uint32_t r = 0; r < 2; r++)
+			{
+				Renderer::Settings& settings = renderers[r].GetSettings();
+				settings.WorkerCount = workerCount;
+				settings.TargetNoise = 0.0f;
+				settings.MaxSamples = 0;
+				settings.ResolveInterval = 0;
+				settings.MaxBounces = variant.MaxBounces;
+				settings.Shadows = variant.Shadows;
+				settings.Specialize = r == 0;
+				renderers[r].OnResize(width, height);
+			}
+
+			for (uint32_t frame = 0; frame < frames; frame++)
+			{
+				for (uint32_t r = 0; r < 2; r++)
+				{
+					Walnut::Timer timer;
+					renderers[r].Render(scene, camera);
+					milliseconds[r] += timer.ElapsedMillis();
+				}
+			}
+
+			for (Renderer& renderer : renderers)
+				renderer.Resolve();
+			bool same = std::memcmp(renderers[0].GetImageData(), renderers[1].GetImageData(), (size_t)width * height * sizeof(uint32_t)) == 0;
+			match &= same;
+
+			double specializedMs = milliseconds[0] / frames;
+			double genericMs = milliseconds[1] / frames;
+			json << "    { \"scene\": \"" << variant.Scene << "\", \"max_bounces\": " << variant.MaxBounces
+				<< ", \"shadows\": " << (variant.Shadows ? "true" : "false")
+				<< ", \"features\": \"" << GetFeatureNames(renderers[0].GetIntegratorFeatures()) << "\""
+				<< ", \"specialized_ms\": " << specializedMs << ", \"generic_ms\": " << genericMs
+				<< ", \"speedup\": " << (specializedMs > 0.0 ? genericMs / specializedMs : 0.0)
+				<< ", \"match\": " << (same ? "true" : "false") << " }" << (v + 1 == variants.size() ? "\n" : ",\n");
+		}
+
+		json << "  ],\n";
+		json << "  \"match\": " << (match ? "true" : "false") << "\n";
+		json << "}\n";
+		report = json.str();
+		return match;
+	}
+}
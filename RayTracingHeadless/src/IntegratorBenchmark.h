@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace IntegratorBenchmark
+{
+	// Renders frames of the built-in scenes with the megakernel variant specialized for each
+	// scene, then with the one that tests every primitive type, for the default settings and a
+	// range of bounce depths and without shadows. Writes a JSON report of the mean frame times
+	// and returns false if a specialized variant rendered a different image.
+	bool Run(uint32_t count, uint32_t width, uint32_t height, uint32_t frames, uint32_t workerCount, std::string& report);
+}
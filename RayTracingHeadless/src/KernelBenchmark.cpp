@@ -0,0 +1,115 @@
+#include "KernelBenchmark.h"
+
+#include "IntersectionKernels.h"
+
+#include "Walnut/Timer.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace KernelBenchmark
+{
+	static constexpr uint32_t LeafSize = 16;
+	static constexpr uint32_t LeafCount = 256;
+
+	struct Result
+	{
+		int Lane;
+		float Distance;
+	};
+
+	bool Run(uint32_t rayCount, std::string& report)
+	{
+		std::mt19937 engine(1234);
+		std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+		std::uniform_real_distribution<float> size(0.05f, 1.0f);
+
+		// Mixed leaves of spheres and boxes, with some rays starting inside primitives
+		PrimitiveSoA soa;
+		soa.Resize(LeafSize * LeafCount);
+		for (uint32_t lane = 0; lane < soa.Count; lane++)
+		{
+			glm::vec3 center(position(engine), position(engine), position(engine));
+			if (lane % 3 == 2)
+				soa.SetBox(lane, center, center + glm::vec3(size(engine), size(engine), size(engine)));
+			else
+				soa.SetSphere(lane, center, size(engine));
+		}
+
+		std::vector<Ray> rays(rayCount);
+		for (Ray& ray : rays)
+		{
+			ray.Origin = glm::vec3(position(engine), position(engine), position(engine));
+			ray.Direction = glm::normalize(glm::vec3(position(engine), position(engine), position(engine)) - ray.Origin);
+		}
+
+		auto runKernel = [&](Kernels::LeafIntersectFn kernel, std::vector<Result>& results)
+		{
+			results.resize(rays.size() * LeafCount);
+
+			Walnut::Timer timer;
+			for (size_t r = 0; r < rays.size(); r++)
+			{
+				for (uint32_t leaf = 0; leaf < LeafCount; leaf++)
+				{
+					Result& result = results[r * LeafCount + leaf];
+					result.Lane = kernel(soa, leaf * LeafSize, LeafSize, rays[r], std::numeric_limits<float>::max(), result.Distance);
+				}
+			}
+			return timer.ElapsedMillis();
+		};
+
+		std::vector<Result> reference;
+		runKernel(Kernels::GetLeafIntersect(Kernels::ISA::Scalar), reference);
+
+		bool allMatch = true;
+		double tests = (double)rays.size() * LeafCount * LeafSize;
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"best_isa\": \"" << Kernels::GetName(Kernels::GetBestISA()) << "\",\n";
+		json << "  \"rays\": " << rays.size() << ",\n";
+		json << "  \"primitives\": " << soa.Count << ",\n";
+		json << "  \"kernels\": [\n";
+
+		bool firstEntry = true;
+		for (Kernels::ISA isa : { Kernels::ISA::Scalar, Kernels::ISA::SSE, Kernels::ISA::AVX2, Kernels::ISA::AVX512 })
+		{
+			if (!Kernels::IsSupported(isa))
+				continue;
+
+			std::vector<Result> results;
+			float milliseconds = runKernel(Kernels::GetLeafIntersect(isa), results);
+
+			uint64_t mismatches = 0;
+			uint64_t hits = 0;
+			for (size_t i = 0; i < results.size(); i++)
+			{
+				if (reference[i].Lane >= 0)
+					hits++;
+
+				// Same operations in the same order, so results must agree exactly
+				if (results[i].Lane != reference[i].Lane ||
+					(reference[i].Lane >= 0 && results[i].Distance != reference[i].Distance))
+					mismatches++;
+			}
+			allMatch &= mismatches == 0;
+
+			json << (firstEntry ? "" : ",\n");
+			json << "    { \"isa\": \"" << Kernels::GetName(isa) << "\", \"ms\": " << milliseconds
+				<< ", \"million_tests_per_sec\": " << (milliseconds > 0.0f ? tests / (milliseconds * 1000.0) : 0.0)
+				<< ", \"leaf_hits\": " << hits << ", \"mismatches\": " << mismatches << " }";
+			firstEntry = false;
+		}
+
+		json << "\n  ],\n";
+		json << "  \"match\": " << (allMatch ? "true" : "false") << "\n";
+		json << "}\n";
+
+		report = json.str();
+		return allMatch;
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace KernelBenchmark
+{
+	// Times every leaf intersection kernel this CPU supports on the same random rays and
+	// primitives, and checks each one's hits against the scalar kernel.
+	// Writes a JSON report and returns false if any kernel disagrees with the scalar one.
+	bool Run(uint32_t rayCount, std::string& report);
+}
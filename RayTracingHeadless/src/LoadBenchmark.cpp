@@ -0,0 +1,75 @@
+#include "LoadBenchmark.h"
+
+#include "SceneFile.h"
+#include "Scenes.h"
+
+#include "Walnut/Timer.h"
+
+#include <filesystem>
+#include <sstream>
+#include <vector>
+
+namespace LoadBenchmark
+{
+	bool Run(uint32_t maxPrimitives, const std::string& directory, std::string& report)
+	{
+		std::vector<uint32_t> sizes;
+		for (uint32_t size = 1000; size < maxPrimitives; size *= 10)
+			sizes.push_back(size);
+		sizes.push_back(maxPrimitives);
+
+		std::error_code errorCode;
+		std::filesystem::create_directories(directory, errorCode);
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"scenes\": [\n";
+
+		bool success = true;
+		for (size_t i = 0; i < sizes.size(); i++)
+		{
+			Scene scene;
+			Scenes::Create("many", scene, sizes[i]);
+
+			std::string textPath = (std::filesystem::path(directory) / ("many_" + std::to_string(sizes[i]) + ".rtscene")).string();
+			std::string binaryPath = SceneFile::GetCachePath(textPath);
+			CameraDescription camera;
+			if (!SceneFile::SaveText(textPath, scene, camera) || !SceneFile::SaveBinary(binaryPath, scene, camera))
+			{
+				success = false;
+				break;
+			}
+
+			Scene loaded;
+			std::string error;
+
+			Walnut::Timer textTimer;
+			bool textLoaded = SceneFile::LoadText(textPath, loaded, camera, error);
+			float textMilliseconds = textTimer.ElapsedMillis();
+
+			Walnut::Timer binaryTimer;
+			bool binaryLoaded = SceneFile::LoadBinary(binaryPath, loaded, camera, error);
+			float binaryMilliseconds = binaryTimer.ElapsedMillis();
+
+			bool complete = loaded.Spheres.size() + loaded.Boxes.size() == sizes[i] &&
+				loaded.Accelerator.GetNodes().size() == scene.Accelerator.GetNodes().size();
+			success = success && textLoaded && binaryLoaded && complete;
+
+			json << (i ? ",\n" : "");
+			json << "    { \"primitives\": " << sizes[i]
+				<< ", \"text_bytes\": " << std::filesystem::file_size(textPath, errorCode)
+				<< ", \"binary_bytes\": " << std::filesystem::file_size(binaryPath, errorCode)
+				<< ", \"text_ms\": " << textMilliseconds
+				<< ", \"binary_ms\": " << binaryMilliseconds
+				<< ", \"speedup\": " << (binaryMilliseconds > 0.0f ? textMilliseconds / binaryMilliseconds : 0.0f)
+				<< " }";
+		}
+
+		json << "\n  ],\n";
+		json << "  \"success\": " << (success ? "true" : "false") << "\n";
+		json << "}\n";
+
+		report = json.str();
+		return success;
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace LoadBenchmark
+{
+	// Writes the "many" scene at 1k, 10k, ... up to maxPrimitives into directory as text and as
+	// compiled binary, then times loading each form (text includes the BVH build). Writes a JSON
+	// report and returns false if a file could not be written or read back.
+	bool Run(uint32_t maxPrimitives, const std::string& directory, std::string& report);
+}
@@ -0,0 +1,235 @@
+#include "OfflineRender.h"
+
+#include "ChunkCache.h"
+#include "TiledImageWriter.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace OfflineRender
+{
+	static constexpr uint32_t CheckpointVersion = 1;
+
+	struct Checkpoint
+	{
+		std::string Description;
+		uint32_t Width = 0, Height = 0, TileSize = 0, Samples = 0;
+		TiledImageWriter::ResumePoint ResumePoint;
+	};
+
+	static bool ReadCheckpoint(const std::string& path, Checkpoint& checkpoint)
+	{
+		std::ifstream stream(path);
+		std::string line;
+		uint32_t version = 0;
+		while (std::getline(stream, line))
+		{
+			std::istringstream fields(line);
+			std::string key;
+			fields >> key;
+			if (key == "rtcheckpoint")
+				fields >> version;
+			else if (key == "description")
+				std::getline(fields >> std::ws, checkpoint.Description);
+			else if (key == "width")
+				fields >> checkpoint.Width;
+			else if (key == "height")
+				fields >> checkpoint.Height;
+			else if (key == "tile_size")
+				fields >> checkpoint.TileSize;
+			else if (key == "samples")
+				fields >> checkpoint.Samples;
+			else if (key == "bands")
+				fields >> checkpoint.ResumePoint.Bands;
+			else if (key == "file_size")
+				fields >> checkpoint.ResumePoint.FileSize;
+			else if (key == "checksum")
+				fields >> checkpoint.ResumePoint.Checksum;
+		}
+		return version == CheckpointVersion;
+	}
+
+	// Written next to the old one and renamed over it, so a crash leaves one or the other
+	static bool WriteCheckpoint(const std::string& path, const Checkpoint& checkpoint)
+	{
+		std::string temporaryPath = path + ".tmp";
+		{
+			std::ofstream stream(temporaryPath);
+			stream << "rtcheckpoint " << CheckpointVersion << "\n";
+			stream << "description " << checkpoint.Description << "\n";
+			stream << "width " << checkpoint.Width << "\n";
+			stream << "height " << checkpoint.Height << "\n";
+			stream << "tile_size " << checkpoint.TileSize << "\n";
+			stream << "samples " << checkpoint.Samples << "\n";
+			stream << "bands " << checkpoint.ResumePoint.Bands << "\n";
+			stream << "file_size " << checkpoint.ResumePoint.FileSize << "\n";
+			stream << "checksum " << checkpoint.ResumePoint.Checksum << "\n";
+			stream.flush();
+			if (!stream)
+				return false;
+		}
+
+		std::error_code errorCode;
+		std::filesystem::rename(temporaryPath, path, errorCode);
+		return !errorCode;
+	}
+
+	Output::Output() = default;
+	Output::~Output() = default;
+
+	bool Output::Open(const Settings& settings, std::string& error)
+	{
+		m_Writer = TiledImageWriter::Create(settings.OutputPath);
+		if (!m_Writer)
+		{
+			error = "Offline output must be .exr or .png: " + settings.OutputPath;
+			return false;
+		}
+		if (settings.Width == 0 || settings.Height == 0 || settings.Samples == 0 || settings.TileSize == 0)
+		{
+			error = "Offline render needs a size, samples and a tile size";
+			return false;
+		}
+		m_Settings = settings;
+
+		m_Checkpoint = std::make_unique<Checkpoint>();
+		m_Checkpoint->Description = settings.Description;
+		m_Checkpoint->Width = settings.Width;
+		m_Checkpoint->Height = settings.Height;
+		m_Checkpoint->TileSize = settings.TileSize;
+		m_Checkpoint->Samples = settings.Samples;
+
+		m_CheckpointPath = settings.OutputPath + ".checkpoint";
+		const TiledImageWriter::ResumePoint* resume = nullptr;
+		Checkpoint previous;
+		if (settings.Resume && std::filesystem::exists(m_CheckpointPath))
+		{
+			if (!ReadCheckpoint(m_CheckpointPath, previous))
+			{
+				error = "Cannot read " + m_CheckpointPath;
+				return false;
+			}
+			if (previous.Description != m_Checkpoint->Description || previous.Width != m_Checkpoint->Width ||
+				previous.Height != m_Checkpoint->Height || previous.TileSize != m_Checkpoint->TileSize || previous.Samples != m_Checkpoint->Samples)
+			{
+				error = m_CheckpointPath + " was written for a different scene or settings";
+				return false;
+			}
+			resume = &previous.ResumePoint;
+		}
+
+		if (!m_Writer->Open(settings.OutputPath, settings.Width, settings.Height, settings.TileSize, resume, error))
+			return false;
+
+		m_TilesX = (settings.Width + settings.TileSize - 1) / settings.TileSize;
+		m_BandCount = (settings.Height + settings.TileSize - 1) / settings.TileSize;
+		m_NextBand = m_Writer->GetResumePoint().Bands;
+		m_FirstBand = m_NextBand;
+		return true;
+	}
+
+	void Output::GetRegions(uint32_t band, std::vector<Renderer::Region>& regions) const
+	{
+		// Tiles count from the top of the file, the renderer's rows from the bottom
+		uint32_t top = band * m_Settings.TileSize;
+		uint32_t rows = std::min(m_Settings.TileSize, m_Settings.Height - top);
+		regions.resize(m_TilesX);
+		for (uint32_t tileX = 0; tileX < m_TilesX; tileX++)
+		{
+			Renderer::Region& region = regions[tileX];
+			region.X = tileX * m_Settings.TileSize;
+			region.Y = m_Settings.Height - top - rows;
+			region.Width = std::min(m_Settings.TileSize, m_Settings.Width - region.X);
+			region.Height = rows;
+			region.FirstSample = 0;
+			region.SampleCount = m_Settings.Samples;
+		}
+	}
+
+	bool Output::WriteBand(std::vector<Renderer::Region>& regions, std::string& error)
+	{
+		std::vector<const float*> tiles(m_TilesX);
+		for (uint32_t tileX = 0; tileX < m_TilesX; tileX++)
+		{
+			Renderer::Region& region = regions[tileX];
+			for (float& value : region.Pixels)
+				value /= (float)m_Settings.Samples;
+
+			size_t rowFloats = 3 * (size_t)region.Width;
+			for (uint32_t row = 0; row < region.Height / 2; row++)
+			{
+				std::swap_ranges(region.Pixels.begin() + row * rowFloats, region.Pixels.begin() + (row + 1) * rowFloats,
+					region.Pixels.begin() + (region.Height - 1 - row) * rowFloats);
+			}
+			tiles[tileX] = region.Pixels.data();
+		}
+
+		if (!m_Writer->WriteBand(tiles))
+		{
+			error = "Cannot write " + m_Settings.OutputPath;
+			return false;
+		}
+
+		m_Checkpoint->ResumePoint = m_Writer->GetResumePoint();
+		if (!WriteCheckpoint(m_CheckpointPath, *m_Checkpoint))
+		{
+			error = "Cannot write " + m_CheckpointPath;
+			return false;
+		}
+		m_NextBand++;
+		std::fprintf(stderr, "\rBand %u/%u", m_NextBand, m_BandCount);
+		return true;
+	}
+
+	bool Output::Finish(std::string& error)
+	{
+		std::fprintf(stderr, "\n");
+		if (!m_Writer->Finish())
+		{
+			error = "Cannot complete " + m_Settings.OutputPath;
+			return false;
+		}
+
+		std::error_code errorCode;
+		std::filesystem::remove(m_CheckpointPath, errorCode);
+		return true;
+	}
+
+	bool Run(Renderer& renderer, const Scene& scene, Camera& camera, const Settings& settings, Result& result, std::string& error)
+	{
+		Output output;
+		if (!output.Open(settings, error))
+			return false;
+		result.Bands = output.GetBandCount();
+		result.ResumedBands = output.GetFirstBand();
+
+		camera.OnResize(settings.Width, settings.Height);
+		Walnut::Timer timer;
+		std::vector<Renderer::Region> regions;
+		for (uint32_t band = output.GetFirstBand(); band < output.GetBandCount(); band++)
+		{
+			output.GetRegions(band, regions);
+			renderer.RenderRegions(scene, camera, regions);
+			result.Rays += renderer.GetLastFrameRayCount();
+			if (scene.Chunks && !scene.Chunks->GetError().empty())
+			{
+				error = scene.Chunks->GetError();
+				return false;
+			}
+
+			if (!output.WriteBand(regions, error))
+				return false;
+		}
+		result.Milliseconds = timer.ElapsedMillis();
+
+		for (const Renderer::Region& region : regions)
+			result.BandBytes += region.Pixels.capacity() * sizeof(float);
+
+		return output.Finish(error);
+	}
+}
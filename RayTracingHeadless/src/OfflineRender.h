@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TiledImageWriter;
+
+// Renders images too large to keep whole, such as print posters, straight to a file. The image
+// is rendered one band (a row of tiles) at a time to a fixed sample count and streamed to a
+// tiled OpenEXR or scanline PNG, so memory holds one band of float pixels instead of the
+// renderer's full-size buffers. After every band a checkpoint "<output>.checkpoint" records
+// how far the file is complete; it is removed once the image is done.
+namespace OfflineRender
+{
+	struct Settings
+	{
+		std::string OutputPath; // .exr or .png
+		uint32_t Width = 0, Height = 0;
+		uint32_t Samples = 64;
+		uint32_t TileSize = 64;
+		bool Resume = false;    // Continue from the checkpoint if there is one
+		std::string Description; // Scene and options; a checkpoint written with others is refused
+	};
+
+	struct Result
+	{
+		uint32_t Bands = 0;
+		uint32_t ResumedBands = 0; // Taken from the checkpoint instead of rendered
+		uint64_t Rays = 0;
+		double Milliseconds = 0.0;
+		size_t BandBytes = 0; // Pixels of the band in flight, the bulk of the memory used
+	};
+
+	struct Checkpoint;
+
+	// The output file and its checkpoint. Bands are written strictly top to bottom, whoever
+	// renders them.
+	class Output
+	{
+	public:
+		Output();
+		~Output();
+
+		// Creates the file, or with Settings::Resume continues it from its checkpoint
+		bool Open(const Settings& settings, std::string& error);
+
+		// The tiles of a band, left to right, as regions of all the samples
+		void GetRegions(uint32_t band, std::vector<Renderer::Region>& regions) const;
+		// Takes the next band's regions from GetRegions() holding their sample sums, divides
+		// them by Settings::Samples and writes them (reordering the pixels in place), then
+		// updates the checkpoint
+		bool WriteBand(std::vector<Renderer::Region>& regions, std::string& error);
+		// Completes the file and removes the checkpoint
+		bool Finish(std::string& error);
+
+		uint32_t GetBandCount() const { return m_BandCount; }
+		uint32_t GetTilesX() const { return m_TilesX; }
+		uint32_t GetFirstBand() const { return m_FirstBand; } // Bands before it were resumed
+		uint32_t GetNextBand() const { return m_NextBand; }
+	private:
+		Settings m_Settings;
+		std::unique_ptr<TiledImageWriter> m_Writer;
+		std::unique_ptr<Checkpoint> m_Checkpoint;
+		std::string m_CheckpointPath;
+		uint32_t m_TilesX = 0, m_BandCount = 0;
+		uint32_t m_FirstBand = 0, m_NextBand = 0;
+	};
+
+	// Renders the bands in this process
+	bool Run(Renderer& renderer, const Scene& scene, Camera& camera, const Settings& settings, Result& result, std::string& error);
+}
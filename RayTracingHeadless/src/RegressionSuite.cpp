@@ -0,0 +1,473 @@
+#include "RegressionSuite.h"
+
+#include "ImageWriter.h"
+#include "IntersectionKernels.h"
+#include "Mesh.h"
+#include "Renderer.h"
+#include "Scenes.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace RegressionSuite
+{
+	// The golden images depend on these, so changing them means recording them again
+	static constexpr uint32_t Width = 320, Height = 200;
+	static constexpr uint32_t Frames = 16;
+	static constexpr uint32_t ManyCount = 1000;
+
+	static constexpr float Miss = -1.0f;
+
+	struct CheckResult
+	{
+		std::string Name;
+		float Distance; // Miss if nothing was hit
+		float Expected;
+		bool Passed;
+	};
+
+	struct RayCase
+	{
+		const char* Name;
+		bool Box; // The box [0, 1]^3 instead of the unit sphere at the origin
+		glm::vec3 Origin, Direction;
+		float Expected;
+		bool MayMiss = false; // Grazes the surface: a hit at Expected or a miss, but never NaN
+	};
+
+	static bool Matches(float distance, float expected, bool mayMiss)
+	{
+		if (std::isnan(distance))
+			return false;
+		if (distance == Miss)
+			return expected == Miss || mayMiss;
+		return expected != Miss && std::abs(distance - expected) <= 1e-4f * std::max(1.0f, std::abs(expected));
+	}
+
+	static Ray MakeRay(const glm::vec3& origin, const glm::vec3& direction)
+	{
+		Ray ray;
+		ray.Origin = origin;
+		ray.Direction = direction;
+		return ray;
+	}
+
+	static std::vector<RayCase> GetRayCases()
+	{
+		glm::vec3 diagonal = glm::normalize(glm::vec3(1.0f));
+		return {
+			{ "sphere_head_on", false, { 0.0f, 0.0f, 5.0f }, { 0.0f, 0.0f, -1.0f }, 4.0f },
+			{ "sphere_miss", false, { 0.0f, 2.0f, 5.0f }, { 0.0f, 0.0f, -1.0f }, Miss },
+			{ "sphere_tangent", false, { 1.0f, 0.0f, 5.0f }, { 0.0f, 0.0f, -1.0f }, 5.0f, true },
+			{ "sphere_behind_origin", false, { 0.0f, 0.0f, -5.0f }, { 0.0f, 0.0f, -1.0f }, Miss },
+			// Spheres are only entered from outside: the near root is behind the ray
+			{ "sphere_origin_inside", false, { 0.0f, 0.0f, 0.5f }, { 0.0f, 0.0f, -1.0f }, Miss },
+			{ "sphere_diagonal", false, -3.0f * diagonal, diagonal, 2.0f },
+			{ "box_head_on", true, { 0.5f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, 4.0f },
+			{ "box_behind_origin", true, { 0.5f, 0.5f, -5.0f }, { 0.0f, 0.0f, -1.0f }, Miss },
+			{ "box_origin_inside", true, { 0.5f, 0.5f, 0.25f }, { 0.0f, 0.0f, -1.0f }, 0.25f },
+			{ "box_origin_inside_diagonal", true, glm::vec3(0.5f), diagonal, 0.5f * std::sqrt(3.0f) },
+			// Directions with zero components are parallel to those slabs' planes
+			{ "box_parallel_outside_slab", true, { 2.0f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, Miss },
+			{ "box_parallel_two_slabs", true, { 5.0f, 0.25f, 0.75f }, { -1.0f, 0.0f, 0.0f }, 4.0f },
+			{ "box_parallel_in_face_plane", true, { 1.0f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, 4.0f, true },
+			{ "box_through_corner", true, -diagonal, diagonal, 1.0f },
+		};
+	}
+
+	static float IntersectRenderer(const RayCase& rayCase)
+	{
+		Ray ray = MakeRay(rayCase.Origin, rayCase.Direction);
+		if (rayCase.Box)
+		{
+			Box box;
+			box.Position = glm::vec3(0.0f);
+			box.Width = box.Height = box.Depth = 1.0f;
+			float distance = Renderer::IntersectBox(ray, box);
+			return distance >= 0.0f ? distance : Miss;
+		}
+
+		Sphere sphere;
+		sphere.Position = glm::vec3(0.0f);
+		sphere.Radius = 1.0f;
+		float distance = Renderer::IntersectSphere(ray, sphere);
+		return distance > 0.0f ? distance : Miss;
+	}
+
+	static float IntersectKernel(Kernels::LeafIntersectFn kernel, const RayCase& rayCase)
+	{
+		// The primitive in the last lane of a vector, the others empty
+		PrimitiveSoA soa;
+		soa.Resize(4);
+		if (rayCase.Box)
+			soa.SetBox(3, glm::vec3(0.0f), glm::vec3(1.0f));
+		else
+			soa.SetSphere(3, glm::vec3(0.0f), 1.0f);
+
+		float distance;
+		int lane = kernel(soa, 0, soa.Count, MakeRay(rayCase.Origin, rayCase.Direction), std::numeric_limits<float>::max(), distance);
+		return lane == 3 ? distance : Miss;
+	}
+
+	static void CheckBoundsTest(std::vector<CheckResult>& results)
+	{
+		struct BoundsCase
+		{
+			const char* Name;
+			glm::vec3 Origin, Direction;
+			float TMax;
+			float Expected;
+		};
+		float unbounded = std::numeric_limits<float>::max();
+		glm::vec3 edgeDirection = glm::normalize(glm::vec3(1.0f, 0.0f, -1.0f));
+		const BoundsCase cases[] = {
+			{ "aabb_head_on", { 0.5f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, 4.0f },
+			{ "aabb_origin_inside", glm::vec3(0.5f), { 0.0f, 0.0f, -1.0f }, unbounded, 0.0f },
+			{ "aabb_behind_origin", { 0.5f, 0.5f, -5.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, Miss },
+			{ "aabb_parallel_outside_slab", { 2.0f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, Miss },
+			{ "aabb_beyond_tmax", { 0.5f, 0.5f, 5.0f }, { 0.0f, 0.0f, -1.0f }, 3.0f, Miss },
+			// Exactly through an edge, which the widened exit distance must keep
+			{ "aabb_through_edge", { -1.0f, 0.5f, 2.0f }, edgeDirection, unbounded, std::sqrt(2.0f) },
+		};
+
+		for (const BoundsCase& boundsCase : cases)
+		{
+			Ray ray = MakeRay(boundsCase.Origin, boundsCase.Direction);
+			float entry = BVH::IntersectAABB(ray, 1.0f / ray.Direction, glm::vec3(0.0f), glm::vec3(1.0f), boundsCase.TMax);
+			float distance = entry == std::numeric_limits<float>::max() ? Miss : entry;
+			results.push_back({ boundsCase.Name, distance, boundsCase.Expected, Matches(distance, boundsCase.Expected, false) });
+		}
+	}
+
+	static void CheckMeshTest(std::vector<CheckResult>& results)
+	{
+		// The unit square at z = 0 as a fan of four triangles around its center, so rays can
+		// go exactly through edges and a vertex the triangles share
+		Mesh mesh;
+		mesh.Positions = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.5f, 0.5f, 0.0f } };
+		mesh.Indices = { 4, 0, 1, 4, 1, 2, 4, 2, 3, 4, 3, 0 };
+		mesh.BuildAcceleration();
+
+		struct MeshCase
+		{
+			const char* Name;
+			glm::vec3 Origin, Direction;
+			float TMax;
+			float Expected;
+		};
+		float unbounded = std::numeric_limits<float>::max();
+		const MeshCase cases[] = {
+			{ "mesh_shared_vertex", { 0.5f, 0.5f, 1.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, 1.0f },
+			{ "mesh_shared_edge", { 0.25f, 0.25f, 2.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, 2.0f },
+			{ "mesh_back_face", { 0.3f, 0.6f, -1.0f }, { 0.0f, 0.0f, 1.0f }, unbounded, 1.0f },
+			{ "mesh_parallel_to_plane", { -1.0f, 0.5f, 0.0f }, { 1.0f, 0.0f, 0.0f }, unbounded, Miss },
+			{ "mesh_behind_origin", { 0.5f, 0.5f, -1.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, Miss },
+			{ "mesh_beyond_tmax", { 0.3f, 0.6f, 2.0f }, { 0.0f, 0.0f, -1.0f }, 1.5f, Miss },
+			{ "mesh_outside", { 1.5f, 0.5f, 1.0f }, { 0.0f, 0.0f, -1.0f }, unbounded, Miss },
+		};
+
+		for (const MeshCase& meshCase : cases)
+		{
+			float tMax = meshCase.TMax;
+			MeshHit hit;
+			float distance = mesh.Intersect(MakeRay(meshCase.Origin, meshCase.Direction), tMax, hit) ? tMax : Miss;
+			results.push_back({ meshCase.Name, distance, meshCase.Expected, Matches(distance, meshCase.Expected, false) });
+		}
+	}
+
+	static void CheckReprojection(std::vector<CheckResult>& results)
+	{
+		// A camera as constructed, never moved: reprojection projects through its view matrix,
+		// so a point seen through a pixel has to land back on that pixel at its depth
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(Width, Height);
+		struct PixelCase
+		{
+			const char* Name;
+			uint32_t X, Y;
+			float Distance;
+		};
+		const PixelCase cases[] = {
+			{ "reproject_default_center", Width / 2, Height / 2, 5.0f },
+			{ "reproject_default_corner", 3, Height - 4, 7.5f },
+		};
+
+		for (const PixelCase& pixelCase : cases)
+		{
+			Ray ray = camera.GenerateRay(pixelCase.X, pixelCase.Y, glm::vec2(0.5f), glm::vec2(0.5f));
+			glm::vec3 position = ray.Origin + glm::normalize(ray.Direction) * pixelCase.Distance;
+			float expectedDepth = glm::dot(position - camera.GetPosition(), camera.GetDirection());
+
+			glm::vec2 pixel(Miss);
+			float depth = Miss;
+			if (!camera.ProjectToPixel(position, pixel, depth))
+				depth = Miss;
+			std::string name = pixelCase.Name;
+			results.push_back({ name + "_x", pixel.x, pixelCase.X + 0.5f, Matches(pixel.x, pixelCase.X + 0.5f, false) });
+			results.push_back({ name + "_y", pixel.y, pixelCase.Y + 0.5f, Matches(pixel.y, pixelCase.Y + 0.5f, false) });
+			results.push_back({ name + "_depth", depth, expectedDepth, Matches(depth, expectedDepth, false) });
+		}
+	}
+
+	// Over RGB, capped for identical images
+	static double GetPSNR(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+	{
+		double squaredError = 0.0;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			for (uint32_t shift = 0; shift < 24; shift += 8)
+			{
+				double difference = (double)((a[i] >> shift) & 0xff) - (double)((b[i] >> shift) & 0xff);
+				squaredError += difference * difference;
+			}
+		}
+		double meanSquaredError = squaredError / (a.size() * 3.0);
+		return meanSquaredError > 0.0 ? std::min(10.0 * std::log10(255.0 * 255.0 / meanSquaredError), 100.0) : 100.0;
+	}
+
+	// Mean structural similarity (Wang et al. 2004) of the luminance over 8x8 windows, 4 pixels apart
+	static double GetSSIM(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, uint32_t width, uint32_t height)
+	{
+		auto luminance = [](uint32_t pixel)
+		{
+			return 0.299 * (pixel & 0xff) + 0.587 * ((pixel >> 8) & 0xff) + 0.114 * ((pixel >> 16) & 0xff);
+		};
+
+		constexpr uint32_t Window = 8, Stride = 4;
+		constexpr double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+		constexpr double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+		double total = 0.0;
+		uint32_t windows = 0;
+		for (uint32_t y = 0; y + Window <= height; y += Stride)
+		{
+			for (uint32_t x = 0; x + Window <= width; x += Stride)
+			{
+				double sumA = 0.0, sumB = 0.0, sumAA = 0.0, sumBB = 0.0, sumAB = 0.0;
+				for (uint32_t j = y; j < y + Window; j++)
+				{
+					for (uint32_t i = x; i < x + Window; i++)
+					{
+						double la = luminance(a[i + j * width]);
+						double lb = luminance(b[i + j * width]);
+						sumA += la;
+						sumB += lb;
+						sumAA += la * la;
+						sumBB += lb * lb;
+						sumAB += la * lb;
+					}
+				}
+
+				constexpr double n = Window * Window;
+				double meanA = sumA / n, meanB = sumB / n;
+				double varianceA = sumAA / n - meanA * meanA;
+				double varianceB = sumBB / n - meanB * meanB;
+				double covariance = sumAB / n - meanA * meanB;
+				total += (2.0 * meanA * meanB + C1) * (2.0 * covariance + C2)
+					/ ((meanA * meanA + meanB * meanB + C1) * (varianceA + varianceB + C2));
+				windows++;
+			}
+		}
+		return windows > 0 ? total / windows : 1.0;
+	}
+
+	static std::map<std::string, float> ReadBudgets(const std::string& path)
+	{
+		std::map<std::string, float> budgets;
+		std::ifstream stream(path);
+		std::string scene;
+		float milliseconds;
+		while (stream >> scene >> milliseconds)
+			budgets[scene] = milliseconds;
+		return budgets;
+	}
+
+	static bool WriteBudgets(const std::string& path, const std::map<std::string, float>& budgets)
+	{
+		std::ofstream stream(path);
+		for (const auto& [scene, milliseconds] : budgets)
+			stream << scene << " " << milliseconds << "\n";
+		return (bool)stream;
+	}
+
+	static void WriteChecks(std::ostringstream& json, const std::vector<CheckResult>& checks)
+	{
+		for (size_t i = 0; i < checks.size(); i++)
+		{
+			const CheckResult& check = checks[i];
+			json << "    { \"name\": \"" << check.Name << "\", \"distance\": " << check.Distance
+				<< ", \"expected\": " << check.Expected << ", \"passed\": " << (check.Passed ? "true" : "false") << " }"
+				<< (i + 1 == checks.size() ? "\n" : ",\n");
+		}
+	}
+
+	bool Run(const Settings& settings, std::string& report)
+	{
+		std::vector<CheckResult> checks;
+		for (const RayCase& rayCase : GetRayCases())
+		{
+			float distance = IntersectRenderer(rayCase);
+			checks.push_back({ rayCase.Name, distance, rayCase.Expected, Matches(distance, rayCase.Expected, rayCase.MayMiss) });
+		}
+		for (Kernels::ISA isa : { Kernels::ISA::Scalar, Kernels::ISA::SSE, Kernels::ISA::AVX2, Kernels::ISA::AVX512 })
+		{
+			if (!Kernels::IsSupported(isa))
+				continue;
+			Kernels::LeafIntersectFn kernel = Kernels::GetLeafIntersect(isa);
+			for (const RayCase& rayCase : GetRayCases())
+			{
+				float distance = IntersectKernel(kernel, rayCase);
+				checks.push_back({ std::string("kernel_") + Kernels::GetName(isa) + "_" + rayCase.Name, distance, rayCase.Expected,
+					Matches(distance, rayCase.Expected, rayCase.MayMiss) });
+			}
+		}
+		CheckBoundsTest(checks);
+		CheckMeshTest(checks);
+		CheckReprojection(checks);
+
+		bool passed = true;
+		uint32_t failedChecks = 0;
+		for (const CheckResult& check : checks)
+			failedChecks += !check.Passed;
+		passed &= failedChecks == 0;
+
+		if (settings.UpdateGolden || settings.UpdateBudgets)
+		{
+			std::error_code errorCode;
+			std::filesystem::create_directories(settings.Directory, errorCode);
+		}
+		std::string budgetPath = GetBudgetPath(settings.Directory);
+		std::map<std::string, float> budgets = ReadBudgets(budgetPath);
+		bool recorded = false;
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"directory\": \"" << settings.Directory << "\",\n";
+		json << "  \"width\": " << Width << ",\n";
+		json << "  \"height\": " << Height << ",\n";
+		json << "  \"frames\": " << Frames << ",\n";
+		json << "  \"min_psnr\": " << settings.MinPSNR << ",\n";
+		json << "  \"min_ssim\": " << settings.MinSSIM << ",\n";
+		json << "  \"budget_tolerance\": " << settings.BudgetTolerance << ",\n";
+		json << "  \"scenes\": [\n";
+
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(Width, Height);
+		const char* sceneNames[] = { "spheres", "boxes", "mixed", "many" };
+		for (size_t s = 0; s < std::size(sceneNames); s++)
+		{
+			std::string sceneName = sceneNames[s];
+			Scene scene;
+			Scenes::Create(sceneName, scene, ManyCount);
+			if (sceneName == "boxes")
+			{
+				// The built-in light only reaches the box tops, which the camera sees edge on, so the
+				// golden image would be close to black; light the faces the camera sees instead
+				Light& light = scene.Lights.emplace_back();
+				light.Type = LightType::Directional;
+				light.Direction = glm::normalize(glm::vec3(0.3f, -0.4f, -0.87f));
+				light.Intensity = 4.0f;
+				scene.BuildLights();
+			}
+
+			Renderer renderer;
+			Renderer::Settings& rendererSettings = renderer.GetSettings();
+			rendererSettings.WorkerCount = 1;
+			rendererSettings.TargetNoise = 0.0f;
+			rendererSettings.MaxSamples = 0;
+			rendererSettings.ResolveInterval = 0;
+			renderer.OnResize(Width, Height);
+
+			// The median, so that the first frame's setup and the odd preempted frame do not count
+			std::vector<float> frameMilliseconds;
+			for (uint32_t frame = 0; frame < Frames; frame++)
+			{
+				Walnut::Timer timer;
+				renderer.Render(scene, camera);
+				frameMilliseconds.push_back(timer.ElapsedMillis());
+			}
+			renderer.Resolve();
+			std::sort(frameMilliseconds.begin(), frameMilliseconds.end());
+			float medianMilliseconds = frameMilliseconds[frameMilliseconds.size() / 2];
+
+			std::vector<uint32_t> image(renderer.GetImageData(), renderer.GetImageData() + Width * Height);
+
+			json << "    { \"scene\": \"" << sceneName << "\", \"median_ms\": " << medianMilliseconds;
+
+			// A missing golden image or budget fails, so a wrong directory cannot pass by recording
+			std::string goldenPath = (std::filesystem::path(settings.Directory) / (sceneName + ".ppm")).string();
+			bool imagePassed;
+			if (settings.UpdateGolden)
+			{
+				imagePassed = ImageWriter::WritePPM(goldenPath, image.data(), Width, Height);
+				json << ", \"image_recorded\": true";
+			}
+			else
+			{
+				std::vector<uint32_t> golden;
+				uint32_t goldenWidth = 0, goldenHeight = 0;
+				bool found = ImageWriter::ReadPPM(goldenPath, golden, goldenWidth, goldenHeight);
+				bool sameSize = found && goldenWidth == Width && goldenHeight == Height;
+				double psnr = sameSize ? GetPSNR(image, golden) : 0.0;
+				double ssim = sameSize ? GetSSIM(image, golden, Width, Height) : 0.0;
+				imagePassed = psnr >= settings.MinPSNR && ssim >= settings.MinSSIM;
+				json << ", \"golden_found\": " << (found ? "true" : "false") << ", \"psnr\": " << psnr << ", \"ssim\": " << ssim;
+			}
+
+			bool timePassed;
+			if (settings.UpdateGolden || settings.UpdateBudgets)
+			{
+				budgets[sceneName] = medianMilliseconds;
+				recorded = true;
+				timePassed = true;
+				json << ", \"budget_recorded\": true";
+			}
+			else
+			{
+				auto budget = budgets.find(sceneName);
+				bool found = budget != budgets.end();
+				timePassed = found && medianMilliseconds <= budget->second * (1.0f + settings.BudgetTolerance);
+				json << ", \"budget_found\": " << (found ? "true" : "false") << ", \"budget_ms\": " << (found ? budget->second : 0.0f);
+			}
+
+			passed &= imagePassed && timePassed;
+			json << ", \"image_passed\": " << (imagePassed ? "true" : "false")
+				<< ", \"time_passed\": " << (timePassed ? "true" : "false")
+				<< ", \"passed\": " << (imagePassed && timePassed ? "true" : "false") << " }";
+			json << (s + 1 == std::size(sceneNames) ? "\n" : ",\n");
+		}
+
+		if (recorded && !WriteBudgets(budgetPath, budgets))
+			passed = false;
+
+		json << "  ],\n";
+		json << "  \"failed_checks\": " << failedChecks << ",\n";
+		json << "  \"intersection_checks\": [\n";
+		WriteChecks(json, checks);
+		json << "  ],\n";
+		json << "  \"passed\": " << (passed ? "true" : "false") << "\n";
+		json << "}\n";
+		report = json.str();
+		return passed;
+	}
+
+	std::string GetBudgetPath(const std::string& directory)
+	{
+		return (std::filesystem::path(directory) / "budgets.txt").string();
+	}
+
+	std::string GetDefaultDirectory()
+	{
+		std::error_code errorCode;
+		if (std::filesystem::is_directory("golden", errorCode))
+			return "golden";
+		return "RayTracingHeadless/golden";
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace RegressionSuite
+{
+	struct Settings
+	{
+		std::string Directory;      // Golden images and budgets.txt
+		bool UpdateGolden = false;  // Record every scene again instead of comparing
+		bool UpdateBudgets = false; // Record only the frame time budgets, which depend on the machine
+		float MinPSNR = 40.0f;      // dB, against the golden image
+		float MinSSIM = 0.98f;
+		float BudgetTolerance = 0.25f; // Allowed slowdown over a scene's recorded frame time
+	};
+
+	// Checks the intersection routines (the renderer's sphere and box tests, every supported
+	// leaf kernel, the BVH's box test and the watertight mesh test) on hand-picked rays,
+	// including rays starting inside primitives, parallel to box faces and grazing edges, and
+	// that an unmoved camera projects points back onto the pixels it sees them through. Then
+	// renders the canonical scenes (spheres, boxes, mixed, many) at fixed settings on one
+	// worker and compares each against its golden image by PSNR and SSIM, and its median frame
+	// time against the recorded budget. A missing golden image or budget fails the scene;
+	// UpdateGolden records both for every scene instead, UpdateBudgets only the budgets. The
+	// samplers are deterministic, so an unchanged renderer reproduces the golden images exactly.
+	// Writes a JSON report and returns false if any check failed.
+	bool Run(const Settings& settings, std::string& report);
+
+	// The committed golden images: golden from RayTracingHeadless, as IDEs run it, otherwise
+	// RayTracingHeadless/golden from the repository root
+	std::string GetDefaultDirectory();
+	// budgets.txt in the directory. Frame times only compare on the machine that recorded them,
+	// so every machine records its own with UpdateBudgets and none are committed.
+	std::string GetBudgetPath(const std::string& directory);
+}
@@ -0,0 +1,106 @@
+#include "RenderThreadBenchmark.h"
+
+#include "RenderThread.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+namespace RenderThreadBenchmark
+{
+	void Run(Scene scene, const Camera& camera, const Renderer::Settings& rendererSettings, const Settings& settings,
+		std::vector<uint32_t>& image, uint32_t& imageWidth, uint32_t& imageHeight, std::string& report)
+	{
+		Walnut::Timer runTimer;
+		RenderThread renderThread(std::move(scene));
+		Camera uiCamera = camera;
+		uint64_t postedMessages = 0;
+		auto postCamera = [&](bool changesView)
+		{
+			renderThread.Post([uiCamera](Renderer&, Scene&, Camera& renderCamera) { renderCamera = uiCamera; }, changesView);
+			postedMessages++;
+		};
+
+		renderThread.Post([rendererSettings](Renderer& renderer, Scene&, Camera&) { renderer.GetSettings() = rendererSettings; });
+		postCamera(false);
+		FrameBudget::Settings budget;
+		budget.Milliseconds = settings.FrameBudgetMs;
+		renderThread.SetFrameBudget(budget);
+		renderThread.SetViewportSize(settings.Width, settings.Height);
+		postedMessages += 3;
+
+		bool orbiting = settings.OrbitDegrees != 0.0f;
+		float angle = glm::radians(settings.OrbitDegrees);
+		auto rotate = [&](const glm::vec3& v)
+		{
+			return glm::vec3(glm::cos(angle) * v.x + glm::sin(angle) * v.z, v.y, glm::cos(angle) * v.z - glm::sin(angle) * v.x);
+		};
+		uint32_t ticks = 0, framesReceived = 0;
+		double busyMilliseconds = 0.0, renderMilliseconds = 0.0;
+		float maxBusyMilliseconds = 0.0f;
+		while (true)
+		{
+			Walnut::Timer tickTimer;
+			if (orbiting && settings.OrbitTicks > 0 && ticks >= settings.OrbitTicks)
+				orbiting = false;
+			if (orbiting && ticks > 0)
+			{
+				uiCamera.SetView(rotate(uiCamera.GetPosition()), rotate(uiCamera.GetDirection()));
+				postCamera(true);
+			}
+
+			bool done = false;
+			if (renderThread.AcquireFrame())
+			{
+				const RenderThread::Frame& frame = renderThread.GetFrame();
+				framesReceived++;
+				renderMilliseconds += frame.RenderMilliseconds;
+
+				bool finalCamera = !orbiting && frame.MessageCount == postedMessages && frame.RenderScale == 1.0f;
+				done = finalCamera ? frame.AccumulatedFrames >= settings.Frames || frame.Converged
+					: orbiting && settings.OrbitTicks == 0 && framesReceived >= settings.Frames;
+			}
+
+			float busy = tickTimer.ElapsedMillis();
+			busyMilliseconds += busy;
+			maxBusyMilliseconds = std::max(maxBusyMilliseconds, busy);
+			ticks++;
+			if (done)
+				break;
+
+			float remaining = settings.TickMilliseconds - tickTimer.ElapsedMillis();
+			if (remaining > 0.0f)
+				std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(remaining * 1000.0f)));
+		}
+
+		const RenderThread::Frame& frame = renderThread.GetFrame();
+		image = frame.Pixels;
+		imageWidth = frame.Width;
+		imageHeight = frame.Height;
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "  \"width\": " << settings.Width << ",\n";
+		json << "  \"height\": " << settings.Height << ",\n";
+		json << "  \"orbit_degrees\": " << settings.OrbitDegrees << ",\n";
+		json << "  \"frame_budget_ms\": " << settings.FrameBudgetMs << ",\n";
+		json << "  \"tick_ms\": " << settings.TickMilliseconds << ",\n";
+		json << "  \"ticks\": " << ticks << ",\n";
+		// Time the loop spent on each tick besides sleeping, which posting and picking up frames
+		// should keep far below tick_ms however long frames take
+		json << "  \"tick_busy_ms_mean\": " << busyMilliseconds / ticks << ",\n";
+		json << "  \"tick_busy_ms_max\": " << maxBusyMilliseconds << ",\n";
+		json << "  \"frames_received\": " << framesReceived << ",\n";
+		json << "  \"frames_published\": " << frame.Number << ",\n";
+		json << "  \"frames_cancelled\": " << frame.CancelledFrames << ",\n";
+		json << "  \"render_ms_mean\": " << (framesReceived ? renderMilliseconds / framesReceived : 0.0) << ",\n";
+		json << "  \"accumulated_frames\": " << frame.AccumulatedFrames << ",\n";
+		json << "  \"workers\": " << frame.WorkerCount << ",\n";
+		json << "  \"total_ms\": " << runTimer.ElapsedMillis() << "\n";
+		json << "}\n";
+		report = json.str();
+	}
+}
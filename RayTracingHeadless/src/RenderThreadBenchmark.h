@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace RenderThreadBenchmark
+{
+	struct Settings
+	{
+		uint32_t Width = 1280, Height = 720;
+		uint32_t Frames = 100;      // Accumulated frames of the last camera the final image needs
+		float OrbitDegrees = 0.0f;  // Camera turn posted every tick
+		uint32_t OrbitTicks = 0;    // Ticks to keep turning for, 0 for all of them
+		float FrameBudgetMs = 0.0f;
+		float TickMilliseconds = 1000.0f / 60.0f;
+	};
+
+	// Drives a RenderThread from this thread the way the app's UI loop does: every tick it posts
+	// the camera if it turned and picks up the latest frame, then sleeps out the rest of the
+	// tick. Runs until a frame of the final camera at full resolution has settings.Frames frames
+	// accumulated (or has converged), or, if the camera never stops, until that many frames
+	// arrived. Reports how long ticks took, so that a slow frame holding up the loop shows, and
+	// returns that last frame's pixels, which are smaller than the settings' size if the frame
+	// budget scaled it down.
+	void Run(Scene scene, const Camera& camera, const Renderer::Settings& rendererSettings, const Settings& settings,
+		std::vector<uint32_t>& image, uint32_t& imageWidth, uint32_t& imageHeight, std::string& report);
+}
@@ -0,0 +1,349 @@
+#include "TiledImageWriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+namespace Utils
+{
+	static void AppendBytes(std::vector<uint8_t>& buffer, const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		buffer.insert(buffer.end(), bytes, bytes + size);
+	}
+
+	// Little endian, as OpenEXR stores everything
+	template<typename T>
+	static void AppendLittleEndian(std::vector<uint8_t>& buffer, T value)
+	{
+		for (size_t i = 0; i < sizeof(T); i++)
+			buffer.push_back((uint8_t)((uint64_t)value >> (8 * i)));
+	}
+
+	static void AppendBigEndian(std::vector<uint8_t>& buffer, uint32_t value)
+	{
+		for (int i = 3; i >= 0; i--)
+			buffer.push_back((uint8_t)(value >> (8 * i)));
+	}
+
+	static void AppendFloat(std::vector<uint8_t>& buffer, float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		AppendLittleEndian(buffer, bits);
+	}
+
+	static void AppendAttribute(std::vector<uint8_t>& header, const char* name, const char* type, const std::vector<uint8_t>& value)
+	{
+		AppendBytes(header, name, std::strlen(name) + 1);
+		AppendBytes(header, type, std::strlen(type) + 1);
+		AppendLittleEndian(header, (int32_t)value.size());
+		AppendBytes(header, value.data(), value.size());
+	}
+
+	static uint32_t CRC32(const uint8_t* data, size_t size, uint32_t crc = 0)
+	{
+		static uint32_t s_Table[256] = {};
+		if (s_Table[1] == 0)
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t value = i;
+				for (int bit = 0; bit < 8; bit++)
+					value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+				s_Table[i] = value;
+			}
+		}
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = s_Table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	static uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler)
+	{
+		uint32_t a = adler & 0xffff, b = adler >> 16;
+		for (size_t i = 0; i < size; i++)
+		{
+			a = (a + data[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return (b << 16) | a;
+	}
+}
+
+std::unique_ptr<TiledImageWriter> TiledImageWriter::Create(const std::string& path)
+{
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+	if (extension == ".exr")
+		return std::make_unique<ExrWriter>();
+	if (extension == ".png")
+		return std::make_unique<PngWriter>();
+	return nullptr;
+}
+
+uint32_t TiledImageWriter::GetBandHeight(uint32_t band) const
+{
+	return std::min(m_TileSize, m_Height - band * m_TileSize);
+}
+
+uint32_t TiledImageWriter::GetTileWidth(uint32_t tileX) const
+{
+	return std::min(m_TileSize, m_Width - tileX * m_TileSize);
+}
+
+bool TiledImageWriter::OpenFile(const std::string& path, const ResumePoint* resume, std::string& error)
+{
+	m_ResumePoint = resume ? *resume : ResumePoint();
+	if (!resume)
+	{
+		m_Stream.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+		if (!m_Stream)
+			error = "Cannot write " + path;
+		return (bool)m_Stream;
+	}
+
+	// Whatever was written after the checkpoint is incomplete
+	std::error_code errorCode;
+	std::filesystem::resize_file(path, resume->FileSize, errorCode);
+	m_Stream.open(path, std::ios::binary | std::ios::in | std::ios::out);
+	m_Stream.seekp(0, std::ios::end);
+	if (errorCode || !m_Stream)
+	{
+		error = "Cannot resume " + path;
+		return false;
+	}
+	return true;
+}
+
+bool TiledImageWriter::Flush()
+{
+	m_Stream.flush();
+	if (!m_Stream)
+		return false;
+
+	m_Stream.seekp(0, std::ios::end);
+	m_ResumePoint.FileSize = (uint64_t)m_Stream.tellp();
+	return (bool)m_Stream;
+}
+
+bool ExrWriter::Open(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize, const ResumePoint* resume, std::string& error)
+{
+	m_Width = width;
+	m_Height = height;
+	m_TileSize = tileSize;
+	m_TilesX = (width + tileSize - 1) / tileSize;
+	m_TilesY = (height + tileSize - 1) / tileSize;
+
+	std::vector<uint8_t> header;
+	Utils::AppendLittleEndian(header, (uint32_t)20000630); // Magic number
+	Utils::AppendLittleEndian(header, (uint32_t)(2 | 0x200)); // Version 2, single part tiled
+
+	// Channels in alphabetical order: name, FLOAT (2), linear, reserved, x and y sampling
+	std::vector<uint8_t> channels;
+	for (const char* name : { "B", "G", "R" })
+	{
+		Utils::AppendBytes(channels, name, 2);
+		Utils::AppendLittleEndian(channels, (int32_t)2);
+		Utils::AppendLittleEndian(channels, (uint32_t)0);
+		Utils::AppendLittleEndian(channels, (int32_t)1);
+		Utils::AppendLittleEndian(channels, (int32_t)1);
+	}
+	channels.push_back(0);
+	Utils::AppendAttribute(header, "channels", "chlist", channels);
+
+	Utils::AppendAttribute(header, "compression", "compression", { 0 });
+
+	std::vector<uint8_t> window;
+	for (int32_t value : { 0, 0, (int32_t)width - 1, (int32_t)height - 1 })
+		Utils::AppendLittleEndian(window, value);
+	Utils::AppendAttribute(header, "dataWindow", "box2i", window);
+	Utils::AppendAttribute(header, "displayWindow", "box2i", window);
+
+	Utils::AppendAttribute(header, "lineOrder", "lineOrder", { 0 }); // Increasing y
+
+	std::vector<uint8_t> value;
+	Utils::AppendFloat(value, 1.0f);
+	Utils::AppendAttribute(header, "pixelAspectRatio", "float", value);
+	Utils::AppendAttribute(header, "screenWindowWidth", "float", value);
+
+	value.clear();
+	Utils::AppendFloat(value, 0.0f);
+	Utils::AppendFloat(value, 0.0f);
+	Utils::AppendAttribute(header, "screenWindowCenter", "v2f", value);
+
+	// Tile size and one resolution level
+	value.clear();
+	Utils::AppendLittleEndian(value, tileSize);
+	Utils::AppendLittleEndian(value, tileSize);
+	value.push_back(0);
+	Utils::AppendAttribute(header, "tiles", "tiledesc", value);
+
+	header.push_back(0);
+	m_OffsetTablePosition = header.size();
+
+	if (!OpenFile(path, resume, error))
+		return false;
+	if (resume)
+		return true;
+
+	// The offset table is filled in as tiles are written
+	std::vector<uint8_t> offsets((size_t)m_TilesX * m_TilesY * sizeof(uint64_t), 0);
+	m_Stream.write((const char*)header.data(), header.size());
+	m_Stream.write((const char*)offsets.data(), offsets.size());
+	if (!Flush())
+	{
+		error = "Cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool ExrWriter::WriteBand(const std::vector<const float*>& tiles)
+{
+	uint32_t tileY = m_ResumePoint.Bands;
+	uint32_t rows = GetBandHeight(tileY);
+
+	std::vector<uint64_t> offsets(m_TilesX);
+	std::vector<uint8_t> chunk;
+	m_Stream.seekp(0, std::ios::end);
+	for (uint32_t tileX = 0; tileX < m_TilesX; tileX++)
+	{
+		uint32_t columns = GetTileWidth(tileX);
+		const float* pixels = tiles[tileX];
+
+		chunk.clear();
+		for (int32_t value : { (int32_t)tileX, (int32_t)tileY, 0, 0, (int32_t)(rows * columns * 3 * sizeof(float)) })
+			Utils::AppendLittleEndian(chunk, value);
+
+		// Each row holds all of its B values, then G, then R
+		for (uint32_t row = 0; row < rows; row++)
+		{
+			for (int channel = 2; channel >= 0; channel--)
+			{
+				for (uint32_t column = 0; column < columns; column++)
+					Utils::AppendFloat(chunk, pixels[3 * (row * columns + column) + channel]);
+			}
+		}
+
+		offsets[tileX] = (uint64_t)m_Stream.tellp();
+		m_Stream.write((const char*)chunk.data(), chunk.size());
+	}
+
+	std::vector<uint8_t> table;
+	for (uint64_t offset : offsets)
+		Utils::AppendLittleEndian(table, offset);
+	m_Stream.seekp(m_OffsetTablePosition + (uint64_t)tileY * m_TilesX * sizeof(uint64_t));
+	m_Stream.write((const char*)table.data(), table.size());
+
+	m_ResumePoint.Bands++;
+	return Flush();
+}
+
+bool ExrWriter::Finish()
+{
+	m_Stream.close();
+	return m_ResumePoint.Bands == m_TilesY;
+}
+
+bool PngWriter::Open(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize, const ResumePoint* resume, std::string& error)
+{
+	m_Width = width;
+	m_Height = height;
+	m_TileSize = tileSize;
+	m_TilesX = (width + tileSize - 1) / tileSize;
+	m_TilesY = (height + tileSize - 1) / tileSize;
+
+	if (!OpenFile(path, resume, error))
+		return false;
+	if (resume)
+		return true;
+
+	const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	m_Stream.write((const char*)signature, sizeof(signature));
+
+	// 8 bits per channel, RGB, deflate, adaptive filtering (always None here), not interlaced
+	std::vector<uint8_t> header;
+	Utils::AppendBigEndian(header, width);
+	Utils::AppendBigEndian(header, height);
+	for (uint8_t value : { 8, 2, 0, 0, 0 })
+		header.push_back(value);
+	WriteChunk("IHDR", header);
+
+	m_ResumePoint.Checksum = 1; // Adler-32 of nothing
+	if (!Flush())
+	{
+		error = "Cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool PngWriter::WriteBand(const std::vector<const float*>& tiles)
+{
+	uint32_t rows = GetBandHeight(m_ResumePoint.Bands);
+
+	// Filter type byte, then the pixels
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve((size_t)rows * (1 + 3 * m_Width));
+	for (uint32_t row = 0; row < rows; row++)
+	{
+		scanlines.push_back(0);
+		for (uint32_t tileX = 0; tileX < m_TilesX; tileX++)
+		{
+			uint32_t columns = GetTileWidth(tileX);
+			const float* pixels = tiles[tileX] + 3 * (size_t)row * columns;
+			for (uint32_t i = 0; i < 3 * columns; i++)
+				scanlines.push_back((uint8_t)(std::min(std::max(pixels[i], 0.0f), 1.0f) * 255.0f));
+		}
+	}
+
+	std::vector<uint8_t> data;
+	if (m_ResumePoint.Bands == 0)
+	{
+		data.push_back(0x78); // zlib header: deflate, 32K window, no preset dictionary
+		data.push_back(0x01);
+	}
+
+	// Stored blocks hold up to 65535 bytes: a header byte (not final), the length and its complement
+	for (size_t offset = 0; offset < scanlines.size(); offset += 65535)
+	{
+		uint16_t length = (uint16_t)std::min<size_t>(65535, scanlines.size() - offset);
+		data.push_back(0);
+		Utils::AppendLittleEndian(data, length);
+		Utils::AppendLittleEndian(data, (uint16_t)~length);
+		Utils::AppendBytes(data, scanlines.data() + offset, length);
+	}
+	WriteChunk("IDAT", data);
+
+	m_ResumePoint.Checksum = Utils::Adler32(scanlines.data(), scanlines.size(), m_ResumePoint.Checksum);
+	m_ResumePoint.Bands++;
+	return Flush();
+}
+
+bool PngWriter::Finish()
+{
+	// An empty final block ends the deflate stream, then the Adler-32 of the scanlines
+	std::vector<uint8_t> data = { 1, 0, 0, 0xff, 0xff };
+	Utils::AppendBigEndian(data, m_ResumePoint.Checksum);
+	WriteChunk("IDAT", data);
+	WriteChunk("IEND", {});
+
+	bool complete = (bool)m_Stream && m_ResumePoint.Bands == m_TilesY;
+	m_Stream.close();
+	return complete;
+}
+
+void PngWriter::WriteChunk(const char* type, const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> chunk;
+	Utils::AppendBigEndian(chunk, (uint32_t)data.size());
+	Utils::AppendBytes(chunk, type, 4);
+	Utils::AppendBytes(chunk, data.data(), data.size());
+	Utils::AppendBigEndian(chunk, Utils::CRC32(chunk.data() + 4, chunk.size() - 4));
+	m_Stream.write((const char*)chunk.data(), chunk.size());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Writes an image a band of tiles at a time, top to bottom, so only the band being written has
+// to be in memory. Every band is flushed to disk before WriteBand() returns, and
+// GetResumePoint() then describes the file up to that band, so an interrupted render can
+// truncate the file there and continue.
+class TiledImageWriter
+{
+public:
+	struct ResumePoint
+	{
+		uint32_t Bands = 0;    // Bands written
+		uint64_t FileSize = 0; // Bytes belonging to them, anything after is cut off on resume
+		uint32_t Checksum = 0; // Format specific running state (the PNG's Adler-32)
+	};
+
+public:
+	virtual ~TiledImageWriter() = default;
+
+	// OpenEXR for ".exr", PNG for ".png", nullptr for anything else
+	static std::unique_ptr<TiledImageWriter> Create(const std::string& path);
+
+	// Starts a new file, or with a resume point reopens one written up to there
+	virtual bool Open(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize, const ResumePoint* resume, std::string& error) = 0;
+
+	// The tiles of the next band, left to right, each with tileSize rows (fewer in the last band)
+	// and tileSize columns (fewer in the last tile) of linear RGB floats, top row first
+	virtual bool WriteBand(const std::vector<const float*>& tiles) = 0;
+
+	// Completes the file after the last band
+	virtual bool Finish() = 0;
+
+	const ResumePoint& GetResumePoint() const { return m_ResumePoint; }
+protected:
+	uint32_t GetBandHeight(uint32_t band) const;
+	uint32_t GetTileWidth(uint32_t tileX) const;
+	// Creates the file, or truncates it to the resume point and continues at its end
+	bool OpenFile(const std::string& path, const ResumePoint* resume, std::string& error);
+	// Flushes and records the file size for the resume point
+	bool Flush();
+protected:
+	std::fstream m_Stream;
+	uint32_t m_Width = 0, m_Height = 0, m_TileSize = 0;
+	uint32_t m_TilesX = 0, m_TilesY = 0;
+	ResumePoint m_ResumePoint;
+};
+
+// Tiled single-part OpenEXR, uncompressed 32-bit float R, G and B. Tiles are appended as their
+// band completes and their entries in the offset table near the start of the file filled in.
+class ExrWriter : public TiledImageWriter
+{
+public:
+	bool Open(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize, const ResumePoint* resume, std::string& error) override;
+	bool WriteBand(const std::vector<const float*>& tiles) override;
+	bool Finish() override;
+private:
+	uint64_t m_OffsetTablePosition = 0;
+};
+
+// 8-bit RGB PNG, clamped and truncated as the interactive resolve does. Each band is one IDAT
+// chunk of stored (uncompressed) deflate blocks, so the zlib stream can be continued from a
+// resume point without a deflate implementation's history.
+class PngWriter : public TiledImageWriter
+{
+public:
+	bool Open(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize, const ResumePoint* resume, std::string& error) override;
+	bool WriteBand(const std::vector<const float*>& tiles) override;
+	bool Finish() override;
+private:
+	void WriteChunk(const char* type, const std::vector<uint8_t>& data);
+};
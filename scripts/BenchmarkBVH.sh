@@ -0,0 +1,25 @@
+#!/bin/sh
+# Traversal cost against primitive count, with and without the BVH.
+# Usage: scripts/BenchmarkBVH.sh [path/to/RayTracingHeadless]
+
+HEADLESS=${1:-bin/Release-linux-x86_64/RayTracingHeadless/RayTracingHeadless}
+ARGS="--scene many --width 640 --height 360 --frames 10 --warmup 1"
+
+field()
+{
+	echo "$1" | sed -n "s/.*\"$2\": \([^,]*\),*/\1/p"
+}
+
+printf "%10s %12s %12s %14s %14s\n" primitives build_ms bvh_ms_frame rays_per_sec linear_ms_frame
+for count in 100 1000 10000 100000 1000000; do
+	bvh=$("$HEADLESS" $ARGS --count $count) || exit 1
+
+	# The linear scan is quadratic in practice; stop timing it once it gets hopeless
+	linear="-"
+	if [ $count -le 10000 ]; then
+		linear=$(field "$("$HEADLESS" $ARGS --count $count --no-bvh)" mean_ms)
+	fi
+
+	printf "%10s %12s %12s %14s %14s\n" $count "$(field "$bvh" bvh_build_ms)" "$(field "$bvh" mean_ms)" \
+		"$(field "$bvh" rays_per_sec)" "$linear"
+done
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Generates makefiles for the headless benchmark on Linux (no Vulkan/GPU needed).
+# Build with: make RayTracingHeadless config=release
+
+cd "$(dirname "$0")/.."
+premake5 gmake2